@@ -0,0 +1,152 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file benchmark.hpp
+ *
+ * Minimal benchmark harness shared by the benchmark executables. Each
+ * benchmark is executed repeatedly until a minimum run time is reached. The
+ * results are written to stdout as one JSON object per line, which allows to
+ * track them across builds.
+ *
+ * @author Andreas Stöckel
+ */
+
+#ifndef INKTTY_BENCHMARK_BENCHMARK_HPP
+#define INKTTY_BENCHMARK_BENCHMARK_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+
+#include <time.h>
+
+namespace inktty {
+namespace benchmark {
+
+/**
+ * Returns the current time of the monotonic clock in nanoseconds.
+ */
+inline int64_t now_ns() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return int64_t(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Prevents the compiler from optimising away the computation of the given
+ * value.
+ */
+template <typename T>
+inline void do_not_optimize(const T &value) {
+	asm volatile("" : : "g"(&value) : "memory");
+}
+
+/**
+ * The Runner class selects and executes the benchmarks. The command line
+ * arguments are a list of substrings; only benchmarks whose name contains one
+ * of them are executed. The minimum run time per benchmark in milliseconds
+ * may be set using the INKTTY_BENCH_TIME environment variable.
+ */
+class Runner {
+private:
+	int m_argc;
+	const char **m_argv;
+	int64_t m_min_time_ns;
+
+	bool selected(const char *name) const {
+		if (m_argc <= 1) {
+			return true;
+		}
+		for (int i = 1; i < m_argc; i++) {
+			if (strstr(name, m_argv[i])) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+public:
+	Runner(int argc, const char *argv[])
+	    : m_argc(argc), m_argv(argv), m_min_time_ns(200000000LL) {
+		const char *t = getenv("INKTTY_BENCH_TIME");
+		if (t && atoi(t) > 0) {
+			m_min_time_ns = int64_t(atoi(t)) * 1000000LL;
+		}
+	}
+
+	/**
+	 * Executes the given function until the minimum run time is reached and
+	 * prints the result.
+	 *
+	 * @param name is the name of the benchmark.
+	 * @param items is the number of items (e.g. pixels) processed by a single
+	 * call to f, used to compute the throughput.
+	 * @param unit is the name of the items.
+	 */
+	void run(const char *name, double items, const char *unit,
+	         const std::function<void()> &f) {
+		if (!selected(name)) {
+			return;
+		}
+
+		// Warm up caches and lazily initialised state
+		f();
+
+		// Double the number of iterations until the minimum time is reached
+		uint64_t n = 1;
+		int64_t dt = 0;
+		while (true) {
+			const int64_t t0 = now_ns();
+			for (uint64_t i = 0; i < n; i++) {
+				f();
+			}
+			dt = now_ns() - t0;
+			if (dt >= m_min_time_ns || n >= (uint64_t(1) << 40)) {
+				break;
+			}
+			n *= 2;
+		}
+
+		const double ns = double(dt) / double(n);
+		printf("{\"name\": \"%s\", \"iterations\": %llu, \"ns_per_iter\": "
+		       "%.1f, \"items_per_iter\": %.0f, \"unit\": \"%s\", "
+		       "\"items_per_sec\": %.1f}\n",
+		       name, (unsigned long long)n, ns, items, unit,
+		       (ns > 0.0) ? (items * 1e9 / ns) : 0.0);
+		fflush(stdout);
+	}
+
+	/**
+	 * Prints a line indicating that the given benchmark was skipped.
+	 */
+	void skip(const char *name, const char *reason) {
+		if (selected(name)) {
+			printf("{\"name\": \"%s\", \"skipped\": \"%s\"}\n", name, reason);
+			fflush(stdout);
+		}
+	}
+};
+
+}  // namespace benchmark
+}  // namespace inktty
+
+#endif /* INKTTY_BENCHMARK_BENCHMARK_HPP */
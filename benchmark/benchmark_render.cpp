@@ -0,0 +1,305 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file benchmark_render.cpp
+ *
+ * Microbenchmarks for the rendering hot paths: drawing into and composing the
+ * MemoryDisplay layers, converting the composite image to the framebuffer
+ * format, updating the cell matrix, merging update rectangles, rendering
+ * glyphs and the e-paper emulation.
+ *
+ * The FontTTF benchmarks require a TrueType font, which is read from the
+ * file given in the INKTTY_BENCH_FONT environment variable.
+ *
+ * @author Andreas Stöckel
+ */
+
+#include <config.h>
+
+#include <vector>
+
+#include <inktty/gfx/display.hpp>
+#include <inktty/gfx/epaper_emulation.hpp>
+#include <inktty/gfx/font_ttf.hpp>
+#include <inktty/gfx/pixel_format.hpp>
+#include <inktty/term/matrix.hpp>
+#include <inktty/utils/geometry.hpp>
+
+#include "benchmark.hpp"
+
+using namespace inktty;
+using namespace inktty::benchmark;
+
+static constexpr int WIDTH = 800, HEIGHT = 600;
+static constexpr int CELL_W = 8, CELL_H = 16;
+static constexpr int COLS = WIDTH / CELL_W, ROWS = HEIGHT / CELL_H;
+
+/**
+ * MemoryDisplay backend discarding all committed content.
+ */
+class NullDisplay : public MemoryDisplay {
+protected:
+	Rect do_lock() override { return Rect(0, 0, WIDTH, HEIGHT); }
+
+	void do_unlock(const CommitRequest *, const CommitRequest *, const RGBA *,
+	               size_t) override {}
+
+	void do_unlock_greyscale(const CommitRequest *, const CommitRequest *,
+	                         const uint8_t *, size_t) override {}
+
+public:
+	NullDisplay(Format format = Format::RGBA) { set_format(format); }
+};
+
+static void benchmark_display(Runner &runner, MemoryDisplay::Format format,
+                              const char *suffix) {
+	NullDisplay display(format);
+	const std::string s(suffix);
+	const double pixels = double(WIDTH) * HEIGHT;
+	const Rect screen(0, 0, WIDTH, HEIGHT);
+
+	// Glyph-sized mask with a diagonal pattern
+	std::vector<uint8_t> mask(CELL_W * CELL_H);
+	for (size_t i = 0; i < mask.size(); i++) {
+		mask[i] = (i % 3) ? 255 : 0;
+	}
+
+	runner.run(("display_fill_" + s).c_str(), pixels, "pixels", [&] {
+		display.lock();
+		display.fill(Display::Layer::Background, RGBA(200, 200, 200), screen);
+		display.unlock();
+	});
+
+	runner.run(("display_fill_dither_" + s).c_str(), pixels, "pixels", [&] {
+		display.lock();
+		display.fill_dither(Display::Layer::Background, 7, screen);
+		display.unlock();
+	});
+
+	for (int binary = 0; binary < 2; binary++) {
+		const std::string name =
+		    "display_blit_" + std::string(binary ? "binary_" : "aa_") + s;
+		runner.run(name.c_str(), double(COLS) * ROWS, "glyphs", [&] {
+			display.lock();
+			for (int y = 0; y < ROWS; y++) {
+				for (int x = 0; x < COLS; x++) {
+					display.blit(Display::Layer::Presentation, RGBA::Black,
+					             mask.data(), CELL_W,
+					             Rect::sized(x * CELL_W, y * CELL_H, CELL_W,
+					                         CELL_H),
+					             Display::DrawMode::Write, binary);
+				}
+			}
+			display.unlock();
+		});
+	}
+
+	runner.run(("display_compose_" + s).c_str(), pixels, "pixels", [&] {
+		display.lock();
+		display.commit();
+		display.unlock();
+	});
+}
+
+static void benchmark_conversion(Runner &runner) {
+	static const struct {
+		const char *name;
+		ColorLayout layout;
+		bool greyscale;
+	} FORMATS[] = {
+	    {"rgb565", {16, 3, 11, 2, 5, 3, 0, 8, 0}, false},
+	    {"xrgb8888", {32, 0, 16, 0, 8, 0, 0, 8, 24}, false},
+	    {"generic24", {24, 0, 0, 0, 8, 0, 16, 8, 0}, false},
+	    {"y8", {8, 0, 0, 0, 0, 0, 0, 8, 0}, true},
+	    {"y4", {4, 4, 0, 4, 0, 4, 0, 8, 0}, true},
+	};
+
+	std::vector<RGBA> src(WIDTH * HEIGHT);
+	std::vector<uint8_t> src_grey(WIDTH * HEIGHT);
+	for (size_t i = 0; i < src.size(); i++) {
+		src[i] = RGBA(i * 7, i * 13, i * 17);
+		src_grey[i] = i * 7;
+	}
+	std::vector<uint8_t> tar(WIDTH * HEIGHT * 4);
+	const double pixels = double(WIDTH) * HEIGHT;
+
+	for (const auto &f : FORMATS) {
+		const PixelFormat format(f.layout, f.greyscale);
+		const size_t stride = (WIDTH * f.layout.bpp + 7) / 8;
+		const std::string name(f.name);
+		runner.run(("convert_rgba_" + name).c_str(), pixels, "pixels", [&] {
+			for (int y = 0; y < HEIGHT; y++) {
+				format.from_rgba(&tar[y * stride], &src[y * WIDTH], 0, WIDTH);
+			}
+			do_not_optimize(tar[0]);
+		});
+		runner.run(("convert_grey_" + name).c_str(), pixels, "pixels", [&] {
+			for (int y = 0; y < HEIGHT; y++) {
+				format.from_grey(&tar[y * stride], &src_grey[y * WIDTH], 0,
+				                 WIDTH);
+			}
+			do_not_optimize(tar[0]);
+		});
+	}
+}
+
+static void benchmark_matrix(Runner &runner) {
+	Matrix matrix(ROWS, COLS);
+	std::vector<Point> updates;
+	std::vector<Matrix::Scroll> scrolls;
+	uint32_t glyph = 'A';
+
+	runner.run("matrix_set_commit_full", double(COLS) * ROWS, "cells", [&] {
+		glyph = (glyph == 'Z') ? 'A' : (glyph + 1);
+		for (int y = 1; y <= ROWS; y++) {
+			for (int x = 1; x <= COLS; x++) {
+				matrix.set(glyph, Style{}, Point{x, y});
+			}
+		}
+		updates.clear();
+		scrolls.clear();
+		matrix.commit(updates, scrolls);
+	});
+
+	runner.run("matrix_set_commit_line", double(COLS), "cells", [&] {
+		glyph = (glyph == 'Z') ? 'A' : (glyph + 1);
+		for (int x = 1; x <= COLS; x++) {
+			matrix.set(glyph, Style{}, Point{x, ROWS});
+		}
+		updates.clear();
+		scrolls.clear();
+		matrix.commit(updates, scrolls);
+	});
+
+	runner.run("matrix_scroll_commit", double(COLS), "cells", [&] {
+		matrix.scroll(0, Style{}, Rect{1, 1, COLS, ROWS}, 1, 0);
+		for (int x = 1; x <= COLS; x++) {
+			matrix.set('x', Style{}, Point{x, ROWS});
+		}
+		updates.clear();
+		scrolls.clear();
+		matrix.commit(updates, scrolls);
+	});
+}
+
+static void benchmark_merger(Runner &runner) {
+	RectangleMerger merger;
+	runner.run("merger_full_screen", double(COLS) * ROWS, "rects", [&] {
+		merger.reset();
+		for (int y = 0; y < ROWS; y++) {
+			for (int x = 0; x < COLS; x++) {
+				merger.insert(Rect::sized(x * CELL_W, y * CELL_H, CELL_W,
+				                          CELL_H));
+			}
+		}
+		merger.merge();
+	});
+
+	// Pseudo-random cells scattered across the screen
+	std::vector<Rect> scattered;
+	uint32_t seed = 1;
+	for (int i = 0; i < 500; i++) {
+		seed = seed * 1103515245U + 12345U;
+		const int x = (seed >> 8) % COLS, y = (seed >> 20) % ROWS;
+		scattered.push_back(
+		    Rect::sized(x * CELL_W, y * CELL_H, CELL_W, CELL_H));
+	}
+	merger.set_cost(RectangleMerger::Cost(16384, 16));
+	runner.run("merger_scattered_capped", scattered.size(), "rects", [&] {
+		merger.reset();
+		for (const Rect &r : scattered) {
+			merger.insert(r);
+		}
+		merger.merge();
+	});
+}
+
+static void benchmark_font(Runner &runner) {
+#ifdef HAS_FREETYPE
+	const char *file = getenv("INKTTY_BENCH_FONT");
+	if (!file || !*file) {
+		runner.skip("font_ttf_render_hit", "INKTTY_BENCH_FONT not set");
+		runner.skip("font_ttf_render_miss", "INKTTY_BENCH_FONT not set");
+		return;
+	}
+	FontTTF font(file, 96);
+	const unsigned int size = 12 * 64;
+
+	// ASCII glyphs are served from the glyph table after the first call
+	runner.run("font_ttf_render_hit", 95, "glyphs", [&] {
+		for (uint32_t c = 32; c < 127; c++) {
+			do_not_optimize(font.render(c, size, false, 0));
+		}
+	});
+
+	// Latin Extended-A glyphs (outside of the glyph table) cycling through more sizes than fit into a
+	// small glyph cache, such that each glyph is rasterised by FreeType
+	FontTTF font_miss(file, 96, 16 * 1024);
+	unsigned int miss_size = size;
+	runner.run("font_ttf_render_miss", 32, "glyphs", [&] {
+		miss_size = (miss_size >= size + 64) ? size : (miss_size + 1);
+		for (uint32_t c = 0x0100; c < 0x0120; c++) {
+			do_not_optimize(font_miss.render(c, miss_size, false, 0));
+		}
+	});
+#else
+	runner.skip("font_ttf_render_hit", "built without FreeType");
+	runner.skip("font_ttf_render_miss", "built without FreeType");
+#endif
+}
+
+static void benchmark_epaper_emulation(Runner &runner) {
+	std::vector<RGBA> src(WIDTH * HEIGHT);
+	for (size_t i = 0; i < src.size(); i++) {
+		src[i] = (i % 5) ? RGBA::White : RGBA::Black;
+	}
+	std::vector<uint8_t> tar(WIDTH * HEIGHT * 4);
+	const PixelFormat format(ColorLayout{32, 0, 16, 0, 8, 0, 0, 8, 24});
+	const double pixels = double(WIDTH) * HEIGHT;
+
+	static const struct {
+		const char *name;
+		UpdateMode mode;
+	} MODES[] = {
+	    {"epaper_emulation_full", UpdateMode()},
+	    {"epaper_emulation_source_mono",
+	     UpdateMode(UpdateMode::Identity, UpdateMode::SourceMono)},
+	    {"epaper_emulation_partial",
+	     UpdateMode(UpdateMode::Identity, UpdateMode::Partial)},
+	};
+	for (const auto &m : MODES) {
+		runner.run(m.name, pixels, "pixels", [&] {
+			epaper_emulation::update(tar.data(), WIDTH * 4, format, src.data(),
+			                         WIDTH * sizeof(RGBA), 0, 0, WIDTH, HEIGHT,
+			                         m.mode);
+		});
+	}
+}
+
+int main(int argc, const char *argv[]) {
+	Runner runner(argc, argv);
+	benchmark_display(runner, MemoryDisplay::Format::RGBA, "rgba");
+	benchmark_display(runner, MemoryDisplay::Format::Y8, "y8");
+	benchmark_conversion(runner);
+	benchmark_matrix(runner);
+	benchmark_merger(runner);
+	benchmark_font(runner);
+	benchmark_epaper_emulation(runner);
+	return 0;
+}
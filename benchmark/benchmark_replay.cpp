@@ -0,0 +1,355 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file benchmark_replay.cpp
+ *
+ * End-to-end throughput benchmark. Replays byte streams as they would be read
+ * from the PTY through VTerm, Matrix and MatrixRenderer onto an in-memory
+ * display and reports the parser throughput, the number of frames per second
+ * as well as the number of cells redrawn and pixels committed per frame.
+ *
+ * Recorded streams (e.g. captured with "script -q /dev/null", by tapping
+ * the PTY or session logs written by inktty's "--record" option) are passed
+ * as command line arguments; of session logs only the child output is used. Without arguments a set of
+ * synthetic streams resembling typical traffic ("cat" of a log file, scrolling
+ * in "vim", "htop" and a split "tmux" window) is replayed.
+ *
+ * The stream is passed to the terminal in chunks of up to INKTTY_BENCH_CHUNK
+ * bytes (defaults to the PTY read buffer size); a frame is drawn after each
+ * chunk. If INKTTY_BENCH_FONT is set, the given TrueType font is used instead
+ * of the built-in bitmap font.
+ *
+ * @author Andreas Stöckel
+ */
+
+#include <config.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <inktty/config/configuration.hpp>
+#include <inktty/gfx/display.hpp>
+#include <inktty/gfx/font_bitmap.hpp>
+#include <inktty/gfx/font_ttf.hpp>
+#include <inktty/gfx/matrix_renderer.hpp>
+#include <inktty/term/matrix.hpp>
+#include <inktty/term/pty.hpp>
+#include <inktty/term/recording.hpp>
+#include <inktty/term/vterm.hpp>
+
+#include "benchmark.hpp"
+
+using namespace inktty;
+using namespace inktty::benchmark;
+
+static constexpr int WIDTH = 800, HEIGHT = 600;
+
+/**
+ * Simulated time in milliseconds passing between two frames.
+ */
+static constexpr int FRAME_DT = 16;
+
+/**
+ * MemoryDisplay backend discarding all committed content, but counting the
+ * number of committed rectangles and pixels.
+ */
+class CountingDisplay : public MemoryDisplay {
+private:
+	uint64_t m_rects;
+	uint64_t m_pixels;
+
+	void count(const CommitRequest *begin, const CommitRequest *end) {
+		for (const CommitRequest *req = begin; req < end; req++) {
+			m_rects++;
+			m_pixels += uint64_t(req->r.width()) * uint64_t(req->r.height());
+		}
+	}
+
+protected:
+	Rect do_lock() override { return Rect(0, 0, WIDTH, HEIGHT); }
+
+	void do_unlock(const CommitRequest *begin, const CommitRequest *end,
+	               const RGBA *, size_t) override {
+		count(begin, end);
+	}
+
+	void do_unlock_greyscale(const CommitRequest *begin,
+	                         const CommitRequest *end, const uint8_t *,
+	                         size_t) override {
+		count(begin, end);
+	}
+
+public:
+	CountingDisplay() : m_rects(0), m_pixels(0) {}
+
+	uint64_t rects() const { return m_rects; }
+	uint64_t pixels() const { return m_pixels; }
+};
+
+/******************************************************************************
+ * Synthetic streams                                                          *
+ ******************************************************************************/
+
+static std::string csi(int y, int x) {
+	return "\033[" + std::to_string(y) + ";" + std::to_string(x) + "H";
+}
+
+static std::string log_line(unsigned int i) {
+	char buf[128];
+	snprintf(buf, sizeof(buf),
+	         "2018-06-%02u 12:%02u:%02u [INFO] worker-%u: handled request "
+	         "id=%08x in %u.%03u ms",
+	         1 + (i / 86400) % 30, (i / 60) % 60, i % 60, i % 8,
+	         i * 2654435761U, (i * 7) % 100, (i * 13) % 1000);
+	return buf;
+}
+
+/**
+ * Output of "cat" on a large log file.
+ */
+static std::string stream_cat(int, int) {
+	std::string res;
+	for (unsigned int i = 0; res.size() < 1024 * 1024; i++) {
+		res += log_line(i) + "\r\n";
+	}
+	return res;
+}
+
+/**
+ * Scrolling through a file line by line in "vim": the text area is scrolled
+ * using a scroll region, the status line is rewritten after each step.
+ */
+static std::string stream_vim(int rows, int cols) {
+	std::string res = "\033[?1049h\033[H\033[2J";
+	for (int y = 1; y < rows; y++) {
+		res += csi(y, 1) + log_line(y).substr(0, cols);
+	}
+	for (int i = rows; i < rows + 5000; i++) {
+		res += "\033[1;" + std::to_string(rows - 1) + "r";
+		res += csi(rows - 1, 1) + "\n" + log_line(i).substr(0, cols);
+		res += "\033[r" + csi(rows, 1) + "\033[7m\"server.log\" line " +
+		       std::to_string(i) + "\033[27m\033[K";
+	}
+	return res + "\033[?1049l";
+}
+
+/**
+ * Periodic refreshes of "htop": coloured meters in the header, followed by a
+ * process list in which most rows change.
+ */
+static std::string stream_htop(int rows, int cols) {
+	std::string res = "\033[?1049h\033[H\033[2J";
+	for (unsigned int i = 0; i < 500; i++) {
+		for (int cpu = 0; cpu < 4; cpu++) {
+			const int bars = (i * 7 + cpu * 13) % 30;
+			res += csi(cpu + 1, 1) + "\033[1m" + std::to_string(cpu) +
+			       "\033[0m[\033[32m" + std::string(bars, '|') +
+			       "\033[31m" + std::string((bars * 3) % 7, '|') +
+			       "\033[0m" + std::string(40 - bars - (bars * 3) % 7, ' ') +
+			       "]";
+		}
+		res += csi(6, 1) + "\033[30;42m  PID USER      PRI  NI  VIRT   RES  "
+		       "CPU% MEM%   TIME+  Command\033[K\033[0m";
+		for (int y = 7; y < rows; y++) {
+			char buf[128];
+			const unsigned int pid = 1000 + ((y * 37 + i * (y % 3)) % 9000);
+			snprintf(buf, sizeof(buf),
+			         "%5u user       20   0  %4uM  %4uM %4.1f %4.1f  "
+			         "0:%02u.%02u /usr/bin/process-%u",
+			         pid, (pid * 3) % 2048, (pid * 7) % 1024,
+			         ((i + y) * 17 % 1000) / 10.0, (pid % 100) / 10.0,
+			         (i / 60) % 60, i % 60, pid % 17);
+			res += csi(y, 1) + (((i + y) % 9) ? "" : "\033[36m") +
+			       std::string(buf).substr(0, cols) + "\033[0m\033[K";
+		}
+		res += csi(rows, 1) + "\033[30;46mF1\033[0mHelp  \033[30;46mF10"
+		       "\033[0mQuit\033[K";
+	}
+	return res + "\033[?1049l";
+}
+
+/**
+ * A "tmux" window split into two panes side by side. Since the terminal
+ * cannot scroll only the left half of the screen, tmux redraws the entire
+ * pane for each new line of output.
+ */
+static std::string stream_tmux(int rows, int cols) {
+	const int w = cols / 2;
+	std::string res = "\033[?1049h\033[H\033[2J";
+	for (int y = 1; y < rows; y++) {
+		res += csi(y, w + 1) + "\342\224\202";
+	}
+	for (unsigned int i = 0; i < 300; i++) {
+		for (int y = 1; y < rows; y++) {
+			std::string line = log_line(i + y).substr(0, w);
+			line.resize(w, ' ');
+			res += csi(y, 1) + line;
+		}
+		res += csi(rows, 1) + "\033[30;42m[0] 0:bash*  1:vim-  \"host\" 12:" +
+		       std::to_string(10 + (i / 60) % 50) + "\033[K\033[0m";
+	}
+	return res + "\033[?1049l";
+}
+
+/******************************************************************************
+ * Replay                                                                     *
+ ******************************************************************************/
+
+/**
+ * Concatenates the child output stored in a session log.
+ */
+static std::string session_output(const std::string &log) {
+	std::istringstream is(log);
+	RecordingReader reader(is);
+	RecordingReader::Record record;
+	std::string res;
+	while (reader.next(record)) {
+		if (record.type == RecordType::Output) {
+			res.append(record.data.begin(), record.data.end());
+		}
+	}
+	return res;
+}
+
+static size_t chunk_size() {
+	const char *s = getenv("INKTTY_BENCH_CHUNK");
+	if (s && atoi(s) > 0) {
+		return size_t(atoi(s));
+	}
+	return PTY::READ_BUF_SIZE;
+}
+
+/**
+ * Terminal emulator pipeline without a PTY.
+ */
+class Pipeline {
+private:
+	Configuration m_config;
+	std::unique_ptr<Font> m_font_ttf;
+	CountingDisplay m_display;
+	Matrix m_matrix;
+	MatrixRenderer m_renderer;
+	VTerm m_vterm;
+
+	static Font &font(std::unique_ptr<Font> &font_ttf) {
+#ifdef HAS_FREETYPE
+		const char *file = getenv("INKTTY_BENCH_FONT");
+		if (file && *file) {
+			font_ttf.reset(new FontTTF(file, 96));
+			return *font_ttf;
+		}
+#endif
+		return FontBitmap::Font8x16;
+	}
+
+public:
+	Pipeline()
+	    : m_renderer(m_config, font(m_font_ttf), m_display, m_matrix),
+	      m_vterm(m_matrix) {
+		// Draw the initial frame, which updates the geometry of the matrix
+		m_renderer.draw(true);
+	}
+
+	int rows() const { return m_matrix.size().y; }
+	int cols() const { return m_matrix.size().x; }
+
+	void replay(const std::string &name, const std::string &stream) {
+		const size_t chunk = chunk_size();
+		const MatrixRenderer::Statistics s0 = m_renderer.statistics();
+		const uint64_t rects0 = m_display.rects();
+		const uint64_t pixels0 = m_display.pixels();
+		int64_t t_parse = 0, t_draw = 0;
+
+		const uint8_t *buf = (const uint8_t *)stream.data();
+		for (size_t i = 0; i < stream.size(); i += chunk) {
+			const int64_t t0 = now_ns();
+			m_vterm.receive_from_pty(buf + i, std::min(chunk, stream.size() - i));
+			const int64_t t1 = now_ns();
+			m_renderer.draw(false, FRAME_DT);
+			t_parse += t1 - t0;
+			t_draw += now_ns() - t1;
+		}
+
+		// Let the renderer finish pending high quality updates
+		const int64_t t0 = now_ns();
+		for (int i = 0, next = 0; next >= 0 && i < 1000; i++) {
+			next = m_renderer.draw(false, std::max(next, FRAME_DT));
+		}
+		t_draw += now_ns() - t0;
+
+		const MatrixRenderer::Statistics &s1 = m_renderer.statistics();
+		const double frames = std::max<double>(1.0, s1.frames - s0.frames);
+		const double cells = (s1.cells_low_quality - s0.cells_low_quality) +
+		                     (s1.cells_high_quality - s0.cells_high_quality);
+		const double tiled = s1.cells_tiled - s0.cells_tiled;
+		const double t = (t_parse + t_draw) * 1e-9;
+		printf("{\"name\": \"%s\", \"bytes\": %zu, \"frames\": %.0f, "
+		       "\"seconds\": %.3f, \"parse_mb_per_sec\": %.2f, "
+		       "\"mb_per_sec\": %.2f, \"fps\": %.1f, \"cells_per_frame\": "
+		       "%.1f, \"tiled_fraction\": %.2f, \"rects_per_frame\": %.1f, "
+		       "\"pixels_per_frame\": %.0f}\n",
+		       name.c_str(), stream.size(), frames, t,
+		       stream.size() / (1e6 * std::max(1e-9, t_parse * 1e-9)),
+		       stream.size() / (1e6 * std::max(1e-9, t)), frames / t,
+		       cells / frames, tiled / std::max(1.0, cells),
+		       (m_display.rects() - rects0) / frames,
+		       (m_display.pixels() - pixels0) / frames);
+		fflush(stdout);
+	}
+};
+
+int main(int argc, const char *argv[]) {
+	if (argc > 1) {
+		for (int i = 1; i < argc; i++) {
+			std::ifstream is(argv[i], std::ios::binary);
+			if (!is) {
+				fprintf(stderr, "Cannot open %s\n", argv[i]);
+				return 1;
+			}
+			std::string stream((std::istreambuf_iterator<char>(is)),
+			                   std::istreambuf_iterator<char>());
+			if (RecordingReader::is_recording(stream)) {
+				stream = session_output(stream);
+			}
+			Pipeline().replay(argv[i], stream);
+		}
+		return 0;
+	}
+
+	static const struct {
+		const char *name;
+		std::string (*generate)(int rows, int cols);
+	} STREAMS[] = {
+	    {"replay_cat", stream_cat},
+	    {"replay_vim", stream_vim},
+	    {"replay_htop", stream_htop},
+	    {"replay_tmux", stream_tmux},
+	};
+	for (const auto &s : STREAMS) {
+		Pipeline pipeline;
+		pipeline.replay(s.name, s.generate(pipeline.rows(), pipeline.cols()));
+	}
+	return 0;
+}
@@ -40,13 +40,13 @@
  * ----------------------------------------------------------------------------
  */
 
+#include <algorithm>
 #include <cerrno>
 #include <cstring>
 #include <string>
 #include <system_error>
 
 #include <fcntl.h>
-#include <linux/fb.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <unistd.h>
@@ -55,6 +55,7 @@
 
 #include <inktty/backends/fbdev.hpp>
 #include <inktty/utils/logger.hpp>
+#include <inktty/utils/trace.hpp>
 
 namespace inktty {
 
@@ -62,8 +63,42 @@ namespace inktty {
  * Class FbDevDisplay                                                         *
  ******************************************************************************/
 
-FbDevDisplay::FbDevDisplay(const char *fbdev)
-    : m_epaper_mxc_marker(0), m_epaper_mxc_prev_marker(0) {
+/**
+ * Translates the waveform mode stored in the configuration to the
+ * corresponding mxcfb constant.
+ */
+static uint32_t mxcfb_waveform_mode(config::Waveform::Mode mode) {
+	switch (mode) {
+		case config::Waveform::Mode::Auto:
+			return WAVEFORM_MODE_AUTO;
+		case config::Waveform::Mode::Init:
+			return WAVEFORM_MODE_INIT;
+		case config::Waveform::Mode::DU:
+			return WAVEFORM_MODE_DU;
+		case config::Waveform::Mode::GC16:
+			return WAVEFORM_MODE_GC16;
+		case config::Waveform::Mode::GC16Fast:
+			return WAVEFORM_MODE_GC16_FAST;
+		case config::Waveform::Mode::A2:
+			return WAVEFORM_MODE_A2;
+		case config::Waveform::Mode::GL16:
+			return WAVEFORM_MODE_GL16;
+		case config::Waveform::Mode::GL16Fast:
+			return WAVEFORM_MODE_GL16_FAST;
+	}
+	return WAVEFORM_MODE_AUTO;
+}
+
+FbDevDisplay::FbDevDisplay(const char *fbdev, const config::EPaper &epaper)
+    : m_page_flip(false),
+      m_pages{nullptr, nullptr},
+      m_back_page(0),
+      m_epaper_mxc_marker(0),
+      m_max_in_flight(std::max(1, epaper.max_updates_in_flight)),
+      m_epaper_config(epaper),
+      m_epaper_mxc_auto_supported(true),
+      m_done(false),
+      m_pixel_format(ColorLayout(), PixelFormat::Type::Generic) {
 	/* Try to open the framebuffer device */
 	m_fb_fd = open(fbdev, O_RDWR);
 	if (m_fb_fd < 0) {
@@ -77,8 +112,10 @@ FbDevDisplay::FbDevDisplay(const char *fbdev)
 	}
 
 	/* Read the screen information */
-	static struct fb_var_screeninfo vinfo;
-	static struct fb_fix_screeninfo finfo;
+	struct fb_var_screeninfo &vinfo = m_vinfo;
+	struct fb_fix_screeninfo finfo;
+	memset(&vinfo, 0, sizeof(vinfo));
+	memset(&finfo, 0, sizeof(finfo));
 	if ((ioctl(m_fb_fd, FBIOGET_VSCREENINFO, &vinfo) < 0) ||
 	    (ioctl(m_fb_fd, FBIOGET_FSCREENINFO, &finfo) < 0)) {
 		throw std::system_error(errno, std::system_category());
@@ -107,10 +144,14 @@ FbDevDisplay::FbDevDisplay(const char *fbdev)
 	m_layout.bl = vinfo.blue.offset;
 	m_layout.al = vinfo.transp.offset;
 
+	/* Select the row converters for the colour layout */
+	m_pixel_format = PixelFormat(m_layout, vinfo.grayscale != 0);
+
 	/* Print some information */
 	global_logger().info() << "Opened \"" << fbdev << "\": \"" << id << "\" ("
 	                       << m_width << 'x' << m_height << '@'
-	                       << int(m_layout.bpp) << ")";
+	                       << int(m_layout.bpp) << ", "
+	                       << m_pixel_format.name() << ")";
 
 	/* Memory map the frame buffer device to memory */
 	m_buf_size = finfo.line_length * vinfo.yres_virtual;
@@ -121,59 +162,339 @@ FbDevDisplay::FbDevDisplay(const char *fbdev)
 	}
 	m_stride = finfo.line_length;
 	m_buf_offs =
-	    m_buf + vinfo.xoffset * m_layout.bypp() + vinfo.yoffset * m_stride;
+	    m_buf + vinfo.xoffset * m_layout.bpp / 8 + vinfo.yoffset * m_stride;
+
+	/* Generic framebuffers with room for two pages are double buffered by
+	   drawing to the hidden page and panning to it. Make sure the driver
+	   supports panning by panning to the visible page. */
+	if (m_type == Type::Generic && vinfo.yres_virtual >= 2 * m_height &&
+	    (vinfo.yoffset == 0 || vinfo.yoffset == m_height) &&
+	    ioctl(m_fb_fd, FBIOPAN_DISPLAY, &vinfo) == 0) {
+		const unsigned int front = vinfo.yoffset / m_height;
+		uint8_t *base = m_buf + vinfo.xoffset * m_layout.bpp / 8;
+		m_pages[0] = base;
+		m_pages[1] = base + m_height * m_stride;
+		m_back_page = 1 - front;
+		m_buf_offs = m_pages[m_back_page];
+		m_page_flip = true;
+
+		/* Both pages must show the same content initially */
+		memcpy(m_pages[m_back_page], m_pages[front], m_height * m_stride);
+		global_logger().info() << "Using page flipping";
+	}
+
+	/* Greyscale framebuffers (e.g. the Kobo EPDC) are filled from a greyscale
+	   composite image; render the layers in greyscale directly instead of
+	   converting from RGBA */
+	if (m_pixel_format.type() == PixelFormat::Type::Y8 ||
+	    m_pixel_format.type() == PixelFormat::Type::Y4) {
+		set_format(Format::Y8);
+	}
+
+	/* E-paper updates are asynchronous; start the thread waiting for their
+	   completion. Track the panel content, such that only pixels that
+	   actually change are submitted. */
+	if (m_type == Type::EPaper) {
+		set_panel_shadow(true);
+		m_completion_thread =
+		    std::thread(&FbDevDisplay::epaper_mxc_completion_thread, this);
+	}
 }
 
 FbDevDisplay::~FbDevDisplay() {
+	/* Make sure the presenter thread no longer accesses the framebuffer */
+	flush();
+
+	/* Wait for all pending updates to finish and stop the completion thread */
+	if (m_completion_thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(m_in_flight_mutex);
+			m_done = true;
+		}
+		m_in_flight_cond_var.notify_all();
+		m_completion_thread.join();
+	}
+
 	munmap(m_buf, m_buf_size);
 	close(m_fb_fd);
 }
 
 Rect FbDevDisplay::do_lock() { return Rect(0, 0, m_width, m_height); }
 
-void FbDevDisplay::epaper_mxc_update(int x, int y, int w, int h,
-                                     const UpdateMode &mode) {
-	static constexpr uint32_t MARKER = 0x4a58f17c;
+RectangleMerger::Cost FbDevDisplay::update_cost() const {
+	if (m_type != Type::EPaper) {
+		return RectangleMerger::Cost();
+	}
+	return RectangleMerger::Cost(
+	    std::max(0, m_epaper_config.update_cost),
+	    size_t(std::max(0, m_epaper_config.max_update_rects)));
+}
+
+const config::Waveform &FbDevDisplay::epaper_waveform(
+    const UpdateMode &mode) const {
+	const int m = mode.mask_op;
+	const bool src_mono = m & UpdateMode::SourceMono;
+	const bool tar_mono = m & UpdateMode::TargetMono;
+	if (src_mono && tar_mono) {
+		return m_epaper_config.source_and_target_mono;
+	} else if (src_mono) {
+		return m_epaper_config.source_mono;
+	} else if (tar_mono) {
+		return m_epaper_config.target_mono;
+	} else if (m & UpdateMode::Partial) {
+		return m_epaper_config.partial;
+	}
+	return m_epaper_config.full;
+}
+
+void FbDevDisplay::epaper_mxc_update(const Rect &r, const UpdateMode &mode) {
+	/* Wait until there is a free slot in the in-flight queue */
+	std::unique_lock<std::mutex> lock(m_in_flight_mutex);
+	m_in_flight_cond_var.wait(
+	    lock, [this] { return m_in_flight.size() < m_max_in_flight; });
+
+	/* Generate a new unique marker; zero is not a valid marker */
+	m_epaper_mxc_marker++;
+	if (m_epaper_mxc_marker == 0) {
+		m_epaper_mxc_marker++;
+	}
 
 	struct mxcfb_update_data data;
 	memset(&data, 0, sizeof(data));
-	data.update_region.top = y;
-	data.update_region.left = x;
-	data.update_region.width = w;
-	data.update_region.height = h;
-	data.update_marker = MARKER;
-
-	// Do a full update in case the update mode is set to "Full"
-	data.update_mode = UPDATE_MODE_PARTIAL;
-	data.waveform_mode = WAVEFORM_MODE_A2;
-	data.flags = EPDC_FLAG_FORCE_MONOCHROME;
-
-	ioctl(m_fb_fd, MXCFB_SEND_UPDATE, &data);
-//	ioctl(m_fb_fd, MXCFB_WAIT_FOR_UPDATE_COMPLETE, &MARKER);
+	data.update_region.top = r.y0;
+	data.update_region.left = r.x0;
+	data.update_region.width = r.width();
+	data.update_region.height = r.height();
+	data.update_marker = m_epaper_mxc_marker;
+	data.temp = TEMP_USE_AMBIENT;
+
+	/* Look up the waveform for the mask operation */
+	const config::Waveform &waveform = epaper_waveform(mode);
+	data.update_mode = waveform.full ? UPDATE_MODE_FULL : UPDATE_MODE_PARTIAL;
+	data.waveform_mode = mxcfb_waveform_mode(waveform.mode);
+	if (waveform.force_mono) {
+		data.flags |= EPDC_FLAG_FORCE_MONOCHROME;
+	}
+
+	/* Apply the output operation. The EPDC can quantise and invert the
+	   content on its own; "White" is achieved by the INIT waveform, which
+	   clears the region independently of the framebuffer content. */
+	switch (mode.output_op) {
+		case UpdateMode::Identity:
+			break;
+		case UpdateMode::ForceMono:
+			data.flags |= EPDC_FLAG_FORCE_MONOCHROME;
+			break;
+		case UpdateMode::Invert:
+			data.flags |= EPDC_FLAG_ENABLE_INVERSION;
+			break;
+		case UpdateMode::InvertAndForceMono:
+			data.flags |= EPDC_FLAG_FORCE_MONOCHROME | EPDC_FLAG_ENABLE_INVERSION;
+			break;
+		case UpdateMode::White:
+			data.update_mode = UPDATE_MODE_FULL;
+			data.waveform_mode = WAVEFORM_MODE_INIT;
+			break;
+	}
+
+	/* Not all drivers implement automatic waveform selection */
+	if (data.waveform_mode == WAVEFORM_MODE_AUTO &&
+	    !m_epaper_mxc_auto_supported) {
+		data.waveform_mode = WAVEFORM_MODE_GC16;
+	}
+
+	/* Submit the update and hand it over to the completion thread */
+	int res = ioctl(m_fb_fd, MXCFB_SEND_UPDATE, &data);
+	if (res < 0 && data.waveform_mode == WAVEFORM_MODE_AUTO) {
+		global_logger().warn() << "EPDC rejected the AUTO waveform mode, "
+		                          "falling back to GC16";
+		m_epaper_mxc_auto_supported = false;
+		data.waveform_mode = WAVEFORM_MODE_GC16;
+		res = ioctl(m_fb_fd, MXCFB_SEND_UPDATE, &data);
+	}
+	if (res < 0) {
+		/* There is nothing to wait for; report the region as completed
+		   such that drawing deferred until the region is idle resumes */
+		global_logger().error() << "MXCFB_SEND_UPDATE failed: "
+		                        << strerror(errno);
+		m_completed.emplace_back(r);
+		return;
+	}
+	const int64_t t = trace::enabled() ? trace::now() : 0;
+	trace::instant("MXCFB_SEND_UPDATE", t, m_epaper_mxc_marker);
+	m_in_flight.emplace_back(InFlightUpdate{m_epaper_mxc_marker, r, t});
+	m_in_flight_cond_var.notify_all();
+}
+
+void FbDevDisplay::epaper_mxc_wait_for_region(const Rect &r) {
+	std::unique_lock<std::mutex> lock(m_in_flight_mutex);
+	m_in_flight_cond_var.wait(lock, [this, &r] {
+		for (const InFlightUpdate &u : m_in_flight) {
+			if (u.r.overlaps(r)) {
+				return false;
+			}
+		}
+		return true;
+	});
+}
+
+void FbDevDisplay::epaper_mxc_completion_thread() {
+	std::unique_lock<std::mutex> lock(m_in_flight_mutex);
+	while (true) {
+		/* Wait for an update to be submitted. Process all remaining updates
+		   before exiting, the framebuffer must stay mapped until then. */
+		m_in_flight_cond_var.wait(
+		    lock, [this] { return m_done || !m_in_flight.empty(); });
+		if (m_in_flight.empty()) {
+			break;
+		}
+
+		/* Wait for the oldest update without blocking the other threads */
+		uint32_t marker = m_in_flight.front().marker;
+		lock.unlock();
+		ioctl(m_fb_fd, MXCFB_WAIT_FOR_UPDATE_COMPLETE, &marker);
+		lock.lock();
+
+		/* Record the time the EPDC needed for the update */
+		if (trace::enabled()) {
+			const int64_t t = trace::now();
+			trace::span("epdc_update", m_in_flight.front().t_submitted, t,
+			            marker);
+			trace::completed(t, marker);
+		}
+
+		/* Move the update to the list of completed regions and wake up
+		   threads waiting for a free slot */
+		m_completed.emplace_back(m_in_flight.front().r);
+		m_in_flight.pop_front();
+		m_in_flight_cond_var.notify_all();
+	}
+}
+
+void FbDevDisplay::page_flip_requests(const CommitRequest *&begin,
+                                      const CommitRequest *&end) {
+	if (!m_page_flip || begin == end) {
+		return;
+	}
+
+	// The back page still shows the frame before the previous one; redraw
+	// the regions updated since then in addition to the committed regions
+	m_page_requests.assign(begin, end);
+	for (const Rect &r : m_page_damage) {
+		m_page_requests.emplace_back(CommitRequest{r, UpdateMode()});
+	}
+	m_page_damage.clear();
+	for (const CommitRequest *req = begin; req < end; req++) {
+		m_page_damage.push_back(req->r);
+	}
+	begin = m_page_requests.data();
+	end = begin + m_page_requests.size();
+}
+
+bool FbDevDisplay::page_flip() {
+	if (!m_page_flip) {
+		return true;
+	}
+
+	m_vinfo.yoffset = m_back_page * m_height;
+	if (ioctl(m_fb_fd, FBIOPAN_DISPLAY, &m_vinfo) < 0) {
+		global_logger().warn()
+		    << "FBIOPAN_DISPLAY failed, disabling page flipping";
+		m_page_flip = false;
+		m_buf_offs = m_pages[1 - m_back_page];
+		return false;
+	}
+	trace::instant("FBIOPAN_DISPLAY", trace::enabled() ? trace::now() : 0);
+	m_back_page = 1 - m_back_page;
+	m_buf_offs = m_pages[m_back_page];
+	return true;
 }
 
 void FbDevDisplay::do_unlock(const CommitRequest *begin,
                              const CommitRequest *end, const RGBA *buf,
                              size_t stride) {
-	const int bypp = m_layout.bypp();
-	for (CommitRequest const *req = begin; req < end; req++) {
-		const Rect r = req->r;
-		const int w = r.width();
+	// Do not touch pixels the EPDC is currently reading from
+	if (m_type == Type::EPaper) {
+		for (CommitRequest const *req = begin; req < end; req++) {
+			epaper_mxc_wait_for_region(req->r);
+		}
+	}
+
+	// Convert the committed regions, possibly in parallel, and show them
+	const CommitRequest *r0 = begin, *r1 = end;
+	page_flip_requests(r0, r1);
+	const auto convert = [this, buf, stride](const Rect &r) {
 		for (int y = r.y0; y < r.y1; y++) {
-			uint8_t *ptar = m_buf_offs + y * m_stride + r.x0 * bypp;
-			RGBA const *psrc = buf + y * stride / sizeof(RGBA) + r.x0;
-			for (int x = 0; x < w; x++) {
-				const uint32_t cc = m_layout.conv_from_rgba(*(psrc++));
-				for (int k = 0; k < bypp; k++) {
-					*(ptar++) = (cc >> (8 * k)) & 0xFF;
-				}
-			}
+			m_pixel_format.from_rgba(m_buf_offs + y * m_stride,
+			                         buf + y * stride / sizeof(RGBA), r.x0,
+			                         r.x1);
 		}
+	};
+	for_each_band(r0, r1, convert);
+	if (r0 < r1 && !page_flip()) {
+		for_each_band(r0, r1, convert);
+	}
+
+	// Submit the updates in the order they were committed
+	if (m_type == Type::EPaper) {
+		for (CommitRequest const *req = begin; req < end; req++) {
+			epaper_mxc_update(req->r, req->mode);
+		}
+		if (begin < end) {
+			trace::submitted(trace::now(), m_epaper_mxc_marker);
+		}
+	}
+}
+
+void FbDevDisplay::do_unlock_greyscale(const CommitRequest *begin,
+                                       const CommitRequest *end,
+                                       const uint8_t *buf, size_t stride) {
+	// Do not touch pixels the EPDC is currently reading from
+	if (m_type == Type::EPaper) {
+		for (CommitRequest const *req = begin; req < end; req++) {
+			epaper_mxc_wait_for_region(req->r);
+		}
+	}
+
+	// Convert the committed regions, possibly in parallel, and show them
+	const CommitRequest *r0 = begin, *r1 = end;
+	page_flip_requests(r0, r1);
+	const auto convert = [this, buf, stride](const Rect &r) {
+		for (int y = r.y0; y < r.y1; y++) {
+			m_pixel_format.from_grey(m_buf_offs + y * m_stride, buf + y * stride,
+			                         r.x0, r.x1);
+		}
+	};
+	for_each_band(r0, r1, convert);
+	if (r0 < r1 && !page_flip()) {
+		for_each_band(r0, r1, convert);
+	}
+
+	// Submit the updates in the order they were committed
+	if (m_type == Type::EPaper) {
+		for (CommitRequest const *req = begin; req < end; req++) {
+			epaper_mxc_update(req->r, req->mode);
+		}
+		if (begin < end) {
+			trace::submitted(trace::now(), m_epaper_mxc_marker);
+		}
+	}
+}
 
-		if (m_type == Type::EPaper) {
-			epaper_mxc_update(r.x0, r.y0, r.width(), r.height(), req->mode);
+bool FbDevDisplay::do_busy(const Rect &r) {
+	std::lock_guard<std::mutex> lock(m_in_flight_mutex);
+	for (const InFlightUpdate &u : m_in_flight) {
+		if (u.r.overlaps(r)) {
+			return true;
 		}
 	}
+	return false;
+}
+
+void FbDevDisplay::do_completed(std::vector<Rect> &regions) {
+	std::lock_guard<std::mutex> lock(m_in_flight_mutex);
+	regions.insert(regions.end(), m_completed.begin(), m_completed.end());
+	m_completed.clear();
 }
 
 }  // namespace inktty
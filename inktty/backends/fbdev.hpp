@@ -19,7 +19,17 @@
 #ifndef INKTTY_BACKENDS_FBDEV_HPP
 #define INKTTY_BACKENDS_FBDEV_HPP
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <linux/fb.h>
+
+#include <inktty/config/configuration.hpp>
 #include <inktty/gfx/display.hpp>
+#include <inktty/gfx/pixel_format.hpp>
 
 namespace inktty {
 /**
@@ -45,10 +55,43 @@ private:
 	uint8_t *m_buf;
 
 	/**
-	 * Pointer at the first pixel of the framebuffer.
+	 * Pointer at the first pixel of the framebuffer. In page flipping mode
+	 * this is the first pixel of the page that is currently not shown.
 	 */
 	uint8_t *m_buf_offs;
 
+	/**
+	 * Variable screen information as read in the constructor. The y-offset
+	 * is updated when flipping pages.
+	 */
+	struct fb_var_screeninfo m_vinfo;
+
+	/**
+	 * True if the virtual framebuffer holds two pages and the display is
+	 * double buffered by panning between them using FBIOPAN_DISPLAY. Only
+	 * used for generic framebuffers.
+	 */
+	bool m_page_flip;
+
+	/**
+	 * Pointers at the first pixel of both pages and index of the page that
+	 * is currently drawn to.
+	 */
+	uint8_t *m_pages[2];
+	unsigned int m_back_page;
+
+	/**
+	 * Regions updated in the previous frame. These are outdated in the back
+	 * page and must be redrawn together with the next frame.
+	 */
+	std::vector<Rect> m_page_damage;
+
+	/**
+	 * Regions drawn to the back page in the current frame, i.e. the committed
+	 * regions followed by the page damage.
+	 */
+	std::vector<CommitRequest> m_page_requests;
+
 	/**
 	 * Total size of the memory mapped region.
 	 */
@@ -79,20 +122,126 @@ private:
 	 */
 	Type m_type;
 
-	int m_epaper_mxc_marker;
+	/**
+	 * Descriptor of an update that has been sent to the EPDC but has not been
+	 * reported as complete yet.
+	 */
+	struct InFlightUpdate {
+		uint32_t marker;
+		Rect r;
+
+		/**
+		 * Time at which the update was submitted, as returned by
+		 * trace::now(). Only set while tracing.
+		 */
+		int64_t t_submitted;
+	};
+
+	/**
+	 * Marker of the last update sent to the EPDC. Each update gets a unique,
+	 * non-zero marker.
+	 */
+	uint32_t m_epaper_mxc_marker;
+
+	/**
+	 * Maximum number of updates that may be in flight at the same time.
+	 */
+	size_t m_max_in_flight;
+
+	/**
+	 * Table used to translate the update mode into a waveform.
+	 */
+	config::EPaper m_epaper_config;
 
-	int m_epaper_mxc_prev_marker;
+	/**
+	 * Set to false once the driver rejected an update using the AUTO waveform
+	 * mode. Subsequent updates fall back to GC16 instead.
+	 */
+	bool m_epaper_mxc_auto_supported;
 
 	/**
-	 * Used internally to commit a change to the epaper display.
+	 * Queue of updates that have been sent to the EPDC, oldest update first.
 	 */
-	void epaper_mxc_update(int x, int y, int w, int h, const UpdateMode &mode);
+	std::deque<InFlightUpdate> m_in_flight;
+
+	/**
+	 * Regions of updates that completed since the last call to do_completed().
+	 */
+	std::vector<Rect> m_completed;
+
+	/**
+	 * Flag used to tell the completion thread to exit.
+	 */
+	bool m_done;
+
+	/**
+	 * Mutex protecting m_in_flight, m_completed, and m_done.
+	 */
+	std::mutex m_in_flight_mutex;
+
+	/**
+	 * Condition variable used to signal changes to the in-flight queue.
+	 */
+	std::condition_variable m_in_flight_cond_var;
+
+	/**
+	 * Thread waiting for the in-flight updates to finish.
+	 */
+	std::thread m_completion_thread;
+
+	/**
+	 * Row converters for the colour layout of the framebuffer.
+	 */
+	PixelFormat m_pixel_format;
+
+	/**
+	 * Returns the entry in the waveform table for the given update mode.
+	 */
+	const config::Waveform &epaper_waveform(const UpdateMode &mode) const;
+
+	/**
+	 * Used internally to commit a change to the epaper display. Blocks if the
+	 * maximum number of updates is already in flight.
+	 */
+	void epaper_mxc_update(const Rect &r, const UpdateMode &mode);
+
+	/**
+	 * Blocks until no update touching the given region is in flight.
+	 */
+	void epaper_mxc_wait_for_region(const Rect &r);
+
+	/**
+	 * Main loop of the completion thread. Waits for the oldest in-flight
+	 * update to finish using MXCFB_WAIT_FOR_UPDATE_COMPLETE and moves it to
+	 * the list of completed regions.
+	 */
+	void epaper_mxc_completion_thread();
+
+	/**
+	 * In page flipping mode, replaces the given range of commit requests with
+	 * the range of regions that must be drawn to the back page. Does nothing
+	 * otherwise.
+	 */
+	void page_flip_requests(const CommitRequest *&begin,
+	                        const CommitRequest *&end);
+
+	/**
+	 * Shows the back page by panning the display to it. Returns false if
+	 * panning failed. In this case page flipping is disabled and the frame
+	 * must be drawn again to the visible page.
+	 */
+	bool page_flip();
 
 protected:
 	/* Implementation of the abstract class MemoryDisplay */
 	Rect do_lock() override;
 	void do_unlock(const CommitRequest *begin, const CommitRequest *end,
 	               const RGBA *buf, size_t stride) override;
+	void do_unlock_greyscale(const CommitRequest *begin,
+	                         const CommitRequest *end, const uint8_t *buf,
+	                         size_t stride) override;
+	bool do_busy(const Rect &r) override;
+	void do_completed(std::vector<Rect> &regions) override;
 
 public:
 	/**
@@ -100,13 +249,23 @@ public:
 	 * if opening the device fails.
 	 *
 	 * @param fbdev is the framebuffer device that should be opened.
+	 * @param epaper is the e-paper configuration containing the waveform table
+	 * and the maximum number of updates that may be processed by the display
+	 * controller at the same time.
 	 */
-	FbDevDisplay(const char *fbdev);
+	FbDevDisplay(const char *fbdev,
+	             const config::EPaper &epaper = config::EPaper());
 
 	/**
 	 * Destroys the FbDevDisplay instance.
 	 */
 	~FbDevDisplay();
+
+	/**
+	 * Returns the update cost configured for e-paper displays. Generic
+	 * framebuffers use the default cost model.
+	 */
+	RectangleMerger::Cost update_cost() const override;
 };
 }  // namespace inktty
 
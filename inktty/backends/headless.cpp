@@ -0,0 +1,131 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstdio>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#include <inktty/backends/headless.hpp>
+#include <inktty/gfx/epaper_emulation.hpp>
+#include <inktty/gfx/panel_shadow.hpp>
+#include <inktty/utils/logger.hpp>
+
+namespace inktty {
+
+/******************************************************************************
+ * Class HeadlessDisplay                                                      *
+ ******************************************************************************/
+
+HeadlessDisplay::HeadlessDisplay(unsigned int width, unsigned int height,
+                                 bool epaper_emulation,
+                                 const std::string &png_prefix)
+    : m_width(width),
+      m_height(height),
+      m_screen(size_t(width) * height * 4U, 0U),
+      m_png_prefix(png_prefix) {
+	// Let the display track the emulated panel content
+	set_panel_shadow(epaper_emulation);
+}
+
+HeadlessDisplay::~HeadlessDisplay() {
+	flush();
+	const Statistics s = statistics();
+	global_logger().info() << "Headless display: " << s.frames << " frames, "
+	                       << s.updates << " updates, " << s.pixels
+	                       << " pixels";
+}
+
+Rect HeadlessDisplay::do_lock() { return Rect(0, 0, m_width, m_height); }
+
+void HeadlessDisplay::do_unlock(const CommitRequest *begin,
+                                const CommitRequest *end, const RGBA *buf,
+                                size_t stride) {
+	if (begin == end) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	const PanelShadow *shadow = panel_shadow();
+	const Rect bounds(0, 0, m_width, m_height);
+	for (const CommitRequest *req = begin; req < end; req++) {
+		if (!bounds.overlaps(req->r)) {
+			continue;
+		}
+		const Rect r = bounds.clip(req->r);
+		m_statistics.updates++;
+		m_statistics.pixels += r.area();
+		for (int y = r.y0; y < r.y1; y++) {
+			uint8_t *tar = &m_screen[(size_t(y) * m_width + r.x0) * 4U];
+			if (shadow) {
+				m_grey_row.resize(r.width());
+				shadow->unpack(m_grey_row.data(), y, r.x0, r.x1);
+			}
+			const RGBA *src = buf + y * stride / sizeof(RGBA);
+			for (int x = r.x0; x < r.x1; x++, tar += 4) {
+				const RGBA c =
+				    shadow ? epaper_emulation::greyscale_to_rgba(
+				                 m_grey_row[x - r.x0])
+				           : src[x];
+				tar[0] = c.r;
+				tar[1] = c.g;
+				tar[2] = c.b;
+				tar[3] = 255U;
+			}
+		}
+	}
+	m_statistics.frames++;
+
+	// Write the frame to a PNG file if requested
+	if (!m_png_prefix.empty()) {
+		char suffix[32];
+		snprintf(suffix, sizeof(suffix), "%06llu.png",
+		         (unsigned long long)m_statistics.frames);
+		const std::string filename = m_png_prefix + suffix;
+		if (!write_png_unlocked(filename.c_str())) {
+			global_logger().warn() << "Couldn't write \"" << filename << "\"";
+		}
+	}
+}
+
+HeadlessDisplay::Statistics HeadlessDisplay::statistics() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_statistics;
+}
+
+RGBA HeadlessDisplay::pixel(unsigned int x, unsigned int y) const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (x >= m_width || y >= m_height) {
+		return RGBA::Black;
+	}
+	const uint8_t *p = &m_screen[(size_t(y) * m_width + x) * 4U];
+	return RGBA(p[0], p[1], p[2], p[3]);
+}
+
+bool HeadlessDisplay::write_png_unlocked(const char *filename) const {
+	return stbi_write_png(filename, m_width, m_height, 4, m_screen.data(),
+	                      m_width * 4) != 0;
+}
+
+bool HeadlessDisplay::write_png(const char *filename) const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return write_png_unlocked(filename);
+}
+
+}  // namespace inktty
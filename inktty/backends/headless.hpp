@@ -0,0 +1,139 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INKTTY_BACKENDS_HEADLESS_HPP
+#define INKTTY_BACKENDS_HEADLESS_HPP
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <inktty/gfx/display.hpp>
+
+namespace inktty {
+/**
+ * The HeadlessDisplay class is a display backend that does not require any
+ * display hardware. It keeps a copy of the displayed content in memory,
+ * records statistics about the committed regions and can write the content to
+ * PNG files. This allows to run inktty for load tests, in continuous
+ * integration, or to render screenshots.
+ */
+class HeadlessDisplay : public MemoryDisplay {
+public:
+	/**
+	 * Statistics about the updates passed to the backend.
+	 */
+	struct Statistics {
+		/**
+		 * Number of frames containing at least one update.
+		 */
+		uint64_t frames;
+
+		/**
+		 * Number of updates, i.e. committed regions after merging and
+		 * filtering.
+		 */
+		uint64_t updates;
+
+		/**
+		 * Total number of pixels in all updates.
+		 */
+		uint64_t pixels;
+
+		Statistics() : frames(0), updates(0), pixels(0) {}
+	};
+
+private:
+	/**
+	 * Width and height of the display in pixels.
+	 */
+	unsigned int m_width, m_height;
+
+	/**
+	 * Displayed content as 8-bit RGBA in memory order, i.e. in the format
+	 * expected by the PNG writer.
+	 */
+	std::vector<uint8_t> m_screen;
+
+	/**
+	 * Scratch buffer used to convert the panel shadow in e-paper emulation
+	 * mode.
+	 */
+	std::vector<uint8_t> m_grey_row;
+
+	/**
+	 * If non-empty, each frame is written to a PNG file starting with this
+	 * prefix, followed by the frame number.
+	 */
+	std::string m_png_prefix;
+
+	Statistics m_statistics;
+
+	/**
+	 * Mutex protecting the screen and the statistics, which are written by
+	 * the presenter thread in double buffered mode.
+	 */
+	mutable std::mutex m_mutex;
+
+	bool write_png_unlocked(const char *filename) const;
+
+protected:
+	/* Implementation of the abstract class MemoryDisplay */
+	Rect do_lock() override;
+	void do_unlock(const CommitRequest *begin, const CommitRequest *end,
+	               const RGBA *buf, size_t stride) override;
+
+public:
+	/**
+	 * Creates a new headless display with the given size.
+	 *
+	 * @param epaper_emulation if true, the content is passed through the
+	 * e-paper emulation, i.e. the stored content and the written PNG files
+	 * show the emulated panel.
+	 * @param png_prefix if non-empty, every frame is written to a PNG file
+	 * named after the prefix and the zero-padded frame number.
+	 */
+	HeadlessDisplay(unsigned int width, unsigned int height,
+	                bool epaper_emulation = false,
+	                const std::string &png_prefix = std::string());
+
+	/**
+	 * Waits for the last frame and logs the statistics.
+	 */
+	~HeadlessDisplay();
+
+	/**
+	 * Returns a copy of the current statistics.
+	 */
+	Statistics statistics() const;
+
+	/**
+	 * Returns the colour currently displayed at the given location.
+	 */
+	RGBA pixel(unsigned int x, unsigned int y) const;
+
+	/**
+	 * Writes the current display content to the given PNG file. Returns false
+	 * if the file could not be written.
+	 */
+	bool write_png(const char *filename) const;
+};
+}  // namespace inktty
+
+#endif /* INKTTY_BACKENDS_HEADLESS_HPP */
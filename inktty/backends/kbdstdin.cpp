@@ -19,6 +19,7 @@
 #include <cerrno>
 #include <cstdio>
 #include <system_error>
+#include <vector>
 
 #include <fcntl.h>
 #include <termios.h>
@@ -35,8 +36,20 @@ namespace inktty {
  ******************************************************************************/
 
 struct KbdStdin::Data {
+	/**
+	 * Number of bytes termkey reads from stdin at once. All keys contained in
+	 * these bytes are passed on as a single event.
+	 */
+	static constexpr size_t BUF_SIZE = 4096;
+
 	int fd_stdout;
 	TermKey *tk;
+
+	/**
+	 * Keys decoded by the last call to event_get(), referenced by
+	 * Event::KeyBatch.
+	 */
+	std::vector<Event::Keyboard> keys;
 };
 
 /******************************************************************************
@@ -47,6 +60,7 @@ KbdStdin::KbdStdin(int, int fd_stdout) : m_data(new KbdStdin::Data()) {
 	// Instantiate a new termkey instance
 	m_data->tk = termkey_new(0, TERMKEY_FLAG_CTRLC);
 	termkey_set_waittime(m_data->tk, 1);
+	termkey_set_buffer_size(m_data->tk, Data::BUF_SIZE);
 
 	// Copy the data
 	m_data->fd_stdout = fd_stdout;
@@ -71,11 +85,7 @@ EventSource::PollMode KbdStdin::event_fd_poll_mode() const {
 	return EventSource::PollIn;
 }
 
-static bool termkey_key_to_event(TermKeyKey &key, Event &event) {
-	// Mark this as key input
-	event.type = Event::Type::KEY_INPUT;
-
-	Event::Keyboard &data = event.data.keybd;
+static bool termkey_key_to_event(TermKeyKey &key, Event::Keyboard &data) {
 	data.unichar = 0;
 	data.key = Event::Key::NONE;
 	data.shift = key.modifiers & TERMKEY_KEYMOD_SHIFT;
@@ -136,20 +146,45 @@ static bool termkey_key_to_event(TermKeyKey &key, Event &event) {
 }
 
 bool KbdStdin::event_get(EventSource::PollMode mode, Event &event) {
-	if (mode == EventSource::PollIn) {
+	if (mode != EventSource::PollIn) {
+		return false;
+	}
+
+	// Read all available input at once and decode all keys contained in it.
+	// Incomplete escape sequences at the end of the buffer are completed (or
+	// interpreted as individual keys) by termkey_waitkey() after a short
+	// timeout.
+	std::vector<Event::Keyboard> &keys = m_data->keys;
+	keys.clear();
+	if (termkey_advisereadable(m_data->tk) == TERMKEY_RES_ERROR) {
+		return false;
+	}
+	while (true) {
 		TermKeyKey key;
-		TermKeyResult ret = termkey_waitkey(m_data->tk, &key);
-		switch (ret) {
-			case TERMKEY_RES_KEY:
-				if (termkey_key_to_event(key, event)) {
-					return true;
-				}
-				break;
-			default:
-				return false;
+		TermKeyResult ret = termkey_getkey(m_data->tk, &key);
+		if (ret == TERMKEY_RES_AGAIN) {
+			ret = termkey_waitkey(m_data->tk, &key);
+		}
+		if (ret != TERMKEY_RES_KEY) {
+			break;
+		}
+		keys.emplace_back();
+		if (!termkey_key_to_event(key, keys.back())) {
+			keys.pop_back();
 		}
 	}
-	return false;
+
+	// Pass single keys on as usual, multiple keys as a batch
+	if (keys.empty()) {
+		return false;
+	} else if (keys.size() == 1) {
+		event.type = Event::Type::KEY_INPUT;
+		event.data.keybd = keys[0];
+	} else {
+		event.type = Event::Type::KEY_BATCH;
+		event.data.keys = Event::KeyBatch{keys.size(), keys.data()};
+	}
+	return true;
 }
 
 }  // namespace inktty
@@ -0,0 +1,341 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <system_error>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <inktty/backends/remote.hpp>
+#include <inktty/backends/remote_protocol.hpp>
+#include <inktty/utils/logger.hpp>
+
+namespace inktty {
+
+/******************************************************************************
+ * Class RemoteFramebuffer::Impl                                              *
+ ******************************************************************************/
+
+class RemoteFramebuffer::Impl : public MemoryDisplay::Tap {
+private:
+	/**
+	 * Maximum number of bytes waiting to be sent to the viewer. Updates are
+	 * discarded while the backlog is larger than this.
+	 */
+	static constexpr size_t MAX_BACKLOG = 1024 * 1024;
+
+	MemoryDisplay &m_display;
+	int m_listen_fd;
+	int m_port;
+
+	/**
+	 * Socket of the connected viewer or -1. Only written by the thread
+	 * running the event loop, with m_mutex held.
+	 */
+	int m_client_fd;
+
+	/**
+	 * Mutex protecting the output buffer, which is written by the thread
+	 * passing the display content to the backend and flushed by the event
+	 * loop.
+	 */
+	mutable std::mutex m_mutex;
+	std::vector<uint8_t> m_out;
+	size_t m_out_pos;
+
+	/**
+	 * If true, the next update sends the entire display content.
+	 */
+	bool m_keyframe;
+
+	/**
+	 * Size of the display last sent to the viewer.
+	 */
+	int m_width, m_height;
+
+	std::vector<uint8_t> m_row;
+
+	/**
+	 * Sends as much of the output buffer as the socket accepts without
+	 * blocking. Returns false if the connection failed. Must be called with
+	 * m_mutex held.
+	 */
+	bool send_pending() {
+		while (m_out_pos < m_out.size()) {
+			const ssize_t n =
+			    send(m_client_fd, m_out.data() + m_out_pos,
+			         m_out.size() - m_out_pos, MSG_DONTWAIT | MSG_NOSIGNAL);
+			if (n < 0 && errno == EINTR) {
+				continue;
+			} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				break;
+			} else if (n <= 0) {
+				return false;
+			}
+			m_out_pos += n;
+		}
+		if (m_out_pos == m_out.size()) {
+			m_out.clear();
+			m_out_pos = 0;
+		}
+		return true;
+	}
+
+	/**
+	 * Appends the content of the given rectangle of the buffer to the output
+	 * buffer.
+	 */
+	void encode(const Rect &rect, const uint8_t *buf, size_t stride,
+	            const Rect &r, MemoryDisplay::Format format) {
+		const size_t w = rect.width();
+		m_out.push_back(remote::MSG_RECT);
+		remote::put_u16(m_out, rect.x0 - r.x0);
+		remote::put_u16(m_out, rect.y0 - r.y0);
+		remote::put_u16(m_out, rect.width());
+		remote::put_u16(m_out, rect.height());
+		const size_t len_pos = m_out.size();
+		remote::put_u32(m_out, 0);
+		m_row.resize(w);
+		for (int y = rect.y0; y < rect.y1; y++) {
+			const uint8_t *src =
+			    buf + (y - r.y0) * stride +
+			    (rect.x0 - r.x0) *
+			        (format == MemoryDisplay::Format::RGBA ? sizeof(RGBA) : 1);
+			if (format == MemoryDisplay::Format::RGBA) {
+				const RGBA *src_rgba = (const RGBA *)src;
+				for (size_t x = 0; x < w; x++) {
+					m_row[x] = src_rgba[x].luma();
+				}
+				src = m_row.data();
+			}
+			remote::encode_rle4(src, w, m_out);
+		}
+		const uint32_t len = m_out.size() - len_pos - 4;
+		for (size_t i = 0; i < 4; i++) {
+			m_out[len_pos + i] = (len >> (8 * i)) & 0xFF;
+		}
+	}
+
+	void disconnect() {
+		if (m_client_fd < 0) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock(m_mutex);
+		close(m_client_fd);
+		m_client_fd = -1;
+		m_out.clear();
+		m_out_pos = 0;
+		global_logger().info("remote", "Viewer disconnected");
+	}
+
+	/**
+	 * Accepts a pending connection. The keyframe is sent by the tap the next
+	 * time the display is unlocked; the display itself must not be accessed
+	 * here, since it may be drawn to by a render thread concurrently. Returns
+	 * true if a viewer connected.
+	 */
+	bool accept_viewer() {
+		const int fd = accept4(m_listen_fd, nullptr, nullptr,
+		                       SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			return false;
+		}
+		const int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_client_fd = fd;
+			m_out.assign(remote::MAGIC, remote::MAGIC + sizeof(remote::MAGIC));
+			m_out_pos = 0;
+			m_keyframe = true;
+		}
+		global_logger().info("remote", "Viewer connected");
+		return true;
+	}
+
+public:
+	Impl(MemoryDisplay &display, const std::string &address, int port)
+	    : m_display(display),
+	      m_listen_fd(-1),
+	      m_port(port),
+	      m_client_fd(-1),
+	      m_out_pos(0),
+	      m_keyframe(true),
+	      m_width(0),
+	      m_height(0) {
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+			throw std::system_error(EINVAL, std::system_category(),
+			                        "Invalid address " + address);
+		}
+
+		m_listen_fd =
+		    socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (m_listen_fd < 0) {
+			throw std::system_error(errno, std::system_category());
+		}
+		const int one = 1;
+		setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		socklen_t len = sizeof(addr);
+		if (bind(m_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		    listen(m_listen_fd, 1) < 0 ||
+		    getsockname(m_listen_fd, (struct sockaddr *)&addr, &len) < 0) {
+			const int err = errno;
+			close(m_listen_fd);
+			throw std::system_error(err, std::system_category());
+		}
+		m_port = ntohs(addr.sin_port);
+
+		// The tap stays installed for the lifetime of the server and ignores
+		// the display content while no viewer is connected
+		m_display.set_tap(this);
+	}
+
+	~Impl() {
+		m_display.set_tap(nullptr);
+		disconnect();
+		close(m_listen_fd);
+	}
+
+	void tap(const MemoryDisplay::CommitRequest *begin,
+	         const MemoryDisplay::CommitRequest *end, const uint8_t *buf,
+	         size_t stride, const Rect &r, MemoryDisplay::Format format) override {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_client_fd < 0 || !buf) {
+			return;
+		}
+
+		// Drop updates while the viewer lags behind and resend everything
+		// once it caught up
+		if (m_out.size() - m_out_pos > MAX_BACKLOG) {
+			m_keyframe = true;
+			return;
+		}
+
+		// Send the entire display if requested or if the size changed
+		if (m_keyframe || m_width != r.width() || m_height != r.height()) {
+			m_width = r.width();
+			m_height = r.height();
+			m_out.push_back(remote::MSG_SIZE);
+			remote::put_u16(m_out, m_width);
+			remote::put_u16(m_out, m_height);
+			encode(r, buf, stride, r, format);
+			m_keyframe = false;
+		} else if (begin != end) {
+			for (const MemoryDisplay::CommitRequest *req = begin; req < end;
+			     req++) {
+				const Rect c = r.clip(req->r);
+				if (c.width() > 0 && c.height() > 0) {
+					encode(c, buf, stride, r, format);
+				}
+			}
+		} else {
+			return;
+		}
+		m_out.push_back(remote::MSG_FRAME);
+		send_pending();  // Failures are handled by the event loop
+	}
+
+	int port() const { return m_port; }
+
+	bool connected() const { return m_client_fd >= 0; }
+
+	int event_fd() const {
+		return (m_client_fd >= 0) ? m_client_fd : m_listen_fd;
+	}
+
+	EventSource::PollMode event_fd_poll_mode() const {
+		if (m_client_fd >= 0) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_out_pos < m_out.size()) {
+				return EventSource::PollMode(EventSource::PollIn |
+				                             EventSource::PollOut);
+			}
+		}
+		return EventSource::PollIn;
+	}
+
+	bool event_get(EventSource::PollMode mode) {
+		if (m_client_fd < 0) {
+			return (mode & EventSource::PollIn) && accept_viewer();
+		}
+
+		// Anything the viewer sends is ignored; detect closed connections
+		bool ok = !(mode & EventSource::PollErr);
+		if (ok && (mode & EventSource::PollIn)) {
+			uint8_t buf[256];
+			const ssize_t n = recv(m_client_fd, buf, sizeof(buf), MSG_DONTWAIT);
+			ok = n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+			                         errno == EINTR));
+		}
+		if (ok && (mode & EventSource::PollOut)) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			ok = send_pending();
+		}
+		if (!ok) {
+			disconnect();
+		}
+		return false;
+	}
+};
+
+constexpr size_t RemoteFramebuffer::Impl::MAX_BACKLOG;
+
+/******************************************************************************
+ * Class RemoteFramebuffer                                                    *
+ ******************************************************************************/
+
+RemoteFramebuffer::RemoteFramebuffer(MemoryDisplay &display,
+                                     const std::string &address, int port)
+    : m_impl(new Impl(display, address, port)) {}
+
+RemoteFramebuffer::~RemoteFramebuffer() {
+	// Implicitly destroy m_impl
+}
+
+int RemoteFramebuffer::port() const { return m_impl->port(); }
+
+bool RemoteFramebuffer::connected() const { return m_impl->connected(); }
+
+int RemoteFramebuffer::event_fd() const { return m_impl->event_fd(); }
+
+EventSource::PollMode RemoteFramebuffer::event_fd_poll_mode() const {
+	return m_impl->event_fd_poll_mode();
+}
+
+bool RemoteFramebuffer::event_get(EventSource::PollMode mode, Event &event) {
+	// Ask for the display content to be passed to the backend once more,
+	// such that the tap sends it to the new viewer
+	if (m_impl->event_get(mode)) {
+		event.type = Event::Type::REPAINT;
+		return true;
+	}
+	return false;
+}
+
+}  // namespace inktty
@@ -0,0 +1,81 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INKTTY_BACKENDS_REMOTE_HPP
+#define INKTTY_BACKENDS_REMOTE_HPP
+
+#include <memory>
+#include <string>
+
+#include <inktty/gfx/display.hpp>
+#include <inktty/term/events.hpp>
+
+namespace inktty {
+/**
+ * The RemoteFramebuffer class streams the content of a MemoryDisplay to a
+ * remote viewer connected via TCP. Only the regions passed to the display
+ * backend are sent, as run-length encoded 4-bit greyscale images (see
+ * remote_protocol.hpp). A single viewer is served at a time.
+ *
+ * The class is an event source: it accepts connections and writes pending
+ * data when the socket becomes writable. The display is never accessed from
+ * the event loop, since it may be drawn to by a render thread. A new viewer
+ * is reported as a REPAINT event instead; the entire display content is sent
+ * the next time the display is unlocked. The data of each display update is
+ * sent directly from the thread passing it to the backend; only data the
+ * socket does not accept immediately is left to the event loop. If the viewer
+ * falls too far behind, updates are discarded and the entire display is sent
+ * once the viewer caught up.
+ */
+class RemoteFramebuffer : public EventSource {
+private:
+	class Impl;
+	std::unique_ptr<Impl> m_impl;
+
+public:
+	/**
+	 * Starts listening for viewers on the given address and port. A port of
+	 * zero selects an arbitrary free port. Throws std::system_error if the
+	 * socket cannot be created.
+	 */
+	RemoteFramebuffer(MemoryDisplay &display, const std::string &address,
+	                  int port);
+
+	/**
+	 * Disconnects the viewer and removes the tap from the display.
+	 */
+	~RemoteFramebuffer();
+
+	/**
+	 * Returns the port the server is listening on.
+	 */
+	int port() const;
+
+	/**
+	 * Returns true if a viewer is connected.
+	 */
+	bool connected() const;
+
+	/* Implementation of the abstract class EventSource */
+	int event_fd() const override;
+	EventSource::PollMode event_fd_poll_mode() const override;
+	bool event_get(EventSource::PollMode mode, Event &event) override;
+};
+}  // namespace inktty
+
+#endif /* INKTTY_BACKENDS_REMOTE_HPP */
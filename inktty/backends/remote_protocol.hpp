@@ -0,0 +1,120 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file remote_protocol.hpp
+ *
+ * Constants and helper functions describing the stream format used to send
+ * the display content to a remote viewer. The stream starts with the eight
+ * MAGIC bytes, followed by a sequence of messages. Each message starts with a
+ * single type byte; all integers are little endian.
+ *
+ * - MSG_SIZE (u16 width, u16 height): the size of the display changed; the
+ *   viewer should clear its image. Always followed by a rectangle covering
+ *   the entire display.
+ * - MSG_RECT (u16 x, u16 y, u16 w, u16 h, u32 n, n bytes of data): the
+ *   content of the given rectangle as 4-bit greyscale values, row by row,
+ *   run-length encoded with encode_rle4().
+ * - MSG_FRAME: all rectangles belonging to one display update have been
+ *   sent.
+ */
+
+#ifndef INKTTY_BACKENDS_REMOTE_PROTOCOL_HPP
+#define INKTTY_BACKENDS_REMOTE_PROTOCOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace inktty {
+namespace remote {
+
+static constexpr char MAGIC[8] = {'I', 'N', 'K', 'T', 'T', 'Y', 'F', '1'};
+
+enum MessageType : uint8_t { MSG_SIZE = 1, MSG_RECT = 2, MSG_FRAME = 3 };
+
+/**
+ * Maximum number of pixels encoded in a single run.
+ */
+static constexpr size_t MAX_RUN = 16;
+
+/**
+ * Appends a 16-bit integer to the given buffer.
+ */
+inline void put_u16(std::vector<uint8_t> &out, uint16_t v) {
+	out.push_back(v & 0xFF);
+	out.push_back(v >> 8);
+}
+
+/**
+ * Appends a 32-bit integer to the given buffer.
+ */
+inline void put_u32(std::vector<uint8_t> &out, uint32_t v) {
+	put_u16(out, v & 0xFFFF);
+	put_u16(out, v >> 16);
+}
+
+inline uint16_t get_u16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+inline uint32_t get_u32(const uint8_t *p) {
+	return get_u16(p) | (uint32_t(get_u16(p + 2)) << 16);
+}
+
+/**
+ * Run-length encodes the upper four bits of the n given 8-bit greyscale
+ * values. Each output byte stores a run of up to MAX_RUN equal values; the
+ * upper four bits are the run length minus one, the lower four bits the
+ * value.
+ */
+inline void encode_rle4(const uint8_t *src, size_t n,
+                        std::vector<uint8_t> &out) {
+	size_t i = 0;
+	while (i < n) {
+		const uint8_t v = src[i] >> 4;
+		size_t j = i + 1;
+		while (j < n && j - i < MAX_RUN && (src[j] >> 4) == v) {
+			j++;
+		}
+		out.push_back(uint8_t(((j - i - 1) << 4) | v));
+		i = j;
+	}
+}
+
+/**
+ * Decodes data produced by encode_rle4() into at most n 8-bit greyscale
+ * values. Returns the number of bytes read from the source or zero if the
+ * source does not contain enough data.
+ */
+inline size_t decode_rle4(const uint8_t *src, size_t src_len, uint8_t *tar,
+                          size_t n) {
+	size_t i = 0, j = 0;
+	while (j < n && i < src_len) {
+		const size_t len = (src[i] >> 4) + 1;
+		const uint8_t v = (src[i] & 0x0F) * 0x11;
+		for (size_t k = 0; k < len && j < n; k++) {
+			tar[j++] = v;
+		}
+		i++;
+	}
+	return (j == n) ? i : 0;
+}
+
+}  // namespace remote
+}  // namespace inktty
+
+#endif /* INKTTY_BACKENDS_REMOTE_PROTOCOL_HPP */
@@ -19,12 +19,14 @@
 #include <config.h>
 #ifdef HAS_SDL
 
+#include <algorithm>
 #include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <mutex>
-#include <queue>
 #include <stdexcept>
 #include <thread>
+#include <vector>
 
 #include <iostream>
 
@@ -35,6 +37,9 @@
 
 #include <inktty/backends/sdl.hpp>
 #include <inktty/gfx/epaper_emulation.hpp>
+#include <inktty/gfx/panel_shadow.hpp>
+#include <inktty/utils/geometry.hpp>
+#include <inktty/utils/spsc_queue.hpp>
 
 #include <time.h>
 
@@ -45,22 +50,83 @@ namespace inktty {
 
 class SDLBackend::Impl {
 private:
-	uint32_t m_sdl_lock_event;
-	uint32_t m_sdl_unlock_event;
+	/**
+	 * Pixel data of the regions committed in one call to unlock(). The
+	 * regions are stored consecutively in the SDL_PIXELFORMAT_ARGB8888
+	 * format, which matches the memory layout of the RGBA structure.
+	 */
+	struct Frame {
+		int width;
+		int height;
+		std::vector<Rect> rects;
+		std::vector<RGBA> pixels;
+	};
 
-	std::queue<SDL_Event> m_event_queue;
+	/**
+	 * Capacity of the queues between the main thread and the GUI thread.
+	 */
+	static constexpr size_t FRAME_QUEUE_SIZE = 64;
+	static constexpr size_t EVENT_QUEUE_SIZE = 1024;
+
+	uint32_t m_sdl_present_event;
+
+	/**
+	 * SDL events forwarded from the GUI thread to the main thread. Each event
+	 * in the queue increments the m_event_fd counter by one.
+	 */
+	SPSCQueue<SDL_Event> m_events;
 	int m_event_fd;
 
-	int m_width;
-	int m_height;
+	/**
+	 * Current window size. Written by the GUI thread whenever the window is
+	 * resized.
+	 */
+	std::atomic<int> m_width;
+	std::atomic<int> m_height;
+
+	/**
+	 * Frames passed from the main thread to the GUI thread, and frames passed
+	 * back for reuse once they have been presented.
+	 */
+	SPSCQueue<Frame *> m_frames;
+	SPSCQueue<Frame *> m_free_frames;
+
+	/**
+	 * Frame without any regions that can be reused by the next call to
+	 * unlock(). Only used by the main thread.
+	 */
+	Frame *m_spare_frame;
 
-	std::atomic_bool m_locked;
-	RGBA *m_pixels;
-	int m_pitch;
-	ColorLayout m_layout;
+	/**
+	 * Size of the display returned by the last call to lock().
+	 */
+	int m_lock_width;
+	int m_lock_height;
+
+	/**
+	 * Set while a present event is queued, such that frames committed in
+	 * quick succession are coalesced into a single present.
+	 */
+	std::atomic_bool m_present_pending;
 
 	SDL_Window *m_wnd;
-	SDL_Surface *m_surf;
+
+	/**
+	 * Renderer and streaming texture used to present the frames. If no
+	 * renderer is available, the frames are copied to the window surface
+	 * instead.
+	 */
+	SDL_Renderer *m_renderer;
+	SDL_Texture *m_texture;
+	int m_texture_width;
+	int m_texture_height;
+
+	/**
+	 * Merges the damaged regions passed to SDL_UpdateWindowSurfaceRects().
+	 * Only used by the GUI thread.
+	 */
+	RectangleMerger m_merger;
+	std::vector<SDL_Rect> m_sdl_rects;
 
 	std::atomic_bool m_done;
 	std::atomic_bool m_initialised;
@@ -75,7 +141,133 @@ private:
 
 	const char *m_init_err;
 
-	bool m_epaper_emulation;
+	/**
+	 * Scratch buffer used to convert the panel shadow in e-paper emulation
+	 * mode.
+	 */
+	std::vector<uint8_t> m_grey_row;
+
+	/**
+	 * Draws all queued frames and presents them. Called on the GUI thread.
+	 * If "full" is true, the entire window is presented.
+	 */
+	void sdl_present(bool full) {
+		m_present_pending = false;
+
+		bool drawn = false;
+		Frame *frame = nullptr;
+		m_merger.reset();
+		while (m_frames.pop(frame)) {
+			if (m_renderer) {
+				sdl_upload_texture(*frame);
+			} else {
+				sdl_copy_to_surface(*frame);
+			}
+			if (!m_free_frames.push(frame)) {
+				delete frame;
+			}
+			drawn = true;
+		}
+		if (!drawn && !full) {
+			return;
+		}
+
+		if (m_renderer) {
+			if (m_texture) {
+				SDL_RenderCopy(m_renderer, m_texture, nullptr, nullptr);
+				SDL_RenderPresent(m_renderer);
+			}
+		} else if (full) {
+			SDL_UpdateWindowSurface(m_wnd);
+		} else {
+			m_merger.merge();
+			m_sdl_rects.clear();
+			for (const Rect &r : m_merger) {
+				m_sdl_rects.push_back(sdl_rect(r));
+			}
+			SDL_UpdateWindowSurfaceRects(m_wnd, m_sdl_rects.data(),
+			                             m_sdl_rects.size());
+		}
+	}
+
+	/**
+	 * Copies the regions stored in the given frame into the streaming
+	 * texture. The texture is recreated if the window size changed.
+	 */
+	void sdl_upload_texture(const Frame &frame) {
+		const int w = frame.width, h = frame.height;
+		if (!m_texture || m_texture_width != w || m_texture_height != h) {
+			if (m_texture) {
+				SDL_DestroyTexture(m_texture);
+			}
+			m_texture =
+			    SDL_CreateTexture(m_renderer, SDL_PIXELFORMAT_ARGB8888,
+			                      SDL_TEXTUREACCESS_STREAMING, w, h);
+			m_texture_width = w;
+			m_texture_height = h;
+		}
+		if (!m_texture) {
+			return;
+		}
+		const RGBA *src = frame.pixels.data();
+		for (const Rect &r : frame.rects) {
+			const SDL_Rect sr = sdl_rect(r);
+			SDL_UpdateTexture(m_texture, &sr, src, r.width() * sizeof(RGBA));
+			src += r.area();
+		}
+	}
+
+	/**
+	 * Converts the regions stored in the given frame into the window surface
+	 * and adds them to the merger.
+	 */
+	void sdl_copy_to_surface(const Frame &frame) {
+		SDL_Surface *surf = SDL_GetWindowSurface(m_wnd);
+		if (!surf) {
+			return;
+		}
+		const Rect bounds(0, 0, surf->w, surf->h);
+		const uint8_t bypp = surf->format->BytesPerPixel;
+		SDL_LockSurface(surf);
+		const RGBA *src = frame.pixels.data();
+		for (const Rect &r : frame.rects) {
+			const int stride = r.width();
+			if (bounds.overlaps(r)) {
+				const Rect c = bounds.clip(r);
+				SDL_ConvertPixels(
+				    c.width(), c.height(), SDL_PIXELFORMAT_ARGB8888,
+				    src + (c.y0 - r.y0) * stride + (c.x0 - r.x0),
+				    stride * sizeof(RGBA), surf->format->format,
+				    static_cast<uint8_t *>(surf->pixels) + c.y0 * surf->pitch +
+				        c.x0 * bypp,
+				    surf->pitch);
+				m_merger.insert(c);
+			}
+			src += r.area();
+		}
+		SDL_UnlockSurface(surf);
+	}
+
+	static SDL_Rect sdl_rect(const Rect &r) {
+		SDL_Rect res;
+		res.x = r.x0;
+		res.y = r.y0;
+		res.w = r.width();
+		res.h = r.height();
+		return res;
+	}
+
+	/**
+	 * Moves the events that could not be forwarded yet to the main thread.
+	 * Called on the GUI thread.
+	 */
+	void sdl_forward_events(std::deque<SDL_Event> &backlog) {
+		while (!backlog.empty() && m_events.push(backlog.front())) {
+			backlog.pop_front();
+			uint64_t buf = 1;
+			write(m_event_fd, &buf, 8);
+		}
+	}
 
 	/**
 	 * This function runs on a separate thread and is the only function inside
@@ -85,7 +277,6 @@ private:
 		// Initialise SDL
 		SDL_SetHint(SDL_HINT_FRAMEBUFFER_ACCELERATION, "1");
 		SDL_SetHint(SDL_HINT_NO_SIGNAL_HANDLERS, "1");
-		SDL_SetHint(SDL_HINT_RENDER_DRIVER, "software");
 		SDL_SetHint(SDL_HINT_RENDER_VSYNC, "0");
 		SDL_setenv("SDL_VIDEODRIVER", "x11",
 		           true);  // Prevent SDL from using the fbcon
@@ -104,86 +295,64 @@ private:
 			return;
 		}
 
-		// Register the lock and unlock event
-		self->m_sdl_lock_event = SDL_RegisterEvents(1);
-		self->m_sdl_unlock_event = SDL_RegisterEvents(1);
-
-		// Set the surface color layout
-		self->m_layout.bpp = 32U;
-		self->m_layout.rr = 0U;
-		self->m_layout.rl = 0U;
-		self->m_layout.gr = 0U;
-		self->m_layout.gl = 8U;
-		self->m_layout.br = 0U;
-		self->m_layout.bl = 16U;
-		self->m_layout.ar = 0U;
-		self->m_layout.al = 24U;
+		// Present using a streaming texture if possible, fall back to copying
+		// to the window surface otherwise
+		self->m_renderer = SDL_CreateRenderer(self->m_wnd, -1, 0);
+
+		// Register the present event and fetch the actual window size
+		self->m_sdl_present_event = SDL_RegisterEvents(1);
+		self->sdl_update_window_size();
 
 		// Initialisation done; notify the main thread
 		self->m_initialised = true;
 		self->m_gui_cond_var.notify_one();
 
+		// Events are forwarded to the main thread through a lock-free queue;
+		// if the main thread falls behind, the remaining events are retried
+		// shortly afterwards
+		std::deque<SDL_Event> backlog;
 		SDL_Event event;
 		while (!self->m_done) {
-			if (SDL_WaitEventTimeout(&event, 100)) {
-				if (event.type == self->m_sdl_lock_event) {
-					// Fetch the screen width and height
-					SDL_GetWindowSize(self->m_wnd, &self->m_width,
-					                  &self->m_height);
-
-					// Update the surface size in case it changed
-					if (!self->m_surf || (self->m_width != self->m_surf->w ||
-					                      self->m_height != self->m_surf->h)) {
-						// Fetch the window surface
-						self->m_surf = SDL_GetWindowSurface(self->m_wnd);
-					}
-
-					// Lock the source surface
-					if (self->m_surf) {
-						SDL_LockSurface(self->m_surf);
-						self->m_pixels = (RGBA *)self->m_surf->pixels;
-						self->m_pitch = self->m_surf->pitch;
-					} else {
-						self->m_pixels = nullptr;
-						self->m_pitch = 0;
-					}
-
-					// Wake up the main thread
-					self->m_locked = true;
-					self->m_gui_cond_var.notify_one();
-				} else if (event.type == self->m_sdl_unlock_event) {
-					if (self->m_surf) {
-						// Unlock the surface
-						SDL_UnlockSurface(self->m_surf);
-
-						// Wake up the main thread
-						self->m_locked = false;
-						self->m_gui_cond_var.notify_one();
-
-						// Blit to the window
-						SDL_UpdateWindowSurface(self->m_wnd);
-
-						// Invalidate the pixel pointers
-						self->m_pixels = nullptr;
-						self->m_pitch = 0;
-					}
+			const int timeout = backlog.empty() ? 100 : 10;
+			if (SDL_WaitEventTimeout(&event, timeout)) {
+				if (event.type == self->m_sdl_present_event) {
+					self->sdl_present(false);
 				} else {
-					// Forward the event to the main thread, notify the main
-					// thread using the event_fd
-					self->m_event_queue.push(event);
-					uint64_t buf = 1;
-					write(self->m_event_fd, &buf, 8);
+					if (event.type == SDL_WINDOWEVENT) {
+						if (event.window.event ==
+						    SDL_WINDOWEVENT_SIZE_CHANGED) {
+							self->sdl_update_window_size();
+						} else if (event.window.event ==
+						           SDL_WINDOWEVENT_EXPOSED) {
+							self->sdl_present(true);
+						}
+					}
+					backlog.push_back(event);
 				}
 			}
+			self->sdl_forward_events(backlog);
 		}
 
 		// Destroy the window
+		if (self->m_texture) {
+			SDL_DestroyTexture(self->m_texture);
+		}
+		if (self->m_renderer) {
+			SDL_DestroyRenderer(self->m_renderer);
+		}
 		SDL_DestroyWindow(self->m_wnd);
 
 		// Finalise SDL
 		SDL_Quit();
 	}
 
+	void sdl_update_window_size() {
+		int w = 0, h = 0;
+		SDL_GetWindowSize(m_wnd, &w, &h);
+		m_width = w;
+		m_height = h;
+	}
+
 	bool sdl_handle_key_event(const SDL_KeyboardEvent &e,
 	                          Event::Keyboard &keybd, bool down) {
 		// Update the state of the shift/control/alt keys
@@ -354,22 +523,29 @@ private:
 	}
 
 public:
-	Impl(unsigned int width, unsigned int height, bool epaper_emulation)
-	    : m_event_fd(eventfd(0, EFD_SEMAPHORE | EFD_CLOEXEC | EFD_NONBLOCK)),
+	Impl(unsigned int width, unsigned int height)
+	    : m_events(EVENT_QUEUE_SIZE),
+	      m_event_fd(eventfd(0, EFD_SEMAPHORE | EFD_CLOEXEC | EFD_NONBLOCK)),
 	      m_width(width),
 	      m_height(height),
-	      m_locked(false),
-	      m_pixels(nullptr),
+	      m_frames(FRAME_QUEUE_SIZE),
+	      m_free_frames(FRAME_QUEUE_SIZE),
+	      m_spare_frame(nullptr),
+	      m_lock_width(0),
+	      m_lock_height(0),
+	      m_present_pending(false),
 	      m_wnd(nullptr),
-	      m_surf(nullptr),
+	      m_renderer(nullptr),
+	      m_texture(nullptr),
+	      m_texture_width(0),
+	      m_texture_height(0),
 	      m_done(false),
 	      m_initialised(false),
 	      m_gui_thread(sdl_main_thread, this),
 	      m_shift(0),
 	      m_ctrl(0),
 	      m_alt(0),
-	      m_init_err(nullptr),
-	      m_epaper_emulation(epaper_emulation) {
+	      m_init_err(nullptr) {
 
 		// Wait for the GUI thread to initialise
 		std::unique_lock<std::mutex> lock(m_gui_mutex);
@@ -388,61 +564,87 @@ public:
 		m_done = true;
 		m_gui_thread.join();
 
+		// Free all frames, the GUI thread no longer accesses them
+		Frame *frame = nullptr;
+		while (m_frames.pop(frame)) {
+			delete frame;
+		}
+		while (m_free_frames.pop(frame)) {
+			delete frame;
+		}
+		delete m_spare_frame;
+
 		// Close the event fd
 		close(m_event_fd);
 	}
 
 	Rect lock() {
-		// Signal the main thread to lock the screen surface
-		SDL_Event event;
-		SDL_memset(&event, 0, sizeof(event));
-		event.type = m_sdl_lock_event;
-		SDL_PushEvent(&event);
-
-		// Wait for the GUI thread to acknowledge the lock
-		std::unique_lock<std::mutex> lock(m_gui_mutex);
-		m_gui_cond_var.wait(lock, [this] { return !!m_locked; });
-
-		if (!m_surf) {
-			return Rect();
-		}
-		return Rect(0, 0, m_width, m_height);
+		m_lock_width = m_width;
+		m_lock_height = m_height;
+		return Rect(0, 0, m_lock_width, m_lock_height);
 	}
 
 	void unlock(const CommitRequest *begin, const CommitRequest *end,
-	            const RGBA *buf, size_t stride) {
-		// Copy the given regions to the pixel buffer
-		if (!m_pixels) {
-			return;
+	            const RGBA *buf, size_t stride, const PanelShadow *shadow) {
+		// Fetch a frame that has already been presented, or allocate a new
+		// one if the GUI thread still holds all of them
+		Frame *frame = m_spare_frame;
+		m_spare_frame = nullptr;
+		if (!frame && !m_free_frames.pop(frame)) {
+			frame = new Frame();
 		}
-		if (!m_epaper_emulation) {
-			for (CommitRequest const *req = begin; req < end; req++) {
-				const Rect r = req->r;
-				const int w = r.width();
-				for (int y = r.y0; y < r.y1; y++) {
-					RGBA *tar = m_pixels + y * m_pitch / sizeof(RGBA) + r.x0;
-					const RGBA *src = buf + y * stride / sizeof(RGBA) + r.x0;
-					std::copy(src, src + w, tar);
-				}
+		frame->width = m_lock_width;
+		frame->height = m_lock_height;
+		frame->rects.clear();
+		frame->pixels.clear();
+
+		// Copy the committed regions into the frame
+		const Rect bounds(0, 0, m_lock_width, m_lock_height);
+		for (CommitRequest const *req = begin; req < end; req++) {
+			if (!bounds.overlaps(req->r)) {
+				continue;
 			}
-		} else {
-			for (CommitRequest const *req = begin; req < end; req++) {
-				const Rect r = req->r;
-				epaper_emulation::update(reinterpret_cast<uint8_t *>(m_pixels),
-				                         m_pitch, m_layout, buf, stride, r.x0,
-				                         r.y0, r.x1, r.y1, req->mode);
+			const Rect r = bounds.clip(req->r);
+			frame->rects.push_back(r);
+			size_t offs = frame->pixels.size();
+			frame->pixels.resize(offs + r.area());
+			for (int y = r.y0; y < r.y1; y++, offs += r.width()) {
+				RGBA *tar = &frame->pixels[offs];
+				if (!shadow) {
+					const RGBA *src = buf + y * stride / sizeof(RGBA);
+					std::copy(src + r.x0, src + r.x1, tar);
+				} else {
+					// In e-paper emulation mode the panel shadow already
+					// contains the emulated content, there is no need to
+					// read back the pixels
+					m_grey_row.resize(r.width());
+					shadow->unpack(m_grey_row.data(), y, r.x0, r.x1);
+					for (int x = 0; x < r.width(); x++) {
+						tar[x] =
+						    epaper_emulation::greyscale_to_rgba(m_grey_row[x]);
+					}
+				}
 			}
 		}
+		if (frame->rects.empty()) {
+			m_spare_frame = frame;
+			return;
+		}
 
-		// Signal the main thread to unlock the screen by sending a user event
-		SDL_Event event;
-		SDL_memset(&event, 0, sizeof(event));
-		event.type = m_sdl_unlock_event;
-		SDL_PushEvent(&event);
+		// Hand the frame over to the GUI thread. This only waits if the GUI
+		// thread is FRAME_QUEUE_SIZE frames behind.
+		while (!m_frames.push(frame)) {
+			std::this_thread::yield();
+		}
 
-		// Wait until the UI has been unlocked
-		std::unique_lock<std::mutex> lock(m_gui_mutex);
-		m_gui_cond_var.wait(lock, [this] { return !m_locked; });
+		// Ask the GUI thread to present the frames; frames committed before
+		// the GUI thread gets to it are presented together
+		if (!m_present_pending.exchange(true)) {
+			SDL_Event event;
+			SDL_memset(&event, 0, sizeof(event));
+			event.type = m_sdl_present_event;
+			SDL_PushEvent(&event);
+		}
 	}
 
 	int event_fd() const { return m_event_fd; }
@@ -452,16 +654,12 @@ public:
 	}
 
 	bool event_get(EventSource::PollMode mode, Event &event) {
-		std::lock_guard<std::mutex> lock(m_gui_mutex);
-
-		if (!m_event_queue.empty()) {
+		SDL_Event sdl_ev;
+		if (m_events.pop(sdl_ev)) {
 			// Decrement the m_event_fd counter by one by calling read()
 			uint64_t buf;
 			read(m_event_fd, &buf, 8);
 
-			// Fetch the last element from the queue and return
-			const SDL_Event sdl_ev = m_event_queue.front();
-			m_event_queue.pop();
 			switch (sdl_ev.type) {
 				case SDL_QUIT:
 					event.type = Event::Type::QUIT;
@@ -479,6 +677,10 @@ public:
 					event.type = Event::Type::TEXT_INPUT;
 					return sdl_handle_text_event(sdl_ev.text, event.data.text);
 				}
+				case SDL_WINDOWEVENT: {
+					event.type = Event::Type::RESIZE;
+					return sdl_ev.window.event == SDL_WINDOWEVENT_SIZE_CHANGED;
+				}
 			}
 			return true;
 		}
@@ -492,17 +694,22 @@ public:
 
 SDLBackend::SDLBackend(unsigned int width, unsigned int height,
                        bool epaper_emulation)
-    : m_impl(new Impl(width, height, epaper_emulation)) {}
+    : m_impl(new Impl(width, height)) {
+	// Let the display track the emulated panel content instead of reading it
+	// back from the pixel buffer
+	set_panel_shadow(epaper_emulation);
+}
 
 SDLBackend::~SDLBackend() {
-	// Do nothing here, implicitly destroy the implementation
+	// Wait for the last frame, then implicitly destroy the implementation
+	flush();
 }
 
 Rect SDLBackend::do_lock() { return m_impl->lock(); }
 
 void SDLBackend::do_unlock(const CommitRequest *begin, const CommitRequest *end,
                            const RGBA *buf, size_t stride) {
-	m_impl->unlock(begin, end, buf, stride);
+	m_impl->unlock(begin, end, buf, stride, panel_shadow());
 }
 
 int SDLBackend::event_fd() const { return m_impl->event_fd(); }
@@ -63,7 +63,19 @@ public:
  * Class General                                                              *
  ******************************************************************************/
 
-General::General() : orientation(0), sdl_epaper_emulation(true) {}
+General::General()
+    : orientation(0),
+      rotate_display(false),
+      sdl_epaper_emulation(true),
+      headless_width(800),
+      headless_height(600),
+      headless_epaper_emulation(false),
+      display_threads(0),
+      double_buffer(false),
+      async_log(false),
+      render_thread(false),
+      replay_realtime(true),
+      sessions(1) {}
 
 /******************************************************************************
  * Class Colors                                                               *
@@ -73,13 +85,78 @@ Colors::Colors()
     : use_bright_on_bold(false),
       default_bg(RGBA::Black),
       default_fg(RGBA(170, 170, 170)),
-      palette(Palette::Default256Colours) {
+      palette(Palette::Default256Colours),
+      dither(dither::Pattern::Ordered4x4) {
 	// Load the nicer default 16 colours into the palette
 	for (size_t i = 0; i < 16; i++) {
 		palette[i] = Palette::Default16Colours[i];
 	}
 }
 
+/******************************************************************************
+ * Class EPaper                                                               *
+ ******************************************************************************/
+
+EPaper::EPaper()
+    : full(Waveform::Mode::GC16, true, false),
+      source_mono(Waveform::Mode::A2, false, true),
+      target_mono(Waveform::Mode::GL16, false, false),
+      source_and_target_mono(Waveform::Mode::A2, false, true),
+      partial(Waveform::Mode::GC16, false, false),
+      max_updates_in_flight(4),
+      update_cost(16384),
+      max_update_rects(16) {}
+
+/******************************************************************************
+ * Class Scheduler                                                            *
+ ******************************************************************************/
+
+Scheduler::Scheduler()
+    : frame_interval(32),
+      max_latency(250),
+      burst_gap(10),
+      echo_window(100),
+      jump_rate(32 * 1024),
+      jump_interval(500) {}
+
+/******************************************************************************
+ * Class Refresh                                                              *
+ ******************************************************************************/
+
+Refresh::Refresh()
+    : region_rows(4),
+      region_cols(16),
+      redraw_timeout(3000),
+      ghosting_budget(64),
+      budget_timeout(500),
+      stale_frames(2000),
+      max_concurrent(2),
+      refresh_duration(500) {}
+
+/******************************************************************************
+ * Class Scrollback                                                           *
+ ******************************************************************************/
+
+Scrollback::Scrollback() : memory(4096) {}
+
+/******************************************************************************
+ * Class Memory                                                               *
+ ******************************************************************************/
+
+Memory::Memory() : budget(0), monitor_pressure(true) {}
+
+/******************************************************************************
+ * Class Font                                                                 *
+ ******************************************************************************/
+
+Font::Font() : file("DejaVuSansMono.ttf"), dpi(96), threads(0) {}
+
+/******************************************************************************
+ * Class Remote                                                               *
+ ******************************************************************************/
+
+Remote::Remote() : address("127.0.0.1"), port(0) {}
+
 }  // namespace config
 
 /******************************************************************************
@@ -108,6 +185,21 @@ Configuration::Configuration(int argc, const char *argv[]) {
 		    return true;
 	    },
 	    Argparse::Required::NOT_REQUIRED);
+	argparse.add_arg(
+	    "record", "Records the session to the given file.", nullptr,
+	    [this](const char *value) -> bool {
+		    this->general.record_file = value;
+		    return true;
+	    },
+	    Argparse::Required::NOT_REQUIRED);
+	argparse.add_arg(
+	    "replay", "Replays a recorded session instead of starting a shell.",
+	    nullptr,
+	    [this](const char *value) -> bool {
+		    this->general.replay_file = value;
+		    return true;
+	    },
+	    Argparse::Required::NOT_REQUIRED);
 	argparse.parse(argc, argv);
 }
 
@@ -25,7 +25,9 @@
 #define INKTTY_CONFIG_CONFIGURATION_HPP
 
 #include <string>
+#include <vector>
 
+#include <inktty/gfx/dither.hpp>
 #include <inktty/utils/color.hpp>
 
 namespace inktty {
@@ -37,7 +39,7 @@ namespace config {
  */
 struct General {
 	/**
-	 * Backend to use, may be one of "sdl" or "fbdev".
+	 * Backend to use, may be one of "sdl", "fbdev" or "headless".
 	 */
 	std::string backend;
 
@@ -46,8 +48,90 @@ struct General {
 	 */
 	int orientation;
 
+	/**
+	 * If true, the orientation is applied by the display when passing the
+	 * composite image to the backend instead of rotating each glyph. Glyphs
+	 * are then always rendered and cached in orientation zero.
+	 */
+	bool rotate_display;
+
 	bool sdl_epaper_emulation;
 
+	/**
+	 * Size of the display used by the headless backend in pixels.
+	 */
+	int headless_width, headless_height;
+
+	/**
+	 * If true, the headless backend shows the content as an e-paper display
+	 * would.
+	 */
+	bool headless_epaper_emulation;
+
+	/**
+	 * If non-empty, the headless backend writes each frame to a PNG file
+	 * starting with this prefix.
+	 */
+	std::string headless_png;
+
+	/**
+	 * Number of threads used to compose the committed regions and to convert
+	 * them to the display format. Values smaller than two disable the worker
+	 * threads.
+	 */
+	int display_threads;
+
+	/**
+	 * If true, the display copies each frame into a front buffer that is
+	 * passed to the backend on a separate thread, such that the next frame
+	 * can be drawn while the previous one is being presented.
+	 */
+	bool double_buffer;
+
+	/**
+	 * If non-empty, a Chrome trace of the processing stages and of the
+	 * latency between key presses and the display updates showing them is
+	 * written to this file.
+	 */
+	std::string trace_file;
+
+	/**
+	 * If true, log messages are written to the console by a background
+	 * thread, such that logging never waits for a slow console.
+	 */
+	bool async_log;
+
+	/**
+	 * If true, frames are drawn on a background thread while the output of
+	 * the child process is parsed on the main thread.
+	 */
+	bool render_thread;
+
+	/**
+	 * If non-empty, the output of the child process and the keyboard input
+	 * are recorded to this session log.
+	 */
+	std::string record_file;
+
+	/**
+	 * If non-empty, the given session log is replayed instead of starting a
+	 * shell.
+	 */
+	std::string replay_file;
+
+	/**
+	 * If true, the session log is replayed at the recorded times, otherwise
+	 * as fast as possible.
+	 */
+	bool replay_realtime;
+
+	/**
+	 * Number of terminal sessions started, each running its own shell. Only
+	 * the active session is drawn; Ctrl+PageUp and Ctrl+PageDown switch
+	 * between the sessions.
+	 */
+	int sessions;
+
 	/**
 	 * Default constructor, sets all values to defaults.
 	 */
@@ -84,12 +168,299 @@ struct Colors {
 	 */
 	Palette palette;
 
+	/**
+	 * Pattern used to represent background colours in low quality mode. May be
+	 * one of "ordered4x4" (default), "bayer8x8" or "blue_noise" in the
+	 * configuration file.
+	 */
+	dither::Pattern dither;
+
 	/**
 	 * Default constructor, initializes all values to default values.
 	 */
 	Colors();
 };
 
+/**
+ * Describes how a class of display updates is translated into an update of an
+ * e-paper display controller.
+ */
+struct Waveform {
+	/**
+	 * Waveform modes supported by e-paper display controllers. See the
+	 * mxcfb.h header for a description of the individual modes.
+	 */
+	enum class Mode { Auto, Init, DU, GC16, GC16Fast, A2, GL16, GL16Fast };
+
+	/**
+	 * Waveform mode that should be used.
+	 */
+	Mode mode;
+
+	/**
+	 * If true, all pixels in the update region are driven, otherwise only the
+	 * pixels that changed. Full updates cause the region to flash.
+	 */
+	bool full;
+
+	/**
+	 * If true, the display controller quantises the content to black and
+	 * white before the update.
+	 */
+	bool force_mono;
+
+	/**
+	 * Creates a new waveform descriptor.
+	 */
+	Waveform(Mode mode = Mode::Auto, bool full = false,
+	         bool force_mono = false)
+	    : mode(mode), full(full), force_mono(force_mono) {}
+};
+
+/**
+ * Configuration options for e-paper displays. The waveform table maps the mask
+ * operation of an UpdateMode onto a waveform, see the UpdateMode class for a
+ * description of the individual mask operations.
+ */
+struct EPaper {
+	/**
+	 * Waveforms used for the individual mask operations.
+	 */
+	Waveform full, source_mono, target_mono, source_and_target_mono, partial;
+
+	/**
+	 * Maximum number of updates that may be in flight at the same time.
+	 */
+	int max_updates_in_flight;
+
+	/**
+	 * Fixed overhead of a single display update in pixels. Regions are merged
+	 * into a single update if this sends fewer pixels than the overhead of the
+	 * additional updates.
+	 */
+	int update_cost;
+
+	/**
+	 * Maximum number of updates sent to the display per frame. Zero disables
+	 * the limit.
+	 */
+	int max_update_rects;
+
+	/**
+	 * Default constructor, initialises the waveform table with defaults that
+	 * use fast A2 updates for monochrome content and non-flashing GC16 updates
+	 * for high quality content.
+	 */
+	EPaper();
+};
+
+/**
+ * Configuration options for the frame scheduler, which decides when the
+ * terminal content is drawn to the screen. All times are in milliseconds.
+ */
+struct Scheduler {
+	/**
+	 * Minimum time between two frames.
+	 */
+	int frame_interval;
+
+	/**
+	 * Maximum time output received from the child process may wait before
+	 * being drawn. While the child keeps writing, drawing is deferred up to
+	 * this bound.
+	 */
+	int max_latency;
+
+	/**
+	 * Time without output from the child process after which a burst of
+	 * output is considered to be complete and is drawn.
+	 */
+	int burst_gap;
+
+	/**
+	 * Output received within this time after a key press is treated as the
+	 * echo of the key press and drawn immediately.
+	 */
+	int echo_window;
+
+	/**
+	 * Output rate of the child process in bytes per second above which jump
+	 * scrolling is enabled. Zero disables jump scrolling.
+	 */
+	int jump_rate;
+
+	/**
+	 * Minimum time between two frames while jump scrolling. Intermediate
+	 * states of the screen are not drawn.
+	 */
+	int jump_interval;
+
+	/**
+	 * Default constructor, sets all values to defaults.
+	 */
+	Scheduler();
+};
+
+/**
+ * Configuration options for the refresh scheduler, which decides when regions
+ * of the screen drawn in the fast monochrome mode are redrawn in high quality
+ * to remove ghosting. All times are in milliseconds.
+ */
+struct Refresh {
+	/**
+	 * Size of the regions the screen is divided into, in cells. Ghosting is
+	 * accounted for and removed per region.
+	 */
+	int region_rows, region_cols;
+
+	/**
+	 * Time without monochrome updates after which a region containing
+	 * monochrome content is redrawn in high quality.
+	 */
+	int redraw_timeout;
+
+	/**
+	 * Number of monochrome updates a region may receive before it is redrawn
+	 * in high quality as soon as it has been idle for "budget_timeout".
+	 */
+	int ghosting_budget;
+
+	/**
+	 * Time without monochrome updates after which a region that exceeded its
+	 * ghosting budget is redrawn in high quality.
+	 */
+	int budget_timeout;
+
+	/**
+	 * Number of frames after which a region is redrawn in high quality even
+	 * if it did not change. Zero disables these refreshes.
+	 */
+	int stale_frames;
+
+	/**
+	 * Maximum number of regions that may be refreshed in high quality at the
+	 * same time, such that the refreshes do not delay the monochrome updates
+	 * showing the user's input.
+	 */
+	int max_concurrent;
+
+	/**
+	 * Time a high quality refresh is assumed to occupy the display.
+	 */
+	int refresh_duration;
+
+	/**
+	 * Default constructor, sets all values to defaults.
+	 */
+	Refresh();
+};
+
+/**
+ * Configuration options for the scrollback history.
+ */
+struct Scrollback {
+	/**
+	 * Maximum memory in kilobytes used for storing rows that scrolled off the
+	 * screen. Set to zero to disable the scrollback history.
+	 */
+	int memory;
+
+	/**
+	 * Default constructor, sets all values to defaults.
+	 */
+	Scrollback();
+};
+
+/**
+ * Configuration options for the memory accounting.
+ */
+struct Memory {
+	/**
+	 * Memory budget in kilobytes for the display buffers, cell arrays,
+	 * scrollback history, glyph caches and terminal state. If the accounted
+	 * memory exceeds the budget, the caches are flushed. Set to zero to
+	 * disable the budget.
+	 */
+	int budget;
+
+	/**
+	 * If true, the caches are flushed as well whenever the kernel reports
+	 * memory pressure (Linux 5.2 and later).
+	 */
+	bool monitor_pressure;
+
+	/**
+	 * Default constructor, sets all values to defaults.
+	 */
+	Memory();
+};
+
+/**
+ * Font used by the TrueType renderer.
+ */
+struct Font {
+	/**
+	 * Font file to load.
+	 */
+	std::string file;
+
+	/**
+	 * Font files used for bold, italic, and bold italic text. Empty strings
+	 * fall back to the less specific faces, i.e. bold italic text is drawn
+	 * using the bold, then the italic, then the regular face.
+	 */
+	std::string bold, italic, bold_italic;
+
+	/**
+	 * Font files consulted in this order for glyphs that are missing in the
+	 * regular face.
+	 */
+	std::vector<std::string> fallback;
+
+	/**
+	 * Screen resolution used to convert font sizes to pixels.
+	 */
+	int dpi;
+
+	/**
+	 * File used to persist rendered glyphs across restarts. An empty string
+	 * disables the on-disk glyph cache.
+	 */
+	std::string glyph_cache;
+
+	/**
+	 * Number of worker threads used to rasterise glyphs in the background.
+	 * Zero disables the worker threads.
+	 */
+	int threads;
+
+	/**
+	 * Default constructor, sets all values to defaults.
+	 */
+	Font();
+};
+
+/**
+ * Remote framebuffer viewer options.
+ */
+struct Remote {
+	/**
+	 * Address the remote framebuffer server listens on.
+	 */
+	std::string address;
+
+	/**
+	 * TCP port the remote framebuffer server listens on. Zero disables the
+	 * server.
+	 */
+	int port;
+
+	/**
+	 * Default constructor, sets all values to defaults.
+	 */
+	Remote();
+};
+
 }  // namespace config
 
 /**
@@ -108,6 +479,41 @@ struct Configuration {
 	 */
 	config::Colors colors;
 
+	/**
+	 * E-paper display configuration options.
+	 */
+	config::EPaper epaper;
+
+	/**
+	 * Frame scheduler configuration options.
+	 */
+	config::Scheduler scheduler;
+
+	/**
+	 * Refresh scheduler configuration options.
+	 */
+	config::Refresh refresh;
+
+	/**
+	 * Scrollback history configuration options.
+	 */
+	config::Scrollback scrollback;
+
+	/**
+	 * Memory accounting configuration options.
+	 */
+	config::Memory memory;
+
+	/**
+	 * Font configuration options.
+	 */
+	config::Font font;
+
+	/**
+	 * Remote framebuffer configuration options.
+	 */
+	config::Remote remote;
+
 	/**
 	 * Initialises the configuration to default values and does nothing.
 	 */
@@ -23,6 +23,7 @@
 #include <cpptoml.h>
 
 #include <inktty/config/toml.hpp>
+#include <inktty/utils/logger.hpp>
 
 namespace inktty {
 namespace config {
@@ -35,6 +36,26 @@ static void get(const char *key, std::shared_ptr<cpptoml::table> tbl, S &tar) {
 	}
 }
 
+static dither::Pattern parse_dither_pattern(const std::string &name,
+                                            dither::Pattern def) {
+	static const struct {
+		const char *name;
+		dither::Pattern pattern;
+	} PATTERNS[] = {
+	    {"ordered4x4", dither::Pattern::Ordered4x4},
+	    {"bayer8x8", dither::Pattern::Bayer8x8},
+	    {"blue_noise", dither::Pattern::BlueNoise16x16},
+	};
+	for (const auto &p : PATTERNS) {
+		if (name == p.name) {
+			return p.pattern;
+		}
+	}
+	global_logger().warn() << "Unknown dithering pattern \"" << name
+	                       << "\", using default";
+	return def;
+}
+
 static Colors parse_colors(std::shared_ptr<cpptoml::table> tbl) {
 	Colors res;
 	get<bool>("use_bright_on_bold", tbl, res.use_bright_on_bold);
@@ -48,6 +69,10 @@ static Colors parse_colors(std::shared_ptr<cpptoml::table> tbl) {
 			}
 		}
 	}
+	auto dither = tbl->get_as<std::string>("dither");
+	if (dither) {
+		res.dither = parse_dither_pattern(*dither, res.dither);
+	}
 	return res;
 }
 
@@ -55,6 +80,135 @@ static General parse_general(std::shared_ptr<cpptoml::table> tbl) {
 	General res;
 	get<std::string>("backend", tbl, res.backend);
 	get<int>("orientation", tbl, res.orientation);
+	get<bool>("rotate_display", tbl, res.rotate_display);
+	get<int>("headless_width", tbl, res.headless_width);
+	get<int>("headless_height", tbl, res.headless_height);
+	get<bool>("headless_epaper_emulation", tbl, res.headless_epaper_emulation);
+	get<std::string>("headless_png", tbl, res.headless_png);
+	get<int>("display_threads", tbl, res.display_threads);
+	get<bool>("double_buffer", tbl, res.double_buffer);
+	get<std::string>("trace_file", tbl, res.trace_file);
+	get<bool>("async_log", tbl, res.async_log);
+	get<bool>("render_thread", tbl, res.render_thread);
+	get<std::string>("record_file", tbl, res.record_file);
+	get<std::string>("replay_file", tbl, res.replay_file);
+	get<bool>("replay_realtime", tbl, res.replay_realtime);
+	get<int>("sessions", tbl, res.sessions);
+	return res;
+}
+
+static Waveform::Mode parse_waveform_mode(const std::string &name,
+                                          Waveform::Mode def) {
+	static const struct {
+		const char *name;
+		Waveform::Mode mode;
+	} MODES[] = {
+	    {"auto", Waveform::Mode::Auto},
+	    {"init", Waveform::Mode::Init},
+	    {"du", Waveform::Mode::DU},
+	    {"gc16", Waveform::Mode::GC16},
+	    {"gc16_fast", Waveform::Mode::GC16Fast},
+	    {"a2", Waveform::Mode::A2},
+	    {"gl16", Waveform::Mode::GL16},
+	    {"gl16_fast", Waveform::Mode::GL16Fast},
+	};
+	for (const auto &m : MODES) {
+		if (name == m.name) {
+			return m.mode;
+		}
+	}
+	global_logger().warn() << "Unknown waveform mode \"" << name
+	                       << "\", using default";
+	return def;
+}
+
+static void parse_waveform(const char *key, std::shared_ptr<cpptoml::table> tbl,
+                           Waveform &tar) {
+	if (!tbl->contains(key)) {
+		return;
+	}
+	auto wtbl = tbl->get_table(key);
+	if (!wtbl) {
+		return;
+	}
+	auto mode = wtbl->get_as<std::string>("waveform");
+	if (mode) {
+		tar.mode = parse_waveform_mode(*mode, tar.mode);
+	}
+	get<bool>("full", wtbl, tar.full);
+	get<bool>("force_mono", wtbl, tar.force_mono);
+}
+
+static EPaper parse_epaper(std::shared_ptr<cpptoml::table> tbl) {
+	EPaper res;
+	get<int>("max_updates_in_flight", tbl, res.max_updates_in_flight);
+	get<int>("update_cost", tbl, res.update_cost);
+	get<int>("max_update_rects", tbl, res.max_update_rects);
+	parse_waveform("full", tbl, res.full);
+	parse_waveform("source_mono", tbl, res.source_mono);
+	parse_waveform("target_mono", tbl, res.target_mono);
+	parse_waveform("source_and_target_mono", tbl, res.source_and_target_mono);
+	parse_waveform("partial", tbl, res.partial);
+	return res;
+}
+
+static Scheduler parse_scheduler(std::shared_ptr<cpptoml::table> tbl) {
+	Scheduler res;
+	get<int>("frame_interval", tbl, res.frame_interval);
+	get<int>("max_latency", tbl, res.max_latency);
+	get<int>("burst_gap", tbl, res.burst_gap);
+	get<int>("echo_window", tbl, res.echo_window);
+	get<int>("jump_rate", tbl, res.jump_rate);
+	get<int>("jump_interval", tbl, res.jump_interval);
+	return res;
+}
+
+static Refresh parse_refresh(std::shared_ptr<cpptoml::table> tbl) {
+	Refresh res;
+	get<int>("region_rows", tbl, res.region_rows);
+	get<int>("region_cols", tbl, res.region_cols);
+	get<int>("redraw_timeout", tbl, res.redraw_timeout);
+	get<int>("ghosting_budget", tbl, res.ghosting_budget);
+	get<int>("budget_timeout", tbl, res.budget_timeout);
+	get<int>("stale_frames", tbl, res.stale_frames);
+	get<int>("max_concurrent", tbl, res.max_concurrent);
+	get<int>("refresh_duration", tbl, res.refresh_duration);
+	return res;
+}
+
+static Scrollback parse_scrollback(std::shared_ptr<cpptoml::table> tbl) {
+	Scrollback res;
+	get<int>("memory", tbl, res.memory);
+	return res;
+}
+
+static Memory parse_memory(std::shared_ptr<cpptoml::table> tbl) {
+	Memory res;
+	get<int>("budget", tbl, res.budget);
+	get<bool>("monitor_pressure", tbl, res.monitor_pressure);
+	return res;
+}
+
+static Font parse_font(std::shared_ptr<cpptoml::table> tbl) {
+	Font res;
+	get<std::string>("file", tbl, res.file);
+	get<std::string>("bold", tbl, res.bold);
+	get<std::string>("italic", tbl, res.italic);
+	get<std::string>("bold_italic", tbl, res.bold_italic);
+	auto fallback = tbl->get_array_of<std::string>("fallback");
+	if (fallback) {
+		res.fallback = *fallback;
+	}
+	get<int>("dpi", tbl, res.dpi);
+	get<std::string>("glyph_cache", tbl, res.glyph_cache);
+	get<int>("threads", tbl, res.threads);
+	return res;
+}
+
+static Remote parse_remote(std::shared_ptr<cpptoml::table> tbl) {
+	Remote res;
+	get<std::string>("address", tbl, res.address);
+	get<int>("port", tbl, res.port);
 	return res;
 }
 
@@ -70,6 +224,27 @@ Configuration from_toml(std::istream &is) {
 	if (config->contains("general")) {
 		res.general = parse_general(config->get_table("general"));
 	}
+	if (config->contains("epaper")) {
+		res.epaper = parse_epaper(config->get_table("epaper"));
+	}
+	if (config->contains("scheduler")) {
+		res.scheduler = parse_scheduler(config->get_table("scheduler"));
+	}
+	if (config->contains("refresh")) {
+		res.refresh = parse_refresh(config->get_table("refresh"));
+	}
+	if (config->contains("scrollback")) {
+		res.scrollback = parse_scrollback(config->get_table("scrollback"));
+	}
+	if (config->contains("memory")) {
+		res.memory = parse_memory(config->get_table("memory"));
+	}
+	if (config->contains("font")) {
+		res.font = parse_font(config->get_table("font"));
+	}
+	if (config->contains("remote")) {
+		res.remote = parse_remote(config->get_table("remote"));
+	}
 
 	return res;
 }
@@ -0,0 +1,369 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(HAS_NEON)
+#include <arm_neon.h>
+#elif defined(HAS_SSE2)
+#include <emmintrin.h>
+#endif
+
+#include <inktty/gfx/compose.hpp>
+
+namespace inktty {
+namespace compose {
+
+/**
+ * Computes x * a / 255 rounded to the nearest integer for x, a in [0, 255].
+ * This is exact and does not require a division.
+ */
+static inline uint16_t mul_div255(uint16_t x, uint16_t a) {
+	const uint16_t t = x * a + 128U;
+	return (t + (t >> 8U)) >> 8U;
+}
+
+static inline uint8_t add_sat(uint16_t a, uint16_t b) {
+	const uint16_t s = a + b;
+	return (s > 255U) ? 255U : s;
+}
+
+void over_scalar(RGBA *tar, const RGBA *bg, const RGBA *mg, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		// Blend the background with the middle-ground, assume the background
+		// is fully opaque and the middle-ground is premultiplied.
+		const uint16_t ia = 255U - mg[i].a;
+		tar[i] = RGBA(add_sat(mul_div255(bg[i].r, ia), mg[i].r),
+		              add_sat(mul_div255(bg[i].g, ia), mg[i].g),
+		              add_sat(mul_div255(bg[i].b, ia), mg[i].b));
+	}
+}
+
+void mask_scalar(RGBA *tar, const uint8_t *mask, const RGBA &c, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		const uint16_t a = mask[i];
+		if (a > 0) {
+			tar[i] = RGBA(mul_div255(c.r, a), mul_div255(c.g, a),
+			              mul_div255(c.b, a), a);
+		}
+	}
+}
+
+static void mask_binary_scalar(RGBA *tar, const uint8_t *mask, const RGBA &c,
+                               size_t n) {
+	const RGBA f(c.r, c.g, c.b, 255U);
+	for (size_t i = 0; i < n; i++) {
+		if (mask[i]) {
+			tar[i] = f;
+		}
+	}
+}
+
+static void mask_erase_scalar(RGBA *tar, const uint8_t *mask, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		if (mask[i]) {
+			tar[i] = RGBA(0, 0, 0, 0);
+		}
+	}
+}
+
+#if defined(HAS_NEON)
+void over(RGBA *tar, const RGBA *bg, const RGBA *mg, size_t n) {
+	// Process eight pixels at a time. vld4 splits them into the b, g, r, a
+	// planes, making the alpha channel directly available.
+	const uint16x8_t c128 = vdupq_n_u16(128U);
+	const uint8x8_t c255 = vdup_n_u8(255U);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const uint8x8x4_t vbg = vld4_u8((const uint8_t *)(bg + i));
+		const uint8x8x4_t vmg = vld4_u8((const uint8_t *)(mg + i));
+		const uint8x8_t ia = vsub_u8(c255, vmg.val[3]);
+		uint8x8x4_t res;
+		for (int c = 0; c < 3; c++) {
+			const uint16x8_t t = vaddq_u16(vmull_u8(vbg.val[c], ia), c128);
+			const uint8x8_t v = vaddhn_u16(t, vshrq_n_u16(t, 8));
+			res.val[c] = vqadd_u8(v, vmg.val[c]);
+		}
+		res.val[3] = c255;
+		vst4_u8((uint8_t *)(tar + i), res);
+	}
+	over_scalar(tar + i, bg + i, mg + i, n - i);
+}
+
+void mask(RGBA *tar, const uint8_t *mask, const RGBA &c, size_t n,
+          bool binary) {
+	const uint8_t cc[4] = {c.b, c.g, c.r, 255U};
+	const uint16x8_t c128 = vdupq_n_u16(128U);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const uint8x8_t m = vld1_u8(mask + i);
+		const uint8x8_t sel = vtst_u8(m, m);
+		uint8x8x4_t res = vld4_u8((const uint8_t *)(tar + i));
+		for (int k = 0; k < 4; k++) {
+			uint8x8_t v;
+			if (binary) {
+				v = vdup_n_u8(cc[k]);
+			} else {
+				const uint16x8_t t =
+				    vaddq_u16(vmull_u8(vdup_n_u8(cc[k]), m), c128);
+				v = vaddhn_u16(t, vshrq_n_u16(t, 8));
+			}
+			res.val[k] = vbsl_u8(sel, v, res.val[k]);
+		}
+		vst4_u8((uint8_t *)(tar + i), res);
+	}
+	if (binary) {
+		mask_binary_scalar(tar + i, mask + i, c, n - i);
+	} else {
+		mask_scalar(tar + i, mask + i, c, n - i);
+	}
+}
+
+void mask_erase(RGBA *tar, const uint8_t *mask, size_t n) {
+	const uint8x8_t zero = vdup_n_u8(0U);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const uint8x8_t m = vld1_u8(mask + i);
+		const uint8x8_t sel = vtst_u8(m, m);
+		uint8x8x4_t res = vld4_u8((const uint8_t *)(tar + i));
+		for (int k = 0; k < 4; k++) {
+			res.val[k] = vbsl_u8(sel, zero, res.val[k]);
+		}
+		vst4_u8((uint8_t *)(tar + i), res);
+	}
+	mask_erase_scalar(tar + i, mask + i, n - i);
+}
+#elif defined(HAS_SSE2)
+void over(RGBA *tar, const RGBA *bg, const RGBA *mg, size_t n) {
+	// Process four pixels at a time, two pixels per 16-bit vector half
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i c128 = _mm_set1_epi16(128);
+	const __m128i c255 = _mm_set1_epi16(255);
+	const __m128i alpha = _mm_set1_epi32(int(0xFF000000U));
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const __m128i vbg = _mm_loadu_si128((const __m128i *)(bg + i));
+		const __m128i vmg = _mm_loadu_si128((const __m128i *)(mg + i));
+		__m128i half[2];
+		for (int h = 0; h < 2; h++) {
+			const __m128i b16 = h ? _mm_unpackhi_epi8(vbg, zero)
+			                      : _mm_unpacklo_epi8(vbg, zero);
+			const __m128i m16 = h ? _mm_unpackhi_epi8(vmg, zero)
+			                      : _mm_unpacklo_epi8(vmg, zero);
+
+			// Broadcast the alpha channel to all components and invert it
+			__m128i a16 = _mm_shufflelo_epi16(m16, _MM_SHUFFLE(3, 3, 3, 3));
+			a16 = _mm_shufflehi_epi16(a16, _MM_SHUFFLE(3, 3, 3, 3));
+			const __m128i ia = _mm_sub_epi16(c255, a16);
+
+			// Exact division by 255
+			const __m128i t = _mm_add_epi16(_mm_mullo_epi16(b16, ia), c128);
+			half[h] = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+		}
+		__m128i res = _mm_packus_epi16(half[0], half[1]);
+		res = _mm_or_si128(_mm_adds_epu8(res, vmg), alpha);
+		_mm_storeu_si128((__m128i *)(tar + i), res);
+	}
+	over_scalar(tar + i, bg + i, mg + i, n - i);
+}
+
+/**
+ * Loads four mask values and returns a vector with one lane per pixel that
+ * is all ones where the mask is zero.
+ */
+static inline __m128i mask_zero_4(const uint8_t *mask, __m128i &m16lo,
+                                  __m128i &m16hi) {
+	uint32_t m4;
+	memcpy(&m4, mask, sizeof(m4));
+	const __m128i m = _mm_cvtsi32_si128(int(m4));
+	const __m128i m8 = _mm_unpacklo_epi8(m, m);     // a0 a0 a1 a1 ...
+	const __m128i m32 = _mm_unpacklo_epi16(m8, m8);  // a0 a0 a0 a0 a1 ...
+	const __m128i zero = _mm_setzero_si128();
+	m16lo = _mm_unpacklo_epi8(m32, zero);
+	m16hi = _mm_unpackhi_epi8(m32, zero);
+	return _mm_cmpeq_epi32(m32, zero);
+}
+
+void mask(RGBA *tar, const uint8_t *mask, const RGBA &c, size_t n,
+          bool binary) {
+	const __m128i c32 = _mm_set1_epi32(int(
+	    0xFF000000U | (uint32_t(c.r) << 16) | (uint32_t(c.g) << 8) | c.b));
+	const __m128i c16 = _mm_unpacklo_epi8(c32, _mm_setzero_si128());
+	const __m128i c128 = _mm_set1_epi16(128);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i m16lo, m16hi;
+		const __m128i z = mask_zero_4(mask + i, m16lo, m16hi);
+		const __m128i t = _mm_loadu_si128((const __m128i *)(tar + i));
+		__m128i v;
+		if (binary) {
+			v = c32;
+		} else {
+			// Exact premultiplication with the mask value
+			__m128i tlo = _mm_add_epi16(_mm_mullo_epi16(c16, m16lo), c128);
+			__m128i thi = _mm_add_epi16(_mm_mullo_epi16(c16, m16hi), c128);
+			tlo = _mm_srli_epi16(_mm_add_epi16(tlo, _mm_srli_epi16(tlo, 8)), 8);
+			thi = _mm_srli_epi16(_mm_add_epi16(thi, _mm_srli_epi16(thi, 8)), 8);
+			v = _mm_packus_epi16(tlo, thi);
+		}
+		const __m128i res =
+		    _mm_or_si128(_mm_and_si128(z, t), _mm_andnot_si128(z, v));
+		_mm_storeu_si128((__m128i *)(tar + i), res);
+	}
+	if (binary) {
+		mask_binary_scalar(tar + i, mask + i, c, n - i);
+	} else {
+		mask_scalar(tar + i, mask + i, c, n - i);
+	}
+}
+
+void mask_erase(RGBA *tar, const uint8_t *mask, size_t n) {
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i m16lo, m16hi;
+		const __m128i z = mask_zero_4(mask + i, m16lo, m16hi);
+		const __m128i t = _mm_loadu_si128((const __m128i *)(tar + i));
+		_mm_storeu_si128((__m128i *)(tar + i), _mm_and_si128(z, t));
+	}
+	mask_erase_scalar(tar + i, mask + i, n - i);
+}
+#else
+void over(RGBA *tar, const RGBA *bg, const RGBA *mg, size_t n) {
+	over_scalar(tar, bg, mg, n);
+}
+
+void mask(RGBA *tar, const uint8_t *mask, const RGBA &c, size_t n,
+          bool binary) {
+	if (binary) {
+		mask_binary_scalar(tar, mask, c, n);
+	} else {
+		mask_scalar(tar, mask, c, n);
+	}
+}
+
+void mask_erase(RGBA *tar, const uint8_t *mask, size_t n) {
+	mask_erase_scalar(tar, mask, n);
+}
+#endif
+
+void over(uint8_t *tar, const uint8_t *bg, const GreyA *mg, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		tar[i] = add_sat(mul_div255(bg[i], 255U - mg[i].a), mg[i].v);
+	}
+}
+
+void mask(GreyA *tar, const uint8_t *mask, uint8_t v, size_t n, bool binary) {
+	for (size_t i = 0; i < n; i++) {
+		const uint16_t a = mask[i];
+		if (a > 0) {
+			tar[i] = binary ? GreyA(v, 255U) : GreyA(mul_div255(v, a), a);
+		}
+	}
+}
+
+void mask(uint8_t *tar, const uint8_t *mask, uint8_t v, size_t n, bool binary) {
+	for (size_t i = 0; i < n; i++) {
+		const uint16_t a = mask[i];
+		if (a > 0) {
+			tar[i] = binary ? v : mul_div255(v, a);
+		}
+	}
+}
+
+void mask_erase(GreyA *tar, const uint8_t *mask, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		if (mask[i]) {
+			tar[i] = GreyA(0U, 0U);
+		}
+	}
+}
+
+void mask_erase(uint8_t *tar, const uint8_t *mask, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		if (mask[i]) {
+			tar[i] = 0U;
+		}
+	}
+}
+
+/**
+ * Edge length of the blocks processed by rotate(). A block of 32 x 32 RGBA
+ * pixels in both the source and the target image fits into the L1 cache.
+ */
+static constexpr size_t ROTATE_BLOCK = 32;
+
+template <typename T>
+static void rotate_impl(T *tar, size_t tar_stride, const T *src,
+                        size_t src_stride, size_t w, size_t h,
+                        unsigned int rotation) {
+	const uint8_t *s = (const uint8_t *)src;
+	uint8_t *t = (uint8_t *)tar;
+	switch (rotation % 4U) {
+		case 0U:
+			for (size_t y = 0; y < h; y++) {
+				memcpy(t + y * tar_stride, s + y * src_stride, w * sizeof(T));
+			}
+			break;
+		case 2U:
+			for (size_t y = 0; y < h; y++) {
+				const T *ps = (const T *)(s + y * src_stride);
+				T *pt = (T *)(t + (h - 1 - y) * tar_stride);
+				for (size_t x = 0; x < w; x++) {
+					pt[w - 1 - x] = ps[x];
+				}
+			}
+			break;
+		case 1U:
+		case 3U: {
+			const bool ccw = (rotation % 4U) == 1U;
+			for (size_t by = 0; by < h; by += ROTATE_BLOCK) {
+				const size_t by1 = std::min(h, by + ROTATE_BLOCK);
+				for (size_t bx = 0; bx < w; bx += ROTATE_BLOCK) {
+					const size_t bx1 = std::min(w, bx + ROTATE_BLOCK);
+					for (size_t y = by; y < by1; y++) {
+						const T *ps = (const T *)(s + y * src_stride);
+						for (size_t x = bx; x < bx1; x++) {
+							if (ccw) {
+								((T *)(t + (w - 1 - x) * tar_stride))[y] = ps[x];
+							} else {
+								((T *)(t + x * tar_stride))[h - 1 - y] = ps[x];
+							}
+						}
+					}
+				}
+			}
+			break;
+		}
+	}
+}
+
+void rotate(RGBA *tar, size_t tar_stride, const RGBA *src, size_t src_stride,
+            size_t w, size_t h, unsigned int rotation) {
+	rotate_impl(tar, tar_stride, src, src_stride, w, h, rotation);
+}
+
+void rotate(uint8_t *tar, size_t tar_stride, const uint8_t *src,
+            size_t src_stride, size_t w, size_t h, unsigned int rotation) {
+	rotate_impl(tar, tar_stride, src, src_stride, w, h, rotation);
+}
+
+}  // namespace compose
+}  // namespace inktty
@@ -0,0 +1,115 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INKTTY_GFX_COMPOSE_HPP
+#define INKTTY_GFX_COMPOSE_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include <inktty/utils/color.hpp>
+
+namespace inktty {
+namespace compose {
+/**
+ * Blends a line of n pixels of the premultiplied foreground "mg" over the
+ * opaque background "bg" and writes the result to "tar". The result is fully
+ * opaque. Uses NEON or SSE2 kernels if these were enabled in the build,
+ * otherwise falls back to a scalar implementation; all implementations
+ * produce exactly the same result. The kernels are fastest if all pointers are
+ * 16-byte aligned.
+ */
+void over(RGBA *tar, const RGBA *bg, const RGBA *mg, size_t n);
+
+/**
+ * Scalar reference implementation of over(), exposed for testing.
+ */
+void over_scalar(RGBA *tar, const RGBA *bg, const RGBA *mg, size_t n);
+
+/**
+ * Writes the colour "c" premultiplied with the given alpha mask to all pixels
+ * in "tar" for which the mask is non-zero. Pixels with a zero mask value are
+ * not touched.
+ *
+ * @param binary must only be set to true if the mask exclusively contains the
+ * values 0 and 255. In this case the operation reduces to a select.
+ */
+void mask(RGBA *tar, const uint8_t *mask, const RGBA &c, size_t n,
+          bool binary = false);
+
+/**
+ * Scalar reference implementation of mask(), exposed for testing.
+ */
+void mask_scalar(RGBA *tar, const uint8_t *mask, const RGBA &c, size_t n);
+
+/**
+ * Sets all pixels in "tar" for which the mask is non-zero to transparent
+ * black, undoing mask().
+ */
+void mask_erase(RGBA *tar, const uint8_t *mask, size_t n);
+
+/**
+ * Greyscale variant of over(). Blends the premultiplied foreground "mg" over
+ * the opaque background "bg".
+ */
+void over(uint8_t *tar, const uint8_t *bg, const GreyA *mg, size_t n);
+
+/**
+ * Greyscale variant of mask() writing to a layer with alpha channel.
+ */
+void mask(GreyA *tar, const uint8_t *mask, uint8_t v, size_t n,
+          bool binary = false);
+
+/**
+ * Greyscale variant of mask() writing to an opaque layer. The value "v" is
+ * premultiplied with the mask, i.e. the result is the colour composed over
+ * black.
+ */
+void mask(uint8_t *tar, const uint8_t *mask, uint8_t v, size_t n,
+          bool binary = false);
+
+/**
+ * Greyscale variants of mask_erase(), setting all pixels for which the mask is
+ * non-zero to transparent black.
+ */
+void mask_erase(GreyA *tar, const uint8_t *mask, size_t n);
+void mask_erase(uint8_t *tar, const uint8_t *mask, size_t n);
+
+/**
+ * Copies the w x h image "src" to "tar" while rotating it by the given number
+ * of quarter turns counter-clockwise. For odd rotations the target image is
+ * h pixels wide and w pixels high. The pixel (x, y) in the source is written
+ * to (y, w - 1 - x) for rotation 1, to (w - 1 - x, h - 1 - y) for rotation 2
+ * and to (h - 1 - y, x) for rotation 3. Transposing rotations are processed
+ * in square blocks, such that both images are accessed cache-friendly.
+ *
+ * @param src_stride is the width of one line in the source image in bytes.
+ * @param tar_stride is the width of one line in the target image in bytes.
+ */
+void rotate(RGBA *tar, size_t tar_stride, const RGBA *src, size_t src_stride,
+            size_t w, size_t h, unsigned int rotation);
+
+/**
+ * Greyscale variant of rotate().
+ */
+void rotate(uint8_t *tar, size_t tar_stride, const uint8_t *src,
+            size_t src_stride, size_t w, size_t h, unsigned int rotation);
+}  // namespace compose
+}  // namespace inktty
+
+#endif /* INKTTY_GFX_COMPOSE_HPP */
@@ -16,12 +16,25 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <atomic>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
 #include <mutex>
+#include <new>
 #include <vector>
 
+#include <inktty/gfx/compose.hpp>
 #include <inktty/gfx/display.hpp>
 #include <inktty/gfx/dither.hpp>
+#include <inktty/gfx/epaper_emulation.hpp>
+#include <inktty/gfx/panel_shadow.hpp>
+#include <inktty/utils/memory.hpp>
+#include <inktty/utils/profile.hpp>
+#include <inktty/utils/thread_pool.hpp>
+#include <inktty/utils/trace.hpp>
 
 namespace inktty {
 
@@ -33,6 +46,73 @@ Display::~Display() {
 	// Do nothing here
 }
 
+bool Display::busy(const Rect &) { return false; }
+
+void Display::completed(std::vector<Rect> &) {
+	// Synchronous displays never have pending updates
+}
+
+RectangleMerger::Cost Display::update_cost() const {
+	return RectangleMerger::Cost();
+}
+
+/******************************************************************************
+ * Class PixelBuffer                                                          *
+ ******************************************************************************/
+
+namespace {
+/**
+ * Zero-initialised pixel buffer aligned to 16 byte boundaries. The memory is
+ * obtained from calloc(), which hands out fresh zero pages for large buffers
+ * without touching them. Allocating the full-screen buffers is thus cheap,
+ * pages only become resident once they are first written.
+ */
+class PixelBuffer {
+private:
+	uint8_t *m_buf;
+	size_t m_size;
+	memory::Account m_account;
+
+public:
+	PixelBuffer()
+	    : m_buf(nullptr), m_size(0), m_account(memory::Pool::Display) {}
+
+	~PixelBuffer() { free(m_buf); }
+
+	PixelBuffer(const PixelBuffer &) = delete;
+	PixelBuffer &operator=(const PixelBuffer &) = delete;
+
+	/**
+	 * Reallocates the buffer if the size changed. The content of a
+	 * reallocated buffer is zero.
+	 */
+	void resize(size_t size) {
+		if (size == m_size) {
+			return;
+		}
+		free(m_buf);
+		m_buf = nullptr;
+		m_size = 0;
+		if (size > 0) {
+			m_buf = (uint8_t *)calloc(size + 15, 1);
+			if (!m_buf) {
+				throw std::bad_alloc();
+			}
+			m_size = size;
+		}
+		m_account.set(m_size);
+	}
+
+	void clear() { resize(0); }
+
+	bool empty() const { return m_size == 0; }
+
+	uint8_t *data() const {
+		return (uint8_t *)((uintptr_t(m_buf) + 15) / 16 * 16);
+	}
+};
+}  // namespace
+
 /******************************************************************************
  * Class MemoryDisplay::Impl                                                  *
  ******************************************************************************/
@@ -41,90 +121,713 @@ class MemoryDisplay::Impl {
 private:
 	MemoryDisplay *m_self = nullptr;
 	std::atomic<int> m_locked;
-	size_t m_width, m_height, m_stride;
+	Format m_format;
+	size_t m_width, m_height;
+	size_t m_stride, m_stride_presentation;
 	Rect m_display_rect;
 	Rect m_surf_rect;
 	std::vector<CommitRequest> m_commit_requests;
-	std::vector<RGBA> m_composite;
-	std::vector<RGBA> m_layer_bg;
-	std::vector<RGBA> m_layer_presentation;
+	PixelBuffer m_composite;
+	PixelBuffer m_layer_bg;
+	PixelBuffer m_layer_presentation;
+	std::vector<RGBA> m_composite_rgba;
 	std::recursive_mutex m_mutex;
 
+	/**
+	 * Number of quarter turns the composite image is rotated by before it is
+	 * passed to the backend. If non-zero, the committed regions are rotated
+	 * into m_rotated, which is m_out_width x m_out_height pixels large.
+	 */
+	unsigned int m_rotation;
+	PixelBuffer m_rotated;
+	size_t m_out_width, m_out_height, m_out_stride;
+
+	/**
+	 * Worker threads used by for_each_band() or nullptr if all regions are
+	 * processed on the calling thread.
+	 */
+	std::unique_ptr<ThreadPool> m_pool;
+
+	/**
+	 * Minimum number of pixels that must be committed before the work is
+	 * distributed among the worker threads. Smaller updates, such as a single
+	 * line of text, are faster to process than to hand over.
+	 */
+	static constexpr size_t MIN_PARALLEL_AREA = 64 * 1024;
+
+	/**
+	 * Number of bands per worker thread. Using more bands than threads
+	 * balances the load if the regions are unevenly distributed.
+	 */
+	static constexpr int BANDS_PER_THREAD = 4;
+
+	/**
+	 * Columns [x0, x1) of a row in which the composite image changed during
+	 * the current call to unlock().
+	 */
+	struct RowChange {
+		int x0, x1;
+
+		RowChange() : x0(INT_MAX), x1(INT_MIN) {}
+	};
+
+	/**
+	 * Changed columns of each row. Each row is written by exactly one thread
+	 * while composing.
+	 */
+	std::vector<RowChange> m_row_changes;
+
+	/**
+	 * One flag per pixel indicating whether the display is known to show
+	 * exactly the composite image, i.e. the pixel was last committed using an
+	 * update mode that does not transform it. Unchanged exact pixels are not
+	 * committed again unless an update mode with the "Full" mask is used.
+	 */
+	std::vector<uint8_t> m_exact;
+
+	/**
+	 * Memory held by the per-pixel buffers that are not PixelBuffer
+	 * instances, i.e. m_exact and m_composite_rgba.
+	 */
+	memory::Account m_account;
+
+	/**
+	 * If true, the content shown on the panel is tracked in m_shadow, which
+	 * replaces the exact flags when filtering the commit requests.
+	 */
+	bool m_shadow_enabled;
+	PanelShadow m_shadow;
+
+	/**
+	 * Scratch buffer holding one row of the composite image as 4-bit
+	 * greyscale values.
+	 */
+	std::vector<uint8_t> m_shadow_row;
+
+	/**
+	 * Bands of the commit requests processed by the worker threads in
+	 * for_each_band(). Kept across frames, such that the tasks only need to
+	 * capture an index and submitting them does not allocate memory.
+	 */
+	struct Band {
+		const CommitRequest *begin, *end;
+		int y0, y1;
+	};
+	std::vector<Band> m_bands;
+	const std::function<void(const Rect &r, size_t worker)> *m_band_fn;
+
+	/**
+	 * Scratch rows used by compose(), one for each worker thread and one for
+	 * the calling thread. Only grown, such that composing does not allocate
+	 * memory once the buffers reached their steady state size.
+	 */
+	std::vector<std::vector<uint8_t>> m_scratch;
+
+	/**
+	 * Thread presenting the front buffer in double buffered mode, nullptr if
+	 * the composite image is passed to the backend directly in unlock().
+	 */
+	std::unique_ptr<ThreadPool> m_presenter;
+
+	/**
+	 * Copy of the committed regions of the composite image read by the
+	 * presenter thread, as well as its dimensions. Only written by the main
+	 * thread while the presenter thread is idle.
+	 */
+	PixelBuffer m_front;
+	size_t m_front_width, m_front_height, m_front_stride;
+	std::vector<CommitRequest> m_front_requests;
+
+	/**
+	 * Display rectangle returned by the last call to do_lock() on the
+	 * presenter thread. Protected by m_present_mutex.
+	 */
+	Rect m_present_rect;
+	std::mutex m_present_mutex;
+
+	/**
+	 * Display rectangle the buffer passed to the backend corresponds to. Set
+	 * by whichever thread currently calls do_unlock().
+	 */
+	Rect m_unlock_rect;
+
+	/**
+	 * Observer receiving the content passed to the backend, or nullptr.
+	 */
+	Tap *m_tap;
+
+	/**
+	 * Number of additional bytes allocated for each layer, allowing to align
+	 * the layers to 16 byte boundaries.
+	 */
+	static constexpr size_t ALIGN_PADDING = 16;
+
 	template <typename T>
 	static T *align(T *p) {
-		//return (T *)((uintptr_t(p) + 15) / 16 * 16);
-		return p;
+		return (T *)((uintptr_t(p) + 15) / 16 * 16);
+	}
+
+	static size_t align_stride(size_t n) { return ((n + 15U) / 16U) * 16U; }
+
+	/**
+	 * Returns the size of a single pixel in the given layer in bytes. In
+	 * greyscale mode the background and the composite image are stored as
+	 * plain 8-bit values, whereas the presentation layer requires an alpha
+	 * channel.
+	 */
+	size_t pixel_size(Layer layer) const {
+		if (m_format == Format::RGBA) {
+			return sizeof(RGBA);
+		}
+		return (layer == Layer::Presentation) ? sizeof(GreyA) : 1U;
 	}
 
-	RGBA *target_pointer(Layer layer) {
+	size_t stride(Layer layer) const {
+		return (layer == Layer::Presentation) ? m_stride_presentation
+		                                      : m_stride;
+	}
+
+	uint8_t *target_pointer(Layer layer) {
 		switch (layer) {
 			case Layer::Background:
-				return align(&m_layer_bg[0]);
+				return m_layer_bg.data();
 			case Layer::Presentation:
-				return align(&m_layer_presentation[0]);
+				return m_layer_presentation.data();
 		}
 		return nullptr;
 	}
 
+	/**
+	 * Returns a pointer at the first pixel in row y of the given layer.
+	 */
+	template <typename T>
+	T *row(Layer layer, size_t y) {
+		return (T *)(target_pointer(layer) + stride(layer) * y);
+	}
+
+	template <typename T>
+	T *composite_row(size_t y) {
+		return (T *)(m_composite.data() + m_stride * y);
+	}
+
 	void resize(size_t w, size_t h) {
 		// Do nothing if the size did not change
-		if (w == m_width || h == m_height) {
+		if (w == m_width && h == m_height) {
 			return;
 		}
 
-		// Compute the new stride and update the width/height variables
-		m_stride = ((w * sizeof(RGBA) + 15U) / 16U) * 16U;
+		// Compute the new strides and update the width/height variables
+		m_stride = align_stride(w * pixel_size(Layer::Background));
+		m_stride_presentation = align_stride(w * pixel_size(Layer::Presentation));
 		m_width = w;
 		m_height = h;
 
-		// Allocate the memory
-		const size_t size = h * m_stride / sizeof(RGBA);
-		m_composite.resize(size);
-		m_layer_bg.resize(size);
-		m_layer_presentation.resize(size);
+		// Allocate the memory. Since the stride is a multiple of 16 bytes,
+		// every line is aligned once the layer is aligned. The pages of the
+		// buffers are only committed once they are drawn to.
+		m_composite.resize(h * m_stride);
+		m_layer_bg.resize(h * m_stride);
+		m_layer_presentation.resize(h * m_stride_presentation);
+		m_composite_rgba.clear();
+
+		// Allocate the buffer holding the rotated composite image
+		m_out_width = (m_rotation & 1U) ? h : w;
+		m_out_height = (m_rotation & 1U) ? w : h;
+		if (m_rotation == 0U) {
+			m_out_stride = m_stride;
+			m_rotated.clear();
+		} else {
+			m_out_stride = align_stride(m_out_width * pixel_size(Layer::Background));
+			m_rotated.resize(m_out_height * m_out_stride);
+		}
+
+		// Nothing is known about the content of the display
+		m_row_changes.assign(h, RowChange());
+		m_exact.assign(w * h, 0);
+		if (m_shadow_enabled) {
+			m_shadow.resize(m_out_width, m_out_height);
+		}
+		account();
+	}
+
+	void account() {
+		m_account.set(m_exact.capacity() +
+		              m_composite_rgba.capacity() * sizeof(RGBA));
+	}
+
+	/**
+	 * Returns a pointer at the image passed to the backend, i.e. either the
+	 * composite image or the rotated composite image.
+	 */
+	template <typename T>
+	T *output_row(size_t y) {
+		if (m_rotation == 0U) {
+			return composite_row<T>(y);
+		}
+		return (T *)(m_rotated.data() + m_out_stride * y);
 	}
 
-	void compose(Rect r) {
-		// Fetch background and presentation layer
-		RGBA *p_tar_s = align(&m_composite[0]);
-		const RGBA *p_bg_s = target_pointer(Layer::Background);
-		const RGBA *p_mg_s = target_pointer(Layer::Presentation);
+	/**
+	 * Transforms a rectangle from the surface coordinates returned by lock()
+	 * to the coordinates of the output image.
+	 */
+	Rect to_output(const Rect &r) const {
+		const int w = m_width, h = m_height;
+		switch (m_rotation) {
+			default:
+			case 0U:
+				return r;
+			case 1U:
+				return Rect(r.y0, w - r.x1, r.y1, w - r.x0);
+			case 2U:
+				return Rect(w - r.x1, h - r.y1, w - r.x0, h - r.y0);
+			case 3U:
+				return Rect(h - r.y1, r.x0, h - r.y0, r.x1);
+		}
+	}
 
-		// Iterate over each line and render the composite image
+	/**
+	 * Inverse of to_output().
+	 */
+	Rect from_output(const Rect &r) const {
+		const int w = m_width, h = m_height;
+		switch (m_rotation) {
+			default:
+			case 0U:
+				return r;
+			case 1U:
+				return Rect(w - r.y1, r.x0, w - r.y0, r.x1);
+			case 2U:
+				return Rect(w - r.x1, h - r.y1, w - r.x0, h - r.y0);
+			case 3U:
+				return Rect(r.y0, h - r.x1, r.y1, h - r.x0);
+		}
+	}
+
+	/**
+	 * Copies the given region of the composite image to the output image and
+	 * returns the region in output coordinates.
+	 */
+	Rect rotate(const Rect &r) {
+		if (m_rotation == 0U) {
+			return r;
+		}
+		const Rect t = to_output(r);
+		if (m_format == Format::RGBA) {
+			compose::rotate(output_row<RGBA>(t.y0) + t.x0, m_out_stride,
+			                composite_row<RGBA>(r.y0) + r.x0, m_stride,
+			                r.width(), r.height(), m_rotation);
+		} else {
+			compose::rotate(output_row<uint8_t>(t.y0) + t.x0, m_out_stride,
+			                composite_row<uint8_t>(r.y0) + r.x0, m_stride,
+			                r.width(), r.height(), m_rotation);
+		}
+		return t;
+	}
+
+	void compose(Rect r, size_t worker) {
+		// Iterate over each line and render it into a temporary buffer first,
+		// such that the changed pixels can be determined
+		const size_t x0 = r.x0, w = r.width();
+		const size_t px = pixel_size(Layer::Background), n = w * px;
+		std::vector<uint8_t> &buf = m_scratch[worker];
+		if (buf.size() < n + ALIGN_PADDING) {
+			buf.resize(n + ALIGN_PADDING);
+		}
+		uint8_t *tmp = align(&buf[0]);
 		for (size_t y = size_t(r.y0); y < size_t(r.y1); y++) {
-			// Compute the offsets from the top-left pixel
-			const size_t o0 = y * m_stride / sizeof(RGBA) + r.x0;
-			const size_t o1 = y * m_stride / sizeof(RGBA) + r.x1;
-
-			// Compute the source and target pointers
-			RGBA *p_tar0 = p_tar_s + o0;
-			RGBA *p_tar1 = p_tar_s + o1;
-			const RGBA *p_bg = p_bg_s + o0;
-			const RGBA *p_mg = p_mg_s + o0;
-
-			for (RGBA *p = p_tar0; p < p_tar1; p++, p_bg++, p_mg++) {
-				// Fetch the background and blend it with the middle-ground,
-				// assume the background was fully opaque.
-				uint16_t r = p_bg->r, g = p_bg->g, b = p_bg->b, a = p_mg->a;
-				r = (r * (255 - a)) / 255 + p_mg->r;
-				g = (g * (255 - a)) / 255 + p_mg->g;
-				b = (b * (255 - a)) / 255 + p_mg->b;
-
-				// Store the result
-				*p = RGBA(r, g, b);
+			if (m_format == Format::RGBA) {
+				compose::over((RGBA *)tmp, row<RGBA>(Layer::Background, y) + x0,
+				              row<RGBA>(Layer::Presentation, y) + x0, w);
+			} else {
+				compose::over(tmp, row<uint8_t>(Layer::Background, y) + x0,
+				              row<GreyA>(Layer::Presentation, y) + x0, w);
+			}
+
+			// Copy the changed pixels to the composite image
+			uint8_t *tar = composite_row<uint8_t>(y) + x0 * px;
+			if (memcmp(tar, tmp, n) == 0) {
+				continue;
+			}
+			size_t i0 = 0, i1 = n;
+			while (tar[i0] == tmp[i0]) {
+				i0++;
 			}
+			while (tar[i1 - 1] == tmp[i1 - 1]) {
+				i1--;
+			}
+			i0 = i0 / px * px;
+			i1 = (i1 + px - 1) / px * px;
+			memcpy(tar + i0, tmp + i0, i1 - i0);
+
+			RowChange &c = m_row_changes[y];
+			c.x0 = std::min(c.x0, int(x0 + i0 / px));
+			c.x1 = std::max(c.x1, int(x0 + i1 / px));
+		}
+	}
+
+	/**
+	 * Returns true if the given update mode shows the composite image as it
+	 * is, i.e. the display content is exactly known after the update.
+	 */
+	static bool is_exact(const UpdateMode &mode) {
+		return (mode.output_op == UpdateMode::Identity) &&
+		       (mode.mask_op == UpdateMode::Full ||
+		        mode.mask_op == UpdateMode::Partial);
+	}
+
+	/**
+	 * Shrinks the given commit request to the region that actually needs to
+	 * be updated. This is the bounding box of the changed pixels and of all
+	 * pixels the display is not known to show as they are in the composite
+	 * image. Returns an invalid rectangle if nothing needs to be updated.
+	 */
+	Rect changed_region(const Rect &r) const {
+		Rect res;
+		const size_t w = r.width();
+		for (int y = r.y0; y < r.y1; y++) {
+			int x0 = std::max(m_row_changes[y].x0, r.x0);
+			int x1 = std::min(m_row_changes[y].x1, r.x1);
+
+			// Search for the first and last pixel that is not exact
+			const uint8_t *e = &m_exact[y * m_width + r.x0];
+			const uint8_t *e0 = (const uint8_t *)memchr(e, 0, w);
+			if (e0) {
+				size_t i1 = w;
+				while (e[i1 - 1]) {
+					i1--;
+				}
+				x0 = std::min(x0, int(r.x0 + (e0 - e)));
+				x1 = std::max(x1, int(r.x0 + i1));
+			}
+			if (x0 < x1) {
+				res = res.grow(Rect(x0, y, x1, y + 1));
+			}
+		}
+		return res;
+	}
+
+	/**
+	 * Updates the exact flags of the pixels touched by the given update.
+	 */
+	void update_exact(const Rect &r, const UpdateMode &mode) {
+		const uint8_t exact = is_exact(mode) ? 1U : 0U;
+		for (int y = r.y0; y < r.y1; y++) {
+			memset(&m_exact[y * m_width + r.x0], exact, r.width());
 		}
 	}
 
+	/**
+	 * Applies the given update to the panel shadow. Returns the bounding box
+	 * of the pixels that change on the panel, or an invalid rectangle if
+	 * nothing changes.
+	 */
+	Rect update_shadow(const Rect &r, const UpdateMode &mode) {
+		Rect res;
+		const size_t x0 = r.x0, x1 = r.x1;
+		m_shadow_row.resize(r.width());
+		for (size_t y = size_t(r.y0); y < size_t(r.y1); y++) {
+			uint8_t *g = m_shadow_row.data();
+			if (m_format == Format::RGBA) {
+				const RGBA *c = output_row<RGBA>(y);
+				for (size_t x = x0; x < x1; x++) {
+					*(g++) = epaper_emulation::rgba_to_greyscale(c[x]);
+				}
+			} else {
+				const uint8_t *c = output_row<uint8_t>(y);
+				for (size_t x = x0; x < x1; x++) {
+					*(g++) = c[x] >> 4U;
+				}
+			}
+			size_t cx0, cx1;
+			if (m_shadow.update(y, x0, x1, m_shadow_row.data(), mode, cx0,
+			                    cx1)) {
+				res = res.grow(Rect(cx0, y, cx1, y + 1));
+			}
+		}
+		return res;
+	}
+
+	/**
+	 * Removes the unchanged parts of the commit requests, drops requests
+	 * that would not change the display content. Requests using the "Full"
+	 * mask operation are always passed on, since they explicitly ask for all
+	 * pixels to be updated. The remaining requests are rotated into the output
+	 * image and transformed to output coordinates.
+	 */
+	void filter_commit_requests() {
+		size_t n = 0;
+		for (const CommitRequest &req : m_commit_requests) {
+			Rect r = req.r;
+			if (r.width() <= 0 || r.height() <= 0) {
+				continue;
+			}
+			if (m_shadow_enabled) {
+				// The panel shadow is indexed like the output image
+				r = update_shadow(rotate(r), req.mode);
+				if (!r.valid()) {
+					continue;
+				}
+			} else {
+				if (req.mode.mask_op != UpdateMode::Full) {
+					r = changed_region(r);
+					if (!r.valid()) {
+						continue;
+					}
+				}
+				update_exact(r, req.mode);
+				r = rotate(r);
+			}
+			m_commit_requests[n++] = CommitRequest{r, req.mode};
+		}
+		m_commit_requests.resize(n);
+
+		// Reset the changes for the next call to unlock()
+		std::fill(m_row_changes.begin(), m_row_changes.end(), RowChange());
+	}
+
+	/**
+	 * Passes the given buffer to the backend. The commit requests must be in
+	 * the coordinate system of the backend, "tar" is the display rectangle
+	 * the buffer corresponds to.
+	 */
+	void backend_unlock(const Rect &tar, const CommitRequest *r0,
+	                    const CommitRequest *r1, const uint8_t *buf,
+	                    size_t stride) {
+		INKTTY_PROFILE_SCOPE(DisplayUnlock);
+		{
+			trace::Span span("do_unlock");
+			m_unlock_rect = tar;
+			if (m_format == Format::RGBA) {
+				m_self->do_unlock(r0, r1, (const RGBA *)buf, stride);
+			} else {
+				m_self->do_unlock_greyscale(r0, r1, buf, stride);
+			}
+		}
+		if (m_tap) {
+			m_tap->tap(r0, r1, buf, stride, tar, m_format);
+		}
+		if (r0 != r1) {
+			INKTTY_PROFILE_SUBMITTED();
+
+			// Synchronous backends are done at this point; asynchronous
+			// backends already passed their update marker to the tracer
+			trace::submitted(trace::now());
+		}
+	}
+
+	/**
+	 * Copies the committed regions of the composite image into the front
+	 * buffer. Must only be called while the presenter thread is idle.
+	 */
+	void copy_to_front() {
+		if (m_front_width != m_out_width || m_front_height != m_out_height ||
+		    m_front_stride != m_out_stride) {
+			m_front.resize(m_out_height * m_out_stride);
+			m_front_width = m_out_width;
+			m_front_height = m_out_height;
+			m_front_stride = m_out_stride;
+		}
+		const size_t px = pixel_size(Layer::Background);
+		uint8_t *front = m_front.data();
+		for (const CommitRequest &req : m_commit_requests) {
+			const Rect &r = req.r;
+			for (int y = r.y0; y < r.y1; y++) {
+				memcpy(front + y * m_front_stride + r.x0 * px,
+				       output_row<uint8_t>(y) + r.x0 * px, r.width() * px);
+			}
+		}
+		m_front_requests.assign(m_commit_requests.begin(),
+		                        m_commit_requests.end());
+	}
+
+	/**
+	 * Runs on the presenter thread. Locks the backend and passes the front
+	 * buffer to it.
+	 */
+	void present() {
+		// Fetch the current display rectangle. Only the part of the display
+		// covered by the front buffer can be updated.
+		const Rect r = m_self->do_lock();
+		Rect tar(0, 0, 0, 0);
+		if (r.valid()) {
+			tar = Rect::sized(r.x0, r.y0,
+			                  std::min(r.width(), int(m_front_width)),
+			                  std::min(r.height(), int(m_front_height)));
+			std::lock_guard<std::mutex> lock(m_present_mutex);
+			m_present_rect = r;
+		}
+
+		// Clip the requests and transform them to the backend coordinates
+		size_t n = 0;
+		for (const CommitRequest &req : m_front_requests) {
+			const Rect c(req.r.x0, req.r.y0, std::min(req.r.x1, tar.width()),
+			             std::min(req.r.y1, tar.height()));
+			if (c.width() > 0 && c.height() > 0) {
+				m_front_requests[n++] =
+				    CommitRequest{c + Point{tar.x0, tar.y0}, req.mode};
+			}
+		}
+		m_front_requests.resize(n);
+
+		const CommitRequest *r0 = m_front_requests.data();
+		const CommitRequest *r1 = r0 + n;
+		backend_unlock(tar, r0, r1, m_front.empty() ? nullptr : m_front.data(),
+		               m_front_stride);
+	}
+
 public:
 	Impl(MemoryDisplay *self)
 	    : m_self(self),
 	      m_locked(0),
+	      m_format(Format::RGBA),
 	      m_width(0),
 	      m_height(0),
 	      m_stride(0),
+	      m_stride_presentation(0),
 	      m_display_rect(0, 0, 0, 0),
-	      m_surf_rect(0, 0, 0, 0) {
+	      m_surf_rect(0, 0, 0, 0),
+	      m_rotation(0),
+	      m_out_width(0),
+	      m_out_height(0),
+	      m_out_stride(0),
+	      m_account(memory::Pool::Display),
+	      m_shadow_enabled(false),
+	      m_band_fn(nullptr),
+	      m_scratch(1),
+	      m_front_width(0),
+	      m_front_height(0),
+	      m_front_stride(0),
+	      m_unlock_rect(0, 0, 0, 0),
+	      m_tap(nullptr) {
+	}
+
+	Format format() const { return m_format; }
+
+	void set_double_buffered(bool double_buffered) {
+		if (double_buffered && !m_presenter) {
+			m_presenter.reset(new ThreadPool(1));
+		} else if (!double_buffered) {
+			m_presenter.reset();
+		}
+	}
+
+	void flush() {
+		if (m_presenter) {
+			m_presenter->wait();
+		}
+	}
+
+	void set_tap(Tap *tap) {
+		flush();  // The presenter thread calls the tap
+		m_tap = tap;
+	}
+
+	void set_panel_shadow(bool enabled) {
+		if (enabled == m_shadow_enabled) {
+			return;
+		}
+		flush();  // The presenter thread may read the shadow
+		m_shadow_enabled = enabled;
+		if (enabled) {
+			m_shadow.resize(m_out_width, m_out_height);
+		} else {
+			m_shadow.resize(0, 0);
+			std::fill(m_exact.begin(), m_exact.end(), 0);
+		}
+	}
+
+	const PanelShadow *panel_shadow() const {
+		return m_shadow_enabled ? &m_shadow : nullptr;
+	}
+
+	void set_threads(unsigned int threads) {
+		if (threads > 1) {
+			m_pool.reset(new ThreadPool(threads));
+		} else {
+			m_pool.reset();
+		}
+		m_scratch.resize(m_pool ? m_pool->size() + 1 : 1);
+	}
+
+	/**
+	 * Calls the given function for the regions covered by the given commit
+	 * requests, see MemoryDisplay::for_each_band(). The function receives the
+	 * index of the thread it runs on; the calling thread has the highest
+	 * index.
+	 */
+	void for_each_band(
+	    const CommitRequest *begin, const CommitRequest *end,
+	    const std::function<void(const Rect &r, size_t worker)> &f) {
+		// Compute the number of pixels and the rows touched by the requests
+		size_t area = 0;
+		int y0 = INT_MAX, y1 = INT_MIN;
+		for (const CommitRequest *req = begin; req < end; req++) {
+			const Rect &r = req->r;
+			if (r.width() > 0 && r.height() > 0) {
+				area += size_t(r.area());
+				y0 = std::min(y0, r.y0);
+				y1 = std::max(y1, r.y1);
+			}
+		}
+
+		// Process small updates on the calling thread
+		if (!m_pool || area < MIN_PARALLEL_AREA) {
+			const size_t worker = m_pool ? m_pool->size() : 0;
+			for (const CommitRequest *req = begin; req < end; req++) {
+				f(req->r, worker);
+			}
+			return;
+		}
+
+		// Split the touched rows into bands of equal height, each band clips
+		// all requests to its rows
+		const int n_bands = int(m_pool->size()) * BANDS_PER_THREAD;
+		const int h = std::max(1, (y1 - y0 + n_bands - 1) / n_bands);
+		m_bands.clear();
+		m_band_fn = &f;
+		for (int by0 = y0; by0 < y1; by0 += h) {
+			m_bands.push_back(Band{begin, end, by0, std::min(y1, by0 + h)});
+		}
+		for (size_t i = 0; i < m_bands.size(); i++) {
+			m_pool->submit([this, i](size_t worker) {
+				process_band(m_bands[i], worker);
+			});
+		}
+		m_pool->wait();
+	}
+
+	void process_band(const Band &band, size_t worker) {
+		for (const CommitRequest *req = band.begin; req < band.end; req++) {
+			const Rect r(req->r.x0, std::max(band.y0, req->r.y0), req->r.x1,
+			             std::min(band.y1, req->r.y1));
+			if (r.width() > 0 && r.height() > 0) {
+				(*m_band_fn)(r, worker);
+			}
+		}
+	}
+
+	void set_rotation(unsigned int rotation) {
+		// Force the buffers to be reallocated upon the next call to lock()
+		rotation = rotation % 4U;
+		if (rotation != m_rotation) {
+			flush();  // The presenter thread reads the output image
+			m_rotation = rotation;
+			m_width = 0;
+			m_height = 0;
+		}
+	}
+
+	unsigned int rotation() const { return m_rotation; }
+
+	void set_format(Format format) {
+		// Force the buffers to be reallocated upon the next call to lock()
+		if (format != m_format) {
+			flush();  // The presenter thread depends on the format
+			m_format = format;
+			m_width = 0;
+			m_height = 0;
+		}
 	}
 
 	Rect lock() {
@@ -133,10 +836,30 @@ public:
 
 		if (m_locked == 0) {
 			// Fetch the current display bounding rectangle and resize the
-			// buffers
-			Rect r = m_self->do_lock();
+			// buffers. In double buffered mode, use the rectangle reported to
+			// the presenter thread unless nothing has been presented yet.
+			Rect r;
+			if (m_presenter) {
+				{
+					std::lock_guard<std::mutex> lock(m_present_mutex);
+					r = m_present_rect;
+				}
+				if (!r.valid()) {
+					m_presenter->wait();
+					r = m_self->do_lock();
+					backend_unlock(r, nullptr, nullptr, nullptr, 0);
+					std::lock_guard<std::mutex> lock(m_present_mutex);
+					m_present_rect = r;
+				}
+			} else {
+				r = m_self->do_lock();
+			}
 			if (r.valid()) {
-				resize(r.width(), r.height());
+				if (m_rotation & 1U) {
+					resize(r.height(), r.width());
+				} else {
+					resize(r.width(), r.height());
+				}
 				m_display_rect = r;
 				m_surf_rect = Rect(0, 0, m_width, m_height);
 			}
@@ -152,24 +875,76 @@ public:
 			m_locked--;
 			if (m_locked == 0) {
 				// Perform the composition operation on the specified rectangle
-				// and transform the commit requests bounding boxes to the
-				// coordinate system used by the implementation
-				const Point origin{m_display_rect.x0, m_display_rect.y0};
-				for (size_t i = 0; i < m_commit_requests.size(); i++) {
-					compose(m_commit_requests[i].r);
-					m_commit_requests[i].r += origin;
-				}
+				// and drop the parts of the commit requests that did not
+				// change. Then transform the commit requests bounding boxes to
+				// the coordinate system used by the implementation.
+				{
+					INKTTY_PROFILE_SCOPE(DisplayCompose);
+					trace::Span span("compose");
+					for_each_band(m_commit_requests.data(),
+					              m_commit_requests.data() +
+					                  m_commit_requests.size(),
+					              [this](const Rect &r, size_t worker) {
+						              compose(r, worker);
+					              });
 
-				// Pass the data to the actual display implementation
+					// The presenter thread reads the panel shadow while
+					// passing the previous frame to the backend
+					if (m_presenter && m_shadow_enabled) {
+						m_presenter->wait();
+					}
+					filter_commit_requests();
+				}
 				const CommitRequest *r0 = m_commit_requests.data();
 				const CommitRequest *r1 = r0 + m_commit_requests.size();
-				m_self->do_unlock(r0, r1, m_composite.data(), m_stride);
+
+				if (m_presenter) {
+					// Wait for the previous frame to be presented, copy the
+					// damaged regions to the front buffer and present them
+					// in the background
+					m_presenter->wait();
+					copy_to_front();
+					m_presenter->submit([this](size_t) { present(); });
+				} else {
+					const Point origin{m_display_rect.x0, m_display_rect.y0};
+					for (CommitRequest &req : m_commit_requests) {
+						req.r += origin;
+					}
+
+					// Pass the data to the actual display implementation
+					backend_unlock(m_display_rect, r0, r1,
+					               output_row<uint8_t>(0), m_out_stride);
+				}
 				m_commit_requests.clear();
+			}
 
-				// Allow other threads to call lock()
-				m_mutex.unlock();
+			// Release the recursion level acquired by the matching call to
+			// lock(); other threads may lock the display once all are gone
+			m_mutex.unlock();
+		}
+	}
+
+	void unlock_greyscale(const CommitRequest *begin, const CommitRequest *end,
+	                      const uint8_t *buf, size_t stride) {
+		// Expand the committed regions to RGBA for backends that only
+		// implement do_unlock()
+		const Rect &u = m_unlock_rect;
+		const size_t w = u.width(), h = u.height();
+		const Rect surf(0, 0, w, h);
+		m_composite_rgba.resize(w * h);
+		account();
+		for (const CommitRequest *req = begin; req < end; req++) {
+			const Rect r = surf.clip(req->r + Point(-u.x0, -u.y0));
+			for (size_t y = size_t(r.y0); y < size_t(r.y1); y++) {
+				const uint8_t *psrc = buf + y * stride;
+				RGBA *ptar = &m_composite_rgba[y * w];
+				for (size_t x = size_t(r.x0); x < size_t(r.x1); x++) {
+					ptar[x] = RGBA(psrc[x], psrc[x], psrc[x]);
+				}
 			}
 		}
+		m_self->do_unlock(begin, end, m_composite_rgba.data(),
+		                  w * sizeof(RGBA));
 	}
 
 	void commit(const Rect &r, UpdateMode mode) {
@@ -189,65 +964,156 @@ public:
 		m_commit_requests.emplace_back(CommitRequest{tar, mode});
 	}
 
-	RGBA* get_target_pointer_and_clip_rect(Layer layer, Rect &r) {
+	bool clip_rect(Rect &r) {
 		// Abort if the surface is not locked
 		if (m_locked <= 0) {
-			return nullptr;
+			return false;
 		}
 
 		// Clip the given rectangle to the target rectangle and abort if there
 		// is nothing to draw
 		r = m_surf_rect.clip(r);
-		if (r.width() == 0 || r.height() == 0) {
-			return nullptr;
-		}
+		return (r.width() > 0) && (r.height() > 0);
+	}
 
-		// Fetch the target pointer
-		return target_pointer(layer);
+	/**
+	 * Blits the mask onto the clipped rectangle r of a layer with pixel type
+	 * T. The pixel format and draw mode are resolved once per call instead of
+	 * once per row.
+	 */
+	template <typename T, typename C>
+	void blit_rows(Layer layer, const C &c, const uint8_t *mask, size_t stride,
+	               const Rect &r, const Point &o, DrawMode mode, bool binary) {
+		const size_t w = r.x1 - r.x0;
+		const uint8_t *psrc = mask + stride * (r.y0 - o.y) + (r.x0 - o.x);
+		if (mode == DrawMode::Write) {
+			for (int y = r.y0; y < r.y1; y++, psrc += stride) {
+				compose::mask(row<T>(layer, y) + r.x0, psrc, c, w, binary);
+			}
+		} else if (mode == DrawMode::Erase) {
+			for (int y = r.y0; y < r.y1; y++, psrc += stride) {
+				compose::mask_erase(row<T>(layer, y) + r.x0, psrc, w);
+			}
+		}
 	}
 
 	void blit(Layer layer, const RGBA &c, const uint8_t *mask, size_t stride,
-	          Rect r, DrawMode mode) {
-		RGBA *p = get_target_pointer_and_clip_rect(layer, r);
-		if (!p) {
+	          Rect r, DrawMode mode, bool binary) {
+		// Remember the unclipped origin, the mask is relative to it
+		const Point o{r.x0, r.y0};
+		if (!clip_rect(r)) {
 			return;
 		}
 
 		// Blit the given data onto the target surface
+		if (m_format == Format::RGBA) {
+			blit_rows<RGBA>(layer, c, mask, stride, r, o, mode, binary);
+		} else if (layer == Layer::Presentation) {
+			blit_rows<GreyA>(layer, c.luma(), mask, stride, r, o, mode, binary);
+		} else {
+			blit_rows<uint8_t>(layer, c.luma(), mask, stride, r, o, mode,
+			                   binary);
+		}
+	}
+
+	void fill_dither(Layer layer, uint8_t g, Rect r, dither::Pattern pattern) {
+		if (!clip_rect(r)) {
+			return;
+		}
+
+		const size_t s = stride(layer);
+		if (m_format == Format::RGBA) {
+			dither::ordered_binary_4bit_greyscale(g, row<RGBA>(layer, 0), s,
+			                                      r.x0, r.y0, r.x1, r.y1,
+			                                      pattern);
+		} else if (layer == Layer::Presentation) {
+			dither::ordered_binary_4bit_greyscale(g, row<GreyA>(layer, 0), s,
+			                                      r.x0, r.y0, r.x1, r.y1,
+			                                      pattern);
+		} else {
+			dither::ordered_binary_4bit_greyscale(g, row<uint8_t>(layer, 0), s,
+			                                      r.x0, r.y0, r.x1, r.y1,
+			                                      pattern);
+		}
+	}
+
+	void blit_tile(const RGBA *img, size_t stride, Rect r) {
+		// Remember the unclipped origin, the image is relative to it
+		const Point o{r.x0, r.y0};
+		if (!clip_rect(r)) {
+			return;
+		}
+
+		// Copy the image to the background layer, the presentation layer
+		// becomes transparent
 		const size_t w = r.x1 - r.x0;
 		for (size_t y = size_t(r.y0); y < size_t(r.y1); y++) {
-			RGBA *ptar = p + (m_stride * y) / sizeof(RGBA) + r.x0;
-			const uint8_t *psrc = mask + stride * (y - r.y0);
-			if (mode == DrawMode::Write) {
+			const RGBA *psrc =
+			    (const RGBA *)((const uint8_t *)img + stride * (y - o.y)) +
+			    (r.x0 - o.x);
+			if (m_format == Format::RGBA) {
+				memcpy(row<RGBA>(Layer::Background, y) + r.x0, psrc,
+				       w * sizeof(RGBA));
+				RGBA *pp = row<RGBA>(Layer::Presentation, y) + r.x0;
+				std::fill(pp, pp + w, RGBA(0, 0, 0, 0));
+			} else {
+				uint8_t *pb = row<uint8_t>(Layer::Background, y) + r.x0;
 				for (size_t x = 0; x < w; x++) {
-					const uint16_t a = psrc[x];
-					if (a > 0) {
-						ptar[x] = RGBA(c.r * a / 255, c.g * a / 255, c.b * a / 255, a);
-					}
-				}
-			} else if (mode == DrawMode::Erase) {
-				for (size_t x = 0; x < w; x++) {
-					const uint16_t a = psrc[x];
-					if (a > 0) {
-						ptar[x] = RGBA(0, 0, 0, 0);
-					}
+					pb[x] = psrc[x].luma();
 				}
+				GreyA *pp = row<GreyA>(Layer::Presentation, y) + r.x0;
+				std::fill(pp, pp + w, GreyA(0, 0));
 			}
 		}
 	}
 
-	void fill_dither(Layer layer, uint8_t g, Rect r) {
-		RGBA *p = get_target_pointer_and_clip_rect(layer, r);
-		if (!p) {
+	void move(Rect r, Point p) {
+		// Abort if the surface is not locked
+		if (m_locked <= 0) {
+			return;
+		}
+
+		// Clip both the source and the target rectangle to the surface
+		const Point d = p - Point{r.x0, r.y0};
+		r = m_surf_rect.clip(r);
+		Rect tar = m_surf_rect.clip(r + d);
+		r = tar + Point{-d.x, -d.y};
+		if (tar.width() <= 0 || tar.height() <= 0) {
 			return;
 		}
 
-		dither::ordered_binary_4bit_greyscale(g, p, m_stride, r.x0, r.y0, r.x1, r.y1);
+		// Iterate over the lines in an order that does not overwrite source
+		// lines before they are read; memmove handles overlap within a line.
+		const int h = tar.height();
+		for (Layer layer : {Layer::Background, Layer::Presentation}) {
+			const size_t px = pixel_size(layer);
+			const size_t n = tar.width() * px;
+			for (int i = 0; i < h; i++) {
+				const int y = (d.y <= 0) ? i : (h - 1 - i);
+				uint8_t *p_tar = row<uint8_t>(layer, tar.y0 + y);
+				const uint8_t *p_src = row<uint8_t>(layer, r.y0 + y);
+				memmove(p_tar + tar.x0 * px, p_src + r.x0 * px, n);
+			}
+		}
+	}
+
+	bool busy(const Rect &r) {
+		const Point origin{m_display_rect.x0, m_display_rect.y0};
+		return m_self->do_busy(to_output(m_surf_rect.clip(r)) + origin);
+	}
+
+	void completed(std::vector<Rect> &regions) {
+		const size_t i0 = regions.size();
+		m_self->do_completed(regions);
+
+		const Point origin{m_display_rect.x0, m_display_rect.y0};
+		for (size_t i = i0; i < regions.size(); i++) {
+			regions[i] = from_output(regions[i] + Point(-origin.x, -origin.y));
+		}
 	}
 
 	void fill(Layer layer, const RGBA &c, Rect r) {
-		RGBA *p = get_target_pointer_and_clip_rect(layer, r);
-		if (!p) {
+		if (!clip_rect(r)) {
 			return;
 		}
 
@@ -255,8 +1121,16 @@ public:
 		// alpha channel. Premultiplied alpha makes the composition faster.
 		const RGBA f = c.premultiply_alpha();
 		for (size_t y = size_t(r.y0); y < size_t(r.y1); y++) {
-			RGBA *py = p + (m_stride * y) / sizeof(RGBA) + r.x0;
-			std::fill(py, py + r.width(), f);
+			if (m_format == Format::RGBA) {
+				RGBA *py = row<RGBA>(layer, y) + r.x0;
+				std::fill(py, py + r.width(), f);
+			} else if (layer == Layer::Presentation) {
+				GreyA *py = row<GreyA>(layer, y) + r.x0;
+				std::fill(py, py + r.width(), GreyA(f.luma(), f.a));
+			} else {
+				uint8_t *py = row<uint8_t>(layer, y) + r.x0;
+				memset(py, f.luma(), r.width());
+			}
 		}
 	}
 };
@@ -265,12 +1139,66 @@ public:
  * Class MemoryDisplay                                                        *
  ******************************************************************************/
 
+constexpr size_t MemoryDisplay::Impl::MIN_PARALLEL_AREA;
+constexpr int MemoryDisplay::Impl::BANDS_PER_THREAD;
+
 MemoryDisplay::MemoryDisplay() : m_impl(new Impl(this)) {}
 
 MemoryDisplay::~MemoryDisplay() {
 	// Do nothing here, implicitly destroy m_impl
 }
 
+bool MemoryDisplay::do_busy(const Rect &) { return false; }
+
+void MemoryDisplay::do_completed(std::vector<Rect> &) {
+	// Synchronous backends never have pending updates
+}
+
+void MemoryDisplay::do_unlock_greyscale(const CommitRequest *begin,
+                                        const CommitRequest *end,
+                                        const uint8_t *buf, size_t stride) {
+	m_impl->unlock_greyscale(begin, end, buf, stride);
+}
+
+MemoryDisplay::Format MemoryDisplay::format() const {
+	return m_impl->format();
+}
+
+void MemoryDisplay::set_format(Format format) { m_impl->set_format(format); }
+
+void MemoryDisplay::set_rotation(unsigned int rotation) {
+	m_impl->set_rotation(rotation);
+}
+
+unsigned int MemoryDisplay::rotation() const { return m_impl->rotation(); }
+
+void MemoryDisplay::set_panel_shadow(bool enabled) {
+	m_impl->set_panel_shadow(enabled);
+}
+
+const PanelShadow *MemoryDisplay::panel_shadow() const {
+	return m_impl->panel_shadow();
+}
+
+void MemoryDisplay::set_double_buffered(bool double_buffered) {
+	m_impl->set_double_buffered(double_buffered);
+}
+
+void MemoryDisplay::flush() { m_impl->flush(); }
+
+void MemoryDisplay::set_tap(Tap *tap) { m_impl->set_tap(tap); }
+
+void MemoryDisplay::set_threads(unsigned int threads) {
+	m_impl->set_threads(threads);
+}
+
+void MemoryDisplay::for_each_band(const CommitRequest *begin,
+                                  const CommitRequest *end,
+                                  const std::function<void(const Rect &r)> &f) {
+	m_impl->for_each_band(begin, end,
+	                      [&f](const Rect &r, size_t) { f(r); });
+}
+
 Rect MemoryDisplay::lock() { return m_impl->lock(); }
 
 void MemoryDisplay::unlock() { m_impl->unlock(); }
@@ -280,16 +1208,29 @@ void MemoryDisplay::commit(const Rect &r, UpdateMode mode) {
 }
 
 void MemoryDisplay::blit(Layer layer, const RGBA &c, const uint8_t *mask,
-                         size_t stride, const Rect &r, DrawMode mode) {
-	m_impl->blit(layer, c, mask, stride, r, mode);
+                         size_t stride, const Rect &r, DrawMode mode,
+                         bool binary) {
+	m_impl->blit(layer, c, mask, stride, r, mode, binary);
 }
 
-void MemoryDisplay::fill_dither(Layer layer, uint8_t g, const Rect &r) {
-	m_impl->fill_dither(layer, g, r);
+void MemoryDisplay::fill_dither(Layer layer, uint8_t g, const Rect &r,
+                                dither::Pattern pattern) {
+	m_impl->fill_dither(layer, g, r, pattern);
 }
 
+void MemoryDisplay::blit_tile(const RGBA *img, size_t stride, const Rect &r) {
+	m_impl->blit_tile(img, stride, r);
+}
 
 void MemoryDisplay::fill(Layer layer, const RGBA &c, const Rect &r) {
 	m_impl->fill(layer, c, r);
 }
+
+void MemoryDisplay::move(const Rect &r, const Point &p) { m_impl->move(r, p); }
+
+bool MemoryDisplay::busy(const Rect &r) { return m_impl->busy(r); }
+
+void MemoryDisplay::completed(std::vector<Rect> &regions) {
+	m_impl->completed(regions);
+}
 }  // namespace inktty
@@ -21,12 +21,17 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <memory>
+#include <vector>
 
+#include <inktty/gfx/dither.hpp>
 #include <inktty/utils/color.hpp>
 #include <inktty/utils/geometry.hpp>
 
 namespace inktty {
+class PanelShadow;
+
 /**
  * The UpdateMode class represent a commit operation that updates the contents
  * of a epaper displays. Full colour backends normally ignore these update modes
@@ -205,19 +210,70 @@ public:
 	 * @param bg is the background color that should be used.
 	 * @param r is the target rectangle. The width and height of this rectangle
 	 * also determines the width/height of the source image.
+	 * @param binary may be set to true if the mask only contains the values 0
+	 * and 255 (e.g. monochrome glyphs), allowing to use a faster code path.
 	 */
 	virtual void blit(Layer layer, const RGBA &c, const uint8_t *mask,
 	                  size_t stride, const Rect &r,
-	                  DrawMode mode = DrawMode::Write) = 0;
+	                  DrawMode mode = DrawMode::Write, bool binary = false) = 0;
+
+	virtual void fill_dither(
+	    Layer layer, uint8_t g, const Rect &r = Rect(),
+	    dither::Pattern pattern = dither::Pattern::Ordered4x4) = 0;
 
-	virtual void fill_dither(Layer layer, uint8_t g,
-	                         const Rect &r = Rect()) = 0;
+	/**
+	 * Writes the given, fully composed and opaque image to the display. The
+	 * image replaces the content of all layers in the given rectangle, i.e.
+	 * it is copied to the background layer while the presentation layer is
+	 * cleared.
+	 *
+	 * @param img is a pointer at the first pixel of the image.
+	 * @param stride is the width of one line in the image in bytes.
+	 * @param r is the target rectangle. The width and height of this rectangle
+	 * also determines the width/height of the source image.
+	 */
+	virtual void blit_tile(const RGBA *img, size_t stride, const Rect &r) = 0;
 
 	/**
 	 * Fills the specified rectangle with the given solid colour.
 	 */
 	virtual void fill(Layer layer, const RGBA &c = RGBA::White,
 	                  const Rect &r = Rect()) = 0;
+
+	/**
+	 * Moves the content of all layers in the given rectangle such that its
+	 * upper-left corner is located at the given point. Overlapping source and
+	 * target regions are allowed. Pixels in the source region which are not
+	 * covered by the target region keep their content. As with all other
+	 * drawing operations, the changed area must be committed.
+	 */
+	virtual void move(const Rect &r, const Point &p) = 0;
+
+	/**
+	 * Returns true if the given region of the display is currently being
+	 * updated, i.e. a previous commit touching this region has been submitted
+	 * to the hardware but has not finished yet. Drawing into such a region
+	 * and committing it either stalls until the update is complete or causes
+	 * tearing. Displays that update synchronously always return false, which is
+	 * the default implementation.
+	 */
+	virtual bool busy(const Rect &r);
+
+	/**
+	 * Appends the regions of all updates that were finished by the display
+	 * since the last call to completed() to the given vector. Displays that
+	 * update synchronously never report any regions, which is the default
+	 * implementation.
+	 */
+	virtual void completed(std::vector<Rect> &regions);
+
+	/**
+	 * Returns the cost model used to merge the regions committed to this
+	 * display. Displays with a large overhead per update, such as e-paper
+	 * displays, should return a larger update cost. The default
+	 * implementation returns the default cost model.
+	 */
+	virtual RectangleMerger::Cost update_cost() const;
 };
 
 /**
@@ -226,7 +282,26 @@ public:
  * do_lock(), do_unlock() functions.
  */
 class MemoryDisplay : public Display {
-protected:
+public:
+	/**
+	 * Pixel format used for the internal layers and the composite image.
+	 */
+	enum class Format {
+		/**
+		 * All layers are stored as RGBA. The composite image is passed to
+		 * do_unlock(). This is the default.
+		 */
+		RGBA,
+
+		/**
+		 * The background layer and the composite image are stored as 8-bit
+		 * greyscale values, the presentation layer as greyscale with alpha.
+		 * Colours are converted to their luminance when drawing. The
+		 * composite image is passed to do_unlock_greyscale().
+		 */
+		Y8
+	};
+
 	/**
 	 * Structure for storing the accumulated commit requests.
 	 */
@@ -235,6 +310,28 @@ protected:
 		UpdateMode mode;
 	};
 
+	/**
+	 * Interface of observers receiving the same content as the backend, e.g.
+	 * to stream the display content to a remote viewer.
+	 */
+	class Tap {
+	public:
+		virtual ~Tap() {}
+
+		/**
+		 * Called after the backend received the given commit requests, on
+		 * the same thread. "buf" contains the image of the entire display
+		 * rectangle "r" in the given format and is nullptr if nothing has
+		 * been drawn yet. The commit requests are in display coordinates,
+		 * i.e. relative to the origin of the display, not of the buffer.
+		 */
+		virtual void tap(const CommitRequest *begin, const CommitRequest *end,
+		                 const uint8_t *buf, size_t stride, const Rect &r,
+		                 Format format) = 0;
+	};
+
+protected:
+
 	/**
 	 * Must return the current size of the display and not change it until
 	 * unlock() is called.
@@ -247,6 +344,69 @@ protected:
 	virtual void do_unlock(const CommitRequest *begin, const CommitRequest *end,
 	                       const RGBA *buf, size_t stride) = 0;
 
+	/**
+	 * May be overriden by displays with an asynchronous update pipeline.
+	 * Returns true if the given region (in display coordinates) is still being
+	 * updated. The default implementation returns false.
+	 */
+	virtual bool do_busy(const Rect &r);
+
+	/**
+	 * May be overriden by displays with an asynchronous update pipeline.
+	 * Appends the regions (in display coordinates) of all finished updates to
+	 * the given vector. The default implementation does nothing.
+	 */
+	virtual void do_completed(std::vector<Rect> &regions);
+
+	/**
+	 * Called instead of do_unlock() if the display operates in the Y8 format.
+	 * The buffer contains one byte per pixel. The default implementation
+	 * converts the committed regions to RGBA and calls do_unlock().
+	 */
+	virtual void do_unlock_greyscale(const CommitRequest *begin,
+	                                 const CommitRequest *end,
+	                                 const uint8_t *buf, size_t stride);
+
+	/**
+	 * Calls the given function for the regions covered by the given commit
+	 * requests. If worker threads are enabled (see set_threads()) and the
+	 * regions are large enough, the regions are split into horizontal bands
+	 * that are processed in parallel. Each row is processed by exactly one
+	 * thread, and the function may be called with a region multiple times if
+	 * the commit requests overlap. The function returns once all regions have
+	 * been processed. May be used by display backends to convert the
+	 * composite image in do_unlock().
+	 */
+	void for_each_band(const CommitRequest *begin, const CommitRequest *end,
+	                   const std::function<void(const Rect &r)> &f);
+
+	/**
+	 * Selects the pixel format of the internal layers. Should be called by
+	 * the display backend before the display is locked for the first time,
+	 * e.g. in the constructor. Must not be called while the display is
+	 * locked. Changing the format discards the content of all layers.
+	 */
+	void set_format(Format format);
+
+	/**
+	 * Enables or disables tracking of the content shown on the panel, e.g.
+	 * for e-paper displays. If enabled, the commit requests passed to the
+	 * backend are reduced to the pixels that actually change on the panel
+	 * according to their update mode, including the mask operations that
+	 * depend on the current panel content. Should be called by the display
+	 * backend in the constructor; must not be called while the display is
+	 * locked.
+	 */
+	void set_panel_shadow(bool enabled);
+
+	/**
+	 * Returns the panel shadow or nullptr if it is disabled. Within
+	 * do_unlock() the shadow contains the panel content after the given
+	 * commit requests have been applied; it is indexed in the same way as
+	 * the buffer passed to do_unlock().
+	 */
+	const PanelShadow *panel_shadow() const;
+
 private:
 	class Impl;
 	std::unique_ptr<Impl> m_impl;
@@ -262,6 +422,60 @@ public:
 	 */
 	~MemoryDisplay();
 
+	/**
+	 * Returns the pixel format of the internal layers.
+	 */
+	Format format() const;
+
+	/**
+	 * Sets the number of worker threads used to compose the committed regions
+	 * and to convert them to the display format. Zero or one processes all
+	 * regions on the thread calling unlock(), which is the default. Must not
+	 * be called while the display is locked.
+	 */
+	void set_threads(unsigned int threads);
+
+	/**
+	 * Rotates the content of the display by the given number of quarter turns
+	 * counter-clockwise. The surface returned by lock() is rotated
+	 * accordingly, i.e. its width and height are swapped for odd rotations,
+	 * and all drawing operations happen in the rotated coordinate system. The
+	 * committed regions are rotated while being passed to the backend, such
+	 * that the rest of the application never has to deal with the
+	 * orientation. Must not be called while the display is locked. Changing
+	 * the rotation discards the content of all layers.
+	 */
+	void set_rotation(unsigned int rotation);
+
+	/**
+	 * Returns the number of quarter turns the display content is rotated by.
+	 */
+	unsigned int rotation() const;
+
+	/**
+	 * Enables or disables double buffering. In double buffered mode unlock()
+	 * copies the committed regions of the composite image into a front buffer
+	 * and returns immediately; a separate thread locks the backend and passes
+	 * the front buffer to it. Drawing the next frame thus overlaps with the
+	 * backend presenting the previous one. Must not be called while the
+	 * display is locked.
+	 */
+	void set_double_buffered(bool double_buffered);
+
+	/**
+	 * Blocks until the last frame has been passed to the backend. Display
+	 * backends using double buffering must call this function in their
+	 * destructor.
+	 */
+	void flush();
+
+	/**
+	 * Sets the observer receiving the content passed to the backend, or
+	 * removes it if nullptr is given. Waits for the presenter thread, must
+	 * not be called while the display is locked.
+	 */
+	void set_tap(Tap *tap);
+
 	/**
 	 * Locks the display. Drawing and commit operations are now allowed.
 	 * Performing a draw or commit operation without locking the surface has no
@@ -296,14 +510,25 @@ public:
 	 * @param bg is the background color that should be used.
 	 * @param r is the target rectangle. The width and height of this rectangle
 	 * also determines the width/height of the source image.
+	 * @param binary may be set to true if the mask only contains the values 0
+	 * and 255, reducing the blit operation to a select.
 	 */
 	void blit(Layer layer, const RGBA &c, const uint8_t *mask, size_t stride,
-	          const Rect &r, DrawMode mode = DrawMode::Write) override;
+	          const Rect &r, DrawMode mode = DrawMode::Write,
+	          bool binary = false) override;
 
 	/**
 	 * Fills the specified rectangle with the given dithering pattern.
 	 */
-	void fill_dither(Layer layer, uint8_t g, const Rect &r = Rect()) override;
+	void fill_dither(
+	    Layer layer, uint8_t g, const Rect &r = Rect(),
+	    dither::Pattern pattern = dither::Pattern::Ordered4x4) override;
+
+	/**
+	 * Copies the given image to the background layer and clears the
+	 * presentation layer in the given rectangle.
+	 */
+	void blit_tile(const RGBA *img, size_t stride, const Rect &r) override;
 
 	/**
 	 * Fills the specified rectangle with the given solid colour.
@@ -316,6 +541,23 @@ public:
 	 */
 	void fill(Layer layer, const RGBA &c = RGBA::White,
 	          const Rect &r = Rect()) override;
+
+	/**
+	 * Moves the content of the background and presentation layers.
+	 */
+	void move(const Rect &r, const Point &p) override;
+
+	/**
+	 * Translates the given rectangle into display coordinates, taking the
+	 * rotation into account, and forwards it to do_busy().
+	 */
+	bool busy(const Rect &r) override;
+
+	/**
+	 * Fetches the finished regions from do_completed() and translates them
+	 * back into the coordinate system returned by lock().
+	 */
+	void completed(std::vector<Rect> &regions) override;
 };
 }  // namespace inktty
 
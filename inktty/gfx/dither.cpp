@@ -16,6 +16,9 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cstring>
+
 #include <inktty/gfx/dither.hpp>
 
 namespace inktty {
@@ -141,17 +144,152 @@ static const uint8_t DITHER_PATTERNS_4BIT[16][4][4] = {
         {0xFF, 0xFF, 0xFF, 0xFF},
     }};
 
-void ordered_binary_4bit_greyscale(uint8_t g, RGBA *tar, size_t tar_stride,
-                                   int tar_x0, int tar_y0, int tar_x1,
-                                   int tar_y1) {
+/**
+ * Classic 8x8 Bayer threshold matrix.
+ */
+static const uint8_t BAYER_8X8[8][8] = {
+    {0, 32, 8, 40, 2, 34, 10, 42},   {48, 16, 56, 24, 50, 18, 58, 26},
+    {12, 44, 4, 36, 14, 46, 6, 38},  {60, 28, 52, 20, 62, 30, 54, 22},
+    {3, 35, 11, 43, 1, 33, 9, 41},   {51, 19, 59, 27, 49, 17, 57, 25},
+    {15, 47, 7, 39, 13, 45, 5, 37},  {63, 31, 55, 23, 61, 29, 53, 21},
+};
+
+/**
+ * 16x16 blue noise threshold matrix generated with the void-and-cluster
+ * algorithm (Gaussian filter with sigma = 1.9, toroidal distances).
+ */
+static const uint8_t BLUE_NOISE_16X16[16][16] = {
+    {252, 131,  58,  10, 227, 146, 191,  81,  40, 204, 106,  29, 229,  42, 164,  66},
+    { 16, 215,  34, 240,  94,  43, 109, 166,  12,  69, 213, 132,  77, 114,  22, 148},
+    { 93, 167, 113, 177,  65, 210, 248, 141, 232, 186,  47, 153, 180, 239, 208, 190},
+    { 46,  75, 202, 135, 157,   3, 124,  24,  88, 119, 245,  98,   2,  56, 138, 105},
+    {224,   6, 235,  25,  80, 195,  50, 222,  60, 161,  17, 194, 218,  82,  35, 246},
+    {121, 145,  54,  97, 254, 181, 102, 172, 205,  33, 144,  70, 125, 170, 155, 183},
+    { 28, 192, 168, 129, 217,  37, 150,  74, 241, 111, 228,  44, 255, 100,  11,  67},
+    {221, 107, 209,  14,  63, 118,  20, 130,   7,  92, 178, 137,  23, 206, 233,  89},
+    {136,  76,  41, 158,  86, 244, 225, 187, 156,  55, 214,  79, 189, 116,  51, 162},
+    {250,   1, 238, 185, 203, 140,  48,  99, 199,  30, 163,   5,  64, 149,  36, 198},
+    {173,  95,  57, 110,  31, 175,  13,  68, 251, 123, 231, 108, 243, 219, 127,  18},
+    {112, 230, 151, 128,  78, 234, 115, 216,  84, 142,  45, 169,  96, 182,  83,  61},
+    {212,  27, 188,   8, 211, 165,  38, 152, 184,  21,  72, 207,  32,  15, 247, 159},
+    { 73, 139,  49, 249,  90,  59, 133, 103,   0, 196, 237, 117, 134,  52, 143, 201},
+    { 39, 226, 104, 171,  19, 200, 242, 223,  53,  91, 160,  62, 220, 193, 101,   4},
+    {179,  85, 197, 154, 120,  71,  26, 174, 126, 253, 147,   9, 176,  87, 236, 122},
+};
+
+namespace {
+/**
+ * All patterns for all greyscale values, repeated to fill a MAX_PERIOD x
+ * MAX_PERIOD tile. This way the drawing code does not need to know about the
+ * period of the individual patterns.
+ */
+struct Tables {
+	uint8_t tiles[3][16][MAX_PERIOD][MAX_PERIOD];
+
+	Tables() {
+		for (int g = 0; g < 16; g++) {
+			for (int y = 0; y < MAX_PERIOD; y++) {
+				for (int x = 0; x < MAX_PERIOD; x++) {
+					tiles[0][g][y][x] = DITHER_PATTERNS_4BIT[g][y & 3][x & 3];
+					tiles[1][g][y][x] =
+					    threshold(BAYER_8X8[y & 7][x & 7], 64, g);
+					tiles[2][g][y][x] =
+					    threshold(BLUE_NOISE_16X16[y][x], 256, g);
+				}
+			}
+		}
+	}
+
+	/**
+	 * Pixels with a threshold below the fraction g / 15 of the n thresholds
+	 * in the matrix are white.
+	 */
+	static uint8_t threshold(int t, int n, int g) {
+		return (t * 15 < g * n) ? 0xFF : 0x00;
+	}
+};
+
+const Tables &tables() {
+	static const Tables tables;
+	return tables;
+}
+}  // namespace
+
+int period(Pattern pattern) {
+	switch (pattern) {
+		case Pattern::Ordered4x4:
+			return 4;
+		case Pattern::Bayer8x8:
+			return 8;
+		case Pattern::BlueNoise16x16:
+			return 16;
+	}
+	return MAX_PERIOD;
+}
+
+static inline void set_pixel(RGBA &p, uint8_t v) { p = RGBA(v, v, v, 0xFF); }
+
+static inline void set_pixel(GreyA &p, uint8_t v) { p = GreyA(v, 0xFF); }
+
+static inline void set_pixel(uint8_t &p, uint8_t v) { p = v; }
+
+template <typename T>
+static void ordered_binary_4bit_greyscale_impl(uint8_t g, T *tar,
+                                               size_t tar_stride, int tar_x0,
+                                               int tar_y0, int tar_x1,
+                                               int tar_y1, Pattern pattern) {
+	const int w = tar_x1 - tar_x0, n = std::min(w, MAX_PERIOD);
+	if (w <= 0) {
+		return;
+	}
+
+	/* Each row of the tile is converted to the target format once, starting
+	   at the phase of the first target column. Since the tile width is a
+	   multiple of all pattern periods, the converted row can be stamped onto
+	   the target in blocks of MAX_PERIOD pixels. */
+	alignas(16) uint8_t buf[MAX_PERIOD][MAX_PERIOD * sizeof(T)];
+	bool converted[MAX_PERIOD] = {false};
+	const auto &tile = tables().tiles[int(pattern)][g & 0xF];
 	for (int y = tar_y0; y < tar_y1; y++) {
-		RGBA *p_tar = tar + y * tar_stride / 4 + tar_x0;
-		for (int x = tar_x0; x < tar_x1; x++) {
-			const uint8_t v = DITHER_PATTERNS_4BIT[g & 0xF][y & 0x3][x & 0x3];
-			*(p_tar++) = RGBA(v, v, v, 0xFF);
+		const int ty = y & (MAX_PERIOD - 1);
+		T *pattern_row = reinterpret_cast<T *>(buf[ty]);
+		if (!converted[ty]) {
+			for (int i = 0; i < n; i++) {
+				set_pixel(pattern_row[i],
+				          tile[ty][(tar_x0 + i) & (MAX_PERIOD - 1)]);
+			}
+			converted[ty] = true;
+		}
+
+		T *p_tar = tar + y * tar_stride / sizeof(T) + tar_x0;
+		int x = 0;
+		for (; x + MAX_PERIOD <= w; x += MAX_PERIOD) {
+			memcpy(p_tar + x, pattern_row, MAX_PERIOD * sizeof(T));
 		}
+		memcpy(p_tar + x, pattern_row, (w - x) * sizeof(T));
 	}
 }
+
+void ordered_binary_4bit_greyscale(uint8_t g, RGBA *tar, size_t tar_stride,
+                                   int tar_x0, int tar_y0, int tar_x1,
+                                   int tar_y1, Pattern pattern) {
+	ordered_binary_4bit_greyscale_impl(g, tar, tar_stride, tar_x0, tar_y0,
+	                                   tar_x1, tar_y1, pattern);
+}
+
+void ordered_binary_4bit_greyscale(uint8_t g, GreyA *tar, size_t tar_stride,
+                                   int tar_x0, int tar_y0, int tar_x1,
+                                   int tar_y1, Pattern pattern) {
+	ordered_binary_4bit_greyscale_impl(g, tar, tar_stride, tar_x0, tar_y0,
+	                                   tar_x1, tar_y1, pattern);
+}
+
+void ordered_binary_4bit_greyscale(uint8_t g, uint8_t *tar, size_t tar_stride,
+                                   int tar_x0, int tar_y0, int tar_x1,
+                                   int tar_y1, Pattern pattern) {
+	ordered_binary_4bit_greyscale_impl(g, tar, tar_stride, tar_x0, tar_y0,
+	                                   tar_x1, tar_y1, pattern);
+}
 }  // namespace dither
 }  // namespace inktty
 
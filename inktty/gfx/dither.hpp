@@ -26,10 +26,46 @@
 
 namespace inktty {
 namespace dither {
+/**
+ * Threshold patterns that can be used to represent greyscale values with
+ * black and white pixels. All patterns are tiled over the screen, so drawing
+ * with any of them costs the same.
+ */
+enum class Pattern {
+	/**
+	 * Hand-tuned 4x4 pattern with a regular structure, well suited for the
+	 * small cells of a terminal.
+	 */
+	Ordered4x4,
+
+	/**
+	 * Classic 8x8 Bayer matrix.
+	 */
+	Bayer8x8,
+
+	/**
+	 * 16x16 blue noise threshold matrix, avoids regular structures at the cost
+	 * of a grainier appearance.
+	 */
+	BlueNoise16x16
+};
+
+/**
+ * Returns the width and height of the tile the given pattern repeats with.
+ * This is at most MAX_PERIOD.
+ */
+int period(Pattern pattern);
+
+/**
+ * Largest value returned by period().
+ */
+static constexpr int MAX_PERIOD = 16;
+
 /**
  * Fills the memory region indicated by tar, tar_stride, tar_x0, tar_y0, tar_x1,
  * tar_y1 with a binary ordered dithering pattern to represent a greyscale value
- * between 0 and 16.
+ * between 0 and 16. The pattern is aligned to the origin of the target memory
+ * region.
  *
  * @param g is the greyscale value between 0 and 15 that should be used to
  * select the dithering pattern.
@@ -38,10 +74,25 @@ namespace dither {
  * @param tar_stride is the distance between two consecutive rows in memory in
  * bytes.
  * @param tar_x0, tar_y0, tar_x1, tar_y1 specify the target rectangle in pixels.
+ * @param pattern is the threshold pattern that should be used.
  */
 void ordered_binary_4bit_greyscale(uint8_t g, RGBA *tar, size_t tar_stride,
                                    int tar_x0, int tar_y0, int tar_x1,
-                                   int tar_y1);
+                                   int tar_y1,
+                                   Pattern pattern = Pattern::Ordered4x4);
+
+/**
+ * Greyscale variants of ordered_binary_4bit_greyscale() for displays operating
+ * in greyscale mode.
+ */
+void ordered_binary_4bit_greyscale(uint8_t g, GreyA *tar, size_t tar_stride,
+                                   int tar_x0, int tar_y0, int tar_x1,
+                                   int tar_y1,
+                                   Pattern pattern = Pattern::Ordered4x4);
+void ordered_binary_4bit_greyscale(uint8_t g, uint8_t *tar, size_t tar_stride,
+                                   int tar_x0, int tar_y0, int tar_x1,
+                                   int tar_y1,
+                                   Pattern pattern = Pattern::Ordered4x4);
 }  // namespace dither
 }  // namespace inktty
 
@@ -16,73 +16,105 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <vector>
+
 #include <inktty/gfx/epaper_emulation.hpp>
 
 namespace inktty {
 namespace epaper_emulation {
-void update(uint8_t *tar, size_t tar_stride, const ColorLayout &tar_layout,
-            const RGBA *src, size_t src_stride, int x0, int y0, int x1, int y1,
-            UpdateMode mode) {
-	const int tar_bypp = tar_layout.bypp();
-	for (int y = y0; y < y1; y++) {
-		uint8_t *ptar = tar + y * tar_stride + x0 * tar_bypp;
-		RGBA const *psrc = src + y * src_stride / sizeof(RGBA) + x0;
-		for (int x = 0; x < x1 - x0; x++) {
-			// Read the current color in the target surface, as well as the
-			// source surface
-			uint32_t c_tar32 = 0;
-			for (int k = 0; k < tar_bypp; k++) {
-				c_tar32 |= ptar[k] << (8 * k);
+namespace {
+/**
+ * Lookup tables for all combinations of output and mask operations.
+ */
+struct Tables {
+	uint8_t lut[8][8][256];
+
+	Tables() {
+		for (unsigned int o = 0; o < 8; o++) {
+			for (unsigned int m = 0; m < 8; m++) {
+				for (unsigned int i = 0; i < 256; i++) {
+					lut[o][m][i] = entry(o, m, i >> 4U, i & 0x0FU);
+				}
 			}
-			RGBA c_tar = tar_layout.conv_to_rgba(c_tar32);
-			RGBA c_src = *(psrc++);
+		}
+	}
 
-			// Convert all colours to 16 bit greyscale
-			uint8_t g_tar = rgba_to_greyscale(c_tar);
-			uint8_t g_src = rgba_to_greyscale(c_src);
+	static uint8_t entry(unsigned int o, unsigned int m, uint8_t g_src,
+	                     uint8_t g_tar) {
+		// Apply the output operation (except for "white")
+		if (o & UpdateMode::Invert) {
+			g_src = 15U - g_src;
+		}
+		if (o & UpdateMode::ForceMono) {
+			g_src = (g_src > 7U) ? 15U : 0U;
+		}
 
-			// Apply the output operation (except for "white")
-			if (mode.output_op & UpdateMode::Invert) {
-				g_src = 15U - g_src;
-			}
-			if (mode.output_op & UpdateMode::ForceMono) {
-				g_src = (g_src > 7U) ? 15U : 0U;
-			}
+		// Compute the update mask, i.e. skip updating pixels that do not
+		// match the specified operation
+		bool masked = false;
+		if ((m & UpdateMode::SourceMono) && g_src != 0U && g_src != 15U) {
+			masked = true;
+		}
+		if ((m & UpdateMode::TargetMono) && g_tar != 0U && g_tar != 15U) {
+			masked = true;
+		}
+		if ((m & UpdateMode::Partial) && g_tar == g_src) {
+			masked = true;
+		}
 
-			// Compute the update mask, i.e. skip updating pixels that do not
-			// match the specified operation
-			bool masked = false;
-			if (mode.mask_op & UpdateMode::SourceMono) {
-				if (g_src != 0U && g_src != 15U) {
-					masked = true;
-				}
-			}
-			if (mode.mask_op & UpdateMode::TargetMono) {
-				if (g_tar != 0U && g_tar != 15U) {
-					masked = true;
-				}
-			}
-			if (mode.mask_op & UpdateMode::Partial) {
-				if (g_tar == g_src) {
-					masked = true;
-				}
-			}
+		if (o & UpdateMode::White) {
+			g_src = 15U;
+		}
+		return masked ? g_tar : (g_src | UPDATED);
+	}
+};
+}  // namespace
 
-			if (mode.output_op & UpdateMode::White) {
-				g_src = 15U;
-			}
+const uint8_t *lut(const UpdateMode &mode) {
+	static const Tables tables;
+	return tables.lut[mode.output_op & 7U][mode.mask_op & 7U];
+}
 
-			// Write the processed target color back
-			uint32_t cc;
-			if (!masked) {
-				cc = tar_layout.conv_from_rgba(greyscale_to_rgba(g_src));
-			} else {
-				cc = tar_layout.conv_from_rgba(greyscale_to_rgba(g_tar));
+void update(uint8_t *tar, size_t tar_stride, const PixelFormat &tar_format,
+            const RGBA *src, size_t src_stride, int x0, int y0, int x1, int y1,
+            UpdateMode mode) {
+	if (x1 <= x0 || y1 <= y0) {
+		return;
+	}
+
+	// Scratch buffers holding the current content of the target row and the
+	// new content as 8-bit greyscale values
+	std::vector<RGBA> row(x1);
+	std::vector<uint8_t> res(x1);
+	const PixelFormat::Type type = tar_format.type();
+	const uint8_t *l = lut(mode);
+	for (int y = y0; y < y1; y++) {
+		uint8_t *ptar = tar + y * tar_stride;
+		RGBA const *psrc = src + y * src_stride / sizeof(RGBA);
+
+		// Fetch the current content as 4-bit greyscale values
+		uint8_t *g = res.data();
+		if (type == PixelFormat::Type::Y8) {
+			for (int x = x0; x < x1; x++) {
+				g[x] = ptar[x] >> 4U;
+			}
+		} else if (type == PixelFormat::Type::Y4) {
+			for (int x = x0; x < x1; x++) {
+				g[x] = (ptar[x / 2] >> ((x & 1) * 4)) & 0x0FU;
 			}
-			for (int k = 0; k < tar_bypp; k++) {
-				*(ptar++) = (cc >> (8 * k)) & 0xFF;
+		} else {
+			tar_format.to_rgba(row.data(), ptar, x0, x1);
+			for (int x = x0; x < x1; x++) {
+				g[x] = rgba_to_greyscale(row[x]);
 			}
 		}
+
+		// Look up the new content and write it back
+		for (int x = x0; x < x1; x++) {
+			const uint8_t s = rgba_to_greyscale(psrc[x]);
+			g[x] = (l[(s << 4U) | g[x]] & 0x0FU) * 17U;
+		}
+		tar_format.from_grey(ptar, g, x0, x1);
 	}
 }
 
@@ -94,8 +126,9 @@ uint8_t rgba_to_greyscale(const RGBA &x) {
 }
 
 RGBA greyscale_to_rgba(uint8_t g) {
-	const uint8_t lookup[16] = {0,   17,  34,  51,  68,  85,  102, 119,
-	                            136, 153, 170, 187, 204, 221, 238, 255};
+	static const uint8_t lookup[16] = {0,   17,  34,  51,  68,  85,
+	                                   102, 119, 136, 153, 170, 187,
+	                                   204, 221, 238, 255};
 	const uint8_t x = lookup[g & 0x0F];
 	return RGBA{x, x, x, 0xFF};
 }
@@ -20,14 +20,30 @@
 #define INKTTY_BACKENDS_EPAPER_EMULATION_HPP
 
 #include <inktty/gfx/display.hpp>
+#include <inktty/gfx/pixel_format.hpp>
 
 namespace inktty {
 namespace epaper_emulation {
 /**
- * EPaperEmulation::update() is used in the SDLBackend epaper emulation
- * mode. This mode is mostly used for development purposes.
+ * Flag set in the entries of the lookup tables returned by lut() if the pixel
+ * is updated, i.e. not masked by the mask operation.
  */
-void update(uint8_t *tar, size_t tar_stride, const ColorLayout &tar_layout,
+static constexpr uint8_t UPDATED = 0x10;
+
+/**
+ * Returns a lookup table with 256 entries describing the given update mode.
+ * Entry (s << 4) | t contains the 4-bit greyscale value a pixel currently
+ * showing t shows after it has been updated with the new content s. The
+ * UPDATED flag is set in the entry if the pixel is not masked.
+ */
+const uint8_t *lut(const UpdateMode &mode);
+
+/**
+ * EPaperEmulation::update() emulates the given update of an e-paper display
+ * on the given target surface. This mode is mostly used for development
+ * purposes.
+ */
+void update(uint8_t *tar, size_t tar_stride, const PixelFormat &tar_format,
             const RGBA *src, size_t src_stride, int x0, int y0, int x1, int y1,
             UpdateMode mode);
 
@@ -16,7 +16,11 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <stdexcept>
+
 #include <inktty/gfx/font.hpp>
+#include <inktty/utils/profile.hpp>
 
 namespace inktty {
 
@@ -28,5 +32,227 @@ Font::~Font() {
 	// Do nothing here
 }
 
+void Font::prefetch(const uint32_t *, size_t, unsigned int, bool,
+                    unsigned int) {
+	// Do nothing here
+}
+
+const GlyphBitmap *Font::render_styled(uint32_t glyph, unsigned int size, bool,
+                                       bool, bool monochrome,
+                                       unsigned int orientation) {
+	return render(glyph, size, monochrome, orientation);
+}
+
+size_t Font::reclaim() { return 0; }
+
+/******************************************************************************
+ * Class FontFamily::Impl                                                     *
+ ******************************************************************************/
+
+class FontFamily::Impl {
+private:
+	/**
+	 * Number of variants, i.e. combinations of bold and italic. The variant
+	 * index has the bit 0 set for bold and bit 1 set for italic faces.
+	 */
+	static constexpr size_t N_VARIANTS = 4;
+
+	/**
+	 * Number of entries in the table remembering which face provides a glyph.
+	 */
+	static constexpr size_t RESOLVED_SIZE = 4096;
+
+	/**
+	 * Entry in the direct-mapped table of resolved glyphs. "face" is the
+	 * index of the face providing the glyph or MISSING if no face in the
+	 * fallback chain contains the glyph.
+	 */
+	struct Resolved {
+		uint32_t glyph;
+		uint8_t variant;
+		uint8_t face;
+		bool valid;
+	};
+
+	static constexpr uint8_t MISSING = 0xFF;
+
+	std::vector<std::unique_ptr<Font>> m_faces;
+
+	/**
+	 * Faces added for each variant, in the order they were added.
+	 */
+	std::vector<uint8_t> m_variant_faces[N_VARIANTS];
+
+	/**
+	 * Fallback chain of each variant: the faces of the variant, followed by
+	 * the faces of the less specific variants.
+	 */
+	std::vector<uint8_t> m_chains[N_VARIANTS];
+
+	std::vector<Resolved> m_resolved;
+
+	/**
+	 * Glyphs passed to prefetch(), sorted by face.
+	 */
+	std::vector<uint32_t> m_prefetch[MAX_FACES];
+
+	static size_t variant(bool bold, bool italic) {
+		return (bold ? 1U : 0U) | (italic ? 2U : 0U);
+	}
+
+	void update_chains() {
+		for (size_t v = 0; v < N_VARIANTS; v++) {
+			std::vector<uint8_t> &chain = m_chains[v];
+			chain.clear();
+			for (size_t w : {v, v & 1U, v & 2U, size_t(0U)}) {
+				for (uint8_t face : m_variant_faces[w]) {
+					if (std::find(chain.begin(), chain.end(), face) ==
+					    chain.end()) {
+						chain.push_back(face);
+					}
+				}
+			}
+		}
+		m_resolved.assign(RESOLVED_SIZE, Resolved{0, 0, 0, false});
+	}
+
+	Resolved &resolved(uint32_t glyph, size_t v) {
+		return m_resolved[((glyph * 0x9E3779B1U) ^ v) % RESOLVED_SIZE];
+	}
+
+public:
+	Impl() : m_resolved(RESOLVED_SIZE, Resolved{0, 0, 0, false}) {}
+
+	void add(std::unique_ptr<Font> face, Weight weight, Style style) {
+		if (m_faces.size() >= MAX_FACES) {
+			throw std::runtime_error("Too many font faces");
+		}
+		const size_t v =
+		    variant(weight >= Weight::Bold, style == Style::Italic);
+		m_variant_faces[v].push_back(m_faces.size());
+		m_faces.emplace_back(std::move(face));
+		update_chains();
+	}
+
+	size_t size() const { return m_faces.size(); }
+
+	const GlyphBitmap *render(uint32_t glyph, unsigned int size, bool bold,
+	                          bool italic, bool monochrome,
+	                          unsigned int orientation) {
+		// Look up the face providing the glyph
+		const size_t v = variant(bold, italic);
+		Resolved &r = resolved(glyph, v);
+		if (r.valid && r.glyph == glyph && r.variant == v) {
+			if (r.face == MISSING) {
+				INKTTY_PROFILE_COUNT(GlyphHit);
+				return nullptr;
+			}
+			const GlyphBitmap *res =
+			    m_faces[r.face]->render(glyph, size, monochrome, orientation);
+			if (res) {
+				return res;
+			}
+		}
+
+		// Walk along the fallback chain and remember the result
+		r = Resolved{glyph, uint8_t(v), MISSING, true};
+		for (uint8_t face : m_chains[v]) {
+			const GlyphBitmap *res =
+			    m_faces[face]->render(glyph, size, monochrome, orientation);
+			if (res) {
+				r.face = face;
+				return res;
+			}
+		}
+		return nullptr;
+	}
+
+	void prefetch(const uint32_t *glyphs, size_t n, unsigned int size,
+	              bool monochrome, unsigned int orientation) {
+		if (m_chains[0].empty()) {
+			return;
+		}
+
+		// Hand the glyphs to the faces known to provide them, unknown glyphs
+		// to the first regular face
+		for (size_t i = 0; i < n; i++) {
+			const Resolved &r = resolved(glyphs[i], 0);
+			if (!r.valid || r.glyph != glyphs[i] || r.variant != 0) {
+				m_prefetch[m_chains[0][0]].push_back(glyphs[i]);
+			} else if (r.face != MISSING) {
+				m_prefetch[r.face].push_back(glyphs[i]);
+			}
+		}
+		for (size_t face = 0; face < m_faces.size(); face++) {
+			std::vector<uint32_t> &g = m_prefetch[face];
+			if (!g.empty()) {
+				m_faces[face]->prefetch(g.data(), g.size(), size, monochrome,
+				                        orientation);
+				g.clear();
+			}
+		}
+	}
+
+	MonospaceFontMetrics metrics(int size) const {
+		if (m_variant_faces[0].empty()) {
+			return MonospaceFontMetrics{0, 0, 0};
+		}
+		return m_faces[m_variant_faces[0][0]]->metrics(size);
+	}
+
+	size_t reclaim() {
+		size_t res = 0;
+		for (const std::unique_ptr<Font> &face : m_faces) {
+			res += face->reclaim();
+		}
+		return res;
+	}
+};
+
+constexpr size_t FontFamily::Impl::N_VARIANTS;
+constexpr size_t FontFamily::Impl::RESOLVED_SIZE;
+constexpr uint8_t FontFamily::Impl::MISSING;
+
+/******************************************************************************
+ * Class FontFamily                                                           *
+ ******************************************************************************/
+
+constexpr size_t FontFamily::MAX_FACES;
+
+FontFamily::FontFamily() : m_impl(new Impl()) {}
+
+FontFamily::~FontFamily() {
+	// Do nothing here, implicitly destroy m_impl
+}
+
+void FontFamily::add(std::unique_ptr<Font> face, Weight weight, Style style) {
+	m_impl->add(std::move(face), weight, style);
+}
+
+size_t FontFamily::size() const { return m_impl->size(); }
+
+const GlyphBitmap *FontFamily::render(uint32_t glyph, unsigned int size,
+                                      bool monochrome,
+                                      unsigned int orientation) {
+	return m_impl->render(glyph, size, false, false, monochrome, orientation);
+}
+
+const GlyphBitmap *FontFamily::render_styled(uint32_t glyph, unsigned int size,
+                                             bool bold, bool italic,
+                                             bool monochrome,
+                                             unsigned int orientation) {
+	return m_impl->render(glyph, size, bold, italic, monochrome, orientation);
+}
+
+void FontFamily::prefetch(const uint32_t *glyphs, size_t n, unsigned int size,
+                          bool monochrome, unsigned int orientation) {
+	m_impl->prefetch(glyphs, n, size, monochrome, orientation);
+}
+
+MonospaceFontMetrics FontFamily::metrics(int size) const {
+	return m_impl->metrics(size);
+}
+
+size_t FontFamily::reclaim() { return m_impl->reclaim(); }
 
 }  // namespace inktty
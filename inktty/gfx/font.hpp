@@ -31,7 +31,9 @@
 #ifndef INKTTY_GFX_FONT_HPP
 #define INKTTY_GFX_FONT_HPP
 
+#include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <vector>
 
 namespace inktty {
@@ -63,13 +65,21 @@ struct GlyphMetadata {
 	 */
 	unsigned int orientation;
 
+	/**
+	 * Identifier of the font face the glyph was rendered with. Allows the
+	 * faces of a FontFamily to share a single FontCache. Zero for fonts that
+	 * do not share their cache.
+	 */
+	uint8_t face;
+
 	/**
 	 * Returns true if two GlyphMetadata instances are equal.
 	 */
 	bool operator==(const GlyphMetadata &o) const
 	{
 		return glyph == o.glyph && size == o.size &&
-		       monochrome == o.monochrome && orientation == o.orientation;
+		       monochrome == o.monochrome && orientation == o.orientation &&
+		       face == o.face;
 	}
 };
 
@@ -79,9 +89,10 @@ struct GlyphMetadata {
 class GlyphBitmap {
 private:
 	/**
-	 * Vector storing the glyph bitmap.
+	 * Pointer at the glyph bitmap. The memory is owned by the FontCache the
+	 * glyph is stored in.
 	 */
-	std::vector<uint8_t> m_buf;
+	uint8_t *m_buf;
 
 public:
 	/**
@@ -119,10 +130,10 @@ public:
 	/**
 	 * Default constructor.
 	 */
-	GlyphBitmap() : x(0), y(0), w(0), h(0), stride(0) {}
+	GlyphBitmap() : m_buf(nullptr), x(0), y(0), w(0), h(0), stride(0) {}
 
 	/**
-	 * Allocates memory for a glyph bitmap of the given size.
+	 * Describes a glyph bitmap of the given size.
 	 *
 	 * @param x is the x-offset that should be applied when blitting the bitmap.
 	 * @param y is the y-offset that should be applied when blitting the bitmap.
@@ -130,10 +141,11 @@ public:
 	 * @param h is the height of the bitmap in pixels.
 	 * @param stride is the size of one bitmap line in bytes.
 	 * @param metadata is the metadata describing the glyph and its style.
+	 * @param buf is the memory holding at least h * stride bytes.
 	 */
 	GlyphBitmap(int x, int y, unsigned int w, unsigned int h,
-	            unsigned int stride, GlyphMetadata metadata)
-	    : m_buf(h * stride, 0U),
+	            unsigned int stride, GlyphMetadata metadata, uint8_t *buf)
+	    : m_buf(buf),
 	      x(x),
 	      y(y),
 	      w(w),
@@ -146,12 +158,12 @@ public:
 	/**
 	 * Returns a pointer at the bitmap containing the Glyph data.
 	 */
-	const uint8_t *buf() const { return &m_buf[0]; }
+	const uint8_t *buf() const { return m_buf; }
 
 	/**
 	 * Returns a pointer at the bitmap containing the Glyph data.
 	 */
-	uint8_t *buf() { return &m_buf[0]; }
+	uint8_t *buf() { return m_buf; }
 };
 
 /**
@@ -199,6 +211,28 @@ public:
 	                          bool monochrome = false,
 	                          unsigned int orientation = 0) = 0;
 
+	/**
+	 * Hint that the given glyphs will be rendered soon. Fonts that are able to
+	 * rasterise glyphs in the background may start doing so. The default
+	 * implementation does nothing.
+	 *
+	 * @param glyphs is a list of Unicode codepoints.
+	 * @param n is the number of codepoints in the list.
+	 */
+	virtual void prefetch(const uint32_t *glyphs, size_t n, unsigned int size,
+	                      bool monochrome = false,
+	                      unsigned int orientation = 0);
+
+	/**
+	 * Renders the given glyph using the bold and/or italic variant of the
+	 * font. Fonts consisting of a single face do not have any variants; the
+	 * default implementation ignores the style and calls render().
+	 */
+	virtual const GlyphBitmap *render_styled(uint32_t glyph, unsigned int size,
+	                                         bool bold, bool italic,
+	                                         bool monochrome = false,
+	                                         unsigned int orientation = 0);
+
 	/**
 	 * Returns the font metrics assuming this font is a monospace font.
 	 *
@@ -207,17 +241,25 @@ public:
 	 * height in pixels.
 	 */
 	virtual MonospaceFontMetrics metrics(int size) const = 0;
+
+	/**
+	 * Releases memory held by rendered glyphs, which are rendered again when
+	 * needed, e.g. in response to memory pressure. Invalidates all glyph
+	 * bitmaps returned so far. Returns the number of bytes released. The
+	 * default implementation does nothing.
+	 */
+	virtual size_t reclaim();
 };
 
 /**
  * The FontFamily class groups multiple variants of the same font, for example
- * a regular, italic, and bold version of the font.
+ * a regular, italic, and bold version of the font. Each variant consists of a
+ * chain of faces; glyphs missing in one face are looked up in the next one,
+ * followed by the faces of the less specific variants. Which face provides a
+ * glyph, or that no face does, is remembered in a fixed-size table, such that
+ * rendering missing or fallback glyphs only costs a lookup.
  */
-class FontFamily {
-private:
-/*	class Impl;
-	std::unique_ptr<Impl> m_impl;*/
-
+class FontFamily : public Font {
 public:
 	enum class Style {
 		Regular, Italic
@@ -227,7 +269,69 @@ public:
 		Regular = 400, Bold = 700
 	};
 
+private:
+	class Impl;
+	std::unique_ptr<Impl> m_impl;
+
+public:
+	/**
+	 * Maximum number of faces in a family.
+	 */
+	static constexpr size_t MAX_FACES = 16;
+
+	/**
+	 * Creates an empty font family. At least one regular face must be added
+	 * before the family is used.
+	 */
+	FontFamily();
 
+	~FontFamily() override;
+
+	/**
+	 * Appends the given face to the fallback chain of the given variant. The
+	 * first regular face determines the metrics of the family. Throws an
+	 * exception if the family already has MAX_FACES faces.
+	 */
+	void add(std::unique_ptr<Font> face, Weight weight = Weight::Regular,
+	         Style style = Style::Regular);
+
+	/**
+	 * Returns the number of faces in the family.
+	 */
+	size_t size() const;
+
+	/**
+	 * Renders the given glyph using the regular variant.
+	 */
+	const GlyphBitmap *render(uint32_t glyph, unsigned int size,
+	                          bool monochrome = false,
+	                          unsigned int orientation = 0) override;
+
+	/**
+	 * Renders the given glyph using the first face in the fallback chain of
+	 * the given variant that contains the glyph.
+	 */
+	const GlyphBitmap *render_styled(uint32_t glyph, unsigned int size,
+	                                 bool bold, bool italic,
+	                                 bool monochrome = false,
+	                                 unsigned int orientation = 0) override;
+
+	/**
+	 * Forwards the hint to all regular faces.
+	 */
+	void prefetch(const uint32_t *glyphs, size_t n, unsigned int size,
+	              bool monochrome = false,
+	              unsigned int orientation = 0) override;
+
+	/**
+	 * Returns the metrics of the first regular face.
+	 */
+	MonospaceFontMetrics metrics(int size) const override;
+
+	/**
+	 * Releases the memory held by all faces.
+	 */
+	size_t reclaim() override;
 };
 
 }  // namespace inktty
@@ -39,7 +39,7 @@ private:
 public:
 	Impl(const uint8_t *mem, int stride, int width, int height, int n,
 	     const uint32_t *codepage)
-	    : m_cache(1024),
+	    : m_cache(256 * 1024),
 	      m_mem(mem),
 	      m_stride(stride),
 	      m_w(width),
@@ -54,8 +54,8 @@ public:
 	const GlyphBitmap *render(uint32_t glyph, unsigned int, bool,
 	                          unsigned int orientation) {
 		// Check whether the glyph is cached, if yes, just return the cached
-		// glyph
-		GlyphMetadata metadata{glyph, 0, false, orientation};
+		// glyph. Bitmap fonts are always rendered monochrome.
+		GlyphMetadata metadata{glyph, 0, true, orientation, 0};
 		GlyphBitmap *res = m_cache.get(metadata);
 		if (res) {
 			return res;
@@ -16,54 +16,206 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
 #include <inktty/gfx/font_cache.hpp>
 
 namespace inktty {
 
-FontCache::FontCache(unsigned int max_cache_size)
-    : m_max_cache_size(max_cache_size) {}
+/******************************************************************************
+ * Class FontCache                                                            *
+ ******************************************************************************/
 
-GlyphBitmap *FontCache::get(const GlyphMetadata &metadata) {
-		// Construct the cache key and look it up in the glyph cache
-		auto it = m_glyph_cache_map.find(metadata);
-		if (it == m_glyph_cache_map.end()) {
-			return nullptr;
+constexpr size_t FontCache::MIN_SLOT_SIZE;
+constexpr size_t FontCache::PAGE_SIZE;
+
+static constexpr size_t NPOS = std::numeric_limits<size_t>::max();
+
+FontCache::Atlas::Atlas(size_t slot_size)
+    : slot_size(slot_size),
+      slots_per_page(std::max<size_t>(1, PAGE_SIZE / slot_size)),
+      hand(0) {}
+
+FontCache::FontCache(size_t max_bytes)
+    : m_index_bits(0),
+      m_size(0),
+      m_bytes(0),
+      m_max_bytes(max_bytes),
+      m_account(memory::Pool::Glyphs) {
+	index_resize(8);
+}
+
+FontCache::~FontCache() = default;
+
+void FontCache::clear() {
+	m_atlases.clear();
+	std::fill(m_index.begin(), m_index.end(), nullptr);
+	m_size = 0;
+	m_bytes = 0;
+	m_account.set(0);
+}
+
+size_t FontCache::bucket(const GlyphMetadata &m) const {
+	const uint64_t h = (uint64_t(m.glyph) << 32U) ^ (uint64_t(m.face) << 24U) ^
+	                   (uint64_t(m.size) << 3U) ^ (uint64_t(m.orientation) << 1U) ^
+	                   uint64_t(m.monochrome);
+	return (h * 0x9E3779B97F4A7C15ULL) >> (64U - m_index_bits);
+}
+
+size_t FontCache::find(const GlyphMetadata &metadata) const {
+	const size_t mask = m_index.size() - 1;
+	for (size_t i = bucket(metadata); m_index[i]; i = (i + 1) & mask) {
+		if (m_index[i]->bmp.metadata == metadata) {
+			return i;
 		}
+	}
+	return NPOS;
+}
+
+void FontCache::index_insert(Slot *slot) {
+	// Keep the load factor below 0.5
+	if ((m_size + 1) * 2 > m_index.size()) {
+		index_resize(m_index_bits + 1);
+	}
+	const size_t mask = m_index.size() - 1;
+	size_t i = bucket(slot->bmp.metadata);
+	while (m_index[i]) {
+		i = (i + 1) & mask;
+	}
+	m_index[i] = slot;
+}
 
-		// Glyph was found, move to the beginning of the glyph list
-		auto bmp_it = it->second;
-		if (bmp_it != m_glyph_cache.begin()) {
-			m_glyph_cache.splice(m_glyph_cache.begin(), m_glyph_cache, bmp_it,
-			                     std::next(bmp_it));
+void FontCache::index_erase(const GlyphMetadata &metadata) {
+	size_t i = find(metadata);
+	if (i == NPOS) {
+		return;
+	}
+
+	// Shift back the subsequent entries in the probe sequence that would no
+	// longer be found once bucket i is empty
+	const size_t mask = m_index.size() - 1;
+	m_index[i] = nullptr;
+	for (size_t j = (i + 1) & mask; m_index[j]; j = (j + 1) & mask) {
+		const size_t home = bucket(m_index[j]->bmp.metadata);
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			m_index[i] = m_index[j];
+			m_index[j] = nullptr;
+			i = j;
 		}
-		return &(*bmp_it);
+	}
 }
 
-GlyphBitmap *FontCache::put(int x, int y, unsigned int w, unsigned int h,
-                            unsigned int stride,
-                            const GlyphMetadata &metadata) {
-		// Add a new glyph to the cache
-		m_glyph_cache.emplace_front(x, y, w, h, stride, metadata);
-		auto bmp_it = m_glyph_cache.begin();
+void FontCache::index_resize(unsigned int bits) {
+	std::vector<Slot *> old(size_t(1) << bits, nullptr);
+	m_index.swap(old);
+	m_index_bits = bits;
 
-		// Add the cache key to the map
-		m_glyph_cache_map.emplace(metadata, bmp_it);
+	const size_t mask = m_index.size() - 1;
+	for (Slot *slot : old) {
+		if (slot) {
+			size_t i = bucket(slot->bmp.metadata);
+			while (m_index[i]) {
+				i = (i + 1) & mask;
+			}
+			m_index[i] = slot;
+		}
+	}
+}
 
-		// Delete the oldest entry in the glyph list if there are too many
-		// glyphs in the cache
-		if (m_glyph_cache.size() > m_max_cache_size) {
-			/* Fetch the old glyph instance */
-			auto old_bmp_it = std::prev(m_glyph_cache.end());
+FontCache::Atlas &FontCache::atlas(size_t bytes) {
+	// Determine the size class
+	size_t cls = 0, slot_size = MIN_SLOT_SIZE;
+	while (slot_size < bytes) {
+		slot_size <<= 1U;
+		cls++;
+	}
 
-			/* Remove it from the glyph cache map */
-			m_glyph_cache_map.erase(old_bmp_it->metadata);
+	// Create the atlas if it does not exist yet
+	if (cls >= m_atlases.size()) {
+		m_atlases.resize(cls + 1);
+	}
+	if (!m_atlases[cls]) {
+		m_atlases[cls].reset(new Atlas(slot_size));
+	}
+	return *m_atlases[cls];
+}
 
-			/* Remove it from the glyph cache */
-			m_glyph_cache.erase(old_bmp_it);
+FontCache::Slot &FontCache::allocate(Atlas &a) {
+	// Add a new page if there are no free slots and the memory limit permits
+	const size_t page_size = a.slot_size * a.slots_per_page;
+	if (a.free.empty() &&
+	    (a.pages.empty() || m_bytes + page_size <= m_max_bytes)) {
+		uint8_t *page = new uint8_t[page_size];
+		a.pages.emplace_back(page);
+		m_bytes += page_size;
+		m_account.set(m_bytes);
+
+		const size_t base = a.slots.size();
+		for (size_t k = 0; k < a.slots_per_page; k++) {
+			a.slots.emplace_back(Slot{
+			    GlyphBitmap(0, 0, 0, 0, 0, GlyphMetadata(), page + k * a.slot_size),
+			    false, false});
+		}
+		for (size_t k = a.slots_per_page; k > 0; k--) {
+			a.free.push_back(base + k - 1);
 		}
+	}
 
-		return &(*bmp_it);
+	// Use a free slot if possible
+	if (!a.free.empty()) {
+		Slot &slot = a.slots[a.free.back()];
+		a.free.pop_back();
+		return slot;
+	}
+
+	// Otherwise advance the clock hand until a glyph that was not accessed
+	// since the last sweep is found
+	while (true) {
+		Slot &slot = a.slots[a.hand];
+		a.hand = (a.hand + 1) % a.slots.size();
+		if (slot.referenced) {
+			slot.referenced = false;
+			continue;
+		}
+		if (slot.used) {
+			index_erase(slot.bmp.metadata);
+			slot.used = false;
+			m_size--;
+		}
+		return slot;
+	}
 }
 
-}  // namespace inktty
+GlyphBitmap *FontCache::get(const GlyphMetadata &metadata) {
+	const size_t i = find(metadata);
+	if (i == NPOS) {
+		return nullptr;
+	}
+	Slot *slot = m_index[i];
+	slot->referenced = true;
+	return &slot->bmp;
+}
+
+GlyphBitmap *FontCache::put(int x, int y, unsigned int w, unsigned int h,
+                            unsigned int stride,
+                            const GlyphMetadata &metadata) {
+	// Fetch a slot from the atlas corresponding to the bitmap size
+	const size_t bytes = size_t(h) * stride;
+	Slot &slot = allocate(atlas(bytes));
 
+	// Initialise the glyph bitmap
+	uint8_t *buf = slot.bmp.buf();
+	memset(buf, 0, bytes);
+	slot.bmp = GlyphBitmap(x, y, w, h, stride, metadata, buf);
+	slot.used = true;
+	slot.referenced = false;
+
+	// Add the slot to the index
+	index_insert(&slot);
+	m_size++;
+	return &slot.bmp;
+}
+
+}  // namespace inktty
@@ -19,71 +19,160 @@
 #ifndef INKTTY_GFX_FONT_CACHE_HPP
 #define INKTTY_GFX_FONT_CACHE_HPP
 
-#include <list>
-#include <unordered_map>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
 
 #include <inktty/gfx/font.hpp>
+#include <inktty/utils/memory.hpp>
 
 namespace inktty {
-
+/**
+ * The FontCache class stores rendered glyph bitmaps. Bitmaps are stored in
+ * fixed-size slots; all slots of the same size class are allocated from pages
+ * of contiguous memory (an "atlas"). Glyphs rendered at the same font size and
+ * orientation usually share a size class. Lookups use an open-addressing hash
+ * table and do not allocate any memory. Once the memory limit is reached, a
+ * glyph of the same size class is evicted following the CLOCK policy, i.e.
+ * glyphs that were accessed since the last sweep of the clock hand are kept.
+ */
 class FontCache {
 private:
 	/**
-	 * Used to compute the hash of the GlyphMetadata class.
+	 * Slot holding a single glyph.
+	 */
+	struct Slot {
+		GlyphBitmap bmp;
+
+		/**
+		 * True if the slot currently holds a glyph.
+		 */
+		bool used;
+
+		/**
+		 * Set whenever the glyph is accessed, reset by the clock hand.
+		 */
+		bool referenced;
+	};
+
+	/**
+	 * Collection of slots of the same size.
 	 */
-	struct GlyphMetadataHasher {
-		size_t operator()(const GlyphMetadata &m) const {
-			return (m.glyph * 48923) ^ (m.size * 28147) ^ (m.monochrome << 5) ^
-			       (m.orientation * 392);
-		}
+	struct Atlas {
+		size_t slot_size;
+		size_t slots_per_page;
+		std::vector<std::unique_ptr<uint8_t[]>> pages;
+
+		/**
+		 * Slots in the order of their memory location. A deque is used such
+		 * that pointers at the glyph bitmaps stay valid when new pages are
+		 * added.
+		 */
+		std::deque<Slot> slots;
+		std::vector<size_t> free;
+		size_t hand;
+
+		Atlas(size_t slot_size);
 	};
 
 	/**
-	 * Map storing references at the already rendered glyphs.
+	 * Atlases indexed by size class. The slot size of size class i is
+	 * MIN_SLOT_SIZE << i.
 	 */
-	std::unordered_map<GlyphMetadata, std::list<GlyphBitmap>::iterator,
-	                   GlyphMetadataHasher>
-	    m_glyph_cache_map;
+	std::vector<std::unique_ptr<Atlas>> m_atlases;
 
 	/**
-	 * List containing the rendered glyphs. Last accessed elements are at the
-	 * end of the list. The first element in the list is deleted whenever there
-	 * are too many elements in the cache.
+	 * Open-addressing hash table with linear probing mapping glyph metadata
+	 * onto the slot holding the glyph. Empty buckets are nullptr.
 	 */
-	std::list<GlyphBitmap> m_glyph_cache;
+	std::vector<Slot *> m_index;
 
 	/**
-	 * Maximum number of entires in the glyph cache.
+	 * The number of buckets in m_index is 2^m_index_bits.
 	 */
-	unsigned int m_max_cache_size;
+	unsigned int m_index_bits;
+
+	/**
+	 * Number of glyphs in the cache.
+	 */
+	size_t m_size;
+
+	/**
+	 * Number of bytes allocated for glyph bitmaps.
+	 */
+	size_t m_bytes;
+
+	/**
+	 * Maximum number of bytes allocated for glyph bitmaps.
+	 */
+	size_t m_max_bytes;
+
+	memory::Account m_account;
+
+	size_t bucket(const GlyphMetadata &metadata) const;
+
+	size_t find(const GlyphMetadata &metadata) const;
+
+	void index_insert(Slot *slot);
+
+	void index_erase(const GlyphMetadata &metadata);
+
+	void index_resize(unsigned int bits);
+
+	Atlas &atlas(size_t bytes);
+
+	Slot &allocate(Atlas &atlas);
 
 public:
 	/**
-	 * Creates a new FontCache instance with the given maximum number of glyphs.
+	 * Minimum slot size in bytes.
+	 */
+	static constexpr size_t MIN_SLOT_SIZE = 64;
+
+	/**
+	 * Size of the memory pages slots are allocated from.
 	 */
-	FontCache(unsigned int max_cache_size);
+	static constexpr size_t PAGE_SIZE = 64 * 1024;
 
 	/**
-	 * Clears the font cache.
+	 * Creates a new FontCache instance that allocates at most the given number
+	 * of bytes for glyph bitmaps. Each size class may allocate a single page
+	 * regardless of this limit, such that every glyph can be stored.
 	 */
-	void clear() {
-		m_glyph_cache.clear();
-		m_glyph_cache_map.clear();
-	}
+	FontCache(size_t max_bytes);
+
+	~FontCache();
 
 	/**
-	 * Searches for the glyph with the given properties in the glyph cache. If
-	 * found, moves the glyph to the beginning of the glyph list so it is not
-	 * freed.
+	 * Clears the font cache and frees all memory.
+	 */
+	void clear();
+
+	/**
+	 * Searches for the glyph with the given properties in the glyph cache.
+	 * Marks the glyph as recently used.
 	 */
 	GlyphBitmap *get(const GlyphMetadata &metadata);
 
 	/**
-	 * Creates a new Glyph instance and adds it to the cache. Removes the least
-	 * recently used glyph from the cache if the cache is over-full.
+	 * Creates a new, zero-initialised glyph bitmap and adds it to the cache.
+	 * The glyph must not be in the cache already. Evicts a glyph of the same
+	 * size class if the memory limit is reached.
 	 */
 	GlyphBitmap *put(int x, int y, unsigned int w, unsigned int h,
 	                 unsigned int stride, const GlyphMetadata &metadata);
+
+	/**
+	 * Returns the number of glyphs stored in the cache.
+	 */
+	size_t size() const { return m_size; }
+
+	/**
+	 * Returns the number of bytes allocated for glyph bitmaps.
+	 */
+	size_t bytes() const { return m_bytes; }
 };
 
 }  // namespace inktty
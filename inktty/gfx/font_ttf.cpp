@@ -20,9 +20,14 @@
 #ifdef HAS_FREETYPE
 
 #include <algorithm>
-#include <list>
+#include <condition_variable>
+#include <cstring>
+#include <limits>
+#include <mutex>
 #include <stdexcept>
-#include <unordered_map>
+#include <string>
+#include <unordered_set>
+#include <vector>
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
@@ -31,6 +36,9 @@
 
 #include <inktty/gfx/font_cache.hpp>
 #include <inktty/gfx/font_ttf.hpp>
+#include <inktty/gfx/glyph_cache_file.hpp>
+#include <inktty/utils/profile.hpp>
+#include <inktty/utils/thread_pool.hpp>
 
 namespace inktty {
 namespace {
@@ -40,8 +48,9 @@ namespace {
  ******************************************************************************/
 
 /**
- * Helper class used to initialize free type. Do not create instances of this
- * class directly but used the singleton instance FreetypeLibrary::inst.
+ * Helper class used to initialize free type. The main thread uses the
+ * singleton instance Freetype::library(); glyph rasterisation workers create
+ * their own instance, since a FT_Library must not be used concurrently.
  */
 class Freetype {
 private:
@@ -66,6 +75,7 @@ private:
 		return code;
 	}
 
+public:
 	/**
 	 * Creates the FreetypeLibrary instance.
 	 */
@@ -81,21 +91,25 @@ private:
 			                           &(value = true)));
 	}
 
-public:
+	~Freetype() { FT_Done_FreeType(m_library); }
+
+	Freetype(const Freetype &) = delete;
+	Freetype &operator=(const Freetype &) = delete;
+
 	/**
-	 * Singleton instance.
+	 * Singleton instance, initialised when the first font is loaded instead
+	 * of at program startup.
 	 */
-	static Freetype library;
+	static Freetype &library() {
+		static Freetype instance;
+		return instance;
+	}
 
 	operator FT_Library() { return m_library; }
 };
 
-Freetype Freetype::library;
-
-}  // namespace
-
 /******************************************************************************
- * Class FontBitmap::Impl                                                     *
+ * Class Rasteriser                                                           *
  ******************************************************************************/
 
 static uint32_t PROBE_CHARS[] = {
@@ -127,8 +141,24 @@ static uint32_t PROBE_CHARS[] = {
     0x2588,  // Full block █
 };
 
-class FontTTF::Impl {
+/**
+ * Glyph bitmap rendered by a Rasteriser, independent of any cache.
+ */
+struct GlyphImage {
+	int x, y;
+	unsigned int w, h, stride;
+	std::vector<uint8_t> data;
+};
+
+/**
+ * The Rasteriser class wraps a single FreeType font face and renders glyphs
+ * to GlyphImage instances. A Rasteriser must only be used by one thread at a
+ * time.
+ */
+class Rasteriser {
 private:
+	FT_Library m_library;
+
 	/**
 	 * Freetype font face.
 	 */
@@ -139,11 +169,6 @@ private:
 	 */
 	FT_Bitmap m_tmp_bmp;
 
-	/**
-	 * Datastructure holding information about the monospace grid size.
-	 */
-	MonospaceFontMetrics m_metrics;
-
 	/**
 	 * Dots per inch on the screen. Used to convert the given sizes in points
 	 * to pixels.
@@ -151,56 +176,10 @@ private:
 	unsigned int m_dpi;
 
 	/**
-	 * Font cache used to store rendered glyphs.
-	 */
-	FontCache m_cache;
-
-	/**
-	 * Computes font metrics from the loaded font face. This function iterates
-	 * over a list of probe characters from different scripts and determines the
-	 * corresponding cell size.
+	 * Size currently set on the font face, used to skip redundant calls to
+	 * FT_Set_Char_Size.
 	 */
-	static MonospaceFontMetrics compute_monospace_font_metrics(
-	    FT_Face face, unsigned int dpi) {
-		// Fix the character size to simplify calculations later on
-		FT_Set_Char_Size(face, 0, 512 * 64, dpi, dpi);
-
-		// Iterate over all probe chars and calculate the metrics
-		int32_t x0 = 0x7FFFFFFF, y0 = 0x7FFFFFFF;
-		int32_t x1 = -0x80000000, y1 = -0x80000000;
-		int32_t origin_y = -0x80000000;
-		const size_t n = sizeof(PROBE_CHARS) / sizeof(PROBE_CHARS[0]);
-		for (size_t i = 0; i < n; i++) {
-			/* Lookup the glyph index */
-			const FT_ULong glyph = PROBE_CHARS[i];
-			const FT_UInt glyph_idx = FT_Get_Char_Index(face, glyph);
-			if (glyph_idx == 0) {
-				continue;
-			}
-
-			/* Compute the glyph metrics */
-			FT_Error err =
-			    FT_Load_Glyph(face, glyph_idx, FT_LOAD_BITMAP_METRICS_ONLY);
-			if (err != FT_Err_Ok) {
-				continue; /* Skip glyph */
-			}
-
-			/* Compute the glyph bounding box */
-			const FT_Glyph_Metrics *metrics = &face->glyph->metrics;
-			const int32_t gx0 = metrics->horiBearingX;
-			const int32_t gx1 = metrics->horiAdvance;
-			const int32_t gy0 = -metrics->horiBearingY;
-			const int32_t gy1 = -metrics->horiBearingY + metrics->height;
-			const int32_t gorigin_y = metrics->horiBearingY;
-
-			/* Update the global bounding box size */
-			x0 = std::min(gx0, x0), x1 = std::max(gx1, x1);
-			y0 = std::min(gy0, y0), y1 = std::max(gy1, y1);
-			origin_y = std::max(gorigin_y, origin_y);
-		}
-
-		return MonospaceFontMetrics{(x1 - x0), (y1 - y0), origin_y};
-	}
+	unsigned int m_char_size;
 
 	static void copy_rotated(const uint8_t *src, size_t src_stride,
 	                         size_t src_w, size_t src_h, uint8_t *tar,
@@ -240,10 +219,12 @@ private:
 	}
 
 public:
-	Impl(const char *ttf_file, unsigned int dpi, unsigned int max_cache_size)
-	    : m_dpi(dpi), m_cache(max_cache_size) {
+	enum class Result { Ok, Missing, Error };
+
+	Rasteriser(FT_Library library, const char *ttf_file, unsigned int dpi)
+	    : m_library(library), m_dpi(dpi), m_char_size(0) {
 		// Try to load the font face
-		FT_Error err = FT_New_Face(Freetype::library, ttf_file, 0, &m_face);
+		FT_Error err = FT_New_Face(m_library, ttf_file, 0, &m_face);
 		if (err == FT_Err_Unknown_File_Format) {
 			throw std::runtime_error(
 			    "Specified font file format not recognized.");
@@ -253,60 +234,113 @@ public:
 
 		// Make sure the font is scaleable
 		if (!FT_IS_SCALABLE(m_face)) {
+			FT_Done_Face(m_face);
 			throw std::runtime_error("Font is not scaleable!");
 		}
 
-		// Compute the monospace font metrics
-		m_metrics = compute_monospace_font_metrics(m_face, m_dpi);
-
 		// Allocate a temporary bitmap
 		FT_Bitmap_Init(&m_tmp_bmp);
 	}
 
-	~Impl() {
-		FT_Bitmap_Done(Freetype::library, &m_tmp_bmp);
+	~Rasteriser() {
+		FT_Bitmap_Done(m_library, &m_tmp_bmp);
 		FT_Done_Face(m_face);
 	}
 
-	const GlyphBitmap *render(uint32_t glyph, unsigned int size,
-	                          bool monochrome, unsigned int orientation) {
-		// Check whether the glyph is cached, if yes, just return the cached
-		// glyph
-		GlyphMetadata metadata{glyph, size, monochrome, orientation};
-		GlyphBitmap *res = m_cache.get(metadata);
-		if (res) {
-			return res;
-		}
+	Rasteriser(const Rasteriser &) = delete;
+	Rasteriser &operator=(const Rasteriser &) = delete;
 
-		// Set the font size and transformation
+	void set_char_size(unsigned int size) {
+		if (size == m_char_size) {
+			return;
+		}
 		FT_Error err = FT_Set_Char_Size(m_face, 0, size, m_dpi, m_dpi);
 		if (err != FT_Err_Ok) {
 			throw std::runtime_error("Error while setting font size.");
 		}
+		m_char_size = size;
+	}
+
+	/**
+	 * Computes font metrics from the loaded font face. This function iterates
+	 * over a list of probe characters from different scripts and determines the
+	 * corresponding cell size.
+	 */
+	MonospaceFontMetrics compute_monospace_font_metrics() {
+		// Fix the character size to simplify calculations later on
+		set_char_size(512 * 64);
+
+
+		// Iterate over all probe chars and calculate the metrics
+		int32_t x0 = 0x7FFFFFFF, y0 = 0x7FFFFFFF;
+		int32_t x1 = -0x80000000, y1 = -0x80000000;
+		int32_t origin_y = -0x80000000;
+		const size_t n = sizeof(PROBE_CHARS) / sizeof(PROBE_CHARS[0]);
+		for (size_t i = 0; i < n; i++) {
+			/* Lookup the glyph index */
+			const FT_ULong glyph = PROBE_CHARS[i];
+			const FT_UInt glyph_idx = FT_Get_Char_Index(m_face, glyph);
+			if (glyph_idx == 0) {
+				continue;
+			}
+
+			/* Compute the glyph metrics */
+			FT_Error err =
+			    FT_Load_Glyph(m_face, glyph_idx, FT_LOAD_BITMAP_METRICS_ONLY);
+			if (err != FT_Err_Ok) {
+				continue; /* Skip glyph */
+			}
+
+			/* Compute the glyph bounding box */
+			const FT_Glyph_Metrics *metrics = &m_face->glyph->metrics;
+			const int32_t gx0 = metrics->horiBearingX;
+			const int32_t gx1 = metrics->horiAdvance;
+			const int32_t gy0 = -metrics->horiBearingY;
+			const int32_t gy1 = -metrics->horiBearingY + metrics->height;
+			const int32_t gorigin_y = metrics->horiBearingY;
+
+			/* Update the global bounding box size */
+			x0 = std::min(gx0, x0), x1 = std::max(gx1, x1);
+			y0 = std::min(gy0, y0), y1 = std::max(gy1, y1);
+			origin_y = std::max(gorigin_y, origin_y);
+		}
+
+		return MonospaceFontMetrics{(x1 - x0), (y1 - y0), origin_y};
+	}
+
+	/**
+	 * Renders the given glyph. The font metrics for the glyph size are used
+	 * to position the glyph within its cell.
+	 */
+	Result render(const GlyphMetadata &metadata, const MonospaceFontMetrics &m,
+	              GlyphImage &res) {
+		const unsigned int orientation = metadata.orientation;
+
+		// Set the font size
+		set_char_size(metadata.size);
 
 		// Lookup the glyph index
-		const FT_UInt glyph_idx = FT_Get_Char_Index(m_face, glyph);
+		const FT_UInt glyph_idx = FT_Get_Char_Index(m_face, metadata.glyph);
 		if (glyph_idx == 0) {
-			return nullptr;  // Glyph is not in this font
+			return Result::Missing;  // Glyph is not in this font
 		}
 
 		// Load the glyph and render it
 		int flags = FT_LOAD_RENDER | FT_LOAD_FORCE_AUTOHINT;
-		if (monochrome) {
+		if (metadata.monochrome) {
 			flags |= FT_LOAD_TARGET_MONO;
 		}
-		err = FT_Load_Glyph(m_face, glyph_idx, flags);
+		const FT_Error err = FT_Load_Glyph(m_face, glyph_idx, flags);
 		if (err != FT_Err_Ok) {
-			return nullptr;  // Return empty glyph
+			return Result::Error;
 		}
 
-		// Allocate the glyph on the cache
 		const FT_GlyphSlot slot = m_face->glyph;
 		const FT_Bitmap *bmp = &slot->bitmap;
 
 		// Convert the bitmap to the right format
 		if (bmp->pixel_mode != FT_PIXEL_MODE_GRAY) {
-			FT_Bitmap_Convert(Freetype::library, bmp, &m_tmp_bmp, 1);
+			FT_Bitmap_Convert(m_library, bmp, &m_tmp_bmp, 1);
 			bmp = &m_tmp_bmp;
 		}
 		if (bmp->num_grays == 2) {
@@ -320,53 +354,565 @@ public:
 		}
 
 		// Determine the x-/y-offset depending on the orientation
-		const MonospaceFontMetrics m = metrics(size);
-		int x = 0, y = 0;
 		switch (orientation % 4) {
 			case 0:
-				x = slot->bitmap_left;
-				y = m.origin_y - slot->bitmap_top;
+				res.x = slot->bitmap_left;
+				res.y = m.origin_y - slot->bitmap_top;
 				break;
 			case 1:
-				x = m.origin_y - slot->bitmap_top;
-				y = slot->bitmap_left;
+				res.x = m.origin_y - slot->bitmap_top;
+				res.y = slot->bitmap_left;
 				break;
 			case 2:
-				x = slot->bitmap_left;
-				y = slot->bitmap_top - m.origin_y + (m.cell_height - bmp->rows);
+				res.x = slot->bitmap_left;
+				res.y = slot->bitmap_top - m.origin_y + (m.cell_height - bmp->rows);
 				break;
 			case 3:
-				x = slot->bitmap_top - m.origin_y + (m.cell_height - bmp->rows);
-				y = slot->bitmap_left;
+				res.x = slot->bitmap_top - m.origin_y + (m.cell_height - bmp->rows);
+				res.y = slot->bitmap_left;
 				break;
 		}
 
-		// Create the glyph
-		const size_t w = (orientation & 1) ? bmp->rows : bmp->width;
-		const size_t h = (orientation & 1) ? bmp->width : bmp->rows;
-		const size_t stride = ((w + 15U) / 16U) * 16U;
-		res = m_cache.put(x, y, w, h, stride, metadata);
+		// Copy the glyph to the output image
+		res.w = (orientation & 1) ? bmp->rows : bmp->width;
+		res.h = (orientation & 1) ? bmp->width : bmp->rows;
+		res.stride = ((res.w + 15U) / 16U) * 16U;
+		res.data.assign(size_t(res.h) * res.stride, 0U);
+		copy_rotated(bmp->buffer, bmp->pitch, bmp->width, bmp->rows,
+		             res.data.data(), res.stride, orientation);
+		return Result::Ok;
+	}
+};
+
+/**
+ * Used to compute the hash of the GlyphMetadata class.
+ */
+struct GlyphMetadataHasher {
+	size_t operator()(const GlyphMetadata &m) const {
+		return (m.glyph * 48923) ^ (m.size * 28147) ^ (m.monochrome << 5) ^
+		       (m.orientation * 392) ^ (m.face * 7919);
+	}
+};
+
+}  // namespace
+
+/******************************************************************************
+ * Class FontTTF::Impl                                                        *
+ ******************************************************************************/
+
+class FontTTF::Impl {
+private:
+	/**
+	 * Rasteriser used by the main thread.
+	 */
+	Rasteriser m_rasteriser;
 
-		// Copy the glyph to the output glyph
-		copy_rotated(bmp->buffer, bmp->pitch, bmp->width, bmp->rows, res->buf(),
-		             stride, orientation);
+	/**
+	 * Datastructure holding information about the monospace grid size.
+	 * Computed when the metrics are first needed, since probing the font is
+	 * expensive and many faces of a font family are never used.
+	 */
+	MonospaceFontMetrics m_metrics;
+	bool m_has_metrics;
+
+	/**
+	 * Size and scaled metrics of the last call to metrics(). The metrics are
+	 * queried for every glyph that is rasterised, almost always with the same
+	 * size.
+	 */
+	int m_scaled_size;
+	MonospaceFontMetrics m_scaled_metrics;
+
+	/**
+	 * Font cache used to store rendered glyphs, possibly shared with other
+	 * faces of a font family.
+	 */
+	std::shared_ptr<FontCache> m_cache;
+
+	/**
+	 * Identifier of this face in the font cache.
+	 */
+	uint8_t m_face;
+
+	/**
+	 * Persistent glyph cache consulted before rendering glyphs with FreeType,
+	 * or nullptr if the on-disk cache is disabled.
+	 */
+	std::unique_ptr<GlyphCacheFile> m_cache_file;
+
+	/**
+	 * Codepoints that are known not to exist in this face, independent of
+	 * size and style. Consulted after a cache miss such that missing glyphs
+	 * do not go through FreeType on every draw. Only accessed by the main
+	 * thread.
+	 */
+	std::unordered_set<uint32_t> m_missing;
+
+	/**
+	 * Maximum number of entries in m_missing. The set is cleared once it
+	 * grows beyond this size.
+	 */
+	static constexpr size_t MAX_MISSING = 16384;
+
+	/**
+	 * Version of the glyph renderer stored in the glyph cache file. Glyphs
+	 * rendered by a different FreeType version are discarded.
+	 */
+	static constexpr uint32_t RENDERER_VERSION =
+	    (FREETYPE_MAJOR << 16) | (FREETYPE_MINOR << 8) | FREETYPE_PATCH;
+
+	/**
+	 * First and last codepoint of the box drawing and block element characters
+	 * stored in the glyph table.
+	 */
+	static constexpr uint32_t BOX_FIRST = 0x2500;
+	static constexpr uint32_t BOX_LAST = 0x259F;
+
+	/**
+	 * Number of entries in the glyph table, codepoints 0-255 followed by the
+	 * box drawing characters.
+	 */
+	static constexpr size_t TABLE_SIZE = 256 + (BOX_LAST - BOX_FIRST + 1);
+
+	/**
+	 * Directly indexed table of the most frequently used glyphs for a single
+	 * size and orientation. The glyphs are stored in a separate, unbounded
+	 * cache such that the pointers in the table are never invalidated by
+	 * evictions. The table is populated all at once whenever the size or
+	 * orientation changes.
+	 */
+	struct GlyphTable {
+		bool valid;
+		unsigned int size;
+		unsigned int orientation;
+		FontCache cache;
+		const GlyphBitmap *glyphs[TABLE_SIZE];
+
+		GlyphTable()
+		    : valid(false),
+		      size(0),
+		      orientation(0),
+		      cache(std::numeric_limits<size_t>::max()),
+		      glyphs() {}
+	};
+
+	/**
+	 * Glyph tables for anti-aliased and monochrome glyphs.
+	 */
+	GlyphTable m_tables[2];
+
+	/**
+	 * Glyph rendered by a worker thread that has not been inserted into the
+	 * target cache yet.
+	 */
+	struct Rendered {
+		GlyphMetadata metadata;
+		FontCache *cache;
+		Rasteriser::Result result;
+		GlyphImage image;
+	};
+
+	/**
+	 * Font file, resolution and number of worker threads, kept to start the
+	 * workers once the first glyphs are rendered.
+	 */
+	std::string m_ttf_file;
+	unsigned int m_dpi;
+	unsigned int m_threads;
+
+	/**
+	 * Per-worker FreeType library and font face.
+	 */
+	struct Worker {
+		Freetype library;
+		Rasteriser rasteriser;
+
+		Worker(const char *ttf_file, unsigned int dpi)
+		    : rasteriser(library, ttf_file, dpi) {}
+	};
+
+	/**
+	 * Mutex protecting m_pending and m_rendered, which are shared with the
+	 * worker threads.
+	 */
+	std::mutex m_mutex;
+	std::condition_variable m_cond_rendered;
+
+	/**
+	 * Glyphs submitted to the workers that have not been collected yet.
+	 */
+	std::unordered_set<GlyphMetadata, GlyphMetadataHasher> m_pending;
+	std::vector<Rendered> m_rendered;
+
+	/**
+	 * Glyphs taken from m_rendered by collect(). Swapped with m_rendered,
+	 * such that both vectors keep their capacity across frames.
+	 */
+	std::vector<Rendered> m_collected;
+
+	std::vector<std::unique_ptr<Worker>> m_workers;
+
+	/**
+	 * Worker threads or nullptr if glyphs are rendered on the main thread
+	 * only or the workers have not been started yet. Declared last, such that
+	 * the workers are stopped before any of the resources above are
+	 * destroyed.
+	 */
+	std::unique_ptr<ThreadPool> m_pool;
+
+	/**
+	 * Returns true if glyphs are rendered by worker threads. Starts the
+	 * workers upon the first call, each worker opens its own font face.
+	 */
+	bool use_pool() {
+		if (!m_pool && m_threads > 0) {
+			for (unsigned int i = 0; i < m_threads; i++) {
+				m_workers.emplace_back(new Worker(m_ttf_file.c_str(), m_dpi));
+			}
+			m_pool.reset(new ThreadPool(m_threads));
+		}
+		return bool(m_pool);
+	}
+
+	/**
+	 * Returns the metrics at the size of 512pt the metrics for all other sizes
+	 * are derived from. Reads the metrics from the glyph cache file or probes
+	 * the font upon the first call.
+	 */
+	const MonospaceFontMetrics &base_metrics() {
+		if (!m_has_metrics) {
+			if (!m_cache_file || !m_cache_file->metrics(m_metrics)) {
+				m_metrics = m_rasteriser.compute_monospace_font_metrics();
+				if (m_cache_file) {
+					m_cache_file->set_metrics(m_metrics);
+				}
+			}
+			m_has_metrics = true;
+		}
+		return m_metrics;
+	}
+
+	/**
+	 * Returns the index of the glyph in the glyph table or -1 if the glyph is
+	 * not stored in the table.
+	 */
+	static int table_index(uint32_t glyph) {
+		if (glyph < 256) {
+			return glyph;
+		} else if (glyph >= BOX_FIRST && glyph <= BOX_LAST) {
+			return 256 + (glyph - BOX_FIRST);
+		}
+		return -1;
+	}
+
+	static uint32_t table_glyph(size_t idx) {
+		return (idx < 256) ? idx : (BOX_FIRST + (idx - 256));
+	}
+
+	/**
+	 * Remembers that the given glyph does not exist in this face.
+	 */
+	void mark_missing(const GlyphMetadata &metadata) {
+		if (m_missing.size() >= MAX_MISSING) {
+			m_missing.clear();
+		}
+		m_missing.insert(metadata.glyph);
+	}
+
+	/**
+	 * Inserts a rendered glyph into the given cache and the glyph cache file.
+	 */
+	GlyphBitmap *insert(FontCache &cache, const GlyphMetadata &metadata,
+	                    Rasteriser::Result result, const GlyphImage &image) {
+		if (result == Rasteriser::Result::Missing) {
+			mark_missing(metadata);
+			if (m_cache_file) {
+				m_cache_file->add(metadata, nullptr);
+			}
+			return nullptr;
+		} else if (result != Rasteriser::Result::Ok) {
+			return nullptr;
+		}
+		GlyphBitmap *res = cache.put(image.x, image.y, image.w, image.h,
+		                             image.stride, metadata);
+		memcpy(res->buf(), image.data.data(), image.data.size());
+		if (m_cache_file) {
+			m_cache_file->add(metadata, res);
+		}
 		return res;
 	}
 
-	MonospaceFontMetrics metrics(int size) const {
-		const int num = size, den = 512 * 64 * 64;
-		return MonospaceFontMetrics{m_metrics.cell_width * num / den,
-		                            m_metrics.cell_height * num / den,
-		                            m_metrics.origin_y * num / den};
+	/**
+	 * Copies the glyph from the glyph cache file into the given cache.
+	 * Returns false if the glyph is not in the file.
+	 */
+	bool load(FontCache &cache, const GlyphMetadata &metadata,
+	          GlyphBitmap *&res) {
+		if (!m_cache_file) {
+			return false;
+		}
+		const GlyphCacheFile::Record *r = m_cache_file->find(metadata);
+		if (!r) {
+			return false;
+		}
+		res = nullptr;
+		if (r->flags & GlyphCacheFile::FLAG_MISSING) {
+			mark_missing(metadata);
+		} else {
+			res = cache.put(r->x, r->y, r->w, r->h, r->stride, metadata);
+			memcpy(res->buf(), m_cache_file->data(*r),
+			       size_t(r->h) * r->stride);
+		}
+		return true;
+	}
+
+	/**
+	 * Renders the glyph described by the given metadata on the main thread
+	 * and stores it in the given cache. Returns nullptr if the glyph does not
+	 * exist.
+	 */
+	GlyphBitmap *rasterise(FontCache &cache, const GlyphMetadata &metadata) {
+		GlyphBitmap *res = nullptr;
+		if (load(cache, metadata, res)) {
+			return res;
+		}
+		GlyphImage image;
+		const Rasteriser::Result result =
+		    m_rasteriser.render(metadata, metrics(metadata.size), image);
+		return insert(cache, metadata, result, image);
+	}
+
+	/**
+	 * Hands the glyph to the worker threads. The rendered glyph is inserted
+	 * into the given cache by collect().
+	 */
+	void submit(FontCache &cache, const GlyphMetadata &metadata) {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!m_pending.insert(metadata).second) {
+				return;  // Already submitted
+			}
+		}
+		const MonospaceFontMetrics m = metrics(metadata.size);
+		FontCache *tar = &cache;
+		m_pool->submit([this, metadata, m, tar](size_t worker) {
+			Rendered rendered{metadata, tar, Rasteriser::Result::Error,
+			                  GlyphImage()};
+			try {
+				rendered.result = m_workers[worker]->rasteriser.render(
+				    metadata, m, rendered.image);
+			} catch (std::runtime_error &) {
+				// Leave the result at "Error", the main thread retries
+			}
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_rendered.emplace_back(std::move(rendered));
+			m_cond_rendered.notify_all();
+		});
+	}
+
+	/**
+	 * Inserts all glyphs rendered by the workers into their target caches.
+	 */
+	void collect() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_collected.swap(m_rendered);
+			for (const Rendered &r : m_collected) {
+				m_pending.erase(r.metadata);
+			}
+		}
+		for (const Rendered &r : m_collected) {
+			insert(*r.cache, r.metadata, r.result, r.image);
+		}
+		m_collected.clear();
+	}
+
+	/**
+	 * Waits until the given glyph is no longer being rendered by a worker.
+	 */
+	void wait_for(const GlyphMetadata &metadata) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (m_pending.count(metadata)) {
+			m_cond_rendered.wait(lock, [this] { return !m_rendered.empty(); });
+			lock.unlock();
+			collect();
+			lock.lock();
+		}
+	}
+
+	/**
+	 * Renders all glyphs in the glyph table for the given style. Distributes
+	 * the work among the worker threads if available.
+	 */
+	void populate(GlyphTable &table, unsigned int size, bool monochrome,
+	              unsigned int orientation) {
+		table.cache.clear();
+		for (size_t i = 0; i < TABLE_SIZE; i++) {
+			const GlyphMetadata metadata{table_glyph(i), size, monochrome,
+			                             orientation, m_face};
+			if (use_pool()) {
+				GlyphBitmap *res;
+				if (!load(table.cache, metadata, res)) {
+					submit(table.cache, metadata);
+				}
+			} else {
+				table.glyphs[i] = rasterise(table.cache, metadata);
+			}
+		}
+		if (m_pool) {
+			m_pool->wait();
+			collect();
+			for (size_t i = 0; i < TABLE_SIZE; i++) {
+				table.glyphs[i] = table.cache.get(GlyphMetadata{
+				    table_glyph(i), size, monochrome, orientation, m_face});
+			}
+		}
+		table.size = size;
+		table.orientation = orientation;
+		table.valid = true;
+	}
+
+	GlyphTable &table(unsigned int size, bool monochrome,
+	                  unsigned int orientation) {
+		GlyphTable &table = m_tables[monochrome ? 1 : 0];
+		if (!table.valid || table.size != size ||
+		    table.orientation != orientation) {
+			populate(table, size, monochrome, orientation);
+		}
+		return table;
+	}
+
+public:
+	Impl(const char *ttf_file, unsigned int dpi, size_t max_cache_bytes,
+	     const char *glyph_cache_file, unsigned int threads,
+	     std::shared_ptr<FontCache> cache, uint8_t face)
+	    : m_rasteriser(Freetype::library(), ttf_file, dpi),
+	      m_has_metrics(false),
+	      m_scaled_size(-1),
+	      m_cache(cache ? cache : std::make_shared<FontCache>(max_cache_bytes)),
+	      m_face(face),
+	      m_ttf_file(ttf_file),
+	      m_dpi(dpi),
+	      m_threads(threads) {
+		// Open the glyph cache file
+		if (glyph_cache_file && *glyph_cache_file) {
+			const GlyphCacheFile::Key key{GlyphCacheFile::hash_file(ttf_file),
+			                              dpi, RENDERER_VERSION};
+			m_cache_file.reset(new GlyphCacheFile(glyph_cache_file, key));
+		}
+
+		// The font metrics and the worker threads are set up when they are
+		// first needed, see base_metrics() and use_pool()
+	}
+
+	const GlyphBitmap *render(uint32_t glyph, unsigned int size,
+	                          bool monochrome, unsigned int orientation) {
+		// Frequently used glyphs are looked up in the glyph table
+		const int idx = table_index(glyph);
+		if (idx >= 0) {
+			INKTTY_PROFILE_COUNT(GlyphHit);
+			return table(size, monochrome, orientation).glyphs[idx];
+		}
+
+		// Check whether the glyph is cached, if yes, just return the cached
+		// glyph
+		const GlyphMetadata metadata{glyph, size, monochrome, orientation,
+		                             m_face};
+		GlyphBitmap *res = m_cache->get(metadata);
+		if (res) {
+			INKTTY_PROFILE_COUNT(GlyphHit);
+			return res;
+		}
+
+		// Glyphs that are known to be missing from this face are not looked
+		// up again
+		if (m_missing.count(glyph)) {
+			INKTTY_PROFILE_COUNT(GlyphHit);
+			return nullptr;
+		}
+		INKTTY_PROFILE_COUNT(GlyphMiss);
+
+		// Wait for the glyph if it is being rendered by a worker
+		if (m_pool) {
+			wait_for(metadata);
+			collect();
+			res = m_cache->get(metadata);
+			if (res || m_missing.count(glyph)) {
+				return res;
+			}
+		}
+		return rasterise(*m_cache, metadata);
+	}
+
+	void prefetch(const uint32_t *glyphs, size_t n, unsigned int size,
+	              bool monochrome, unsigned int orientation) {
+		if (!use_pool()) {
+			return;
+		}
+		collect();
+		for (size_t i = 0; i < n; i++) {
+			const GlyphMetadata metadata{glyphs[i], size, monochrome,
+			                             orientation, m_face};
+			if (table_index(glyphs[i]) >= 0) {
+				table(size, monochrome, orientation);
+			} else if (!m_cache->get(metadata) && !m_missing.count(glyphs[i])) {
+				GlyphBitmap *res;
+				if (!load(*m_cache, metadata, res)) {
+					submit(*m_cache, metadata);
+				}
+			}
+		}
+	}
+
+	MonospaceFontMetrics metrics(int size) {
+		if (size != m_scaled_size) {
+			const MonospaceFontMetrics &m = base_metrics();
+			const int num = size, den = 512 * 64 * 64;
+			m_scaled_metrics =
+			    MonospaceFontMetrics{m.cell_width * num / den,
+			                         m.cell_height * num / den,
+			                         m.origin_y * num / den};
+			m_scaled_size = size;
+		}
+		return m_scaled_metrics;
+	}
+
+	size_t reclaim() {
+		// Glyphs handed to the workers are inserted into the caches once
+		// they are done, make sure they are not inserted during the clear
+		if (m_pool) {
+			m_pool->wait();
+			collect();
+		}
+		size_t res = m_cache->bytes();
+		m_cache->clear();
+		for (GlyphTable &table : m_tables) {
+			res += table.cache.bytes();
+			table.cache.clear();
+			table.valid = false;
+		}
+		return res;
 	}
 };
 
+constexpr uint32_t FontTTF::Impl::RENDERER_VERSION;
+constexpr uint32_t FontTTF::Impl::BOX_FIRST;
+constexpr uint32_t FontTTF::Impl::BOX_LAST;
+constexpr size_t FontTTF::Impl::TABLE_SIZE;
+constexpr size_t FontTTF::Impl::MAX_MISSING;
+
 /******************************************************************************
  * Class FontTTF                                                              *
  ******************************************************************************/
 
-FontTTF::FontTTF(const char *ttf_file, unsigned int dpi, unsigned int max_cache_size)
-    : m_impl(std::unique_ptr<Impl>(new Impl(ttf_file, dpi, max_cache_size))) {}
+constexpr size_t FontTTF::DEFAULT_CACHE_BYTES;
+
+FontTTF::FontTTF(const char *ttf_file, unsigned int dpi, size_t max_cache_bytes,
+                 const char *glyph_cache_file, unsigned int threads,
+                 std::shared_ptr<FontCache> cache, uint8_t face)
+    : m_impl(std::unique_ptr<Impl>(new Impl(ttf_file, dpi, max_cache_bytes,
+                                            glyph_cache_file, threads, cache,
+                                            face))) {}
 
 FontTTF::~FontTTF() {
 	// Do nothing here
@@ -377,10 +923,17 @@ const GlyphBitmap *FontTTF::render(uint32_t glyph, unsigned int size,
 	return m_impl->render(glyph, size, monochrome, orientation);
 }
 
+void FontTTF::prefetch(const uint32_t *glyphs, size_t n, unsigned int size,
+                       bool monochrome, unsigned int orientation) {
+	m_impl->prefetch(glyphs, n, size, monochrome, orientation);
+}
+
 MonospaceFontMetrics FontTTF::metrics(int size) const {
 	return m_impl->metrics(size);
 }
 
+size_t FontTTF::reclaim() { return m_impl->reclaim(); }
+
 }  // namespace inktty
 
 #endif /* HAS_FREETYPE*/
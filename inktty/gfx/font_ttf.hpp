@@ -34,11 +34,15 @@
 #include <config.h>
 #ifdef HAS_FREETYPE
 
+#include <cstddef>
 #include <memory>
 
 #include <inktty/gfx/font.hpp>
 
 namespace inktty {
+/* Forward declarations */
+class FontCache;
+
 /**
  * The Font class represents a single font as it is stored in a TrueType font
  * file. It allows to render individual glyphs from the font to a bitmap,
@@ -50,8 +54,31 @@ private:
 	std::unique_ptr<Impl> m_impl;
 
 public:
+	/**
+	 * Default maximum number of bytes used for caching rendered glyphs.
+	 */
+	static constexpr size_t DEFAULT_CACHE_BYTES = 4 * 1024 * 1024;
+
+	/**
+	 * Loads the given font file.
+	 *
+	 * @param max_cache_bytes is the maximum number of bytes used for caching
+	 * rendered glyphs.
+	 * @param glyph_cache_file is the file rendered glyphs and the font metrics
+	 * are persisted in. May be nullptr or empty to disable the on-disk cache.
+	 * @param threads is the number of worker threads used to rasterise
+	 * glyphs in the background. Each worker opens its own font face. If zero,
+	 * all glyphs are rasterised on the calling thread.
+	 * @param cache is a font cache shared with other fonts, e.g. the other
+	 * faces of a FontFamily. If nullptr, a cache holding at most
+	 * max_cache_bytes is created for this font.
+	 * @param face identifies the glyphs of this font in a shared cache. Must
+	 * be unique among the fonts sharing the cache.
+	 */
 	FontTTF(const char *ttf_file, unsigned int dpi = 96,
-	        unsigned int max_cache_size = 1000);
+	        size_t max_cache_bytes = DEFAULT_CACHE_BYTES,
+	        const char *glyph_cache_file = nullptr, unsigned int threads = 0,
+	        std::shared_ptr<FontCache> cache = nullptr, uint8_t face = 0);
 
 	/**
 	 * Destroys the open font handle.
@@ -75,6 +102,15 @@ public:
 	                          bool monochrome = false,
 	                          unsigned int orientation = 0) override;
 
+	/**
+	 * Hands the given glyphs to the worker threads, such that they are
+	 * rasterised in parallel before they are requested by render(). Does
+	 * nothing if no worker threads were started.
+	 */
+	void prefetch(const uint32_t *glyphs, size_t n, unsigned int size,
+	              bool monochrome = false,
+	              unsigned int orientation = 0) override;
+
 	/**
 	 * Returns the font metrics assuming this font is a monospace font.
 	 *
@@ -83,6 +119,12 @@ public:
 	 * height in pixels.
 	 */
 	MonospaceFontMetrics metrics(int size) const override;
+
+	/**
+	 * Clears the glyph cache and the glyph tables. If the glyph cache is
+	 * shared with other faces, their glyphs are released as well.
+	 */
+	size_t reclaim() override;
 };
 
 }  // namespace inktty
@@ -0,0 +1,329 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <inktty/gfx/glyph_cache_file.hpp>
+#include <inktty/utils/logger.hpp>
+
+namespace inktty {
+
+/******************************************************************************
+ * File layout                                                                *
+ ******************************************************************************/
+
+namespace {
+static const char MAGIC[8] = {'I', 'N', 'K', 'T', 'T', 'Y', 'G', 'C'};
+
+struct FileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t n_records;
+	uint64_t font_hash;
+	uint32_t dpi;
+	uint32_t renderer;
+	uint32_t has_metrics;
+	int32_t cell_width, cell_height, origin_y;
+};
+
+static_assert(sizeof(FileHeader) % 8 == 0,
+              "FileHeader size must preserve the record alignment");
+static_assert(sizeof(GlyphCacheFile::Record) == 40,
+              "GlyphCacheFile::Record should not contain any padding");
+
+/**
+ * Glyph bitmaps are aligned to this number of bytes within the file.
+ */
+static constexpr size_t DATA_ALIGN = 16;
+
+GlyphCacheFile::Record make_record(const GlyphMetadata &metadata) {
+	GlyphCacheFile::Record r;
+	memset(&r, 0, sizeof(r));
+	r.glyph = metadata.glyph;
+	r.size = metadata.size;
+	r.monochrome = metadata.monochrome ? 1 : 0;
+	r.orientation = metadata.orientation;
+	return r;
+}
+
+/**
+ * Order in which the records are stored in the file.
+ */
+bool less(const GlyphCacheFile::Record &a, const GlyphCacheFile::Record &b) {
+	if (a.size != b.size) {
+		return a.size < b.size;
+	}
+	if (a.orientation != b.orientation) {
+		return a.orientation < b.orientation;
+	}
+	if (a.monochrome != b.monochrome) {
+		return a.monochrome < b.monochrome;
+	}
+	return a.glyph < b.glyph;
+}
+
+bool same_glyph(const GlyphCacheFile::Record &a,
+                const GlyphCacheFile::Record &b) {
+	return !less(a, b) && !less(b, a);
+}
+}  // namespace
+
+/******************************************************************************
+ * Class GlyphCacheFile                                                       *
+ ******************************************************************************/
+
+constexpr uint8_t GlyphCacheFile::FLAG_MISSING;
+constexpr uint32_t GlyphCacheFile::VERSION;
+constexpr size_t GlyphCacheFile::MAX_PENDING;
+
+uint64_t GlyphCacheFile::hash_file(const char *filename) {
+	std::ifstream is(filename, std::ios::binary);
+	if (!is) {
+		return 0;
+	}
+
+	// 64-bit FNV-1a
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	std::vector<char> buf(64 * 1024);
+	while (is) {
+		is.read(buf.data(), buf.size());
+		const std::streamsize n = is.gcount();
+		for (std::streamsize i = 0; i < n; i++) {
+			hash = (hash ^ uint8_t(buf[i])) * 0x100000001B3ULL;
+		}
+	}
+	return hash;
+}
+
+GlyphCacheFile::GlyphCacheFile(const char *filename, const Key &key)
+    : m_filename(filename),
+      m_key(key),
+      m_map(nullptr),
+      m_map_size(0),
+      m_records(nullptr),
+      m_n_records(0),
+      m_has_metrics(false),
+      m_metrics{0, 0, 0},
+      m_dirty(false) {
+	open();
+}
+
+GlyphCacheFile::~GlyphCacheFile() {
+	save();
+	close();
+}
+
+void GlyphCacheFile::open() {
+	const int fd = ::open(m_filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(FileHeader)) {
+		::close(fd);
+		return;
+	}
+	void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED) {
+		return;
+	}
+	m_map = static_cast<const uint8_t *>(map);
+	m_map_size = st.st_size;
+
+	// Make sure the file was created for the same font and settings
+	const FileHeader &hdr = *reinterpret_cast<const FileHeader *>(m_map);
+	if (memcmp(hdr.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+	    hdr.version != VERSION || hdr.font_hash != m_key.font_hash ||
+	    hdr.dpi != m_key.dpi || hdr.renderer != m_key.renderer ||
+	    sizeof(FileHeader) + size_t(hdr.n_records) * sizeof(Record) >
+	        m_map_size) {
+		global_logger().info() << "Ignoring outdated glyph cache \""
+		                       << m_filename << "\"";
+		close();
+		return;
+	}
+
+	m_records = reinterpret_cast<const Record *>(m_map + sizeof(FileHeader));
+	m_n_records = hdr.n_records;
+	m_has_metrics = hdr.has_metrics != 0;
+	m_metrics =
+	    MonospaceFontMetrics{hdr.cell_width, hdr.cell_height, hdr.origin_y};
+}
+
+void GlyphCacheFile::close() {
+	if (m_map) {
+		munmap(const_cast<uint8_t *>(m_map), m_map_size);
+	}
+	m_map = nullptr;
+	m_map_size = 0;
+	m_records = nullptr;
+	m_n_records = 0;
+	m_has_metrics = false;
+}
+
+bool GlyphCacheFile::metrics(MonospaceFontMetrics &metrics) const {
+	if (m_has_metrics) {
+		metrics = m_metrics;
+	}
+	return m_has_metrics;
+}
+
+void GlyphCacheFile::set_metrics(const MonospaceFontMetrics &metrics) {
+	m_metrics = metrics;
+	m_has_metrics = true;
+	m_dirty = true;
+}
+
+const GlyphCacheFile::Record *GlyphCacheFile::find(
+    const GlyphMetadata &metadata) const {
+	const Record key = make_record(metadata);
+	const Record *end = m_records + m_n_records;
+	const Record *r = std::lower_bound(m_records, end, key, less);
+	if (r == end || !same_glyph(*r, key)) {
+		return nullptr;
+	}
+
+	// Do not trust records pointing outside of the file
+	if (!(r->flags & FLAG_MISSING) &&
+	    r->offs + uint64_t(r->h) * r->stride > m_map_size) {
+		return nullptr;
+	}
+	return r;
+}
+
+void GlyphCacheFile::add(const GlyphMetadata &metadata,
+                         const GlyphBitmap *bmp) {
+	if (m_pending.size() >= MAX_PENDING) {
+		return;
+	}
+
+	Pending p{make_record(metadata), std::vector<uint8_t>()};
+	if (bmp) {
+		p.record.x = bmp->x;
+		p.record.y = bmp->y;
+		p.record.w = bmp->w;
+		p.record.h = bmp->h;
+		p.record.stride = bmp->stride;
+		p.data.assign(bmp->buf(), bmp->buf() + size_t(bmp->h) * bmp->stride);
+	} else {
+		p.record.flags = FLAG_MISSING;
+	}
+	m_pending.emplace_back(std::move(p));
+	m_dirty = true;
+}
+
+void GlyphCacheFile::save() {
+	if (!m_dirty) {
+		return;
+	}
+
+	// Merge the records in the file with the pending records
+	std::vector<std::pair<Record, const uint8_t *>> records;
+	records.reserve(m_n_records + m_pending.size());
+	for (size_t i = 0; i < m_n_records; i++) {
+		const Record &r = m_records[i];
+		if ((r.flags & FLAG_MISSING) ||
+		    r.offs + uint64_t(r.h) * r.stride <= m_map_size) {
+			records.emplace_back(r, data(r));
+		}
+	}
+	for (const Pending &p : m_pending) {
+		records.emplace_back(p.record, p.data.data());
+	}
+	std::stable_sort(records.begin(), records.end(),
+	                 [](const std::pair<Record, const uint8_t *> &a,
+	                    const std::pair<Record, const uint8_t *> &b) {
+		                 return less(a.first, b.first);
+	                 });
+	records.erase(std::unique(records.begin(), records.end(),
+	                          [](const std::pair<Record, const uint8_t *> &a,
+	                             const std::pair<Record, const uint8_t *> &b) {
+		                          return same_glyph(a.first, b.first);
+	                          }),
+	              records.end());
+
+	// Assign the data offsets
+	uint64_t offs = sizeof(FileHeader) + records.size() * sizeof(Record);
+	for (auto &r : records) {
+		if (!(r.first.flags & FLAG_MISSING)) {
+			offs = (offs + DATA_ALIGN - 1) / DATA_ALIGN * DATA_ALIGN;
+			r.first.offs = offs;
+			offs += uint64_t(r.first.h) * r.first.stride;
+		} else {
+			r.first.offs = 0;
+		}
+	}
+
+	// Write the header, the records and the bitmap data to a temporary file
+	FileHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, MAGIC, sizeof(MAGIC));
+	hdr.version = VERSION;
+	hdr.n_records = records.size();
+	hdr.font_hash = m_key.font_hash;
+	hdr.dpi = m_key.dpi;
+	hdr.renderer = m_key.renderer;
+	hdr.has_metrics = m_has_metrics ? 1 : 0;
+	hdr.cell_width = m_metrics.cell_width;
+	hdr.cell_height = m_metrics.cell_height;
+	hdr.origin_y = m_metrics.origin_y;
+
+	const std::string tmp = m_filename + ".tmp";
+	{
+		std::ofstream os(tmp, std::ios::binary | std::ios::trunc);
+		os.write(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+		for (const auto &r : records) {
+			os.write(reinterpret_cast<const char *>(&r.first), sizeof(Record));
+		}
+		static const char zeros[DATA_ALIGN] = {0};
+		uint64_t pos = sizeof(FileHeader) + records.size() * sizeof(Record);
+		for (const auto &r : records) {
+			if (r.first.flags & FLAG_MISSING) {
+				continue;
+			}
+			os.write(zeros, r.first.offs - pos);
+			const size_t n = size_t(r.first.h) * r.first.stride;
+			os.write(reinterpret_cast<const char *>(r.second), n);
+			pos = r.first.offs + n;
+		}
+		if (!os) {
+			global_logger().warn() << "Cannot write glyph cache \"" << tmp
+			                       << "\"";
+			std::remove(tmp.c_str());
+			return;
+		}
+	}
+	if (std::rename(tmp.c_str(), m_filename.c_str()) != 0) {
+		global_logger().warn() << "Cannot replace glyph cache \""
+		                       << m_filename << "\"";
+		std::remove(tmp.c_str());
+		return;
+	}
+	m_dirty = false;
+}
+
+}  // namespace inktty
@@ -0,0 +1,182 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file glyph_cache_file.hpp
+ *
+ * Contains the GlyphCacheFile class, a persistent on-disk cache of rendered
+ * glyphs.
+ *
+ * @author Andreas Stöckel
+ */
+
+#ifndef INKTTY_GFX_GLYPH_CACHE_FILE_HPP
+#define INKTTY_GFX_GLYPH_CACHE_FILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <inktty/gfx/font.hpp>
+
+namespace inktty {
+/**
+ * The GlyphCacheFile class stores rendered glyph bitmaps and the monospace
+ * font metrics in a file, such that they do not have to be recomputed when
+ * the application is started again. The file is memory-mapped when opened; it
+ * consists of a header, a table of glyph records sorted by glyph metadata, and
+ * the bitmap data. The file is only used if the font file hash, the DPI and
+ * the renderer version stored in the header match the current values. Files
+ * are stored in native byte order and are not meant to be shared between
+ * machines.
+ */
+class GlyphCacheFile {
+public:
+	/**
+	 * Identifies the font and rendering settings the glyphs were created with.
+	 */
+	struct Key {
+		uint64_t font_hash;
+		uint32_t dpi;
+		uint32_t renderer;
+	};
+
+	/**
+	 * Glyph record as stored in the file.
+	 */
+	struct Record {
+		uint32_t glyph;
+		uint32_t size;
+		uint8_t monochrome;
+		uint8_t orientation;
+		uint8_t flags;
+		uint8_t reserved;
+		int32_t x, y;
+		uint32_t w, h, stride;
+		uint64_t offs;
+	};
+
+	/**
+	 * Set in the record flags if the glyph does not exist in the font.
+	 */
+	static constexpr uint8_t FLAG_MISSING = 0x01;
+
+	/**
+	 * File format version. Must be incremented whenever the file layout or
+	 * the way glyphs are rendered changes.
+	 */
+	static constexpr uint32_t VERSION = 1;
+
+	/**
+	 * Maximum number of glyphs that are added in a single session.
+	 */
+	static constexpr size_t MAX_PENDING = 8192;
+
+private:
+	struct Pending {
+		Record record;
+		std::vector<uint8_t> data;
+	};
+
+	std::string m_filename;
+	Key m_key;
+
+	/**
+	 * Memory mapping of the file or nullptr if there is no valid file.
+	 */
+	const uint8_t *m_map;
+	size_t m_map_size;
+
+	const Record *m_records;
+	size_t m_n_records;
+
+	bool m_has_metrics;
+	MonospaceFontMetrics m_metrics;
+
+	/**
+	 * Glyphs that were rendered in this session and are written to the file
+	 * by save().
+	 */
+	std::vector<Pending> m_pending;
+	bool m_dirty;
+
+	void open();
+
+	void close();
+
+public:
+	/**
+	 * Computes a hash of the content of the given file. Returns zero if the
+	 * file cannot be read.
+	 */
+	static uint64_t hash_file(const char *filename);
+
+	/**
+	 * Opens the given cache file. If the file does not exist or has been
+	 * created with a different key, the cache is empty.
+	 */
+	GlyphCacheFile(const char *filename, const Key &key);
+
+	/**
+	 * Writes pending glyphs to the file.
+	 */
+	~GlyphCacheFile();
+
+	GlyphCacheFile(const GlyphCacheFile &) = delete;
+	GlyphCacheFile &operator=(const GlyphCacheFile &) = delete;
+
+	/**
+	 * Reads the font metrics stored in the file. Returns false if the file
+	 * does not store any metrics.
+	 */
+	bool metrics(MonospaceFontMetrics &metrics) const;
+
+	/**
+	 * Stores the font metrics in the file.
+	 */
+	void set_metrics(const MonospaceFontMetrics &metrics);
+
+	/**
+	 * Searches for the glyph with the given metadata. Returns nullptr if the
+	 * glyph is not in the file.
+	 */
+	const Record *find(const GlyphMetadata &metadata) const;
+
+	/**
+	 * Returns a pointer at the bitmap data of the given record.
+	 */
+	const uint8_t *data(const Record &record) const {
+		return m_map + record.offs;
+	}
+
+	/**
+	 * Adds a glyph to the file. The glyph is written to disk by save(). If
+	 * bmp is nullptr, records that the glyph does not exist in the font.
+	 */
+	void add(const GlyphMetadata &metadata, const GlyphBitmap *bmp);
+
+	/**
+	 * Writes the file if glyphs or metrics were added. The new file is
+	 * written next to the old file and then atomically replaces it.
+	 */
+	void save();
+};
+}  // namespace inktty
+
+#endif /* INKTTY_GFX_GLYPH_CACHE_FILE_HPP */
@@ -17,11 +17,20 @@
  */
 
 #include <algorithm>
+#include <cstdlib>
 #include <iostream>
+#include <vector>
 
+#include <inktty/gfx/compose.hpp>
+#include <inktty/gfx/dither.hpp>
 #include <inktty/gfx/epaper_emulation.hpp>
 #include <inktty/gfx/matrix_renderer.hpp>
+#include <inktty/gfx/refresh_scheduler.hpp>
+#include <inktty/gfx/tile_cache.hpp>
+#include <inktty/utils/dirty_rows.hpp>
+#include <inktty/utils/grid.hpp>
 #include <inktty/utils/logger.hpp>
+#include <inktty/utils/profile.hpp>
 
 namespace inktty {
 
@@ -38,20 +47,6 @@ private:
 		 */
 		Matrix::Cell cell;
 
-		/**
-		 * The time since the cell was last updated. This is reset to zero
-		 * whenever the cell is being redrawn.
-		 */
-		uint32_t last_update;
-
-		/**
-		 * The global number of update operations since the cell has last been
-		 * redrawn. Since the content shown on epaper displays degrades over
-		 * time when other parts of the screen are updated, this counter is
-		 * used to regularly update the screen.
-		 */
-		uint32_t operation_counter;
-
 		/**
 		 * A flag indicating whether or not the cell has last been drawn in
 		 * the low quality mode.
@@ -65,8 +60,8 @@ private:
 		bool is_high_quality : 1;
 
 		/**
-		 * A flag indicating whether the cell needs a refresh because of one of
-		 * the global update rules.
+		 * A flag indicating whether the cell needs a refresh because the
+		 * refresh scheduler selected the region containing it.
 		 */
 		bool is_overdue : 1;
 
@@ -75,21 +70,153 @@ private:
 		 */
 		bool is_dirty : 1;
 
+		/**
+		 * A flag indicating whether the cell has been drawn as a single tile.
+		 * Tiles leave nothing on the presentation layer that would have to be
+		 * erased.
+		 */
+		bool is_tile : 1;
+
+		/**
+		 * A flag indicating whether the glyph drawn in this cell exceeds the
+		 * cell boundaries. Neighbouring cells must not be drawn as tiles, since
+		 * this would clip the glyph.
+		 */
+		bool overhangs : 1;
+
 		/**
 		 * Initialises the cell metadata to default values.
 		 */
 		Cell()
-		    : last_update(0),
-		      operation_counter(0),
-		      is_low_quality(false),
+		    : is_low_quality(false),
 		      is_high_quality(true),
 		      is_overdue(true),
-		      is_dirty(false) {}
+		      is_dirty(false),
+		      is_tile(false),
+		      overhangs(false) {}
+	};
+
+	Grid<Cell> m_cells;
+
+	/**
+	 * Colours a cell is drawn with, as derived from the cell style and the
+	 * colour configuration.
+	 */
+	struct Ink {
+		RGBA fg, bg;
+
+		/**
+		 * Greyscale values of fg and bg used in the low quality mode.
+		 */
+		uint8_t g_fg, g_bg;
+	};
+
+	/**
+	 * Entry in the direct-mapped cache of resolved inks. The key consists of
+	 * the colours and the colour-related attributes of a style.
+	 */
+	struct InkCacheEntry {
+		uint32_t fg, bg, attrs;
+		bool valid;
+		Ink ink;
+
+		InkCacheEntry() : valid(false) {}
+	};
+
+	static constexpr size_t INK_CACHE_SIZE = 256;
+
+	/**
+	 * Everything needed to draw a cell.
+	 */
+	struct Paint {
+		/**
+		 * Glyph bitmap or nullptr if no glyph is drawn.
+		 */
+		const GlyphBitmap *g;
+
+		RGBA fg, bg;
+
+		/**
+		 * Greyscale value of the dithered background in low quality mode.
+		 */
+		uint8_t g_bg;
+
+		/**
+		 * If true, the glyph is surrounded by a shadow in the inverse
+		 * foreground colour, offset by one pixel.
+		 */
+		bool shadow;
 	};
 
-	std::vector<std::vector<Cell>> m_cells;
+	/**
+	 * Lines drawn across a cell in addition to the glyph.
+	 */
+	enum Decoration : uint8_t {
+		DecorationUnderline = 1,
+		DecorationDoubleUnderline = 2,
+		DecorationStrikethrough = 4,
+	};
 
-	Rect m_update_bounds;
+	/**
+	 * Run of adjacent cells in a row that were drawn in the current pass with
+	 * the same decoration lines and colour. Each line of the run is drawn
+	 * with a single fill once the run ends.
+	 */
+	struct DecorationSpan {
+		size_t row, col0, col1;
+		uint8_t lines;
+		RGBA colour;
+	};
+
+	/**
+	 * Global clock in milliseconds, advanced by the "dt" passed to draw().
+	 */
+	uint64_t m_time;
+
+	/**
+	 * Decides which regions of the screen are redrawn in high quality.
+	 */
+	RefreshScheduler m_refresh;
+
+	/**
+	 * Temporary vector holding the cell blocks selected for a high quality
+	 * refresh.
+	 */
+	std::vector<Rect> m_refresh_blocks;
+
+	/**
+	 * Cells that were not drawn because the display was still busy updating
+	 * the region they cover. These cells keep their flags and are revisited
+	 * once the display reports a completed update.
+	 */
+	std::vector<Point> m_deferred;
+
+	/**
+	 * Temporary vector holding the regions reported as completed by the
+	 * display.
+	 */
+	std::vector<Rect> m_completed;
+
+	/**
+	 * Temporary vectors holding the updates and scroll operations reported by
+	 * the matrix, as well as the glyphs about to be drawn. Kept across frames
+	 * such that drawing does not allocate memory once they reached their
+	 * steady state size.
+	 */
+	std::vector<Point> m_updates;
+	std::vector<Matrix::Scroll> m_scrolls;
+	std::vector<uint32_t> m_glyphs_mono, m_glyphs;
+
+	/**
+	 * Cells drawn by the cursor fast path in the current frame.
+	 */
+	std::vector<Point> m_cursor_cells;
+
+	/**
+	 * Span of cells in each row that need to be visited in the next call to
+	 * draw().
+	 */
+	DirtyRows m_update_rows;
 
 	const Configuration &m_config;
 
@@ -97,7 +224,31 @@ private:
 
 	Display &m_display;
 
-	Matrix &m_matrix;
+	/**
+	 * Matrix that is being drawn. May be replaced by set_matrix(), the new
+	 * matrix is picked up by the next call to snapshot().
+	 */
+	Matrix *m_matrix;
+
+	/**
+	 * Set by set_matrix(); the next call to snapshot() adapts the new matrix
+	 * to the screen geometry and redraws the entire screen.
+	 */
+	bool m_matrix_changed;
+
+	/**
+	 * Copy of the matrix cells as of the last call to snapshot(). The cells
+	 * are drawn from this copy, such that render() does not access the
+	 * matrix. The copy is kept in sync by applying the scroll operations and
+	 * updates reported by the matrix.
+	 */
+	Matrix::CellArray m_snapshot;
+
+	/**
+	 * If true, the next call to snapshot() copies all matrix cells, e.g.
+	 * because the geometry changed.
+	 */
+	bool m_snapshot_stale;
 
 	unsigned int m_font_size;
 
@@ -111,10 +262,67 @@ private:
 
 	size_t m_cell_w, m_cell_h;
 
+	/**
+	 * Offset of the decoration lines from the top of a cell and the line
+	 * thickness in pixels, derived from the font metrics.
+	 */
+	int m_underline_y, m_double_underline_y, m_strikethrough_y, m_line_h;
+
+	DecorationSpan m_span;
+
 	bool m_needs_geometry_update;
 
+	bool m_needs_bounds_update;
+
+	bool m_needs_redraw;
+
+	bool m_needs_repaint;
+
+	std::vector<InkCacheEntry> m_ink_cache;
+
+	TileCache m_tiles;
+
+	/**
+	 * Scratch buffers for the background and presentation layer of a tile
+	 * that is being composed.
+	 */
+	std::vector<RGBA> m_tile_bg, m_tile_mg;
+
 	RectangleMerger m_merger;
 
+	Statistics m_statistics;
+
+	/**
+	 * Interval in milliseconds in which draw() should be called while cells
+	 * are waiting for the display to finish an update.
+	 */
+	static constexpr int DEFERRED_POLL_INTERVAL = 32;
+
+	/**
+	 * Marks the cell at the given location as drawn in the current frame.
+	 */
+	void mark_drawn(size_t row, size_t col, bool low_quality) {
+		Cell &c = m_cells[row][col];
+		c.is_high_quality = !low_quality;
+		c.is_low_quality = low_quality;
+		c.is_overdue = false;
+		c.is_dirty = false;
+		if (low_quality) {
+			m_refresh.drawn_low_quality(row, col);
+		}
+	}
+
+	/**
+	 * Returns the number of milliseconds after which draw() must be called
+	 * again, or -1 if there is no such need.
+	 */
+	int next_wakeup() {
+		if (!m_deferred.empty()) {
+			return DEFERRED_POLL_INTERVAL;
+		}
+		return m_refresh.next_wakeup(m_time);
+	}
+
 	/**
 	 * Used internally to recompute the number of cells and to initialize the
 	 * cell metadata in case the underlying display geometry changes.
@@ -125,6 +333,19 @@ private:
 		m_cell_w = m.cell_width;
 		m_cell_h = m.cell_height;
 
+		/* Place the decoration lines relative to the baseline. Fonts without
+		   a baseline (bitmap fonts) are assumed to have it at 13/16 of the
+		   cell height. */
+		const int ch = m_cell_h;
+		const int baseline =
+		    (m.origin_y > 0 && m.origin_y < ch) ? m.origin_y : ch * 13 / 16;
+		const int t = std::max(1, (ch + 8) / 16);
+		m_line_h = t;
+		m_underline_y = std::max(0, std::min(baseline + t, ch - t));
+		m_double_underline_y = std::max(0, std::min(baseline + t, ch - 3 * t));
+		m_strikethrough_y =
+		    std::max(0, std::min(baseline - baseline * 3 / 10 - t / 2, ch - t));
+
 		/* Fetch the bounding box */
 		const int b_x0 = m_bounds.x0, b_y0 = m_bounds.y0;
 		const int b_x1 = m_bounds.x1, b_y1 = m_bounds.y1;
@@ -141,31 +362,39 @@ private:
 		m_pad_y = (h - m_cell_h * m_rows) / 2;
 
 		/* Allocate the Cell structure */
-		m_cells.clear();
-		for (size_t i = 0; i < m_rows; i++) {
-			m_cells.emplace_back(std::vector<Cell>(m_cols, Cell()));
-		}
+		m_cells.resize(m_rows, m_cols);
+		m_cells.fill(Cell());
+		m_deferred.clear();
+		m_update_rows.clear();
+		m_update_rows.resize(m_rows);
+		m_refresh.reset(m_rows, m_cols);
+
+		/* Tiles have the size of a cell on the screen */
+		const Rect r = get_coords(0, 0);
+		m_tiles.reset(r.width(), r.height());
 
 		/* Resize the underlying matrix instance */
-		m_matrix.resize(m_rows, m_cols);
+		m_matrix->resize(m_rows, m_cols);
+		m_snapshot_stale = true;
 
 		/* The geometry has been updated, prevent unecessary calls to this
 		   function. */
 		m_needs_geometry_update = false;
 	}
 
-	Rect get_coords(size_t row, size_t col) {
-		// Compute the untransformed bounding box
-		const int x0 = col * m_cell_w;
-		const int x1 = x0 + m_cell_w;
-		const int y0 = row * m_cell_h;
-		const int y1 = y0 + m_cell_h;
-
+	/**
+	 * Transforms the given rectangle from the unrotated cell area to screen
+	 * coordinates for the orientation O. The orientation is a template
+	 * parameter such that the cell drawing kernels below do not branch on it
+	 * for every cell.
+	 */
+	template <unsigned int O>
+	Rect transform(int x0, int y0, int x1, int y1) const {
 		const int b_x0 = m_bounds.x0, b_y0 = m_bounds.y0;
 		const int b_x1 = m_bounds.x1, b_y1 = m_bounds.y1;
 
 		// Return the bounding box depending on the orientation
-		switch (m_orientation) {
+		switch (O) {
 			default:
 			case 0:
 				return Rect{
@@ -199,81 +428,608 @@ private:
 		__builtin_unreachable();
 	}
 
-	Rect draw_cell(size_t row, size_t col, const Matrix::Cell &cell, bool erase,
-	               bool low_quality = true) {
+	/**
+	 * Computes the bounding box of the given cell on the screen for the
+	 * orientation O.
+	 */
+	template <unsigned int O>
+	Rect get_coords(size_t row, size_t col) const {
+		const int x0 = col * m_cell_w, y0 = row * m_cell_h;
+		return transform<O>(x0, y0, x0 + m_cell_w, y0 + m_cell_h);
+	}
+
+	Rect get_coords(size_t row, size_t col) const {
+		switch (m_orientation) {
+			default:
+			case 0:
+				return get_coords<0>(row, col);
+			case 1:
+				return get_coords<1>(row, col);
+			case 2:
+				return get_coords<2>(row, col);
+			case 3:
+				return get_coords<3>(row, col);
+		}
+	}
+
+	/**
+	 * Resolves the colours a cell with the given style is drawn with.
+	 */
+	Ink resolve_ink(const Style &style, bool cursor) const {
 		/* Fetch foreground and background colour */
 		const auto &cc = m_config.colors;  // color config
-		Color cfg = cell.style.fg, cbg = cell.style.bg;
-		if (cc.use_bright_on_bold && cell.style.bold &&
-		    cell.style.fg.is_indexed() && cell.style.fg.idx() < 8) {
-			cfg = Color(cell.style.fg.idx() + 8);
+		Color cfg = style.fg, cbg = style.bg;
+		if (cc.use_bright_on_bold && style.bold() && style.fg.is_indexed() &&
+		    style.fg.idx() < 8) {
+			cfg = Color(style.fg.idx() + 8);
 		}
 
 		/* Convert the colours to RGBA */
-		RGBA fg, bg;
-		if (cell.style.default_fg) {
-			fg = cc.default_fg;
+		Ink ink;
+		if (style.default_fg()) {
+			ink.fg = cc.default_fg;
 		} else {
-			fg = cfg.rgb(cc.palette);
+			ink.fg = cfg.rgb(cc.palette);
 		}
-		if (cell.style.default_bg) {
-			bg = cc.default_bg;
+		if (style.default_bg()) {
+			ink.bg = cc.default_bg;
 		} else {
-			bg = cbg.rgb(cc.palette);
+			ink.bg = cbg.rgb(cc.palette);
+		}
+		if (cursor ^ style.inverse()) {
+			std::swap(ink.fg, ink.bg);
 		}
-		if (cell.cursor ^ cell.style.inverse) {
-			std::swap(fg, bg);
+		ink.g_fg = epaper_emulation::rgba_to_greyscale(ink.fg);
+		ink.g_bg = epaper_emulation::rgba_to_greyscale(ink.bg);
+		return ink;
+	}
+
+	/**
+	 * Returns the colours a cell with the given style is drawn with. Looks up
+	 * the colours in the ink cache first.
+	 */
+	const Ink &ink(const Style &style, bool cursor) {
+		/* Only the colours and the attributes affecting the colours are part
+		   of the key */
+		constexpr uint32_t attrs_mask = Style::AttrDefaultFg |
+		                                Style::AttrDefaultBg | Style::AttrBold |
+		                                Style::AttrInverse;
+		const uint32_t fg = style.default_fg() ? 0U : style.fg.value();
+		const uint32_t bg = style.default_bg() ? 0U : style.bg.value();
+		const uint32_t attrs =
+		    (style.attrs & attrs_mask) | (cursor ? 0x80000000U : 0U);
+
+		InkCacheEntry &e =
+		    m_ink_cache[((fg * 0x9E3779B1U) ^ (bg * 0x85EBCA77U) ^ attrs) %
+		                INK_CACHE_SIZE];
+		if (!e.valid || e.fg != fg || e.bg != bg || e.attrs != attrs) {
+			e.ink = resolve_ink(style, cursor);
+			e.fg = fg, e.bg = bg, e.attrs = attrs;
+			e.valid = true;
+		}
+		return e.ink;
+	}
+
+	/**
+	 * Determines the glyph and the colours the given cell is drawn with.
+	 */
+	template <unsigned int O, bool LowQuality>
+	Paint paint(const Matrix::Cell &cell) {
+		const Ink &ink = this->ink(cell.style, cell.cursor);
+		const bool bold = cell.style.bold(), italic = cell.style.italic();
+		Paint p{nullptr, ink.fg, ink.bg, ink.g_bg, false};
+		if (cell.style.concealed()) {
+			/* Concealed cells only show their background */
+		} else if (LowQuality) {
+			if (ink.fg != ink.bg) {
+				p.g = m_font.render_styled(cell.glyph, m_font_size, bold,
+				                           italic, true, O);
+			}
+			p.fg = (ink.g_fg >= ink.g_bg) ? RGBA::White : RGBA::Black;
+			p.shadow = p.g && p.bg != RGBA::White && p.bg != RGBA::Black;
+		} else {
+			p.g = m_font.render_styled(cell.glyph, m_font_size, bold, italic,
+			                           false, O);
 		}
+		return p;
+	}
+
+	/**
+	 * Draws the given cell onto the display layers, or removes the glyph of
+	 * the cell from the presentation layer if Erase is true. Returns the
+	 * region that was touched.
+	 */
+	template <unsigned int O, bool LowQuality, bool Erase>
+	Rect draw_cell(size_t row, size_t col, const Matrix::Cell &cell) {
+		const Paint p = paint<O, LowQuality>(cell);
 
-		Rect r = get_coords(row, col);
+		Rect r = get_coords<O>(row, col);
 		Rect gr = r;
-		const GlyphBitmap *g = nullptr;
-		if (low_quality) {
-			const uint8_t g_fg = epaper_emulation::rgba_to_greyscale(fg);
-			const uint8_t g_bg = epaper_emulation::rgba_to_greyscale(bg);
-			if (!erase) {
-				m_display.fill_dither(Display::Layer::Background, g_bg, r);
+		if (!Erase) {
+			if (LowQuality) {
+				m_display.fill_dither(Display::Layer::Background, p.g_bg, r,
+				                      m_config.colors.dither);
+			} else {
+				m_display.fill(Display::Layer::Background, p.bg, r);
+			}
+		}
+
+		if (p.g) {
+			/* Monochrome glyphs only contain the values 0 and 255 */
+			const bool binary = p.g->metadata.monochrome;
+			const Display::DrawMode mode =
+			    Erase ? Display::DrawMode::Erase : Display::DrawMode::Write;
+			gr = Rect::sized(r.x0 + p.g->x, r.y0 + p.g->y, p.g->w, p.g->h);
+			if (p.shadow) {
+				const Rect gr2 = gr + Point(1, 1);
+				m_display.blit(Display::Layer::Presentation, ~p.fg, p.g->buf(),
+				               p.g->stride, gr2, mode, binary);
+				r = r.grow(gr2);
 			}
-			if (fg != bg) {
-				g = m_font.render(cell.glyph, m_font_size, true, m_orientation);
+			m_display.blit(Display::Layer::Presentation, p.fg, p.g->buf(),
+			               p.g->stride, gr, mode, binary);
+		}
+		return r.grow(gr);
+	}
+
+	/**
+	 * Composes the tile with the given key in the tile cache. Returns nullptr
+	 * if the glyph exceeds the cell boundaries and thus cannot be drawn as a
+	 * tile.
+	 */
+	template <unsigned int O, bool LowQuality>
+	const RGBA *compose_tile(const TileCache::Key &key, const Matrix::Cell &cell,
+	                         const Rect &r) {
+		const Paint p = paint<O, LowQuality>(cell);
+		const int w = r.width(), h = r.height(), s = p.shadow ? 1 : 0;
+		if (p.g && (p.g->x < 0 || p.g->y < 0 || p.g->x + int(p.g->w) + s > w ||
+		            p.g->y + int(p.g->h) + s > h)) {
+			return nullptr;
+		}
+
+		/* Draw the background. The background buffer is padded such that the
+		   dithering pattern lines up with the pattern on the screen. */
+		const dither::Pattern pattern = m_config.colors.dither;
+		const int period = dither::period(pattern);
+		const int px = r.x0 % period, py = r.y0 % period, bw = w + period - 1;
+		m_tile_bg.resize(bw * (h + period - 1));
+		RGBA *bg = &m_tile_bg[py * bw + px];
+		if (LowQuality) {
+			dither::ordered_binary_4bit_greyscale(p.g_bg, m_tile_bg.data(),
+			                                      bw * sizeof(RGBA), px, py,
+			                                      px + w, py + h, pattern);
+		} else {
+			const RGBA f = p.bg.premultiply_alpha();
+			for (int y = 0; y < h; y++) {
+				std::fill(bg + y * bw, bg + y * bw + w, f);
 			}
-			if (g_fg >= g_bg) {
-				fg = RGBA::White;
+		}
+
+		/* Draw the shadow and the glyph onto the presentation layer */
+		m_tile_mg.assign(w * h, RGBA(0, 0, 0, 0));
+		if (p.g) {
+			const bool binary = p.g->metadata.monochrome;
+			RGBA *mg = &m_tile_mg[p.g->y * w + p.g->x];
+			if (p.shadow) {
+				for (unsigned int y = 0; y < p.g->h; y++) {
+					compose::mask(mg + (y + 1) * w + 1,
+					              p.g->buf() + y * p.g->stride, ~p.fg, p.g->w,
+					              binary);
+				}
+			}
+			for (unsigned int y = 0; y < p.g->h; y++) {
+				compose::mask(mg + y * w, p.g->buf() + y * p.g->stride, p.fg,
+				              p.g->w, binary);
+			}
+		}
+
+		/* Compose both layers into the tile */
+		RGBA *tile = m_tiles.put(key);
+		for (int y = 0; y < h; y++) {
+			compose::over(tile + y * w, bg + y * bw, &m_tile_mg[y * w], w);
+		}
+		return tile;
+	}
+
+	/**
+	 * Draws the given cell as a single tile copied from the tile cache.
+	 * Returns false if the cell cannot be drawn as a tile.
+	 */
+	template <unsigned int O, bool LowQuality>
+	bool draw_tile(size_t row, size_t col, const Matrix::Cell &cell) {
+		const Rect r = get_coords<O>(row, col);
+
+		/* In low quality mode the dithering pattern depends on the location
+		   of the cell on the screen. Bold and italic glyphs are rendered
+		   from different faces. */
+		const uint32_t period = dither::period(m_config.colors.dither);
+		const uint32_t mode =
+		    (LowQuality
+		         ? (1U | ((r.x0 % period) << 1U) | ((r.y0 % period) << 5U))
+		         : 0U) |
+		    (cell.style.bold() ? (1U << 9U) : 0U) |
+		    (cell.style.italic() ? (1U << 10U) : 0U) |
+		    (cell.style.concealed() ? (1U << 11U) : 0U);
+		const Ink &ink = this->ink(cell.style, cell.cursor);
+		const TileCache::Key key{cell.glyph, ink.fg, ink.bg, mode};
+		const RGBA *tile = m_tiles.get(key);
+		if (!tile && !(tile = compose_tile<O, LowQuality>(key, cell, r))) {
+			return false;
+		}
+		m_display.blit_tile(tile, m_tiles.stride(), r);
+		return true;
+	}
+
+	/**
+	 * Returns true if one of the cells surrounding the given cell is drawn
+	 * with a glyph exceeding its boundaries.
+	 */
+	bool neighbour_overhangs(size_t row, size_t col) const {
+		const size_t y0 = row ? row - 1 : 0, y1 = std::min(row + 2, m_rows);
+		const size_t x0 = col ? col - 1 : 0, x1 = std::min(col + 2, m_cols);
+		for (size_t y = y0; y < y1; y++) {
+			for (size_t x = x0; x < x1; x++) {
+				if ((y != row || x != col) && m_cells[y][x].overhangs) {
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	/**
+	 * Returns the decoration lines drawn across the given cell.
+	 */
+	uint8_t decoration(const Matrix::Cell &cell) {
+		const Style &style = cell.style;
+		if (!(style.underline() || style.strikethrough()) ||
+		    style.concealed()) {
+			return 0;
+		}
+		const Ink &ink = this->ink(style, cell.cursor);
+		if (ink.fg == ink.bg) {
+			return 0;
+		}
+		return (style.strikethrough() ? DecorationStrikethrough : 0) |
+		       (style.underline() == 1 ? DecorationUnderline : 0) |
+		       (style.underline() > 1 ? DecorationDoubleUnderline : 0);
+	}
+
+	/**
+	 * Replaces the cell currently shown at the given location with the given
+	 * content. Draws the cell as a single tile if possible, otherwise removes
+	 * the old glyph and draws the new one onto the display layers. Returns
+	 * the region that was touched.
+	 */
+	template <unsigned int O, bool LowQuality>
+	Rect redraw_cell(size_t row, size_t col, const Matrix::Cell &cell) {
+		Cell &c = m_cells[row][col];
+		const Rect r = get_coords<O>(row, col);
+		const bool isolated = !neighbour_overhangs(row, col);
+
+		/* Remove the old glyph. Nothing needs to be done for tiles. If the cell
+		   is the only one covering its presentation layer, the layer is
+		   simply cleared; otherwise the glyph must be erased pixel by pixel
+		   to keep the other glyphs intact. */
+		Rect r1 = r;
+		if (!c.is_tile) {
+			if (isolated && !c.overhangs) {
+				m_display.fill(Display::Layer::Presentation, RGBA(0, 0, 0, 0),
+				               r);
 			} else {
-				fg = RGBA::Black;
+				r1 = c.is_low_quality
+				         ? draw_cell<O, true, true>(row, col, c.cell)
+				         : draw_cell<O, false, true>(row, col, c.cell);
 			}
-		} else {
-			if (!erase) {
-				m_display.fill(Display::Layer::Background, bg, r);
+		}
+
+		/* Tiles would clip glyphs reaching into this cell. Decorated cells
+		   are not drawn as tiles either: tiles contain the glyph in the
+		   background layer, where the decoration lines would cover it. */
+		if (isolated && !decoration(cell) &&
+		    draw_tile<O, LowQuality>(row, col, cell)) {
+			c.is_tile = true;
+			c.overhangs = false;
+			m_statistics.cells_tiled++;
+			return r1;
+		}
+
+		const Rect r2 = draw_cell<O, LowQuality, false>(row, col, cell);
+		c.is_tile = false;
+		c.overhangs = (r2 != r);
+		return r1.grow(r2);
+	}
+
+	/**
+	 * Adds the decoration lines of the given cell, which was just drawn, to
+	 * the current decoration span. Flushes the span if the cell does not
+	 * continue it. Lines are drawn onto the background layer, such that
+	 * redrawing a cell erases them. Decorated cells are never drawn as tiles,
+	 * so their glyphs are on the presentation layer, on top of the lines.
+	 */
+	template <unsigned int O, bool LowQuality>
+	void decorate(size_t row, size_t col, const Matrix::Cell &cell) {
+		const uint8_t lines = decoration(cell);
+		RGBA colour;
+		if (lines) {
+			const Ink &ink = this->ink(cell.style, cell.cursor);
+			colour = LowQuality
+			             ? ((ink.g_fg >= ink.g_bg) ? RGBA::White : RGBA::Black)
+			             : ink.fg;
+		}
+
+		/* Extend the current span if the cell continues it */
+		if (m_span.lines && m_span.row == row && m_span.col1 == col &&
+		    m_span.lines == lines && m_span.colour == colour) {
+			m_span.col1++;
+			return;
+		}
+		flush_decoration<O>();
+		if (lines) {
+			m_span = DecorationSpan{row, col, col + 1, lines, colour};
+		}
+	}
+
+	/**
+	 * Draws the lines of the current decoration span and resets the span.
+	 */
+	template <unsigned int O>
+	void flush_decoration() {
+		const DecorationSpan &s = m_span;
+		if (!s.lines) {
+			return;
+		}
+		const int x0 = s.col0 * m_cell_w, x1 = s.col1 * m_cell_w;
+		const int y = s.row * m_cell_h, h = m_line_h;
+		const auto line = [&](int dy) {
+			m_display.fill(Display::Layer::Background, s.colour,
+			               transform<O>(x0, y + dy, x1, y + dy + h));
+			m_statistics.decoration_fills++;
+		};
+		if (s.lines & DecorationUnderline) {
+			line(m_underline_y);
+		}
+		if (s.lines & DecorationDoubleUnderline) {
+			line(m_double_underline_y);
+			line(m_double_underline_y + 2 * h);
+		}
+		if (s.lines & DecorationStrikethrough) {
+			line(m_strikethrough_y);
+		}
+		m_span.lines = 0;
+	}
+
+	/**
+	 * Returns the bounding box (in screen coordinates) of the block of cells
+	 * spanned by the rows [row0, row1) and columns [col0, col1).
+	 */
+	Rect get_coords(size_t row0, size_t col0, size_t row1, size_t col1) {
+		return get_coords(row0, col0).grow(get_coords(row1 - 1, col1 - 1));
+	}
+
+	/**
+	 * Applies a move operation reported by the matrix. Moves the cell
+	 * metadata and, if "move_pixels" is true, moves the pixels on the display
+	 * instead of redrawing the moved cells.
+	 */
+	void scroll(const Matrix::Scroll &s, bool move_pixels) {
+		/* Convert the region to zero-based coordinates and clip it */
+		const int x0 = s.r.x0 - 1, y0 = s.r.y0 - 1;
+		const int x1 = std::min(s.r.x1, int(m_cols));
+		const int y1 = std::min(s.r.y1, int(m_rows));
+		const int down = s.downward, right = s.rightward;
+		if (x0 < 0 || y0 < 0 || std::abs(down) >= y1 - y0 ||
+		    std::abs(right) >= x1 - x0) {
+			return;
+		}
+
+		/* Move the cell metadata */
+		m_cells.move(y0, y1, x0, x1, down, right);
+
+		/* Compute the cell block that received content */
+		const int ty0 = y0 + std::max(0, -down), ty1 = y1 - std::max(0, down);
+		const int tx0 = x0 + std::max(0, -right), tx1 = x1 - std::max(0, right);
+
+		/* Move the deferred cells along with the region, discard deferred
+		   cells that were moved out of the region */
+		auto it = m_deferred.begin();
+		for (Point &p : m_deferred) {
+			if (p.x >= x0 && p.x < x1 && p.y >= y0 && p.y < y1) {
+				p -= Point(right, down);
+				if (p.x < x0 || p.x >= x1 || p.y < y0 || p.y >= y1) {
+					continue;
+				}
 			}
-			g = m_font.render(cell.glyph, m_font_size, false, m_orientation);
-		}
-
-		if (g) {
-			gr = Rect::sized(r.x0 + g->x, r.y0 + g->y, g->w, g->h);
-			if (low_quality && bg != RGBA::White && bg != RGBA::Black) {
-				Rect gr2 =
-				    Rect::sized(r.x0 + g->x + 1, r.y0 + g->y + 1, g->w, g->h);
-				m_display.blit(Display::Layer::Presentation, ~fg, g->buf(),
-				               g->stride, gr2,
-				               erase ? Display::DrawMode::Erase
-				                     : Display::DrawMode::Write);
-				r = r.grow(gr2);
+			*(it++) = p;
+		}
+		m_deferred.erase(it, m_deferred.end());
+
+		if (!move_pixels) {
+			return;
+		}
+
+		/* Move the pixels */
+		const Rect tar = get_coords(ty0, tx0, ty1, tx1);
+		const Rect src = get_coords(ty0 + down, tx0 + right, ty1 + down,
+		                            tx1 + right);
+		m_display.move(src, Point(tar.x0, tar.y0));
+
+		/* Use a monochrome update if none of the moved cells were drawn in
+		   high quality mode */
+		bool high_quality = false;
+		for (int y = ty0; y < ty1 && !high_quality; y++) {
+			for (int x = tx0; x < tx1; x++) {
+				if (m_cells[y][x].is_high_quality) {
+					high_quality = true;
+					break;
+				}
 			}
-			m_display.blit(
-			    Display::Layer::Presentation, fg, g->buf(), g->stride, gr,
-			    erase ? Display::DrawMode::Erase : Display::DrawMode::Write);
 		}
-		return r.grow(gr);
+		m_display.commit(
+		    tar, UpdateMode(UpdateMode::Identity, high_quality
+		                                              ? UpdateMode::Partial
+		                                              : UpdateMode::SourceMono));
+
+		/* A monochrome update adds to the ghosting of the moved region */
+		if (!high_quality) {
+			for (int y = ty0; y < ty1; y++) {
+				for (int x = tx0; x < tx1; x++) {
+					m_refresh.drawn_low_quality(y, x);
+				}
+			}
+		}
+	}
+
+	/**
+	 * Redraws all dirty cells in low quality mode (LowQuality = true) or all
+	 * overdue cells in high quality mode (LowQuality = false) and commits the
+	 * touched regions. The kernel is instantiated for every orientation and
+	 * quality, such that the per-cell code does not branch on either.
+	 */
+	template <unsigned int O, bool LowQuality>
+	void redraw_pass() {
+		m_merger.reset();
+		for (int y = m_update_rows.y0(); y <= m_update_rows.y1(); y++) {
+			const DirtyRows::Span &span = m_update_rows[y];
+			for (int x = span.x0; x <= span.x1; x++) {
+				/* Fetch the cell, skip it if it is not scheduled for this
+				   pass */
+				Cell &c = m_cells[y][x];
+				if (LowQuality ? !c.is_dirty : !c.is_overdue) {
+					continue;
+				}
+
+				/* Do not stall on regions the display is still updating */
+				if (m_display.busy(get_coords<O>(y, x))) {
+					m_deferred.emplace_back(x, y);
+					continue;
+				}
+
+				/* Draw the new cell content and insert the region we touched
+				   into the rectangle merger */
+				const Matrix::Cell &c_new = m_snapshot[y][x];
+				m_merger.insert(redraw_cell<O, LowQuality>(y, x, c_new));
+				decorate<O, LowQuality>(y, x, c_new);
+
+				/* Update the cell metadata */
+				c.cell = c_new;
+				mark_drawn(y, x, LowQuality);
+				if (LowQuality) {
+					m_statistics.cells_low_quality++;
+				} else {
+					m_statistics.cells_high_quality++;
+				}
+			}
+			flush_decoration<O>();
+		}
+
+		/* Merge all rectangles and commit them; low quality updates are
+		   displayed with a monochrome waveform */
+		m_merger.merge();
+		const UpdateMode mode(UpdateMode::Identity,
+		                      LowQuality ? UpdateMode::SourceMono
+		                                 : UpdateMode::Partial);
+		for (const Rect &r : m_merger) {
+			m_display.commit(r, mode);
+		}
+	}
+
+	/**
+	 * Returns true if the cell at the given location only needs to be redrawn
+	 * because the cursor moved onto or away from it. A pending high quality
+	 * redraw of the cell is left to the refresh scheduler, which accounts for
+	 * the cell being drawn in low quality.
+	 */
+	bool cursor_only(int row, int col) const {
+		const Cell &c = m_cells[row][col];
+		Matrix::Cell cell = m_snapshot[row][col];
+		if (cell.cursor == c.cell.cursor) {
+			return false;
+		}
+		cell.cursor = c.cell.cursor;
+		cell.dirty = true;
+		return !cell.needs_update(c.cell);
+	}
+
+	/**
+	 * Draws the cells in m_cursor_cells, which only differ from the displayed
+	 * content in the cursor flag. Each cell is committed on its own; the
+	 * glyph prefetch, the rectangle merger and the high quality pass are
+	 * skipped.
+	 */
+	template <unsigned int O>
+	void cursor_pass() {
+		const UpdateMode mode(UpdateMode::Identity, UpdateMode::SourceMono);
+		for (const Point &p : m_cursor_cells) {
+			if (m_display.busy(get_coords<O>(p.y, p.x))) {
+				m_deferred.push_back(p);
+				continue;
+			}
+			const Matrix::Cell &c_new = m_snapshot[p.y][p.x];
+			const Rect r = redraw_cell<O, true>(p.y, p.x, c_new);
+			decorate<O, true>(p.y, p.x, c_new);
+			flush_decoration<O>();
+			m_display.commit(r, mode);
+			m_cells[p.y][p.x].cell = c_new;
+			mark_drawn(p.y, p.x, true);
+			m_statistics.cells_low_quality++;
+		}
+	}
+
+	/**
+	 * Selects the cursor_pass() kernel for the current orientation.
+	 */
+	void draw_cursor_pass() {
+		switch (m_orientation) {
+			default:
+			case 0:
+				cursor_pass<0>();
+				break;
+			case 1:
+				cursor_pass<1>();
+				break;
+			case 2:
+				cursor_pass<2>();
+				break;
+			case 3:
+				cursor_pass<3>();
+				break;
+		}
+	}
+
+	/**
+	 * Selects the redraw_pass() kernel for the current orientation.
+	 */
+	template <bool LowQuality>
+	void draw_pass() {
+		switch (m_orientation) {
+			default:
+			case 0:
+				redraw_pass<0, LowQuality>();
+				break;
+			case 1:
+				redraw_pass<1, LowQuality>();
+				break;
+			case 2:
+				redraw_pass<2, LowQuality>();
+				break;
+			case 3:
+				redraw_pass<3, LowQuality>();
+				break;
+		}
 	}
 
 public:
 	Impl(const Configuration &config, Font &font, Display &display,
 	     Matrix &matrix, unsigned int font_size, unsigned int orientation)
-	    : m_config(config),
+	    : m_time(0),
+	      m_refresh(config.refresh),
+	      m_config(config),
 	      m_font(font),
 	      m_display(display),
-	      m_matrix(matrix),
+	      m_matrix(&matrix),
+	      m_matrix_changed(false),
+	      m_snapshot_stale(true),
 	      m_font_size(font_size),
 	      m_orientation(orientation),
 	      m_cols(0),
@@ -283,188 +1039,267 @@ public:
 	      m_pad_y(0),
 	      m_cell_w(0),
 	      m_cell_h(0),
-	      m_needs_geometry_update(true) {
-		// Temporarily lock/unlock the display to get the screen size
-		m_bounds = m_display.lock();
-		m_display.unlock();
+	      m_underline_y(0),
+	      m_double_underline_y(0),
+	      m_strikethrough_y(0),
+	      m_line_h(0),
+	      m_span{0, 0, 0, 0, RGBA()},
+	      m_needs_geometry_update(true),
+	      m_needs_bounds_update(true),
+	      m_needs_redraw(false),
+	      m_needs_repaint(false),
+	      m_ink_cache(INK_CACHE_SIZE),
+	      m_merger(display.update_cost()) {
+		// The screen size and the geometry are determined by the first call
+		// to snapshot(), such that constructing the renderer neither locks
+		// the display nor queries the font metrics
+	}
 
-		// Compute the geometry
-		update_geometry();
+	void update_bounds() {
+		/* Temporarily lock/unlock the display to get the screen size, clear
+		   the screen if the size changed */
+		const Rect bounds = m_display.lock();
+		if (bounds != m_bounds) {
+			// The display is blank before the first frame
+			if (m_bounds.width() > 0 && m_bounds.height() > 0) {
+				m_display.fill(Display::Layer::Background, RGBA::Black,
+				               bounds);
+				m_display.fill(Display::Layer::Presentation, RGBA(0, 0, 0, 0),
+				               bounds);
+				m_display.commit(bounds);
+			}
+			m_bounds = bounds;
+			m_needs_geometry_update = true;
+		}
+		m_display.unlock();
+		m_needs_bounds_update = false;
 	}
 
-	void draw(bool redraw, int dt) {
+	void snapshot() {
 		/* Check whether the geometry needs to be updated */
+		if (m_needs_bounds_update) {
+			update_bounds();
+		}
 		if (m_needs_geometry_update) {
 			update_geometry(); /* Resets m_needs_geometry_update */
 		}
+		if (m_needs_repaint) {
+			m_display.lock();
+			m_display.unlock();
+			m_needs_repaint = false;
+		}
 
+		/* Collect all updates from the underlying cell matrix. The updates
+		   refer to the cell locations after the move operations. */
+		m_updates.clear();
+		m_scrolls.clear();
+		if (m_matrix_changed) {
+			m_matrix->resize(m_rows, m_cols);
+		}
+		m_matrix->commit(m_updates, m_scrolls);
+
+		/* A different matrix replaces the entire screen content; the pending
+		   changes of the new matrix do not refer to the displayed content */
+		if (m_matrix_changed) {
+			m_matrix_changed = false;
+			m_updates.clear();
+			m_scrolls.clear();
+			m_snapshot_stale = true;
+			m_needs_redraw = true;
+		}
+
+		/* Bring the copy of the cells up to date. Apart from a geometry
+		   change only the reported cells need to be copied. */
+		const Matrix::CellArray &cells = m_matrix->cells();
+		const size_t rows = std::min(m_rows, cells.rows());
+		const size_t cols = std::min(m_cols, cells.cols());
+		if (m_snapshot_stale) {
+			m_snapshot.resize(m_rows, m_cols);
+			for (size_t y = 0; y < rows; y++) {
+				std::copy(cells[y], cells[y] + cols, m_snapshot[y]);
+			}
+			m_snapshot_stale = false;
+			return;
+		}
+		for (const Matrix::Scroll &s : m_scrolls) {
+			m_snapshot.move(s.r.y0 - 1, std::min<size_t>(s.r.y1, m_rows),
+			                s.r.x0 - 1, std::min<size_t>(s.r.x1, m_cols),
+			                s.downward, s.rightward);
+		}
+		for (const Point &p : m_updates) {
+			if (p.y <= int(rows) && p.x <= int(cols)) {
+				m_snapshot[p.y - 1][p.x - 1] = cells[p.y - 1][p.x - 1];
+			}
+		}
+	}
+
+	int render(bool redraw, int dt) {
 		/* If the redraw flag is set, mark all cells as dirty by resetting the
 		   cell metadata and thus marking the cell as "overdue". */
-		if (redraw) {
+		const bool full = redraw || m_needs_redraw;
+		if (full) {
+			m_needs_redraw = false;
+			m_cells.fill(Cell());
+			m_refresh.reset(m_rows, m_cols);
 			for (size_t y = 0; y < m_rows; y++) {
-				for (size_t x = 0; x < m_cols; x++) {
-					m_cells[y][x] = Cell();
-					m_update_bounds = m_update_bounds.grow(Point(x, y));
-				}
+				m_update_rows.grow(int(y), 0, int(m_cols) - 1);
 			}
 		}
 
-		/* Increment the last_update timer */
-		for (size_t y = 0; y < m_rows; y++) {
-			for (size_t x = 0; x < m_cols; x++) {
-				m_cells[y][x].last_update += dt;
+		/* Fetch the regions the display finished updating; cells deferred
+		   because of a pending update may now be drawn. */
+		m_completed.clear();
+		m_display.completed(m_completed);
+		const bool resumed = !m_completed.empty() && !m_deferred.empty();
+		if (!m_completed.empty()) {
+			for (const Point &p : m_deferred) {
+				m_update_rows.grow(p.y, p.x);
 			}
+			m_deferred.clear();
 		}
 
-		/* Collect all updates from the underlying cell matrix. */
-		std::vector<Point> updates;
-		m_matrix.commit(updates);
-		for (const Point &p: updates) {
-			if (p.y <= int(m_rows) && p.x <= int(m_cols)) {
-				m_cells[p.y - 1][p.x - 1].is_dirty = true;
-				m_update_bounds = m_update_bounds.grow(Point(p.x - 1, p.y - 1));
+		/* Advance the global clock */
+		m_time += std::max(0, dt);
+
+		/* Apply the move operations reported by the last snapshot first, the
+		   updates refer to the cell locations after these operations. Moving
+		   the already drawn pixels is unnecessary if the entire screen is
+		   redrawn. */
+		const bool scrolled = !m_scrolls.empty();
+		if (scrolled) {
+			m_refresh.frame(m_time);
+			m_display.lock();
+			for (const Matrix::Scroll &s : m_scrolls) {
+				scroll(s, !full);
 			}
 		}
-
-		/* Update cells depending on a global update rule, such as a redraw
-		   timeout. */
-		constexpr uint32_t redraw_timeout_low = 2000;
-		constexpr uint32_t redraw_timeout_high = 3000;
-		constexpr uint32_t update_counter_threshold_low = 1000;
-		constexpr uint32_t update_counter_threshold_high = 2000;
-		uint32_t update_counter_threshold = update_counter_threshold_high;
-		uint32_t redraw_timeout = redraw_timeout_high;
-		for (size_t y = 0; y < m_rows; y++) {
-			for (size_t x = 0; x < m_cols; x++) {
-				if (m_cells[y][x].operation_counter >
-				    update_counter_threshold) {
-					update_counter_threshold = update_counter_threshold_low;
-				}
-				if (m_cells[y][x].last_update >
-				    redraw_timeout) {
-					redraw_timeout = redraw_timeout_low;
-					break;
+		/* Moving the cursor only changes the cursor flag of the cells the
+		   cursor moved away from and onto */
+		bool cursor_moved = !full && !scrolled && !resumed &&
+		                    !m_updates.empty() && m_updates.size() <= 2;
+		m_cursor_cells.clear();
+		for (const Point &p : m_updates) {
+			if (p.y <= int(m_rows) && p.x <= int(m_cols)) {
+				m_cells[p.y - 1][p.x - 1].is_dirty = true;
+				m_update_rows.grow(p.y - 1, p.x - 1);
+				if (cursor_moved) {
+					cursor_moved = cursor_only(p.y - 1, p.x - 1);
+					m_cursor_cells.emplace_back(p.x - 1, p.y - 1);
 				}
 			}
 		}
-		for (size_t y = 0; y < m_rows; y++) {
-			for (size_t x = 0; x < m_cols; x++) {
-				Cell &c = m_cells[y][x];
-				const bool rule_counter =
-				    c.operation_counter >= update_counter_threshold;
-				const bool rule_timeout =
-				    c.is_low_quality && c.last_update >= redraw_timeout;
-				if (rule_counter || rule_timeout) {
+		m_updates.clear();
+		m_scrolls.clear();
+
+		/* Redraw the regions selected by the refresh scheduler in high
+		   quality */
+		m_refresh_blocks.clear();
+		m_refresh.due(m_time, m_refresh_blocks);
+		for (const Rect &b : m_refresh_blocks) {
+			for (int y = b.y0; y < b.y1; y++) {
+				for (int x = b.x0; x < b.x1; x++) {
 					m_cells[y][x].is_overdue = true;
-					m_update_bounds = m_update_bounds.grow(Point(x, y));
 				}
+				m_update_rows.grow(y, b.x0, b.x1 - 1);
 			}
 		}
 
 		/* Cancel if there are no updates scheduled */
-		if (!m_update_bounds.valid()) {
-			return;
+		if (m_update_rows.empty()) {
+			if (scrolled) {
+				m_display.unlock();
+			}
+			return next_wakeup();
 		}
 
-		/* There is going to be at least one draw operation; update the global
-		   operation counter. */
-		for (size_t y = 0; y < m_rows; y++) {
-			for (size_t x = 0; x < m_cols; x++) {
-				m_cells[y][x].operation_counter++;
-			}
+		/* There is going to be at least one draw operation; start a new frame
+		   unless the scroll operations already did so. */
+		if (!scrolled) {
+			m_refresh.frame(m_time);
+		}
+		m_statistics.frames++;
+
+		/* Take the fast path if only the cursor moved and no region is due
+		   for a high quality refresh */
+		if (cursor_moved && m_refresh_blocks.empty()) {
+			m_display.lock();
+			draw_cursor_pass();
+			m_display.unlock();
+			m_statistics.cursor_frames++;
+			m_update_rows.clear();
+			return next_wakeup();
 		}
 
-		m_display.lock(); /* TODO update screen size */
+		/* The display is already locked if the scroll operations were
+		   applied */
+		if (!scrolled) {
+			m_display.lock(); /* TODO update screen size */
+		}
 
-		/* Pass 1: Redraw all dirty cells in low quality mode */
-		const auto &matrix_cells = m_matrix.cells();
-		m_merger.reset();
-		for (int y = m_update_bounds.y0; y <= m_update_bounds.y1; y++) {
-			for (int x = m_update_bounds.x0; x <= m_update_bounds.x1; x++) {
-				/* Fetch the cell, skip it if it was not dirty */
-				Cell &c = m_cells[y][x];
-				if (!c.is_dirty) {
-					continue;
+		/* Hand the glyphs of all cells about to be drawn to the font, such that
+		   they can be rasterised in parallel. Dirty cells are drawn in low
+		   quality (monochrome) mode first, overdue cells in high quality. */
+		m_glyphs_mono.clear();
+		m_glyphs.clear();
+		for (int y = m_update_rows.y0(); y <= m_update_rows.y1(); y++) {
+			const DirtyRows::Span &span = m_update_rows[y];
+			for (int x = span.x0; x <= span.x1; x++) {
+				const Cell &c = m_cells[y][x];
+				if (c.is_dirty) {
+					m_glyphs_mono.push_back(m_snapshot[y][x].glyph);
+				}
+				if (c.is_dirty || c.is_overdue) {
+					m_glyphs.push_back(m_snapshot[y][x].glyph);
 				}
-
-				/* Fetch the old and new cell content */
-				const Matrix::Cell &c_old = m_cells[y][x].cell;
-				const Matrix::Cell &c_new = matrix_cells[y][x];
-
-				/* Erase the cell */
-				const Rect r1 =
-				    draw_cell(y, x, c_old, true, c.is_low_quality);
-
-				/* Draw the cell in low quality mode */
-				const Rect r2 =
-				    draw_cell(y, x, c_new, false, true);
-
-				/* Insert the region we touched into the rectangle merger */
-				m_merger.insert(r1.grow(r2));
-
-				/* Update the cell metadata */
-				c.cell = c_new;
-				c.operation_counter = 0;
-				c.last_update = 0;
-				c.is_high_quality = false;
-				c.is_low_quality = true;
-				c.is_overdue = false;
-				c.is_dirty = false;
 			}
 		}
+		m_font.prefetch(m_glyphs_mono.data(), m_glyphs_mono.size(),
+		                m_font_size, true, m_orientation);
+		m_font.prefetch(m_glyphs.data(), m_glyphs.size(), m_font_size, false,
+		                m_orientation);
 
-		/* Merge all rectangles and commit them; draw them in low-quality mode*/
-		m_merger.merge();
-		for (const Rect &r : m_merger) {
-			m_display.commit(
-			    r, UpdateMode(UpdateMode::Identity, UpdateMode::SourceMono));
-		}
+		/* Pass 1: Redraw all dirty cells in low quality mode */
+		INKTTY_PROFILE_TIMER(t_low_quality, RendererLowQuality);
+		draw_pass<true>();
+		INKTTY_PROFILE_STOP(t_low_quality);
 
 		/* Pass 2: Redraw all overdue cells in high quality mode */
-		m_merger.reset();
-		for (int y = m_update_bounds.y0; y <= m_update_bounds.y1; y++) {
-			for (int x = m_update_bounds.x0; x <= m_update_bounds.x1; x++) {
-				/* Fetch the cell, skip it if it was not dirty */
-				Cell &c = m_cells[y][x];
-				if (!c.is_overdue) {
-					continue;
-				}
+		INKTTY_PROFILE_TIMER(t_high_quality, RendererHighQuality);
+		draw_pass<false>();
+		INKTTY_PROFILE_STOP(t_high_quality);
 
-				/* Fetch the old and new cell content */
-				const Matrix::Cell &c_old = m_cells[y][x].cell;
-				const Matrix::Cell &c_new = matrix_cells[y][x];
+		m_display.unlock();
 
-				/* Erase the cell */
-				const Rect r1 =
-				    draw_cell(y, x, c_old, true, c.is_low_quality);
+		/* Reset the update spans */
+		m_update_rows.clear();
+		return next_wakeup();
+	}
 
-				/* Draw the cell in low quality mode */
-				const Rect r2 =
-				    draw_cell(y, x, c_new, false, false);
+	int draw(bool redraw, int dt) {
+		snapshot();
+		return render(redraw, dt);
+	}
 
-				/* Insert the region we touched into the rectangle merger */
-				m_merger.insert(r1.grow(r2));
+	void resize() { m_needs_bounds_update = true; }
 
-				/* Update the cell metadata */
-				c.cell = c_new;
-				c.operation_counter = 0;
-				c.last_update = 0;
-				c.is_high_quality = true;
-				c.is_low_quality = false;
-				c.is_overdue = false;
-				c.is_dirty = false;
-			}
-		}
-		m_merger.merge();
-		for (const Rect &r : m_merger) {
-			m_display.commit(
-			    r, UpdateMode(UpdateMode::Identity, UpdateMode::Partial));
+	void repaint() { m_needs_repaint = true; }
+
+	void set_matrix(Matrix &matrix) {
+		if (&matrix != m_matrix) {
+			m_matrix = &matrix;
+			m_matrix_changed = true;
 		}
+	}
 
-		m_display.unlock();
+	void colors_changed() {
+		std::fill(m_ink_cache.begin(), m_ink_cache.end(), InkCacheEntry());
+		m_needs_redraw = true;
+	}
 
-		/* Reset the update boundaries */
-		m_update_bounds = Rect();
+	size_t reclaim() {
+		const size_t res = m_tiles.bytes();
+		m_tiles.clear();
+		return res + m_font.reclaim();
 	}
 
 	void set_font_size(unsigned int font_size) {
@@ -491,8 +1326,12 @@ public:
 	}
 
 	unsigned int orientation() const { return m_orientation; }
+
+	const Statistics &statistics() const { return m_statistics; }
 };
 
+constexpr size_t MatrixRenderer::Impl::INK_CACHE_SIZE;
+
 /******************************************************************************
  * Class MatrixRenderer                                                       *
  ******************************************************************************/
@@ -506,7 +1345,25 @@ MatrixRenderer::~MatrixRenderer() {
 	// Make sure the destructor of m_impl is called.
 }
 
-void MatrixRenderer::draw(bool redraw, int dt) { m_impl->draw(redraw, dt); }
+int MatrixRenderer::draw(bool redraw, int dt) {
+	return m_impl->draw(redraw, dt);
+}
+
+void MatrixRenderer::snapshot() { m_impl->snapshot(); }
+
+int MatrixRenderer::render(bool redraw, int dt) {
+	return m_impl->render(redraw, dt);
+}
+
+void MatrixRenderer::resize() { m_impl->resize(); }
+
+void MatrixRenderer::repaint() { m_impl->repaint(); }
+
+void MatrixRenderer::set_matrix(Matrix &matrix) { m_impl->set_matrix(matrix); }
+
+void MatrixRenderer::colors_changed() { m_impl->colors_changed(); }
+
+size_t MatrixRenderer::reclaim() { return m_impl->reclaim(); }
 
 void MatrixRenderer::set_font_size(unsigned int font_size) {
 	m_impl->set_font_size(font_size);
@@ -522,4 +1379,8 @@ unsigned int MatrixRenderer::orientation() const {
 	return m_impl->orientation();
 }
 
+const MatrixRenderer::Statistics &MatrixRenderer::statistics() const {
+	return m_impl->statistics();
+}
+
 }  // namespace inktty
@@ -19,6 +19,7 @@
 #ifndef INKTTY_GFX_MATRIX_RENDERER_HPP
 #define INKTTY_GFX_MATRIX_RENDERER_HPP
 
+#include <cstdint>
 #include <memory>
 
 #include <inktty/config/configuration.hpp>
@@ -32,6 +33,54 @@ namespace inktty {
  * The MatrixRenderer class is used to render a terminal grid onto a display.
  */
 class MatrixRenderer {
+public:
+	/**
+	 * Counters accumulated over all calls to draw(), e.g. used to quantify the
+	 * amount of work performed by the renderer in benchmarks.
+	 */
+	struct Statistics {
+		/**
+		 * Number of calls to draw() that drew at least one cell.
+		 */
+		uint64_t frames;
+
+		/**
+		 * Number of cells drawn in low quality (monochrome) mode.
+		 */
+		uint64_t cells_low_quality;
+
+		/**
+		 * Number of cells drawn in high quality mode.
+		 */
+		uint64_t cells_high_quality;
+
+		/**
+		 * Number of cells (of either quality) that were drawn by copying a
+		 * pre-rendered tile.
+		 */
+		uint64_t cells_tiled;
+
+		/**
+		 * Number of frames that only moved the cursor and were drawn by the
+		 * cursor fast path.
+		 */
+		uint64_t cursor_frames;
+
+		/**
+		 * Number of fills drawing underlines and strikethrough lines. A single
+		 * fill covers all adjacent cells in a row sharing the same lines.
+		 */
+		uint64_t decoration_fills;
+
+		Statistics()
+		    : frames(0),
+		      cells_low_quality(0),
+		      cells_high_quality(0),
+		      cells_tiled(0),
+		      cursor_frames(0),
+		      decoration_fills(0) {}
+	};
+
 private:
 	class Impl;
 	std::unique_ptr<Impl> m_impl;
@@ -44,13 +93,69 @@ public:
 	~MatrixRenderer();
 
 	/**
-	 * Draws the matrix to the screen.
+	 * Draws the matrix to the screen. Equivalent to calling snapshot()
+	 * followed by render().
 	 *
 	 * @param redraw if true, redraws the entire screen.
 	 * @param dt is the number of milliseconds that passed since the last call
 	 * to "draw".
+	 * @return the number of milliseconds after which draw() must be called
+	 * again even if the matrix does not change, e.g. to redraw cells in high
+	 * quality mode. Returns -1 if there is no such need.
+	 */
+	int draw(bool redraw = false, int dt = 0);
+
+	/**
+	 * Commits the pending updates of the matrix and copies the changed cells
+	 * to an internal snapshot. This is the only function besides draw() that
+	 * accesses the matrix; the matrix must not be modified concurrently.
+	 * Each call must be followed by a call to render().
+	 */
+	void snapshot();
+
+	/**
+	 * Draws the content captured by the last call to snapshot(). Does not
+	 * access the matrix, i.e. the matrix may be modified by another thread
+	 * while this function is running. Parameters and return value are the
+	 * same as for draw().
+	 */
+	int render(bool redraw = false, int dt = 0);
+
+	/**
+	 * Must be called if the size of the display changed. Re-reads the display
+	 * size and updates the geometry of the matrix in the next call to draw().
+	 */
+	void resize();
+
+	/**
+	 * Passes the unchanged display content to the display backend once more
+	 * in the next call to draw(), e.g. such that a newly connected remote
+	 * viewer receives the entire screen.
+	 */
+	void repaint();
+
+	/**
+	 * Draws the given matrix instead of the current one, e.g. to switch
+	 * between several terminal sessions. The next call to snapshot() resizes
+	 * the matrix to the screen geometry and the next frame redraws the entire
+	 * screen. Like snapshot(), must not be called concurrently with
+	 * snapshot(), but may be called while render() is running.
+	 */
+	void set_matrix(Matrix &matrix);
+
+	/**
+	 * Must be called if the colour configuration changed. Discards the
+	 * colours cached for each cell style and redraws the entire matrix in the
+	 * next call to draw().
+	 */
+	void colors_changed();
+
+	/**
+	 * Releases the memory of the cached cell images and of the glyphs
+	 * rendered by the font, e.g. in response to memory pressure. Returns the
+	 * number of bytes released. Must not be called while render() is running.
 	 */
-	void draw(bool redraw = false, int dt = 0);
+	size_t reclaim();
 
 	void set_font_size(unsigned int font_size);
 
@@ -60,6 +165,7 @@ public:
 
 	unsigned int orientation() const;
 
+	const Statistics &statistics() const;
 };
 
 }  // namespace inktty
@@ -0,0 +1,71 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include <inktty/gfx/epaper_emulation.hpp>
+#include <inktty/gfx/panel_shadow.hpp>
+
+namespace inktty {
+
+/******************************************************************************
+ * Class PanelShadow                                                          *
+ ******************************************************************************/
+
+void PanelShadow::resize(size_t width, size_t height) {
+	m_width = width;
+	m_height = height;
+	m_stride = (width + 1) / 2;
+	m_stride_known = (width + 7) / 8;
+	m_data.assign(m_stride * height, 0);
+	m_known.assign(m_stride_known * height, 0);
+}
+
+void PanelShadow::unpack(uint8_t *tar, size_t y, size_t x0, size_t x1) const {
+	for (size_t x = x0; x < x1; x++) {
+		*(tar++) = get(x, y);
+	}
+}
+
+bool PanelShadow::update(size_t y, size_t x0, size_t x1, const uint8_t *src,
+                         const UpdateMode &mode, size_t &cx0, size_t &cx1) {
+	// Unknown target pixels are not masked by any operation depending on the
+	// panel content
+	const bool full = mode.mask_op == UpdateMode::Full;
+	const uint8_t *l = epaper_emulation::lut(mode);
+	const uint8_t *lu = epaper_emulation::lut(UpdateMode(
+	    mode.output_op, UpdateMode::MaskOp(mode.mask_op & UpdateMode::SourceMono)));
+	cx0 = x1, cx1 = x0;
+	for (size_t x = x0; x < x1; x++) {
+		const bool k = known(x, y);
+		const uint8_t t = get(x, y);
+		const uint8_t e = (k ? l : lu)[((*(src++) & 0x0FU) << 4U) | t];
+
+		// Store the new content and record the pixels that change
+		if ((e & epaper_emulation::UPDATED) && (!k || (e & 0x0FU) != t)) {
+			set(x, y, e & 0x0FU);
+		} else if (!full) {
+			continue;
+		}
+		cx0 = std::min(cx0, x);
+		cx1 = x + 1;
+	}
+	return cx0 < cx1;
+}
+
+}  // namespace inktty
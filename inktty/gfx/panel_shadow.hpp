@@ -0,0 +1,112 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file panel_shadow.hpp
+ *
+ * Contains the PanelShadow class, which keeps track of the content currently
+ * shown on an e-paper panel.
+ *
+ * @author Andreas Stöckel
+ */
+
+#ifndef INKTTY_GFX_PANEL_SHADOW_HPP
+#define INKTTY_GFX_PANEL_SHADOW_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <inktty/gfx/display.hpp>
+
+namespace inktty {
+/**
+ * The PanelShadow class stores the 4-bit greyscale value each pixel of an
+ * e-paper panel currently shows, packed into two pixels per byte. Each pixel
+ * additionally carries a bit indicating whether its value is known; pixels
+ * are unknown until they are updated for the first time.
+ *
+ * The update() function applies an UpdateMode in the same way as the e-paper
+ * emulation does. This allows to compute the mask operations depending on
+ * the current content of the panel (i.e. TargetMono and Partial) in software.
+ * Unknown pixels are treated as being black or white and as being different
+ * from any new content, i.e. they are always updated.
+ */
+class PanelShadow {
+private:
+	size_t m_width, m_height;
+	size_t m_stride, m_stride_known;
+	std::vector<uint8_t> m_data;
+	std::vector<uint8_t> m_known;
+
+	void set(size_t x, size_t y, uint8_t g) {
+		uint8_t &b = m_data[y * m_stride + x / 2];
+		b = (x & 1) ? ((b & 0x0F) | (g << 4)) : ((b & 0xF0) | g);
+		m_known[y * m_stride_known + x / 8] |= (1U << (x & 7));
+	}
+
+public:
+	PanelShadow() : m_width(0), m_height(0), m_stride(0), m_stride_known(0) {}
+
+	/**
+	 * Resizes the shadow to the given size and marks all pixels as unknown.
+	 */
+	void resize(size_t width, size_t height);
+
+	size_t width() const { return m_width; }
+
+	size_t height() const { return m_height; }
+
+	/**
+	 * Returns the 4-bit greyscale value shown at the given location. Unknown
+	 * pixels are reported as black.
+	 */
+	uint8_t get(size_t x, size_t y) const {
+		const uint8_t b = m_data[y * m_stride + x / 2];
+		return (x & 1) ? (b >> 4) : (b & 0x0F);
+	}
+
+	/**
+	 * Returns true if the value of the pixel at the given location is known.
+	 */
+	bool known(size_t x, size_t y) const {
+		return m_known[y * m_stride_known + x / 8] & (1U << (x & 7));
+	}
+
+	/**
+	 * Unpacks the pixels [x0, x1) of row y into one 4-bit value per byte.
+	 */
+	void unpack(uint8_t *tar, size_t y, size_t x0, size_t x1) const;
+
+	/**
+	 * Updates the pixels [x0, x1) of row y with the given new content using
+	 * the given update mode.
+	 *
+	 * @param src contains one 4-bit greyscale value per pixel, starting with
+	 * pixel x0.
+	 * @param cx0, cx1 are set to the columns [cx0, cx1) that need to be
+	 * updated on the panel. This includes all pixels if the "Full" mask
+	 * operation is used.
+	 * @return false if no pixel needs to be updated.
+	 */
+	bool update(size_t y, size_t x0, size_t x1, const uint8_t *src,
+	            const UpdateMode &mode, size_t &cx0, size_t &cx1);
+};
+}  // namespace inktty
+
+#endif /* INKTTY_GFX_PANEL_SHADOW_HPP */
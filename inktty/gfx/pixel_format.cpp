@@ -0,0 +1,315 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <cstring>
+
+#if defined(HAS_NEON)
+#include <arm_neon.h>
+#elif defined(HAS_SSE2)
+#include <emmintrin.h>
+#endif
+
+#include <inktty/gfx/pixel_format.hpp>
+
+namespace inktty {
+
+/******************************************************************************
+ * Pixel layouts                                                              *
+ ******************************************************************************/
+
+/*
+ * Each layout provides the number of bytes per pixel as well as functions for
+ * storing and loading a single pixel. The row converters below are
+ * instantiated for each layout.
+ */
+
+struct LayoutGeneric {
+	static size_t bypp(const ColorLayout &l) { return l.bypp(); }
+
+	static void store(uint8_t *p, const RGBA &c, const ColorLayout &l) {
+		const uint32_t cc = l.conv_from_rgba(c);
+		for (size_t k = 0; k < bypp(l); k++) {
+			p[k] = (cc >> (8 * k)) & 0xFF;
+		}
+	}
+
+	static RGBA load(const uint8_t *p, const ColorLayout &l) {
+		uint32_t cc = 0;
+		for (size_t k = 0; k < bypp(l); k++) {
+			cc |= uint32_t(p[k]) << (8 * k);
+		}
+		RGBA res = l.conv_to_rgba(cc);
+		res.a = 0xFF;
+		return res;
+	}
+};
+
+struct LayoutRGB565 {
+	static size_t bypp(const ColorLayout &) { return 2; }
+
+	static void store(uint8_t *p, const RGBA &c, const ColorLayout &) {
+		const uint16_t v = ((c.r & 0xF8U) << 8U) | ((c.g & 0xFCU) << 3U) |
+		                   (c.b >> 3U);
+		memcpy(p, &v, sizeof(v));
+	}
+
+	static RGBA load(const uint8_t *p, const ColorLayout &) {
+		uint16_t v;
+		memcpy(&v, p, sizeof(v));
+		return RGBA((v >> 8U) & 0xF8U, (v >> 3U) & 0xFCU, (v << 3U) & 0xF8U);
+	}
+};
+
+struct LayoutXRGB8888 {
+	static size_t bypp(const ColorLayout &) { return 4; }
+
+	static void store(uint8_t *p, const RGBA &c, const ColorLayout &) {
+		memcpy(p, &c, sizeof(RGBA));
+	}
+
+	static RGBA load(const uint8_t *p, const ColorLayout &) {
+		RGBA res;
+		memcpy(&res, p, sizeof(RGBA));
+		res.a = 0xFF;
+		return res;
+	}
+};
+
+struct LayoutY8 {
+	static size_t bypp(const ColorLayout &) { return 1; }
+
+	static void store(uint8_t *p, const RGBA &c, const ColorLayout &) {
+		*p = c.luma();
+	}
+
+	static RGBA load(const uint8_t *p, const ColorLayout &) {
+		return RGBA(*p, *p, *p);
+	}
+};
+
+/******************************************************************************
+ * Row converters                                                             *
+ ******************************************************************************/
+
+template <typename L>
+static void from_rgba_row(uint8_t *tar, const RGBA *src, int x0, int x1,
+                          const ColorLayout &l) {
+	const size_t bypp = L::bypp(l);
+	uint8_t *p = tar + x0 * bypp;
+	for (int x = x0; x < x1; x++, p += bypp) {
+		L::store(p, src[x], l);
+	}
+}
+
+template <typename L>
+static void from_grey_row(uint8_t *tar, const uint8_t *src, int x0, int x1,
+                          const ColorLayout &l) {
+	const size_t bypp = L::bypp(l);
+	uint8_t *p = tar + x0 * bypp;
+	for (int x = x0; x < x1; x++, p += bypp) {
+		L::store(p, RGBA(src[x], src[x], src[x]), l);
+	}
+}
+
+template <typename L>
+static void to_rgba_row(RGBA *tar, const uint8_t *src, int x0, int x1,
+                        const ColorLayout &l) {
+	const size_t bypp = L::bypp(l);
+	const uint8_t *p = src + x0 * bypp;
+	for (int x = x0; x < x1; x++, p += bypp) {
+		tar[x] = L::load(p, l);
+	}
+}
+
+/* XRGB8888 is the memory layout of RGBA, rows can be copied as they are */
+
+template <>
+void from_rgba_row<LayoutXRGB8888>(uint8_t *tar, const RGBA *src, int x0,
+                                   int x1, const ColorLayout &) {
+	if (x1 > x0) {
+		memcpy(tar + x0 * sizeof(RGBA), src + x0, (x1 - x0) * sizeof(RGBA));
+	}
+}
+
+/* Y8 greyscale rows can be copied as well */
+
+template <>
+void from_grey_row<LayoutY8>(uint8_t *tar, const uint8_t *src, int x0, int x1,
+                             const ColorLayout &) {
+	if (x1 > x0) {
+		memcpy(tar + x0, src + x0, x1 - x0);
+	}
+}
+
+/* The RGB565 conversion is vectorised, eight pixels at a time */
+
+template <>
+void from_rgba_row<LayoutRGB565>(uint8_t *tar, const RGBA *src, int x0,
+                                 int x1, const ColorLayout &l) {
+	int x = x0;
+#if defined(HAS_NEON)
+	for (; x + 8 <= x1; x += 8) {
+		// vld4 splits the pixels into b, g, r, a planes; successively insert
+		// the most significant bits of each channel
+		const uint8x8x4_t c = vld4_u8((const uint8_t *)(src + x));
+		uint16x8_t v = vshll_n_u8(c.val[2], 8);
+		v = vsriq_n_u16(v, vshll_n_u8(c.val[1], 8), 5);
+		v = vsriq_n_u16(v, vshll_n_u8(c.val[0], 8), 11);
+		vst1q_u8(tar + 2 * x, vreinterpretq_u8_u16(v));
+	}
+#elif defined(HAS_SSE2)
+	const __m128i mr = _mm_set1_epi32(0xF800);
+	const __m128i mg = _mm_set1_epi32(0x07E0);
+	const __m128i mb = _mm_set1_epi32(0x001F);
+	for (; x + 8 <= x1; x += 8) {
+		__m128i half[2];
+		for (int h = 0; h < 2; h++) {
+			const __m128i c =
+			    _mm_loadu_si128((const __m128i *)(src + x + 4 * h));
+			const __m128i v = _mm_or_si128(
+			    _mm_and_si128(_mm_srli_epi32(c, 8), mr),
+			    _mm_or_si128(_mm_and_si128(_mm_srli_epi32(c, 5), mg),
+			                 _mm_and_si128(_mm_srli_epi32(c, 3), mb)));
+
+			// Sign-extend the lower 16 bits such that the signed saturation
+			// in _mm_packs_epi32 does not alter the values
+			half[h] = _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+		}
+		_mm_storeu_si128((__m128i *)(tar + 2 * x),
+		                 _mm_packs_epi32(half[0], half[1]));
+	}
+#endif
+	uint8_t *p = tar + 2 * x;
+	for (; x < x1; x++, p += 2) {
+		LayoutRGB565::store(p, src[x], l);
+	}
+}
+
+/* Y4 packs two pixels into one byte and requires dedicated converters */
+
+static inline void store_y4(uint8_t *tar, int x, uint8_t v) {
+	uint8_t &p = tar[x >> 1];
+	if (x & 1) {
+		p = (p & 0x0FU) | (v & 0xF0U);
+	} else {
+		p = (p & 0xF0U) | (v >> 4U);
+	}
+}
+
+static void from_grey_row_y4(uint8_t *tar, const uint8_t *src, int x0, int x1,
+                             const ColorLayout &) {
+	int x = x0;
+	if ((x & 1) && x < x1) {
+		store_y4(tar, x, src[x]);
+		x++;
+	}
+	for (; x + 2 <= x1; x += 2) {
+		tar[x >> 1] = (src[x] >> 4U) | (src[x + 1] & 0xF0U);
+	}
+	if (x < x1) {
+		store_y4(tar, x, src[x]);
+	}
+}
+
+static void from_rgba_row_y4(uint8_t *tar, const RGBA *src, int x0, int x1,
+                             const ColorLayout &) {
+	for (int x = x0; x < x1; x++) {
+		store_y4(tar, x, src[x].luma());
+	}
+}
+
+static void to_rgba_row_y4(RGBA *tar, const uint8_t *src, int x0, int x1,
+                           const ColorLayout &) {
+	for (int x = x0; x < x1; x++) {
+		const uint8_t v = ((x & 1) ? (src[x >> 1] >> 4U) : src[x >> 1]) & 0x0FU;
+		tar[x] = RGBA(v * 17U, v * 17U, v * 17U);
+	}
+}
+
+/******************************************************************************
+ * Class PixelFormat                                                          *
+ ******************************************************************************/
+
+PixelFormat::Type PixelFormat::detect(const ColorLayout &l, bool greyscale) {
+	if (greyscale && l.bpp == 8) {
+		return Type::Y8;
+	} else if (greyscale && l.bpp == 4) {
+		return Type::Y4;
+	} else if (l.bpp == 16 && l.rr == 3 && l.rl == 11 && l.gr == 2 &&
+	           l.gl == 5 && l.br == 3 && l.bl == 0) {
+		return Type::RGB565;
+	} else if (l.bpp == 32 && l.rr == 0 && l.rl == 16 && l.gr == 0 &&
+	           l.gl == 8 && l.br == 0 && l.bl == 0) {
+		return Type::XRGB8888;
+	}
+	return Type::Generic;
+}
+
+PixelFormat::PixelFormat(const ColorLayout &layout, bool greyscale)
+    : PixelFormat(layout, detect(layout, greyscale)) {}
+
+PixelFormat::PixelFormat(const ColorLayout &layout, Type type)
+    : m_layout(layout), m_type(type) {
+	switch (type) {
+		case Type::Generic:
+			m_from_rgba = from_rgba_row<LayoutGeneric>;
+			m_from_grey = from_grey_row<LayoutGeneric>;
+			m_to_rgba = to_rgba_row<LayoutGeneric>;
+			break;
+		case Type::RGB565:
+			m_from_rgba = from_rgba_row<LayoutRGB565>;
+			m_from_grey = from_grey_row<LayoutRGB565>;
+			m_to_rgba = to_rgba_row<LayoutRGB565>;
+			break;
+		case Type::XRGB8888:
+			m_from_rgba = from_rgba_row<LayoutXRGB8888>;
+			m_from_grey = from_grey_row<LayoutXRGB8888>;
+			m_to_rgba = to_rgba_row<LayoutXRGB8888>;
+			break;
+		case Type::Y8:
+			m_from_rgba = from_rgba_row<LayoutY8>;
+			m_from_grey = from_grey_row<LayoutY8>;
+			m_to_rgba = to_rgba_row<LayoutY8>;
+			break;
+		case Type::Y4:
+			m_from_rgba = from_rgba_row_y4;
+			m_from_grey = from_grey_row_y4;
+			m_to_rgba = to_rgba_row_y4;
+			break;
+	}
+}
+
+const char *PixelFormat::name() const {
+	switch (m_type) {
+		case Type::Generic:
+			return "generic";
+		case Type::RGB565:
+			return "RGB565";
+		case Type::XRGB8888:
+			return "XRGB8888";
+		case Type::Y8:
+			return "Y8";
+		case Type::Y4:
+			return "Y4";
+	}
+	return "unknown";
+}
+
+}  // namespace inktty
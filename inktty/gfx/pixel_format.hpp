@@ -0,0 +1,138 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef INKTTY_GFX_PIXEL_FORMAT_HPP
+#define INKTTY_GFX_PIXEL_FORMAT_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include <inktty/utils/color.hpp>
+
+namespace inktty {
+/**
+ * The PixelFormat class converts rows of pixels between the internal RGBA or
+ * greyscale representation and the memory layout of a display surface. The
+ * row converters are selected once when the PixelFormat instance is
+ * constructed; common layouts use specialised (and, where available,
+ * vectorised) converters, all other layouts fall back to the generic
+ * ColorLayout conversion.
+ *
+ * All conversion functions operate on a single row. The row pointers point at
+ * the first pixel of the row, the converted range is [x0, x1).
+ */
+class PixelFormat {
+public:
+	enum class Type {
+		/**
+		 * Arbitrary layout described by a ColorLayout instance.
+		 */
+		Generic,
+
+		/**
+		 * 16-bit RGB with five bits red, six bits green, five bits blue.
+		 */
+		RGB565,
+
+		/**
+		 * 32-bit little endian RGB with red in bits 16-23, equivalent to the
+		 * memory layout of the RGBA structure.
+		 */
+		XRGB8888,
+
+		/**
+		 * 8-bit greyscale.
+		 */
+		Y8,
+
+		/**
+		 * 4-bit greyscale, two pixels per byte. The left pixel is stored in the
+		 * lower nibble, as is the default for little endian framebuffers.
+		 */
+		Y4
+	};
+
+	using FromRGBA = void (*)(uint8_t *tar, const RGBA *src, int x0, int x1,
+	                          const ColorLayout &layout);
+	using FromGrey = void (*)(uint8_t *tar, const uint8_t *src, int x0, int x1,
+	                          const ColorLayout &layout);
+	using ToRGBA = void (*)(RGBA *tar, const uint8_t *src, int x0, int x1,
+	                        const ColorLayout &layout);
+
+private:
+	ColorLayout m_layout;
+	Type m_type;
+	FromRGBA m_from_rgba;
+	FromGrey m_from_grey;
+	ToRGBA m_to_rgba;
+
+public:
+	/**
+	 * Determines the pixel format type for the given layout.
+	 *
+	 * @param greyscale must be set to true if the surface stores greyscale
+	 * values (e.g. the "grayscale" flag of a Linux framebuffer is set).
+	 */
+	static Type detect(const ColorLayout &layout, bool greyscale = false);
+
+	/**
+	 * Selects the row converters for the given colour layout.
+	 */
+	PixelFormat(const ColorLayout &layout, bool greyscale = false);
+
+	/**
+	 * Forces the use of the converters for the given format type. Mostly used
+	 * for testing.
+	 */
+	PixelFormat(const ColorLayout &layout, Type type);
+
+	Type type() const { return m_type; }
+
+	const ColorLayout &layout() const { return m_layout; }
+
+	/**
+	 * Returns the name of the pixel format type for diagnostic output.
+	 */
+	const char *name() const;
+
+	/**
+	 * Converts the pixels [x0, x1) in the RGBA row "src" to the pixels
+	 * [x0, x1) in the target row "tar".
+	 */
+	void from_rgba(uint8_t *tar, const RGBA *src, int x0, int x1) const {
+		m_from_rgba(tar, src, x0, x1, m_layout);
+	}
+
+	/**
+	 * Converts the pixels [x0, x1) in the 8-bit greyscale row "src" to the
+	 * target row "tar".
+	 */
+	void from_grey(uint8_t *tar, const uint8_t *src, int x0, int x1) const {
+		m_from_grey(tar, src, x0, x1, m_layout);
+	}
+
+	/**
+	 * Reads back the pixels [x0, x1) of the row "src" as opaque RGBA values.
+	 */
+	void to_rgba(RGBA *tar, const uint8_t *src, int x0, int x1) const {
+		m_to_rgba(tar, src, x0, x1, m_layout);
+	}
+};
+}  // namespace inktty
+
+#endif /* INKTTY_GFX_PIXEL_FORMAT_HPP */
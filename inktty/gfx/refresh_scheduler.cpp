@@ -0,0 +1,176 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include <inktty/gfx/refresh_scheduler.hpp>
+
+namespace inktty {
+
+/******************************************************************************
+ * Class RefreshScheduler                                                     *
+ ******************************************************************************/
+
+RefreshScheduler::RefreshScheduler(const config::Refresh &config)
+    : m_config(config),
+      m_rows(0),
+      m_cols(0),
+      m_region_rows(std::max(1, config.region_rows)),
+      m_region_cols(std::max(1, config.region_cols)),
+      m_regions_x(0),
+      m_regions_y(0),
+      m_time(0),
+      m_frame(0) {}
+
+void RefreshScheduler::reset(size_t rows, size_t cols) {
+	m_rows = rows;
+	m_cols = cols;
+	m_regions_x = (cols + m_region_cols - 1) / m_region_cols;
+	m_regions_y = (rows + m_region_rows - 1) / m_region_rows;
+	m_regions.assign(m_regions_x * m_regions_y,
+	                 Region{0, 0, m_frame, 0, 0, false});
+}
+
+void RefreshScheduler::frame(uint64_t t) {
+	m_time = t;
+	m_frame++;
+}
+
+void RefreshScheduler::drawn_low_quality(size_t row, size_t col) {
+	if (row >= m_rows || col >= m_cols) {
+		return;
+	}
+
+	/* Each frame counts as a single update of the region */
+	Region &r = region(row, col);
+	if (r.updates == 0 || r.frame_update != m_frame) {
+		r.updates++;
+	}
+	r.frame_update = m_frame;
+	r.t_update = m_time;
+}
+
+int64_t RefreshScheduler::t_due(const Region &r) const {
+	if (r.updates == 0) {
+		return -1;
+	}
+	const int timeout = (int64_t(r.updates) >= m_config.ghosting_budget)
+	                        ? m_config.budget_timeout
+	                        : m_config.redraw_timeout;
+	return int64_t(r.t_update) + std::max(0, timeout);
+}
+
+bool RefreshScheduler::stale(const Region &r) const {
+	/* Do not interrupt a region that is currently being written to */
+	return (m_config.stale_frames > 0) &&
+	       (m_frame - r.frame_refresh >= uint64_t(m_config.stale_frames)) &&
+	       (r.updates == 0 || r.frame_update != m_frame);
+}
+
+size_t RefreshScheduler::in_flight() const {
+	size_t res = 0;
+	for (const Region &r : m_regions) {
+		if (r.refreshed &&
+		    m_time < r.t_refresh + uint64_t(m_config.refresh_duration)) {
+			res++;
+		}
+	}
+	return res;
+}
+
+void RefreshScheduler::due(uint64_t t, std::vector<Rect> &blocks) {
+	m_time = std::max(m_time, t);
+
+	/* Collect all regions that are due */
+	m_due.clear();
+	for (size_t i = 0; i < m_regions.size(); i++) {
+		const Region &r = m_regions[i];
+		const int64_t td = t_due(r);
+		if ((td >= 0 && int64_t(m_time) >= td) || stale(r)) {
+			m_due.push_back(i);
+		}
+	}
+	if (m_due.empty()) {
+		return;
+	}
+
+	/* Limit the number of concurrent refreshes */
+	size_t n = m_due.size();
+	if (m_config.max_concurrent > 0) {
+		const size_t n_max = size_t(m_config.max_concurrent);
+		const size_t n_busy = in_flight();
+		n = std::min(n, (n_busy < n_max) ? (n_max - n_busy) : 0);
+	}
+
+	/* Prefer the regions with the most ghosting, then the ones that have not
+	   been refreshed for the longest time */
+	std::partial_sort(m_due.begin(), m_due.begin() + n, m_due.end(),
+	                  [this](size_t a, size_t b) {
+		                  const Region &ra = m_regions[a], &rb = m_regions[b];
+		                  return (ra.updates > rb.updates) ||
+		                         (ra.updates == rb.updates &&
+		                          ra.frame_refresh < rb.frame_refresh);
+	                  });
+
+	for (size_t j = 0; j < n; j++) {
+		const size_t i = m_due[j];
+		Region &r = m_regions[i];
+		r.updates = 0;
+		r.frame_refresh = m_frame;
+		r.t_refresh = m_time;
+		r.refreshed = true;
+
+		const int x0 = (i % m_regions_x) * m_region_cols;
+		const int y0 = (i / m_regions_x) * m_region_rows;
+		blocks.emplace_back(x0, y0,
+		                    std::min(x0 + int(m_region_cols), int(m_cols)),
+		                    std::min(y0 + int(m_region_rows), int(m_rows)));
+	}
+}
+
+int RefreshScheduler::next_wakeup(uint64_t t) const {
+	/* Find the time at which the next region becomes due */
+	int64_t t_next = -1;
+	for (const Region &r : m_regions) {
+		const int64_t td = stale(r) ? int64_t(t) : t_due(r);
+		if (td >= 0 && (t_next < 0 || td < t_next)) {
+			t_next = td;
+		}
+	}
+	if (t_next < 0) {
+		return -1;
+	}
+	t_next = std::max(t_next, int64_t(t));
+
+	/* If all refresh slots are taken, wait for the first one to be freed */
+	if (m_config.max_concurrent > 0 &&
+	    in_flight() >= size_t(m_config.max_concurrent)) {
+		int64_t t_free = -1;
+		for (const Region &r : m_regions) {
+			const int64_t tf = int64_t(r.t_refresh) + m_config.refresh_duration;
+			if (r.refreshed && tf > int64_t(m_time) &&
+			    (t_free < 0 || tf < t_free)) {
+				t_free = tf;
+			}
+		}
+		t_next = std::max(t_next, t_free);
+	}
+	return int(t_next - int64_t(t));
+}
+
+}  // namespace inktty
@@ -0,0 +1,164 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file refresh_scheduler.hpp
+ *
+ * Contains the RefreshScheduler class, which decides when regions of the
+ * screen are redrawn in high quality to remove ghosting.
+ *
+ * @author Andreas Stöckel
+ */
+
+#ifndef INKTTY_GFX_REFRESH_SCHEDULER_HPP
+#define INKTTY_GFX_REFRESH_SCHEDULER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <inktty/config/configuration.hpp>
+#include <inktty/utils/geometry.hpp>
+
+namespace inktty {
+/**
+ * The RefreshScheduler class divides the cell matrix into rectangular regions
+ * and counts the number of fast monochrome (A2) updates each region received
+ * since it was last redrawn in high quality. A region containing monochrome
+ * content is due for a high quality refresh once it has not been updated for
+ * a while; the required idle time is shortened once the region exceeds its
+ * ghosting budget. Regions are furthermore refreshed after a fixed number of
+ * frames. The number of refreshes running at the same time is limited, such
+ * that they do not delay the monochrome updates following the user's input.
+ *
+ * All times are in milliseconds.
+ */
+class RefreshScheduler {
+private:
+	struct Region {
+		/**
+		 * Number of monochrome updates since the last high quality refresh.
+		 */
+		uint32_t updates;
+
+		/**
+		 * Frame in which the region last received a monochrome update.
+		 */
+		uint64_t frame_update;
+
+		/**
+		 * Frame in which the region was last refreshed.
+		 */
+		uint64_t frame_refresh;
+
+		/**
+		 * Time of the last monochrome update.
+		 */
+		uint64_t t_update;
+
+		/**
+		 * Time at which the last refresh was issued.
+		 */
+		uint64_t t_refresh;
+
+		/**
+		 * True if the region was refreshed at least once; only then
+		 * t_refresh is valid.
+		 */
+		bool refreshed;
+	};
+
+	config::Refresh m_config;
+
+	size_t m_rows, m_cols;
+
+	size_t m_region_rows, m_region_cols;
+
+	size_t m_regions_x, m_regions_y;
+
+	std::vector<Region> m_regions;
+
+	uint64_t m_time;
+
+	uint64_t m_frame;
+
+	/**
+	 * Temporary vector holding the indices of the due regions.
+	 */
+	std::vector<size_t> m_due;
+
+	/**
+	 * Returns the time at which the given region becomes due, or -1 if it is
+	 * not due at all.
+	 */
+	int64_t t_due(const Region &r) const;
+
+	/**
+	 * Returns true if the given region is due because of the frame count.
+	 */
+	bool stale(const Region &r) const;
+
+	/**
+	 * Returns the number of refreshes that are still occupying the display.
+	 */
+	size_t in_flight() const;
+
+	Region &region(size_t row, size_t col) {
+		return m_regions[(row / m_region_rows) * m_regions_x +
+		                 col / m_region_cols];
+	}
+
+public:
+	RefreshScheduler(const config::Refresh &config = config::Refresh());
+
+	/**
+	 * Sets the size of the cell matrix and resets all regions to the state
+	 * of having been drawn in high quality.
+	 */
+	void reset(size_t rows, size_t cols);
+
+	/**
+	 * Must be called at the beginning of each frame that draws cells.
+	 *
+	 * @param t is the current time.
+	 */
+	void frame(uint64_t t);
+
+	/**
+	 * Must be called whenever the cell at the given location was drawn in
+	 * monochrome mode in the current frame.
+	 */
+	void drawn_low_quality(size_t row, size_t col);
+
+	/**
+	 * Appends the cell blocks of all regions that should be redrawn in high
+	 * quality now to the given vector. The blocks are given as zero-based,
+	 * exclusive cell coordinates. The returned regions are considered to be
+	 * refreshed.
+	 */
+	void due(uint64_t t, std::vector<Rect> &blocks);
+
+	/**
+	 * Returns the number of milliseconds after which due() should be called
+	 * again, or -1 if no region will become due without further updates.
+	 */
+	int next_wakeup(uint64_t t) const;
+};
+}  // namespace inktty
+
+#endif /* INKTTY_GFX_REFRESH_SCHEDULER_HPP */
@@ -0,0 +1,203 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <condition_variable>
+#include <system_error>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <inktty/gfx/render_thread.hpp>
+#include <inktty/utils/trace.hpp>
+
+namespace inktty {
+
+/******************************************************************************
+ * Class RenderThread::Impl                                                   *
+ ******************************************************************************/
+
+class RenderThread::Impl {
+private:
+	MatrixRenderer &m_renderer;
+	std::mutex &m_matrix_mutex;
+
+	/**
+	 * Mutex and condition variable protecting the request state below.
+	 */
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+
+	/**
+	 * True if a frame was requested that the thread did not start drawing
+	 * yet.
+	 */
+	bool m_requested;
+
+	/**
+	 * True if a frame was requested that was not collected by finished()
+	 * yet. Only accessed by the thread calling request().
+	 */
+	bool m_busy;
+
+	/**
+	 * True if the requested frame has been drawn; m_next holds the result.
+	 */
+	bool m_finished;
+	int m_dt;
+	int m_next;
+
+	/**
+	 * Set to true to stop the thread.
+	 */
+	bool m_done;
+
+	/**
+	 * Pipe used to wake up the event loop once a frame has been drawn.
+	 */
+	int m_pipe[2];
+
+	std::thread m_thread;
+
+	void run() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true) {
+			m_cond.wait(lock, [this] { return m_done || m_requested; });
+			if (m_done) {
+				return;
+			}
+			const int dt = m_dt;
+			m_requested = false;
+			lock.unlock();
+
+			// Only hold the matrix mutex while copying the changed cells
+			{
+				std::lock_guard<std::mutex> matrix_lock(m_matrix_mutex);
+				trace::Span span("snapshot");
+				m_renderer.snapshot();
+			}
+			int next;
+			{
+				trace::Span span("draw");
+				next = m_renderer.render(false, dt);
+			}
+
+			lock.lock();
+			m_next = next;
+			m_finished = true;
+
+			// Wake up the event loop. If the pipe is full, it is awake anyway.
+			const char c = 0;
+			while (write(m_pipe[1], &c, 1) < 0 && errno == EINTR) {
+			}
+		}
+	}
+
+public:
+	Impl(MatrixRenderer &renderer, std::mutex &mutex)
+	    : m_renderer(renderer),
+	      m_matrix_mutex(mutex),
+	      m_requested(false),
+	      m_busy(false),
+	      m_finished(false),
+	      m_dt(0),
+	      m_next(-1),
+	      m_done(false) {
+		if (pipe2(m_pipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+			throw std::system_error(errno, std::system_category());
+		}
+		m_thread = std::thread([this] { run(); });
+	}
+
+	~Impl() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_done = true;
+		}
+		m_cond.notify_one();
+		m_thread.join();
+		close(m_pipe[0]);
+		close(m_pipe[1]);
+	}
+
+	bool request(int dt) {
+		if (m_busy) {
+			return false;
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_requested = true;
+			m_dt = dt;
+		}
+		m_busy = true;
+		m_cond.notify_one();
+		return true;
+	}
+
+	bool busy() const { return m_busy; }
+
+	bool finished(int &next) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_finished) {
+			return false;
+		}
+		next = m_next;
+		m_finished = false;
+		m_busy = false;
+		return true;
+	}
+
+	int event_fd() const { return m_pipe[0]; }
+
+	void drain() {
+		char buf[64];
+		while (read(m_pipe[0], buf, sizeof(buf)) > 0) {
+		}
+	}
+};
+
+/******************************************************************************
+ * Class RenderThread                                                         *
+ ******************************************************************************/
+
+RenderThread::RenderThread(MatrixRenderer &renderer, std::mutex &mutex)
+    : m_impl(new Impl(renderer, mutex)) {}
+
+RenderThread::~RenderThread() {
+	// Implicitly destroy m_impl
+}
+
+bool RenderThread::request(int dt) { return m_impl->request(dt); }
+
+bool RenderThread::busy() const { return m_impl->busy(); }
+
+bool RenderThread::finished(int &next) { return m_impl->finished(next); }
+
+int RenderThread::event_fd() const { return m_impl->event_fd(); }
+
+EventSource::PollMode RenderThread::event_fd_poll_mode() const {
+	return PollIn;
+}
+
+bool RenderThread::event_get(PollMode, Event &) {
+	m_impl->drain();
+	return false;
+}
+
+}  // namespace inktty
@@ -0,0 +1,99 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file render_thread.hpp
+ *
+ * Contains the RenderThread class, which draws the terminal matrix on a
+ * background thread.
+ *
+ * @author Andreas Stöckel
+ */
+
+#ifndef INKTTY_GFX_RENDER_THREAD_HPP
+#define INKTTY_GFX_RENDER_THREAD_HPP
+
+#include <memory>
+#include <mutex>
+
+#include <inktty/gfx/matrix_renderer.hpp>
+#include <inktty/term/events.hpp>
+
+namespace inktty {
+/**
+ * The RenderThread class runs MatrixRenderer on a background thread, such
+ * that the thread running the event loop keeps reading and parsing the output
+ * of the child process while a frame is drawn. Upon request, the thread locks
+ * the given mutex, takes a snapshot of the matrix (see
+ * MatrixRenderer::snapshot()) and draws the snapshot without holding the
+ * mutex. All other accesses to the matrix must hold the mutex as well.
+ *
+ * The class is an event source that wakes up the event loop whenever a frame
+ * has been drawn; it never produces any events.
+ */
+class RenderThread : public EventSource {
+private:
+	class Impl;
+	std::unique_ptr<Impl> m_impl;
+
+public:
+	/**
+	 * Starts the render thread.
+	 *
+	 * @param renderer is the renderer used to draw frames. Must not be used by
+	 * other threads, except for calling functions that do not draw while
+	 * holding the mutex, such as MatrixRenderer::resize().
+	 * @param mutex is the mutex protecting the matrix.
+	 */
+	RenderThread(MatrixRenderer &renderer, std::mutex &mutex);
+
+	/**
+	 * Waits for the current frame to be drawn and stops the thread.
+	 */
+	~RenderThread() override;
+
+	/**
+	 * Requests a new frame. Does nothing and returns false if the previous
+	 * frame has not been collected by finished() yet.
+	 *
+	 * @param dt is the number of milliseconds that passed since the last
+	 * frame, see MatrixRenderer::draw().
+	 */
+	bool request(int dt);
+
+	/**
+	 * Returns true if a frame has been requested that was not collected by
+	 * finished() yet.
+	 */
+	bool busy() const;
+
+	/**
+	 * Returns true if the requested frame has been drawn. In this case, the
+	 * return value of MatrixRenderer::draw() is written to "next" and a new
+	 * frame may be requested.
+	 */
+	bool finished(int &next);
+
+	/* Implementation of the EventSource interface */
+	int event_fd() const override;
+	PollMode event_fd_poll_mode() const override;
+	bool event_get(PollMode mode, Event &event) override;
+};
+}  // namespace inktty
+
+#endif /* INKTTY_GFX_RENDER_THREAD_HPP */
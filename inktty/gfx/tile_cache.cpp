@@ -0,0 +1,99 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include <inktty/gfx/tile_cache.hpp>
+
+namespace inktty {
+
+/******************************************************************************
+ * Class TileCache                                                            *
+ ******************************************************************************/
+
+size_t TileCache::KeyHash::operator()(const Key &k) const {
+	uint32_t fg, bg;
+	memcpy(&fg, &k.fg, sizeof(fg));
+	memcpy(&bg, &k.bg, sizeof(bg));
+	const uint64_t h = (uint64_t(k.glyph) << 32U) ^ (uint64_t(fg) << 16U) ^
+	                   uint64_t(bg) ^ (uint64_t(k.mode) << 56U);
+	return size_t((h * 0x9E3779B97F4A7C15ULL) >> 16U);
+}
+
+TileCache::TileCache(size_t max_bytes)
+    : m_width(0),
+      m_height(0),
+      m_capacity(1),
+      m_max_bytes(max_bytes),
+      m_hand(0),
+      m_account(memory::Pool::Tiles) {}
+
+void TileCache::reset(size_t width, size_t height) {
+	clear();
+	m_width = width;
+	m_height = height;
+	const size_t tile_bytes = std::max<size_t>(1, width * height * sizeof(RGBA));
+	m_capacity = std::max<size_t>(1, m_max_bytes / tile_bytes);
+}
+
+void TileCache::clear() {
+	m_slots.clear();
+	m_slots.shrink_to_fit();
+	m_pixels.clear();
+	m_pixels.shrink_to_fit();
+	m_index.clear();
+	m_hand = 0;
+	m_account.set(0);
+}
+
+const RGBA *TileCache::get(const Key &key) {
+	const auto it = m_index.find(key);
+	if (it == m_index.end()) {
+		return nullptr;
+	}
+	m_slots[it->second].referenced = true;
+	return pixels(it->second);
+}
+
+RGBA *TileCache::put(const Key &key) {
+	// Allocate a new slot if the memory limit permits
+	if (m_slots.size() < m_capacity) {
+		const size_t i = m_slots.size();
+		m_slots.emplace_back(Slot{key, false});
+		m_pixels.resize(m_slots.size() * m_width * m_height);
+		m_account.set(m_pixels.capacity() * sizeof(RGBA));
+		m_index.emplace(key, i);
+		return pixels(i);
+	}
+
+	// Otherwise advance the clock hand until a tile that was not accessed
+	// since the last sweep is found
+	while (m_slots[m_hand].referenced) {
+		m_slots[m_hand].referenced = false;
+		m_hand = (m_hand + 1) % m_slots.size();
+	}
+	const size_t i = m_hand;
+	m_hand = (m_hand + 1) % m_slots.size();
+	m_index.erase(m_slots[i].key);
+	m_slots[i] = Slot{key, false};
+	m_index.emplace(key, i);
+	return pixels(i);
+}
+
+}  // namespace inktty
@@ -0,0 +1,164 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file tile_cache.hpp
+ *
+ * Contains the TileCache class, which stores fully composed images of
+ * terminal cells.
+ *
+ * @author Andreas Stöckel
+ */
+
+#ifndef INKTTY_GFX_TILE_CACHE_HPP
+#define INKTTY_GFX_TILE_CACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <inktty/utils/color.hpp>
+#include <inktty/utils/memory.hpp>
+
+namespace inktty {
+/**
+ * The TileCache class stores fully composed, cell-sized images ("tiles") of
+ * glyphs drawn with a certain foreground and background colour. All tiles
+ * have the same size, which usually is the size of a cell on the screen. Once
+ * the memory limit is reached, tiles are evicted following the CLOCK policy,
+ * i.e. tiles that were accessed since the last sweep of the clock hand are
+ * kept.
+ */
+class TileCache {
+public:
+	/**
+	 * Properties of a tile. Two cells with the same key look exactly the same.
+	 */
+	struct Key {
+		uint32_t glyph;
+		RGBA fg, bg;
+
+		/**
+		 * Further, renderer-defined properties, such as the quality mode the
+		 * tile was drawn in.
+		 */
+		uint32_t mode;
+
+		bool operator==(const Key &o) const {
+			return (glyph == o.glyph) && (fg == o.fg) && (bg == o.bg) &&
+			       (mode == o.mode);
+		}
+	};
+
+private:
+	struct KeyHash {
+		size_t operator()(const Key &k) const;
+	};
+
+	/**
+	 * Slot holding a single tile.
+	 */
+	struct Slot {
+		Key key;
+
+		/**
+		 * Set whenever the tile is accessed, reset by the clock hand.
+		 */
+		bool referenced;
+	};
+
+	size_t m_width, m_height;
+
+	/**
+	 * Maximum number of tiles, derived from the memory limit.
+	 */
+	size_t m_capacity;
+
+	size_t m_max_bytes;
+
+	size_t m_hand;
+
+	std::vector<Slot> m_slots;
+
+	/**
+	 * Pixels of all tiles, the pixels of slot i start at i * m_width *
+	 * m_height.
+	 */
+	std::vector<RGBA> m_pixels;
+
+	std::unordered_map<Key, size_t, KeyHash> m_index;
+
+	memory::Account m_account;
+
+	RGBA *pixels(size_t slot) { return &m_pixels[slot * m_width * m_height]; }
+
+public:
+	/**
+	 * Creates a new TileCache instance that allocates at most the given number
+	 * of bytes for tiles. A single tile is stored regardless of this limit.
+	 */
+	TileCache(size_t max_bytes = 4 * 1024 * 1024);
+
+	/**
+	 * Discards all tiles and sets the size of the tiles stored from now on.
+	 */
+	void reset(size_t width, size_t height);
+
+	/**
+	 * Discards all tiles and frees all memory.
+	 */
+	void clear();
+
+	/**
+	 * Returns the pixels of the tile with the given key or nullptr if there
+	 * is no such tile. Marks the tile as recently used. Rows are stride()
+	 * bytes apart. The pointer is valid until the next call to put().
+	 */
+	const RGBA *get(const Key &key);
+
+	/**
+	 * Adds the tile with the given key to the cache and returns a pointer at
+	 * its pixels, which must be filled by the caller. The tile must not be in
+	 * the cache already. Evicts a tile if the memory limit is reached.
+	 */
+	RGBA *put(const Key &key);
+
+	size_t width() const { return m_width; }
+
+	size_t height() const { return m_height; }
+
+	/**
+	 * Distance between two rows of a tile in bytes.
+	 */
+	size_t stride() const { return m_width * sizeof(RGBA); }
+
+	/**
+	 * Returns the number of tiles stored in the cache.
+	 */
+	size_t size() const { return m_index.size(); }
+
+	/**
+	 * Returns the number of bytes allocated for tiles.
+	 */
+	size_t bytes() const { return m_pixels.size() * sizeof(RGBA); }
+};
+
+}  // namespace inktty
+
+#endif /* INKTTY_GFX_TILE_CACHE_HPP */
@@ -16,20 +16,35 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
 
+#include <signal.h>
 #include <stdlib.h>
 #include <time.h>
 
 #include <inktty/gfx/font.hpp>
 #include <inktty/gfx/font_bitmap.hpp>
+#include <inktty/gfx/font_cache.hpp>
 #include <inktty/gfx/font_ttf.hpp>
 #include <inktty/gfx/matrix_renderer.hpp>
+#include <inktty/gfx/render_thread.hpp>
 #include <inktty/inktty.hpp>
 #include <inktty/term/matrix.hpp>
 #include <inktty/term/pty.hpp>
+#include <inktty/term/recording.hpp>
+#include <inktty/term/scrollback.hpp>
 #include <inktty/term/vterm.hpp>
+#include <inktty/utils/frame_scheduler.hpp>
+#include <inktty/utils/logger.hpp>
+#include <inktty/utils/memory.hpp>
+#include <inktty/utils/profile.hpp>
+#include <inktty/utils/startup.hpp>
+#include <inktty/utils/trace.hpp>
 #include <inktty/utils/utf8.hpp>
 
 namespace inktty {
@@ -38,6 +53,116 @@ namespace inktty {
  * CLASS IMPLEMENTATIONS                                                      *
  ******************************************************************************/
 
+/******************************************************************************
+ * Static helpers                                                             *
+ ******************************************************************************/
+
+#ifdef HAS_PROFILE
+/**
+ * Interval in microseconds in which the profiling statistics are written to
+ * the log. A dump can be requested at any time by sending SIGUSR1.
+ */
+static constexpr int64_t PROFILE_DUMP_INTERVAL = 30 * 1000 * 1000;
+
+static void handle_sigusr1(int) { profile::request_dump(); }
+#endif
+
+/**
+ * SIGUSR2 asks inktty to release the memory held by its caches, e.g. when sent
+ * by a low memory daemon on systems without pressure stall information.
+ */
+static void handle_sigusr2(int) { memory::request_reclaim(); }
+
+/**
+ * If more than PTY_BACKLOG_HIGH bytes wait to be written to the child process,
+ * no more input is read until the backlog dropped below PTY_BACKLOG_LOW bytes.
+ */
+static constexpr size_t PTY_BACKLOG_HIGH = 1024 * 1024;
+static constexpr size_t PTY_BACKLOG_LOW = 64 * 1024;
+
+#ifdef HAS_FREETYPE
+/**
+ * Loads the font family described by the font configuration. All faces share
+ * a single glyph cache, each face persists its glyphs in a separate glyph
+ * cache file. Only the regular face uses worker threads.
+ */
+static Font *load_font(const config::Font &config) {
+	std::unique_ptr<FontFamily> family(new FontFamily());
+	std::shared_ptr<FontCache> cache =
+	    std::make_shared<FontCache>(FontTTF::DEFAULT_CACHE_BYTES);
+	auto add = [&](const std::string &file, FontFamily::Weight weight,
+	               FontFamily::Style style) {
+		if (file.empty()) {
+			return;
+		}
+		const uint8_t face = family->size();
+		std::string glyph_cache = config.glyph_cache;
+		if (!glyph_cache.empty() && face > 0) {
+			glyph_cache += "." + std::to_string(face);
+		}
+		const unsigned int threads = face ? 0 : std::max(0, config.threads);
+		try {
+			family->add(std::unique_ptr<Font>(new FontTTF(
+			                file.c_str(), config.dpi,
+			                FontTTF::DEFAULT_CACHE_BYTES, glyph_cache.c_str(),
+			                threads, cache, face)),
+			            weight, style);
+		} catch (std::runtime_error &e) {
+			if (face == 0) {
+				throw;  // The regular face is required
+			}
+			global_logger().warn()
+			    << "Couldn't load font \"" << file << "\": " << e.what();
+		}
+	};
+
+	using Weight = FontFamily::Weight;
+	using Style = FontFamily::Style;
+	add(config.file, Weight::Regular, Style::Regular);
+	for (const std::string &file : config.fallback) {
+		add(file, Weight::Regular, Style::Regular);
+	}
+	add(config.bold, Weight::Bold, Style::Regular);
+	add(config.italic, Weight::Regular, Style::Italic);
+	add(config.bold_italic, Weight::Bold, Style::Italic);
+	return family.release();
+}
+#endif
+
+/******************************************************************************
+ * Struct Session                                                             *
+ ******************************************************************************/
+
+/**
+ * Terminal state of a single session. All sessions share the font, the
+ * display and the renderer; only the active session is drawn.
+ */
+struct Session {
+	Scrollback scrollback;
+	Matrix matrix;
+
+	/**
+	 * Child process, or nullptr while replaying a session log.
+	 */
+	std::unique_ptr<PTY> pty;
+	VTerm vterm;
+
+	/**
+	 * Size of the matrix the terminal state and the child process know
+	 * about.
+	 */
+	Point size;
+
+	Session(size_t scrollback_size, const Point &size, PTY *pty)
+	    : scrollback(scrollback_size),
+	      matrix(size.y, size.x),
+	      pty(pty),
+	      vterm(matrix),
+	      size(size) {
+		matrix.scrollback(&scrollback);
+	}
+};
+
 /******************************************************************************
  * Class Inktty::Impl                                                         *
  ******************************************************************************/
@@ -45,16 +170,91 @@ namespace inktty {
 class Inktty::Impl {
 private:
 	const Configuration &m_config;
-	std::vector<EventSource *> m_event_sources;
+	EventLoop m_event_loop;
+
+	/**
+	 * Event sources providing user input, i.e. all sources except for the
+	 * PTY. Disabled while the PTY backlog is too large.
+	 */
+	std::vector<EventSource *> m_input_sources;
+	bool m_input_paused;
 	Display &m_display;
+
+	/**
+	 * Session log replayed instead of running a child process, or nullptr.
+	 */
+	std::unique_ptr<Replay> m_replay;
+
+	/**
+	 * Terminal sessions and the index of the session that is drawn and
+	 * receives the user input. The sessions are started before the font is
+	 * loaded, such that the shells start up while the font is loaded.
+	 */
+	std::vector<std::unique_ptr<Session>> m_sessions;
+	size_t m_active;
 	Font *m_font;
-	Matrix m_matrix;
 	MatrixRenderer m_matrix_renderer;
-	PTY m_pty;
-	VTerm m_vterm;
+
+	/**
+	 * Session log the child output and user input are recorded to, or
+	 * nullptr.
+	 */
+	std::unique_ptr<Recorder> m_recorder;
+	FrameScheduler m_scheduler;
 	int64_t m_t_last_draw;
 	bool m_needs_redraw;
 
+	/**
+	 * Set once the child process produced output, and the number of startup
+	 * phases that finished after initialisation: the first frame and the
+	 * first frame showing output of the child, i.e. the prompt.
+	 */
+	bool m_output_seen;
+	int m_startup_frames;
+
+	/**
+	 * Jump scroll state and number of skipped frames as of the last call to
+	 * report_skipped().
+	 */
+	bool m_jump;
+	uint64_t m_skipped;
+
+	/**
+	 * Mutex protecting the matrix if frames are drawn on the render thread.
+	 * Held while handling events.
+	 */
+	std::mutex m_matrix_mutex;
+
+	/**
+	 * Thread drawing the frames, or nullptr if frames are drawn by the
+	 * thread running the event loop.
+	 */
+	std::unique_ptr<RenderThread> m_render_thread;
+
+	/**
+	 * Source of the memory pressure notifications of the kernel, or nullptr
+	 * if disabled or not supported.
+	 */
+	std::unique_ptr<memory::PressureMonitor> m_pressure;
+
+	/**
+	 * Events fetched by the last call to EventLoop::wait().
+	 */
+	std::vector<Event> m_events;
+
+	/**
+	 * Event sources of the sessions closed while handling the current batch
+	 * of events. The remaining events of these sources are dropped; their
+	 * buffers belong to the destroyed PTY.
+	 */
+	std::vector<const EventSource *> m_closed;
+
+	/**
+	 * Codepoints of the last text input event or text run, kept to avoid
+	 * reallocation.
+	 */
+	std::vector<uint32_t> m_text;
+
 	static int64_t microtime() {
 		struct timespec ts;
 		clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
@@ -70,24 +270,140 @@ private:
 		return shell;
 	}
 
+	static Replay *open_replay(const config::General &config) {
+		if (config.replay_file.empty()) {
+			return nullptr;
+		}
+		try {
+			return new Replay(config.replay_file.c_str(),
+			                  config.replay_realtime);
+		} catch (const std::exception &e) {
+			global_logger().error()
+			    << "Cannot replay \"" << config.replay_file
+			    << "\", starting a shell instead: " << e.what();
+		}
+		return nullptr;
+	}
+
+	Session *new_session(const Point &size) const {
+		const size_t scrollback_size =
+		    size_t(std::max(0, m_config.scrollback.memory)) * 1024;
+		return new Session(scrollback_size, size,
+		                   m_replay ? nullptr
+		                            : new PTY(size.y, size.x, {get_shell()}));
+	}
+
+	/**
+	 * Starts the configured number of sessions, a single one while replaying
+	 * a session log.
+	 */
+	std::vector<std::unique_ptr<Session>> start_sessions() const {
+		std::vector<std::unique_ptr<Session>> res;
+		const int n = m_replay ? 1 : std::max(1, m_config.general.sessions);
+		for (int i = 0; i < n; i++) {
+			res.emplace_back(new_session(Matrix().size()));
+		}
+		startup::phase("sessions");
+		return res;
+	}
+
+	static Font *init_font(const Configuration &config) {
+#ifdef HAS_FREETYPE
+		Font *res = load_font(config.font);
+#else
+		(void)config;
+		Font *res = &FontBitmap::Font8x16;
+#endif
+		startup::phase("font");
+		return res;
+	}
+
+	Session &active() { return *m_sessions[m_active]; }
+
+	/**
+	 * Returns the index of the session the given event source belongs to.
+	 * Events of the replayed session log belong to the active session.
+	 * Returns the number of sessions if the source is no PTY.
+	 */
+	size_t find_session(const EventSource *source) const {
+		for (size_t i = 0; i < m_sessions.size(); i++) {
+			if (m_sessions[i]->pty.get() == source) {
+				return i;
+			}
+		}
+		return (m_replay && source == m_replay.get()) ? m_active
+		                                              : m_sessions.size();
+	}
+
+	static Recorder *open_recorder(const config::General &config) {
+		if (config.record_file.empty()) {
+			return nullptr;
+		}
+		try {
+			return new Recorder(config.record_file.c_str());
+		} catch (const std::exception &e) {
+			global_logger().warn() << "Cannot record the session to \""
+			                       << config.record_file << "\": " << e.what();
+		}
+		return nullptr;
+	}
+
 public:
 	Impl(const Configuration &config,
 	     const std::vector<EventSource *> &event_sources, Display &display)
 	    : m_config(config),
-	      m_event_sources(event_sources),
+	      m_input_sources(event_sources),
+	      m_input_paused(false),
 	      m_display(display),
-#ifdef HAS_FREETYPE
-	      m_font(new FontTTF("DejaVuSansMono.ttf", 96)),
-#else
-	      m_font(&FontBitmap::Font8x16),
-#endif
-	      m_matrix(),
-	      m_matrix_renderer(m_config, *m_font, m_display, m_matrix, 13 * 64, config.general.orientation % 4),
-	      m_pty(m_matrix.size().y, m_matrix.size().x, {get_shell()}),
-	      m_vterm(m_matrix),
+	      m_replay(open_replay(config.general)),
+	      m_sessions(start_sessions()),
+	      m_active(0),
+	      m_font(init_font(config)),
+	      m_matrix_renderer(m_config, *m_font, m_display,
+	                        m_sessions[0]->matrix, 13 * 64,
+	                        config.general.rotate_display
+	                            ? 0
+	                            : config.general.orientation % 4),
+	      m_recorder(open_recorder(config.general)),
+	      m_scheduler(config.scheduler),
 	      m_t_last_draw(microtime()),
-	      m_needs_redraw(false) {
-		m_event_sources.push_back(&m_pty);
+	      m_needs_redraw(false),
+	      m_output_seen(false),
+	      m_startup_frames(0),
+	      m_jump(false),
+	      m_skipped(0) {
+		for (EventSource *source : m_input_sources) {
+			m_event_loop.add(source);
+		}
+		if (m_replay) {
+			m_event_loop.add(m_replay.get());
+		}
+		for (const auto &session : m_sessions) {
+			if (session->pty) {
+				m_event_loop.add(session->pty.get());
+			}
+		}
+		if (config.general.render_thread) {
+			m_render_thread = std::unique_ptr<RenderThread>(
+			    new RenderThread(m_matrix_renderer, m_matrix_mutex));
+			m_event_loop.add(m_render_thread.get());
+		}
+		memory::set_budget(size_t(std::max(0, config.memory.budget)) * 1024);
+		if (config.memory.monitor_pressure) {
+			m_pressure.reset(new memory::PressureMonitor());
+			if (m_pressure->active()) {
+				m_event_loop.add(m_pressure.get());
+			} else {
+				global_logger().debug("memory")
+				    << "Memory pressure notifications are not available";
+				m_pressure.reset();
+			}
+		}
+		signal(SIGUSR2, handle_sigusr2);
+#ifdef HAS_PROFILE
+		signal(SIGUSR1, handle_sigusr1);
+#endif
+		startup::phase("init");
 	}
 
 	~Impl() {
@@ -96,28 +412,133 @@ public:
 #endif
 	}
 
+	/**
+	 * Draws the given session and sends the user input to it.
+	 */
+	void switch_session(size_t idx) {
+		m_active = idx;
+		m_matrix_renderer.set_matrix(active().matrix);
+		m_scheduler.output(microtime());
+	}
+
+	/**
+	 * Handles the termination of the child process of the given session.
+	 * Returns true if this was the last session.
+	 */
+	bool close_session(size_t idx) {
+		if (m_sessions[idx]->pty) {
+			m_event_loop.remove(m_sessions[idx]->pty.get());
+			m_closed.push_back(m_sessions[idx]->pty.get());
+		}
+		if (m_sessions.size() == 1) {
+			return true;
+		}
+		m_sessions.erase(m_sessions.begin() + idx);
+		if (idx < m_active) {
+			m_active--;
+		} else if (idx == m_active) {
+			switch_session(std::min(idx, m_sessions.size() - 1));
+		}
+		return false;
+	}
+
+	void handle_key(const Event::Keyboard &k) {
+		Session &session = active();
+		const bool paging =
+		    k.key == Event::Key::PAGE_UP || k.key == Event::Key::PAGE_DOWN;
+		if (paging && k.shift) {
+			// Scroll the view without involving the child process
+			const int page = std::max(1, session.matrix.size().y - 1);
+			session.matrix.view_offset(
+			    session.matrix.view_offset() +
+			    ((k.key == Event::Key::PAGE_UP) ? page : -page));
+			m_scheduler.output(microtime());
+			return;
+		}
+		if (paging && k.ctrl && m_sessions.size() > 1) {
+			// Switch to the previous or next session
+			const size_t n = m_sessions.size();
+			const size_t step = (k.key == Event::Key::PAGE_UP) ? (n - 1) : 1;
+			switch_session((m_active + step) % n);
+			return;
+		}
+		session.matrix.view_offset(0);
+		if (k.key != Event::Key::NONE) {
+			session.vterm.send_key(k.key, k.shift, k.ctrl, k.alt);
+		} else if (k.unichar) {
+			session.vterm.send_char(k.unichar, k.shift, k.ctrl, k.alt);
+		}
+	}
+
+	/**
+	 * Returns true if the given key is a character that can be sent to the
+	 * terminal as part of a text run.
+	 */
+	static bool is_text(const Event::Keyboard &k) {
+		return k.key == Event::Key::NONE && k.unichar && !k.ctrl && !k.alt;
+	}
+
+	/**
+	 * Handles a batch of keys. Consecutive characters are sent to the
+	 * terminal as a single text run.
+	 */
+	void handle_keys(const Event::Keyboard *keys, size_t n_keys) {
+		for (size_t i = 0; i < n_keys;) {
+			m_text.clear();
+			for (; i < n_keys && is_text(keys[i]); i++) {
+				m_text.push_back(keys[i].unichar);
+			}
+			if (!m_text.empty()) {
+				active().matrix.view_offset(0);
+				active().vterm.send_text(m_text.data(), m_text.size());
+			}
+			if (i < n_keys) {
+				handle_key(keys[i++]);
+			}
+		}
+	}
+
 	bool handle_event(const Event &event) {
+		// Drop the pending events of sessions closed in this batch
+		if (std::find(m_closed.begin(), m_closed.end(), event.source) !=
+		    m_closed.end()) {
+			return false;
+		}
+
+		// Events of background sessions only update their terminal state
+		const size_t idx = find_session(event.source);
+		if (idx < m_sessions.size() && idx != m_active) {
+			return handle_background_event(idx, event);
+		}
+		if (m_recorder) {
+			m_recorder->record(microtime(), event);
+		}
 		switch (event.type) {
 			case Event::Type::NONE:
 				break;
 			case Event::Type::KEY_INPUT: {
-				const Event::Keyboard &k = event.data.keybd;
-				if (k.key != Event::Key::NONE) {
-					m_vterm.send_key(k.key, k.shift, k.ctrl, k.alt);
-				} else if (k.unichar) {
-					m_vterm.send_char(k.unichar, k.shift, k.ctrl, k.alt);
-				}
+				m_scheduler.input(microtime());
+				INKTTY_PROFILE_KEY_PRESSED();
+				trace::input(event.time);
+				handle_key(event.data.keybd);
+				break;
+			}
+			case Event::Type::KEY_BATCH: {
+				m_scheduler.input(microtime());
+				INKTTY_PROFILE_KEY_PRESSED();
+				trace::input(event.time);
+				handle_keys(event.data.keys.keys, event.data.keys.n_keys);
 				break;
 			}
 			case Event::Type::TEXT_INPUT: {
+				m_scheduler.input(microtime());
+				INKTTY_PROFILE_KEY_PRESSED();
+				trace::input(event.time);
 				const Event::Text &t = event.data.text;
-				UTF8Decoder utf8;
-				for (size_t i = 0; i < t.buf_len; i++) {
-					UTF8Decoder::Status res;
-					if ((res = utf8.feed(t.buf[i])) && !res.error) {
-						m_vterm.send_char(res.codepoint, false, false, false);
-					}
-				}
+				active().matrix.view_offset(0);
+				m_text.clear();
+				UTF8Decoder().decode(t.buf, t.buf_len, m_text);
+				active().vterm.send_text(m_text.data(), m_text.size());
 				break;
 			}
 			case Event::Type::MOUSE_BTN_DOWN:
@@ -129,47 +550,242 @@ public:
 			case Event::Type::MOUSE_CLICK:
 				break;
 			case Event::Type::QUIT:
-				return true;
+				return (idx < m_sessions.size()) ? close_session(idx) : true;
 			case Event::Type::RESIZE:
+				m_matrix_renderer.resize();
+				m_scheduler.output(microtime());
 				break;
-			case Event::Type::CHILD_OUTPUT:
-				m_vterm.receive_from_pty(event.data.child.buf,
-				                         event.data.child.buf_len);
+			case Event::Type::REPAINT:
+				m_matrix_renderer.repaint();
+				m_scheduler.output(microtime());
+				break;
+			case Event::Type::CHILD_OUTPUT: {
+				trace::output(event.time);
+				trace::Span span("vterm_receive");
+				active().vterm.receive_from_pty(event.data.child.buf,
+				                                event.data.child.buf_len);
+				m_scheduler.output(microtime(), event.data.child.buf_len);
 				m_needs_redraw = true;
+				m_output_seen = true;
 				break;
+			}
 		}
 		return false;
 	}
 
-	void run() {
-		int evsrc = -1;
-		bool done = false;
-		uint8_t buf[64];
+	/**
+	 * Parses the output of a session that is not drawn. Nothing is drawn and
+	 * the frame scheduler is not involved; the session is redrawn entirely
+	 * once it becomes active. Returns true if this was the last session.
+	 */
+	bool handle_background_event(size_t idx, const Event &event) {
+		Session &session = *m_sessions[idx];
+		switch (event.type) {
+			case Event::Type::CHILD_OUTPUT:
+				session.vterm.receive_from_pty(event.data.child.buf,
+				                               event.data.child.buf_len);
+				session.matrix.discard_scrolls();
+				break;
+			case Event::Type::QUIT:
+				return close_session(idx);
+			default:
+				break;
+		}
+		return false;
+	}
+
+	/**
+	 * Queues the output of the terminal for the PTY and writes as much of it
+	 * as the child accepts. Pauses reading input while the child of the
+	 * active session lags behind. While replaying a session log, the output
+	 * of the terminal is discarded.
+	 */
+	void forward_to_pty() {
+		uint8_t buf[4096];
 		size_t buf_len = 0;
-		while (!done) {
-			Event event;
-
-			// Redraw the UI in 16.667 ms intervals (corresponding to 60 Hz)
-			const int64_t t = microtime();
-			const int timeout = 32;
-			int dt = (t - m_t_last_draw) / 1000;
-			if (dt >= timeout) {
-				m_matrix_renderer.draw(false, dt);
+		for (const auto &session : m_sessions) {
+			bool forwarded = false;
+			while ((buf_len = session->vterm.send_to_pty(buf, sizeof(buf)))) {
+				if (session->pty) {
+					session->pty->write(buf, buf_len);
+					forwarded = true;
+				}
+			}
+			if (forwarded) {
+				session->pty->flush();
+				trace::forwarded(trace::now());
+			}
+		}
+		const PTY *pty = active().pty.get();
+		if (!pty) {
+			return;
+		}
+
+		const size_t backlog = pty->backlog();
+		const bool pause = m_input_paused ? (backlog > PTY_BACKLOG_LOW)
+		                                  : (backlog > PTY_BACKLOG_HIGH);
+		if (pause != m_input_paused) {
+			m_input_paused = pause;
+			for (EventSource *source : m_input_sources) {
+				m_event_loop.set_enabled(source, !pause);
+			}
+		}
+	}
+
+	/**
+	 * The renderer resizes the matrix of the active session if the geometry
+	 * changed or the session was switched to; informs the terminal state and
+	 * the child process. The matrix mutex must be held.
+	 */
+	void sync_size() {
+		Session &session = active();
+		const Point size = session.matrix.size();
+		if (size.x != session.size.x || size.y != session.size.y) {
+			session.vterm.resize(size.y, size.x);
+			if (session.pty) {
+				session.pty->resize(size.y, size.x);
+			}
+			session.size = size;
+		}
+	}
+
+	/**
+	 * Logs changes of the jump scroll state and passes the number of frames
+	 * skipped since the last call to the profiler.
+	 */
+	void report_skipped() {
+		if (m_scheduler.jump() != m_jump) {
+			m_jump = m_scheduler.jump();
+			if (m_jump) {
+				global_logger().debug("scheduler") << "Jump scrolling";
+			} else {
+				global_logger().debug("scheduler")
+				    << "Stopped jump scrolling, " << m_scheduler.skipped()
+				    << " frames skipped in total";
+			}
+		}
+		const uint64_t skipped = m_scheduler.skipped();
+		if (skipped != m_skipped) {
+#ifdef HAS_PROFILE
+			profile::count(profile::Counter::FramesSkipped,
+			               skipped - m_skipped);
+#endif
+			m_skipped = skipped;
+		}
+	}
+
+	/**
+	 * Finishes the startup phases once the first frame and the first frame
+	 * showing output of the child process have been drawn.
+	 */
+	void frame_drawn() {
+		if (m_startup_frames == 0) {
+			startup::phase("first frame");
+			m_startup_frames++;
+		}
+		if (m_startup_frames == 1 && m_output_seen) {
+			startup::phase("prompt");
+			startup::report(global_logger());
+			memory::report(global_logger());
+			m_startup_frames++;
+		}
+	}
+
+	/**
+	 * Draws a frame if the scheduler says so. If there is a render thread,
+	 * collects the frame drawn by the thread and requests a new one.
+	 */
+	void draw() {
+		const int64_t t = microtime();
+		report_skipped();
+		if (!m_render_thread) {
+			if (m_scheduler.due(t)) {
+				const int dt = (t - m_t_last_draw) / 1000;
+				trace::Span span("draw");
+				const int next = m_matrix_renderer.draw(false, dt);
 				m_t_last_draw = t;
+				m_scheduler.drawn(t, next);
+				sync_size();
+				frame_drawn();
 			}
+			return;
+		}
+
+		// Output arriving while the frame is drawn is pending again, thus
+		// the frame is marked as drawn once it is requested
+		int next;
+		if (m_render_thread->finished(next)) {
+			m_scheduler.wakeup(t, next);
+			std::lock_guard<std::mutex> lock(m_matrix_mutex);
+			sync_size();
+			frame_drawn();
+		}
+		if (!m_render_thread->busy() && m_scheduler.due(t)) {
+			m_render_thread->request((t - m_t_last_draw) / 1000);
+			m_t_last_draw = t;
+			m_scheduler.drawn(t);
+		}
+	}
+
+	/**
+	 * Releases the memory held by the caches if the memory budget is exceeded
+	 * or the system runs low on memory. The caches are used by the render
+	 * thread, so nothing is done while it is busy.
+	 */
+	void reclaim() {
+		if (!memory::under_pressure() ||
+		    (m_render_thread && m_render_thread->busy())) {
+			return;
+		}
+		const size_t before = memory::total();
+		m_matrix_renderer.reclaim();
+		memory::reclaimed(global_logger(), before);
+	}
 
-			// Wait for a new event or sleep for the timeout calculated above
-			evsrc = Event::wait(m_event_sources, event, evsrc, timeout);
+	void run() {
+		bool done = false;
+		while (!done) {
+			draw();
+
+			// Wait for a new event or until the next frame is due; sleep
+			// indefinitely if there is nothing to draw. While the render
+			// thread is busy, it wakes up the loop once it is done.
+			const bool rendering = m_render_thread && m_render_thread->busy();
+			const int timeout =
+			    rendering ? -1 : m_scheduler.timeout(microtime());
+			INKTTY_PROFILE_TIMER(t_wait, EventWait);
+			m_event_loop.wait(m_events, timeout);
+			INKTTY_PROFILE_STOP(t_wait);
+
+			// Handle all events fetched in this wakeup and forward the output
+			// of the terminal to the PTY
+			{
+				std::lock_guard<std::mutex> lock(m_matrix_mutex);
+				m_closed.clear();
+				for (const Event &event : m_events) {
+					if (handle_event(event)) {
+						done = true;
+						break;
+					}
+				}
+				forward_to_pty();
+			}
 
-			// If there was an event, handle the event
-			if (evsrc >= 0) {
-				done = handle_event(event);
+			// Keep showing the final state once the session log is replayed
+			if (m_replay && m_replay->done()) {
+				global_logger().info() << "Replay finished";
+				m_event_loop.remove(m_replay.get());
+				m_replay.reset();
 			}
 
-			// Forward the output of the terminal to the PTY
-			while ((buf_len = m_vterm.send_to_pty(buf, sizeof(buf)))) {
-				m_pty.write(buf, buf_len);
+			reclaim();
+
+#ifdef HAS_PROFILE
+			if (profile::poll(global_logger(), profile::now(),
+			                  PROFILE_DUMP_INTERVAL)) {
+				memory::report(global_logger());
 			}
+#endif
 		}
 	}
 };
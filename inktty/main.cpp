@@ -16,16 +16,22 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <iostream>
 #include <memory>
 #include <stdexcept>
+#include <system_error>
 
 #include <inktty/backends/fbdev.hpp>
+#include <inktty/backends/headless.hpp>
 #include <inktty/backends/kbdstdin.hpp>
+#include <inktty/backends/remote.hpp>
 #include <inktty/backends/sdl.hpp>
 #include <inktty/config/configuration.hpp>
 #include <inktty/inktty.hpp>
 #include <inktty/utils/logger.hpp>
+#include <inktty/utils/startup.hpp>
+#include <inktty/utils/trace.hpp>
 
 using namespace inktty;
 
@@ -38,6 +44,12 @@ static std::unique_ptr<Display> get_display(
 		try {
 			SDLBackend *sdl_backend =
 			    new SDLBackend(800, 600, config.general.sdl_epaper_emulation);
+			sdl_backend->set_threads(
+			    std::max(0, config.general.display_threads));
+			sdl_backend->set_double_buffered(config.general.double_buffer);
+			if (config.general.rotate_display) {
+				sdl_backend->set_rotation(std::max(0, config.general.orientation));
+			}
 			display = std::unique_ptr<Display>(sdl_backend);
 			event_sources.push_back(sdl_backend);
 		} catch (std::runtime_error &e) {
@@ -47,19 +59,54 @@ static std::unique_ptr<Display> get_display(
 #endif
 	if ((name == "fbdev" || name == "default") && !display) {
 		try {
-			display = std::unique_ptr<Display>(new FbDevDisplay("/dev/fb0"));
+			FbDevDisplay *fbdev = new FbDevDisplay("/dev/fb0", config.epaper);
+			display = std::unique_ptr<Display>(fbdev);
+			fbdev->set_threads(std::max(0, config.general.display_threads));
+			fbdev->set_double_buffered(config.general.double_buffer);
+			if (config.general.rotate_display) {
+				fbdev->set_rotation(std::max(0, config.general.orientation));
+			}
 		} catch (std::runtime_error &e) {
 			global_logger().warn()
 			    << "Couldn't open framebuffer backend: " << e.what();
 		}
 	}
+	if (name == "headless" && !display) {
+		const config::General &g = config.general;
+		HeadlessDisplay *headless = new HeadlessDisplay(
+		    std::max(1, g.headless_width), std::max(1, g.headless_height),
+		    g.headless_epaper_emulation, g.headless_png);
+		display = std::unique_ptr<Display>(headless);
+		headless->set_threads(std::max(0, g.display_threads));
+		headless->set_double_buffered(g.double_buffer);
+		if (g.rotate_display) {
+			headless->set_rotation(std::max(0, g.orientation));
+		}
+	}
 	return display;
 }
 
 int main(int argc, const char *argv[]) {
 	// Load the configuration
+	startup::begin();
 	Configuration config(argc, argv);
 
+	// Move writing log messages to the console to a background thread
+	if (config.general.async_log) {
+		Logger &logger = global_logger();
+		logger.backend(std::make_shared<LogAsyncBackend>(logger.backend()));
+	}
+
+	// Start recording a trace if requested
+	if (!config.general.trace_file.empty()) {
+		try {
+			trace::start(config.general.trace_file.c_str());
+		} catch (std::system_error &e) {
+			global_logger().warn() << e.what();
+		}
+	}
+	startup::phase("config");
+
 	// Try to allocate a display
 	std::vector<EventSource *> event_sources;
 	std::unique_ptr<Display> display = get_display(config, event_sources);
@@ -67,6 +114,7 @@ int main(int argc, const char *argv[]) {
 		global_logger().fatal_error() << "Couldn't allocate a display.";
 		return 1;
 	}
+	startup::phase("display");
 
 	// If there is no event source yet, append the terminal keyboard
 	std::unique_ptr<KbdStdin> keyboard;
@@ -75,6 +123,23 @@ int main(int argc, const char *argv[]) {
 		event_sources.push_back(keyboard.get());
 	}
 
+	// Allow a remote viewer to mirror the display contents
+	std::unique_ptr<RemoteFramebuffer> remote;
+	MemoryDisplay *memory_display = dynamic_cast<MemoryDisplay *>(display.get());
+	if (config.remote.port > 0 && memory_display) {
+		try {
+			remote = std::unique_ptr<RemoteFramebuffer>(new RemoteFramebuffer(
+			    *memory_display, config.remote.address, config.remote.port));
+			event_sources.push_back(remote.get());
+		} catch (std::system_error &e) {
+			global_logger().warn() << "Cannot start remote framebuffer: "
+			                       << e.what();
+		}
+	}
+
+	startup::phase("input");
+
 	Inktty(config, event_sources, *display).run();
+	trace::stop();
 	return 0;
 }
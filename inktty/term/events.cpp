@@ -16,79 +16,321 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <config.h>
+
 #include <algorithm>
 
 #include <poll.h>
+#include <unistd.h>
+
+#ifdef HAS_EPOLL
+#include <sys/epoll.h>
+#endif
 
 #include <inktty/term/events.hpp>
+#include <inktty/utils/trace.hpp>
 
 namespace inktty {
 
 /******************************************************************************
- * Class Event                                                                *
+ * Struct Event                                                               *
  ******************************************************************************/
 
-int Event::wait(const std::vector<EventSource *> &sources, Event &event,
-                int last_source, int timeout) {
-	// Make sure "last_source + 1" is in the range between [0, fds.size()]
-	last_source = std::max(0, std::min<int>(sources.size(), last_source + 1));
-
-	std::vector<struct pollfd> fds;
-	std::vector<size_t> srcs;
-	for (size_t i = 0; i < sources.size(); i++) {
-		// Fetch the event source pointer
-		const EventSource *src = sources[i];
-
-		// Initialize the fds structure
-		struct pollfd fd;
-		fd.fd = src->event_fd();
-		fd.events = 0;
-		fd.revents = 0;
-		if (fd.fd < 0) {
-			continue;
-		}
+constexpr size_t Event::BUF_SIZE;
+
+/******************************************************************************
+ * Class EventLoop::Impl                                                      *
+ ******************************************************************************/
+
+class EventLoop::Impl {
+private:
+	/**
+	 * Registered event source, together with the file descriptor and poll
+	 * mode it was registered with.
+	 */
+	struct Entry {
+		EventSource *source;
+		int fd;
+		EventSource::PollMode mode;
+		bool enabled;
+	};
+
+	std::vector<Entry> m_entries;
+
+	/**
+	 * File descriptor of the epoll instance, or -1 if poll() is used.
+	 */
+	int m_epoll_fd;
 
-		// Write the requested events
-		const EventSource::PollMode mode = src->event_fd_poll_mode();
+	/**
+	 * Ready sources of the last wakeup together with the events they are
+	 * ready for.
+	 */
+	std::vector<std::pair<EventSource *, EventSource::PollMode>> m_ready;
+
+	std::vector<struct pollfd> m_pollfds;
+
+#ifdef HAS_EPOLL
+	std::vector<struct epoll_event> m_epoll_events;
+
+	static uint32_t epoll_events(EventSource::PollMode mode) {
+		uint32_t res = 0;
 		if (mode & EventSource::PollIn) {
-			fd.events |= POLLIN;
+			res |= EPOLLIN;
 		}
 		if (mode & EventSource::PollOut) {
-			fd.events |= POLLOUT;
+			res |= EPOLLOUT;
+		}
+		if (mode & EventSource::PollPri) {
+			res |= EPOLLPRI;
 		}
+		return res;
+	}
+
+	/**
+	 * Returns true if the entry is registered with the epoll instance.
+	 * Sources without poll mode, e.g. disabled ones, are not registered;
+	 * otherwise the kernel would still report hang-ups and errors for them.
+	 */
+	static bool registered(const Entry &e) {
+		return (e.fd >= 0) && (e.mode != EventSource::PollNone);
+	}
+
+	void epoll_register(int op, const Entry &e) {
+		struct epoll_event ev;
+		ev.events = epoll_events(e.mode);
+		ev.data.ptr = e.source;
+		epoll_ctl(m_epoll_fd, op, e.fd, &ev);
+	}
+#endif
 
-		fds.push_back(fd);
-		srcs.push_back(i);
+	/**
+	 * Updates the registration of all sources whose file descriptor or poll
+	 * mode changed since the last call.
+	 */
+	void sync() {
+		for (Entry &e : m_entries) {
+			const int fd = e.source->event_fd();
+			const EventSource::PollMode mode =
+			    e.enabled ? e.source->event_fd_poll_mode()
+			              : EventSource::PollNone;
+			if (fd == e.fd && mode == e.mode) {
+				continue;
+			}
+#ifdef HAS_EPOLL
+			if (m_epoll_fd >= 0) {
+				const bool was_registered = registered(e);
+				const bool same_fd = (fd == e.fd);
+				const Entry old = e;
+				e.fd = fd;
+				e.mode = mode;
+				if (was_registered && !(same_fd && registered(e))) {
+					epoll_register(EPOLL_CTL_DEL, old);
+				}
+				if (registered(e)) {
+					epoll_register((was_registered && same_fd) ? EPOLL_CTL_MOD
+					                                           : EPOLL_CTL_ADD,
+					               e);
+				}
+				continue;
+			}
+#endif
+			e.fd = fd;
+			e.mode = mode;
+		}
 	}
 
-	// Wait for events on the specified list of fds
-	if (poll(&fds[0], fds.size(), timeout) <= 0) {
-		return -1;
+	/**
+	 * Waits for the registered sources using epoll and fills m_ready.
+	 */
+	bool wait_epoll(int timeout) {
+#ifdef HAS_EPOLL
+		m_epoll_events.resize(std::max<size_t>(1, m_entries.size()));
+		const int n = epoll_wait(m_epoll_fd, m_epoll_events.data(),
+		                         m_epoll_events.size(), timeout);
+		if (n <= 0) {
+			return false;
+		}
+
+		// Report the ready sources in the order they were registered
+		for (const Entry &e : m_entries) {
+			for (int i = 0; i < n; i++) {
+				if (m_epoll_events[i].data.ptr != e.source) {
+					continue;
+				}
+				const uint32_t revents = m_epoll_events[i].events;
+				int mode = EventSource::PollNone;
+				if (revents & EPOLLOUT) {
+					mode |= EventSource::PollOut;
+				}
+				if (revents & EPOLLPRI) {
+					mode |= EventSource::PollPri;
+				}
+				if (revents & EPOLLIN) {
+					mode |= EventSource::PollIn;
+				} else if (revents & (EPOLLERR | EPOLLHUP)) {
+					mode |= EventSource::PollErr;
+				}
+				m_ready.emplace_back(e.source, EventSource::PollMode(mode));
+			}
+		}
+		return true;
+#else
+		(void)timeout;
+		return false;
+#endif
 	}
 
-	// Fetch the events from the event sources.
-	// TODO: handle last_source correctly
-	for (size_t i = 0, j = 0; i < sources.size(); i++, j++) {
-		if (srcs[j] > i) {
-			continue;
+	/**
+	 * Waits for the registered sources using poll() and fills m_ready.
+	 */
+	bool wait_poll(int timeout) {
+		m_pollfds.clear();
+		for (const Entry &e : m_entries) {
+			// Sources without poll mode are ignored, poll() would still
+			// report hang-ups and errors for them
+			struct pollfd fd;
+			fd.fd = (e.mode != EventSource::PollNone) ? e.fd : -1;
+			fd.events = 0;
+			fd.revents = 0;
+			if (e.mode & EventSource::PollIn) {
+				fd.events |= POLLIN;
+			}
+			if (e.mode & EventSource::PollOut) {
+				fd.events |= POLLOUT;
+			}
+			if (e.mode & EventSource::PollPri) {
+				fd.events |= POLLPRI;
+			}
+			m_pollfds.push_back(fd);  // Negative fds are ignored by poll()
+		}
+		if (poll(m_pollfds.data(), m_pollfds.size(), timeout) <= 0) {
+			return false;
 		}
 
-		if (fds[j].revents & POLLOUT) {
-			if (sources[i]->event_get(EventSource::PollOut, event)) {
-				return i;
+		for (size_t i = 0; i < m_entries.size(); i++) {
+			const short revents = m_pollfds[i].revents;
+			int mode = EventSource::PollNone;
+			if (revents & POLLOUT) {
+				mode |= EventSource::PollOut;
+			}
+			if (revents & POLLPRI) {
+				mode |= EventSource::PollPri;
 			}
-		} else if (fds[j].revents & POLLIN) {
-			if (sources[i]->event_get(EventSource::PollIn, event)) {
-				return i;
+			if (revents & POLLIN) {
+				mode |= EventSource::PollIn;
+			} else if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+				mode |= EventSource::PollErr;
 			}
-		} else if (fds[j].revents & POLLNVAL || fds[j].revents & POLLHUP) {
-			if (sources[i]->event_get(EventSource::PollErr, event)) {
-				return i;
+			if (mode != EventSource::PollNone) {
+				m_ready.emplace_back(m_entries[i].source,
+				                     EventSource::PollMode(mode));
 			}
 		}
+		return true;
 	}
-	return -1;
+
+public:
+	explicit Impl(bool use_epoll) : m_epoll_fd(-1) {
+#ifdef HAS_EPOLL
+		// Older kernels may not provide epoll_create1(); use poll() then
+		if (use_epoll) {
+			m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		}
+#else
+		(void)use_epoll;
+#endif
+	}
+
+	~Impl() {
+		if (m_epoll_fd >= 0) {
+			close(m_epoll_fd);
+		}
+	}
+
+	bool uses_epoll() const { return m_epoll_fd >= 0; }
+
+	void add(EventSource *source) {
+		m_entries.push_back(Entry{source, -1, EventSource::PollNone, true});
+	}
+
+	void remove(EventSource *source) {
+		for (auto it = m_entries.begin(); it != m_entries.end(); it++) {
+			if (it->source == source) {
+#ifdef HAS_EPOLL
+				if (m_epoll_fd >= 0 && registered(*it)) {
+					epoll_register(EPOLL_CTL_DEL, *it);
+				}
+#endif
+				m_entries.erase(it);
+				return;
+			}
+		}
+	}
+
+	void set_enabled(EventSource *source, bool enabled) {
+		for (Entry &e : m_entries) {
+			if (e.source == source) {
+				e.enabled = enabled;
+			}
+		}
+	}
+
+	size_t wait(std::vector<Event> &events, int timeout) {
+		events.clear();
+		m_ready.clear();
+		sync();
+
+		const bool ready =
+		    uses_epoll() ? wait_epoll(timeout) : wait_poll(timeout);
+		if (!ready) {
+			return 0;  // Timeout or interrupted by a signal
+		}
+
+		// Fetch at most one event per ready source and readiness type
+		const int64_t t = trace::now();
+		for (const auto &r : m_ready) {
+			static const EventSource::PollMode MODES[] = {
+			    EventSource::PollOut, EventSource::PollIn,
+			    EventSource::PollPri, EventSource::PollErr};
+			for (EventSource::PollMode mode : MODES) {
+				if (!(r.second & mode)) {
+					continue;
+				}
+				events.emplace_back();
+				events.back().time = t;
+				events.back().source = r.first;
+				if (!r.first->event_get(mode, events.back())) {
+					events.pop_back();
+				}
+			}
+		}
+		return events.size();
+	}
+};
+
+/******************************************************************************
+ * Class EventLoop                                                            *
+ ******************************************************************************/
+
+EventLoop::EventLoop(bool use_epoll) : m_impl(new Impl(use_epoll)) {}
+
+EventLoop::~EventLoop() {
+	// Implicitly destroy m_impl
 }
 
-}  // namespace inktty
+bool EventLoop::uses_epoll() const { return m_impl->uses_epoll(); }
+
+void EventLoop::add(EventSource *source) { m_impl->add(source); }
+
+void EventLoop::remove(EventSource *source) { m_impl->remove(source); }
+
+void EventLoop::set_enabled(EventSource *source, bool enabled) {
+	m_impl->set_enabled(source, enabled);
+}
+
+size_t EventLoop::wait(std::vector<Event> &events, int timeout) {
+	return m_impl->wait(events, timeout);
+}
 
+}  // namespace inktty
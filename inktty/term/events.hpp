@@ -21,6 +21,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <vector>
 
 namespace inktty {
@@ -30,9 +31,9 @@ struct EventSource;
 
 struct Event {
 	/**
-	 * Number of bytes that can be stored in the data buffer.
+	 * Number of bytes that can be stored in the text input buffer.
 	 */
-	static constexpr size_t BUF_SIZE = 1024;
+	static constexpr size_t BUF_SIZE = 32;
 
 	enum class Type {
 		/**
@@ -50,6 +51,12 @@ struct Event {
 		 */
 		TEXT_INPUT,
 
+		/**
+		 * A sequence of keys and characters has been read at once, e.g. when
+		 * text is pasted into a terminal.
+		 */
+		KEY_BATCH,
+
 		/**
 		 * A mouse button was pressed.
 		 */
@@ -83,7 +90,14 @@ struct Event {
 		/**
 		 * Output was received from the child
 		 */
-		CHILD_OUTPUT
+		CHILD_OUTPUT,
+
+		/**
+		 * An observer of the display, e.g. a remote viewer, needs the display
+		 * content to be passed to the backend once more, even if nothing
+		 * changed.
+		 */
+		REPAINT
 	};
 
 	/**
@@ -191,9 +205,25 @@ struct Event {
 		size_t buf_len;
 
 		/**
-		 * Data received from the child process.
+		 * Data received from the child process. Points into the read buffer
+		 * of the event source and is only valid until the next event is
+		 * fetched from that source.
 		 */
-		uint8_t buf[BUF_SIZE];
+		const uint8_t *buf;
+	};
+
+	struct KeyBatch {
+		/**
+		 * Number of keys in the batch.
+		 */
+		size_t n_keys;
+
+		/**
+		 * Keys in the order they were read. Points into a buffer of the event
+		 * source and is only valid until the next event is fetched from that
+		 * source.
+		 */
+		const Keyboard *keys;
 	};
 
 	struct Text {
@@ -218,30 +248,25 @@ struct Event {
 	};
 
 	Type type = Type::NONE;
+
+	/**
+	 * Time in microseconds at which the event was read from its source, as
+	 * returned by trace::now().
+	 */
+	int64_t time = 0;
+
+	/**
+	 * Source the event was fetched from, set by EventLoop::wait().
+	 */
+	EventSource *source = nullptr;
+
 	union Data {
 		Keyboard keybd;
 		Mouse mouse;
 		Child child;
+		KeyBatch keys;
 		Text text;
 	} data;
-
-	/**
-	 * Waits for a single new within the given list of event sources.
-	 *
-	 * @param sources is a vector listing all available EventSource instances.
-	 * @param event is a reference at a Event instance in which the event should
-	 * be stored.
-	 * @param last_source is a pointer at the index of the last event source
-	 * that produced an event. This value is used to fairly round-robin between
-	 * event sources. It should be set to the last values returned by this
-	 * function. A negative value indicates that there was no last event. This
-	 * value is assumed to be -1 if the pointer is set to NULL.
-	 * @param timeout is a timeout in milliseconds. If the timeout expires
-	 * without any event happening in the meantime this function returns -1.
-	 * @return the
-	 */
-	static int wait(const std::vector<EventSource *> &sources, Event &event,
-	                int last_source = -1, int timeout = -1);
 };
 
 /**
@@ -252,9 +277,16 @@ struct Event {
 struct EventSource {
 	/**
 	 * Poll mode that should be used to read from the device. Values may be
-	 * combined via bit-wise OR.
+	 * combined via bit-wise OR. PollPri waits for priority data, which some
+	 * kernel interfaces use to signal events (e.g. pressure stall triggers).
 	 */
-	enum PollMode { PollNone = 0, PollIn = 1, PollOut = 2, PollErr = 4 };
+	enum PollMode {
+		PollNone = 0,
+		PollIn = 1,
+		PollOut = 2,
+		PollErr = 4,
+		PollPri = 8
+	};
 
 	/**
 	 * Virtual destructor.
@@ -276,6 +308,66 @@ struct EventSource {
 	 */
 	virtual bool event_get(PollMode mode, Event &event) = 0;
 };
+
+/**
+ * The EventLoop class waits for events from a set of event sources. Sources
+ * are registered once; if available, the file descriptors are monitored with
+ * epoll, otherwise the loop falls back to poll(). Changes to the file
+ * descriptor or poll mode of a source are picked up before each wait.
+ */
+class EventLoop {
+private:
+	class Impl;
+	std::unique_ptr<Impl> m_impl;
+
+public:
+	/**
+	 * Creates a new event loop.
+	 *
+	 * @param use_epoll if false, poll() is used even if epoll is available.
+	 */
+	explicit EventLoop(bool use_epoll = true);
+
+	~EventLoop();
+
+	/**
+	 * Returns true if the event loop uses epoll.
+	 */
+	bool uses_epoll() const;
+
+	/**
+	 * Registers the given event source. The source must outlive the event
+	 * loop or be removed before it is destroyed.
+	 */
+	void add(EventSource *source);
+
+	/**
+	 * Unregisters the given event source.
+	 */
+	void remove(EventSource *source);
+
+	/**
+	 * Temporarily stops (or resumes) fetching events from the given source,
+	 * e.g. to stop reading input while the consumer of the input is busy.
+	 * Sources are enabled when they are added.
+	 */
+	void set_enabled(EventSource *source, bool enabled);
+
+	/**
+	 * Waits until at least one of the registered sources is ready or the
+	 * timeout expires, then fetches at most one event from each ready
+	 * source. Fetching a single event per source ensures that data referenced
+	 * by an event (see Event::Child and Event::KeyBatch) is still valid when
+	 * the events are handled.
+	 *
+	 * @param events is cleared and receives the fetched events, ordered by
+	 * the order in which the sources were registered.
+	 * @param timeout is the maximum time to wait in milliseconds. A negative
+	 * value waits indefinitely.
+	 * @return the number of fetched events.
+	 */
+	size_t wait(std::vector<Event> &events, int timeout = -1);
+};
 }  // namespace inktty
 
 #endif /* INKTTY_TERM_EVENTS_HPP */
@@ -17,8 +17,13 @@
  */
 
 #include <algorithm>
+#include <cstdlib>
+#include <initializer_list>
 
 #include <inktty/term/matrix.hpp>
+#include <inktty/term/scrollback.hpp>
+#include <inktty/utils/profile.hpp>
+#include <inktty/utils/trace.hpp>
 
 namespace inktty {
 
@@ -26,11 +31,14 @@ namespace inktty {
  * Class Matrix::Cell                                                         *
  ******************************************************************************/
 
+static_assert(sizeof(Matrix::Cell) <= 16,
+              "Matrix::Cell should fit into 16 bytes");
+
 bool Matrix::Cell::invisible() const {
-	if (style.concealed) {
+	if (style.concealed()) {
 		return true;
 	}
-	if (style.strikethrough || style.underline) {
+	if (style.strikethrough() || style.underline()) {
 		return false;
 	}
 	if (!glyph || glyph == ' ') {
@@ -46,8 +54,8 @@ bool Matrix::Cell::needs_update(const Cell &old) const {
 	}
 
 	// Need to update if the "cursor" flag changed
-	const bool inverse = cursor ^ style.inverse;
-	const bool inverse_old = old.cursor ^ old.style.inverse;
+	const bool inverse = cursor ^ style.inverse();
+	const bool inverse_old = old.cursor ^ old.style.inverse();
 	if (inverse != inverse_old) {
 		return true;
 	}
@@ -59,34 +67,19 @@ bool Matrix::Cell::needs_update(const Cell &old) const {
 		if (glyph != old.glyph) {
 			return true;
 		}
-		if (!inverse) {
-			if (style.fg != old.style.fg) {
-				return true;
-			}
-		} else {
-			if (style.bg != old.style.bg) {
-				return true;
-			}
+		if (!(inverse ? style.same_bg(old.style) : style.same_fg(old.style))) {
+			return true;
 		}
-		if ((style.bold != old.style.bold) ||
-		    (style.italic != old.style.italic) ||
-		    (style.strikethrough != old.style.strikethrough) ||
-		    (style.underline != old.style.underline)) {
+		constexpr uint32_t fg_attrs = Style::AttrBold | Style::AttrItalic |
+		                              Style::AttrStrikethrough |
+		                              Style::AttrUnderlineMask;
+		if ((style.attrs ^ old.style.attrs) & fg_attrs) {
 			return true;
 		}
 	}
 
 	// Check the background
-	if (!inverse) {
-		if (style.bg != old.style.bg) {
-			return true;
-		}
-	} else {
-		if (style.fg != old.style.fg) {
-			return true;
-		}
-	}
-	return false;
+	return !(inverse ? style.same_fg(old.style) : style.same_bg(old.style));
 }
 
 /******************************************************************************
@@ -99,7 +92,11 @@ Matrix::Matrix(int rows, int cols)
       m_size(cols, rows),
       m_cursor_visible(true),
       m_cursor_visible_old(false),
-      m_alternative_buffer_active(false) {
+      m_alternative_buffer_active(false),
+      m_scrollback(nullptr),
+      m_view_offset(0),
+      m_view_active(false),
+      m_account(memory::Pool::Cells) {
 	reset();
 }
 
@@ -107,27 +104,42 @@ bool Matrix::valid(const Point &p) const {
 	return (p.x >= 1) && (p.y >= 1) && (p.x <= m_size.x) && (p.y <= m_size.y);
 }
 
-void Matrix::extend_update_bounds(const Point &p) {
-	m_update_bounds = m_update_bounds.grow(p);
+void Matrix::mark_dirty(const Point &p) {
+	m_dirty.grow(p.y - 1, p.x);
+}
+
+void Matrix::account() {
+	m_account.set(m_cells.bytes() + m_cells_alt.bytes() + m_cells_old.bytes() +
+	              m_cells_view.bytes());
+}
+
+void Matrix::mark_all_dirty() {
+	for (Cell &c : m_cells) {
+		c.dirty = true;
+	}
+	for (int y = 1; y <= m_size.y; y++) {
+		m_dirty.grow(y - 1, 1, m_size.x);
+	}
 }
 
 void Matrix::reset() {
 	// Set the new cursor location
 	m_pos = Point(1, 1);
 
+	// Show the current screen content
+	view_offset(0);
+
 	// Make the cursor visible
 	m_cursor_visible = true;
 
-	// Resize the vectors to the current matrix size. This deletes any content
-	// that might have been left over from a previous resize().
-	m_cells.resize(m_size.y);
-	m_cells_alt.resize(m_size.y);
-	m_cells_old.resize(m_size.y);
-	for (int y = 0; y < m_size.y; y++) {
-		m_cells[y].resize(m_size.x);
-		m_cells_alt[y].resize(m_size.x);
-		m_cells_old[y].resize(m_size.x);
-	}
+	// Resize the cell arrays to the current matrix size. This deletes any
+	// content that might have been left over from a previous resize().
+	m_cells.resize(m_size.y, m_size.x);
+	m_cells_alt.resize(m_size.y, m_size.x);
+	m_cells_old.resize(m_size.y, m_size.x);
+	m_cells_view.resize(m_size.y, m_size.x);
+	m_dirty.resize(m_size.y);
+	account();
 
 	// Reset all cells to their initial, empty state
 	for (int y = 1; y <= m_size.y; y++) {
@@ -137,33 +149,125 @@ void Matrix::reset() {
 	}
 }
 
+void Matrix::reflow(CellArray &cells, const Point &size, bool track_cursor) {
+	// Concatenate the soft-wrapped rows of the old content into logical lines
+	// and re-wrap them to the new width. If track_cursor is set, the cursor
+	// stays at the same offset within its logical line.
+	const int w = size.x;
+	std::vector<Cell> line, res;
+	Point pos(1, 1);
+	int n_rows = 0, n_rows_used = 0;
+	for (int y = 1; y <= m_size.y; y++) {
+		const Cell *row = cells[y - 1];
+		const int cursor = (track_cursor && y == m_pos.y)
+		                       ? int(line.size()) + m_pos.x - 1
+		                       : -1;
+		line.insert(line.end(), row, row + m_size.x);
+		if (row[m_size.x - 1].wrapped && y < m_size.y) {
+			continue;
+		}
+
+		// Drop trailing empty cells, but keep the cell with the cursor
+		int len = line.size();
+		while (len > 0 && line[len - 1].glyph == 0 &&
+		       line[len - 1].style == Style{}) {
+			len--;
+		}
+		len = std::max(len, cursor + 1);
+
+		// Emit the re-wrapped rows
+		const int n = std::max(1, (len + w - 1) / w);
+		res.resize(size_t(n_rows + n) * w);
+		for (int i = 0; i < len; i++) {
+			Cell &c = res[size_t(n_rows) * w + i];
+			c = line[i];
+			c.cursor = false;
+			c.dirty = true;
+			c.wrapped = false;
+		}
+		for (int i = 0; i < n - 1; i++) {
+			res[size_t(n_rows + i + 1) * w - 1].wrapped = true;
+		}
+		if (cursor >= 0) {
+			pos = Point(cursor % w + 1, n_rows + cursor / w + 1);
+		}
+		n_rows += n;
+		if (len > 0 || cursor >= 0) {
+			n_rows_used = n_rows;
+		}
+		line.clear();
+	}
+
+	// Move rows that do not fit onto the screen to the scrollback store, but
+	// keep the cursor on the screen
+	int top = std::max(0, n_rows_used - size.y);
+	if (track_cursor) {
+		top = std::min(top, pos.y - 1);
+	}
+	if (m_scrollback) {
+		for (int y = 0; y < top; y++) {
+			m_scrollback->push(&res[size_t(y) * w], w);
+		}
+	}
+
+	// Copy the remaining rows to the cell array
+	cells = CellArray(std::max<size_t>(size.y, cells.rows()),
+	                  std::max<size_t>(size.x, cells.cols()));
+	for (int y = top; y < std::min(n_rows, top + size.y); y++) {
+		std::copy(&res[size_t(y) * w], &res[size_t(y + 1) * w],
+		          cells[y - top]);
+	}
+	if (track_cursor) {
+		m_pos = Point(pos.x, pos.y - top);
+	}
+}
+
 void Matrix::resize(int rows, int cols) {
 	// Make sure rows, cols is valid
 	rows = std::max(0, rows);
 	cols = std::max(0, cols);
-
-	// Set the new size
-	m_size = Point(cols, rows);
-
-	// Add new rows to the matrix
-	if ((size_t)rows > m_cells.size()) {
-		m_cells.resize(rows);
-		m_cells_alt.resize(rows);
-		m_cells_old.resize(rows);
+	if (rows == m_size.y && cols == m_size.x) {
+		return;
 	}
+	view_offset(0);
 
-	// Add new colums to the matrix
-	for (int y = 0; y < rows; y++) {
-		if ((size_t)cols > m_cells[y].size()) {
-			m_cells[y].resize(cols);
-			m_cells_alt[y].resize(cols);
-			m_cells_old[y].resize(cols);
-		}
+	// Remove the cursor flag, the cursor location may change
+	if (valid(m_pos_old)) {
+		m_cells[m_pos_old.y - 1][m_pos_old.x - 1].cursor = false;
+	}
+	m_cursor_visible_old = false;
+
+	// Re-wrap the primary screen content. The content of the alternative
+	// screen is not reflowed, applications using it redraw after a resize.
+	if (rows > 0 && cols > 0 && m_size.x > 0 && m_size.y > 0) {
+		CellArray &primary =
+		    m_alternative_buffer_active ? m_cells_alt : m_cells;
+		reflow(primary, Point(cols, rows), !m_alternative_buffer_active);
 	}
 
-	// Limit the update rectangle to the new size
-	m_update_bounds.x1 = std::min(m_update_bounds.x1, cols);
-	m_update_bounds.y1 = std::min(m_update_bounds.y1, rows);
+	// Set the new size
+	m_size = Point(cols, rows);
+	m_pos = Rect{1, 1, m_size.x, m_size.y}.clip(m_pos, true);
+
+	// Grow the cell arrays if necessary. The arrays never shrink, so content
+	// outside the visible area is retained when the matrix grows again.
+	const size_t rows_arr = std::max<size_t>(rows, m_cells.rows());
+	const size_t cols_arr = std::max<size_t>(cols, m_cells.cols());
+	m_cells.resize(rows_arr, cols_arr);
+	m_cells_alt.resize(rows_arr, cols_arr);
+	m_cells_old.resize(rows_arr, cols_arr);
+	m_cells_view.resize(rows_arr, cols_arr);
+	account();
+
+	// Pending move operations refer to the old size. Consumers redraw the
+	// screen after a resize, so it is safe to discard them.
+	m_scrolls.clear();
+
+	// Discard the dirty spans of rows that are no longer visible, commit()
+	// clips the spans to the number of columns; compare all cells against
+	// the old content in the next commit
+	m_dirty.resize(rows);
+	mark_all_dirty();
 }
 
 void Matrix::move_abs(Point pos) {
@@ -184,9 +288,35 @@ void Matrix::set(uint32_t glyph, const Style &style, Point pos) {
 		c.style = style;
 		c.dirty = true;
 
-		// Grow the update bounds
-		extend_update_bounds(pos);
+		// Add the cell to the dirty span of its row
+		mark_dirty(pos);
+	}
+}
+
+void Matrix::set_run(const uint32_t *glyphs, size_t n, const Style &style,
+                     Point pos) {
+	// Clip the run to the row
+	if (!valid(pos)) {
+		return;
+	}
+	const int x1 =
+	    pos.x - 1 + int(std::min<size_t>(n, size_t(m_size.x - pos.x + 1)));
+
+	// Assign the changed cells, track the span of cells that actually changed
+	Cell *row = m_cells[pos.y - 1];
+	int dirty0 = x1 + 1, dirty1 = pos.x - 1;
+	for (int x = pos.x; x <= x1; x++) {
+		Cell &c = row[x - 1];
+		const uint32_t glyph = *(glyphs++);
+		if (glyph != c.glyph || style != c.style) {
+			c.glyph = glyph;
+			c.style = style;
+			c.dirty = true;
+			dirty0 = std::min(dirty0, x);
+			dirty1 = x;
+		}
 	}
+	m_dirty.grow(pos.y - 1, dirty0, dirty1);
 }
 
 void Matrix::fill(uint32_t glyph, const Style &style, const Point &from, const Point &to) {
@@ -197,73 +327,203 @@ void Matrix::fill(uint32_t glyph, const Style &style, const Point &from, const P
 		for (int col = col0; col <= col1; col++) {
 			set(glyph, style, Point{col, row});
 		}
+		if (col1 >= m_size.x) {
+			set_wrapped(row, false);
+		}
+	}
+}
+
+void Matrix::set_wrapped(int row, bool wrapped) {
+	if (row >= 1 && row <= m_size.y && m_size.x > 0) {
+		m_cells[row - 1][m_size.x - 1].wrapped = wrapped;
 	}
 }
 
-void Matrix::scroll(uint32_t glyph, const Style &style, const Rect &r, int downward, int rightward) {
+void Matrix::move(const Rect &r, int downward, int rightward) {
 	// Abort if there is nothing to do
 	if ((downward == 0 && rightward == 0) || !r.valid()) {
 		return;
 	}
 
-	// Copy cells by calling "set" (TODO: optimize)
-	const int x0 = (rightward >= 0) ? r.x0 : r.x1;
-	const int x1 = (rightward >= 0) ? r.x1 : r.x0;
-	const int y0 = (downward >= 0) ? r.y0 : r.y1;
-	const int y1 = (downward >= 0) ? r.y1 : r.y0;
-	const int dir_x = (x1 >= x0) ? 1 : -1;
-	const int dir_y = (y1 >= y0) ? 1 : -1;
-	for (int y_tar = y0; dir_y * y_tar <= dir_y * y1; y_tar += dir_y) {
-		const int y_src = y_tar + downward;
-		if (y_src < r.y0 || y_src > r.y1) {
-			Cell c;
-			c.style = style;
-			std::fill(m_cells[y_tar - 1].begin() + r.x0 - 1, m_cells[y_tar - 1].begin() + r.x1, c);
-		} else {
-			for (int x_tar = x0; dir_x * x_tar <= dir_x * x1; x_tar += dir_x) {
-				Cell &c_tar = m_cells[y_tar - 1][x_tar - 1];
-				const int x_src = x_tar + rightward;
-				if (x_src < r.x0 || x_src > r.x1) {
-					Cell c;
-					c.style = style;
-					c_tar = c;
-				} else {
-					const Cell &c_src = m_cells[y_src - 1][x_src - 1];
-					c_tar = c_src;
-					c_tar.dirty = true;
-					c_tar.cursor = false;
-				}
+	// Move the current and the old cell content. Include the hidden columns
+	// in moves spanning entire rows, allowing to rotate the row index table.
+	const size_t col1 = (r.x0 == 1 && r.x1 >= m_size.x) ? m_cells.cols()
+	                                                    : size_t(r.x1);
+	m_cells.move(r.y0 - 1, r.y1, r.x0 - 1, col1, downward, rightward);
+
+	// The displayed content does not move while the view is scrolled back
+	if (!m_view_active) {
+		m_cells_old.move(r.y0 - 1, r.y1, r.x0 - 1, col1, downward, rightward);
+		m_scrolls.emplace_back(Scroll{r, downward, rightward});
+	}
+
+	// Update the stored old cursor position if it was moved
+	if (m_pos_old.x >= r.x0 && m_pos_old.x <= r.x1 && m_pos_old.y >= r.y0 &&
+	    m_pos_old.y <= r.y1) {
+		m_pos_old.y -= downward;
+		m_pos_old.x -= rightward;
+	}
+
+	// Dirty cells may have been moved around in the region. Move the dirty
+	// spans along with vertically moved rows; horizontal moves are rare (they
+	// are used for inserting and deleting characters), simply mark the entire
+	// region as dirty in that case.
+	const int y0 = std::max(r.y0, 1), y1 = std::min(r.y1, int(m_dirty.rows()));
+	if (rightward != 0) {
+		for (int y = y0; y <= y1; y++) {
+			m_dirty.grow(y - 1, r.x0, r.x1);
+		}
+	} else if (y0 <= y1) {
+		const bool full_width = (r.x0 == 1 && r.x1 >= m_size.x);
+		std::vector<DirtyRows::Span> spans(y1 - y0 + 1);
+		for (int y = y0; y <= y1; y++) {
+			spans[y - y0] = m_dirty[y - 1];
+		}
+		for (int y = y0; y <= y1; y++) {
+			const int src = y + downward;
+			if (src < y0 || src > y1) {
+				continue;
+			}
+			const DirtyRows::Span &s = spans[src - y0];
+			if (full_width) {
+				m_dirty.set(y - 1, s);
+			} else {
+				m_dirty.grow(y - 1, std::max(s.x0, r.x0), std::min(s.x1, r.x1));
 			}
 		}
 	}
+}
 
-	// Update the y-coordinates of all stored old positions
-	m_pos_old.y -= downward;
-	m_pos_old.x -= rightward;
+void Matrix::scroll(uint32_t glyph, const Style &style, const Rect &r,
+                    int downward, int rightward) {
+	// Abort if there is nothing to do
+	if ((downward == 0 && rightward == 0) || !r.valid()) {
+		return;
+	}
+
+	// Hand rows scrolled off the top of the screen to the scrollback store
+	if (m_scrollback && !m_alternative_buffer_active && downward > 0 &&
+	    r.y0 == 1 && r.x0 == 1 && r.x1 >= m_size.x) {
+		const int h = std::min(downward, r.y1 - r.y0 + 1);
+		for (int y = 1; y <= h; y++) {
+			m_scrollback->push(m_cells[y - 1], m_size.x);
+		}
 
-	// Set the update bounds to the entire screen rectangle
-	m_update_bounds = Rect{1, 1, m_size.x, m_size.y};
+		// Keep the view in place
+		if (m_view_offset > 0) {
+			view_offset(m_view_offset + h);
+		}
+	}
+
+	move(r, downward, rightward);
+
+	// Compute the bands of cells that were scrolled in
+	Cell blank;
+	blank.glyph = glyph;
+	blank.style = style;
+	const int h = std::min(std::abs(downward), r.y1 - r.y0 + 1);
+	const int w = std::min(std::abs(rightward), r.x1 - r.x0 + 1);
+	const Rect band_y = (downward >= 0) ? Rect{r.x0, r.y1 - h + 1, r.x1, r.y1}
+	                                    : Rect{r.x0, r.y0, r.x1, r.y0 + h - 1};
+	const Rect band_x = (rightward >= 0) ? Rect{r.x1 - w + 1, r.y0, r.x1, r.y1}
+	                                     : Rect{r.x0, r.y0, r.x0 + w - 1, r.y1};
+
+	// Blank the scrolled in cells and mark them as dirty
+	for (const Rect &band : {band_y, band_x}) {
+		for (int y = band.y0; y <= band.y1; y++) {
+			Cell *row = m_cells[y - 1];
+			for (int x = band.x0; x <= band.x1; x++) {
+				row[x - 1] = blank;
+			}
+			m_dirty.grow(y - 1, band.x0, band.x1);
+		}
+	}
 }
 
 void Matrix::set_alternative_buffer_active(bool active) {
 	if (active != m_alternative_buffer_active) {
+		view_offset(0);
 		m_alternative_buffer_active = active;
-		std::swap(m_cells, m_cells_alt);
-		for (size_t y = 0; y < m_cells.size(); y++) {
-			for (size_t x = 0; x < m_cells[y].size(); x++) {
-				m_cells[y][x].dirty = true;
+		m_cells.swap(m_cells_alt);
+		mark_all_dirty();
+	}
+}
+
+void Matrix::scrollback(Scrollback *scrollback) {
+	view_offset(0);
+	m_scrollback = scrollback;
+}
+
+void Matrix::view_offset(int offset) {
+	offset = std::max(0, offset);
+	if (offset > 0) {
+		// Only re-wrap as many rows of the scrollback store as are needed
+		offset = (m_scrollback && !m_alternative_buffer_active)
+		             ? int(m_scrollback->rows(m_size.x, offset))
+		             : 0;
+	}
+	if (offset != m_view_offset) {
+		m_view_offset = offset;
+
+		// The cells have to be compared against the content of the view once
+		// the view returns to the current screen content
+		if (offset == 0) {
+			mark_all_dirty();
+		}
+	}
+}
+
+void Matrix::commit_view(std::vector<Point> &updates) {
+	// Assemble the view from the scrollback store and the current cells
+	for (int y = 0; y < m_size.y; y++) {
+		Cell *row = m_cells_view[y];
+		const int src = y - m_view_offset;
+		if (src >= 0) {
+			std::copy(m_cells[src], m_cells[src] + m_size.x, row);
+		} else {
+			m_scrollback->get(-src - 1, row, m_size.x);
+		}
+
+		// Compare the view against the displayed content
+		Cell *row_old = m_cells_old[y];
+		for (int x = 0; x < m_size.x; x++) {
+			Cell &cell = row[x];
+			cell.cursor = false;
+			cell.dirty = true;
+			if (cell.needs_update(row_old[x])) {
+				updates.emplace_back(x + 1, y + 1);
 			}
+			cell.dirty = false;
+			row_old[x] = cell;
 		}
 	}
 }
 
-void Matrix::commit(std::vector<Point> &updates) {
+void Matrix::commit(std::vector<Point> &updates,
+                    std::vector<Scroll> &scrolls) {
+	INKTTY_PROFILE_SCOPE(MatrixCommit);
+	trace::Span span("matrix_commit");
+
+	// Hand the move operations to the caller
+	scrolls.insert(scrolls.end(), m_scrolls.begin(), m_scrolls.end());
+	m_scrolls.clear();
+
 	// Remove the "cursor" flag from the cell that last had the cursor
 	if (m_cursor_visible_old && valid(m_pos_old)) {
 		Cell &c = m_cells[m_pos_old.y - 1][m_pos_old.x - 1];
 		c.cursor = false;
 		c.dirty = true;
-		extend_update_bounds(m_pos_old);
+		mark_dirty(m_pos_old);
+	}
+
+	// Report the content of the view while it is scrolled back; the cursor
+	// is hidden
+	m_view_active = (m_view_offset > 0);
+	if (m_view_active) {
+		commit_view(updates);
+		m_pos_old = m_pos;
+		m_cursor_visible_old = false;
+		return;
 	}
 
 	// Add the "cursor" flag to the cell that currently has the cursor
@@ -271,19 +531,26 @@ void Matrix::commit(std::vector<Point> &updates) {
 		Cell &c = m_cells[m_pos.y - 1][m_pos.x - 1];
 		c.cursor = true;
 		c.dirty = true;
-		extend_update_bounds(m_pos);
+		mark_dirty(m_pos);
 	}
 
-	// Scan the cells within the update rectangle for updates
-	for (int y = m_update_bounds.y0; y <= m_update_bounds.y1; y++) {
-		for (int x = m_update_bounds.x0; x <= m_update_bounds.x1; x++) {
+	// Scan the dirty cells of each row for updates
+	for (int y = m_dirty.y0(); y <= m_dirty.y1(); y++) {
+		const DirtyRows::Span &s = m_dirty[y];
+		if (!s.valid()) {
+			continue;
+		}
+		Cell *row = m_cells[y];
+		Cell *row_old = m_cells_old[y];
+		const int x0 = std::max(s.x0, 1), x1 = std::min(s.x1, m_size.x);
+		for (int x = x0; x <= x1; x++) {
 			// Fetch references at the current and the old cell content
-			Cell &cell = m_cells[y - 1][x - 1];
-			Cell &cell_old = m_cells_old[y - 1][x - 1];
+			Cell &cell = row[x - 1];
+			Cell &cell_old = row_old[x - 1];
 
 			// Check whether we actually need to update the cell
 			if (cell.needs_update(cell_old)) {
-				updates.emplace_back(x, y);
+				updates.emplace_back(x, y + 1);
 			}
 
 			// Reset the "dirty" flag and copy the current cell content to the
@@ -293,8 +560,10 @@ void Matrix::commit(std::vector<Point> &updates) {
 		}
 	}
 
-	// Backup the old cursor position and the
+	// Backup the old cursor position and the cursor visibility, all cells
+	// have been scanned
 	m_pos_old = m_pos;
 	m_cursor_visible_old = m_cursor_visible;
+	m_dirty.clear();
 }
 }  // namespace inktty
@@ -30,88 +30,141 @@
 #include <vector>
 
 #include <inktty/utils/color.hpp>
+#include <inktty/utils/dirty_rows.hpp>
 #include <inktty/utils/geometry.hpp>
+#include <inktty/utils/grid.hpp>
+#include <inktty/utils/memory.hpp>
 
 namespace inktty {
+class Scrollback;
+
 /**
  * The Style structure tracks the text style of the TTY and is modified by
- * appropriate ANSI escape sequences.
+ * appropriate ANSI escape sequences. All attributes besides the colours are
+ * packed into a single integer, such that styles can be compared with a few
+ * integer comparisons.
  */
 struct Style {
 	/**
-	 * If true, uses the default foreground color and ignores "fg". This is the
-	 * default.
+	 * Bits in the packed attribute word.
+	 */
+	enum Attr : uint32_t {
+		AttrDefaultFg = 0x01,
+		AttrDefaultBg = 0x02,
+		AttrConcealed = 0x04,
+		AttrBold = 0x08,
+		AttrItalic = 0x10,
+		AttrStrikethrough = 0x20,
+		AttrInverse = 0x40,
+		AttrUnderlineShift = 7,
+		AttrUnderlineMask = 0x180,
+	};
+
+	/**
+	 * Foreground or text colour. Ignored if default_fg() is true.
 	 */
-	bool default_fg;
+	Color fg;
 
 	/**
-	 * If true, uses the default background color and ignores "bg". This is the
-	 + default.
+	 * Background colour. Ignored if default_bg() is true.
 	 */
-	bool default_bg;
+	Color bg;
 
 	/**
-	 * Foreground or text colour.
+	 * Packed attributes, see the Attr enum.
 	 */
-	Color fg;
+	uint32_t attrs;
 
 	/**
-	 * Background colour.
+	 * Default constructor, resets all member variables to their default value.
 	 */
-	Color bg;
+	Style()
+	    : fg(RGBA(0xF7F7F7)), bg(RGBA(0x000000)),
+	      attrs(AttrDefaultFg | AttrDefaultBg) {}
+
+	bool flag(uint32_t attr) const { return attrs & attr; }
+
+	void flag(uint32_t attr, bool set) {
+		attrs = set ? (attrs | attr) : (attrs & ~attr);
+	}
+
+	/**
+	 * If true, uses the default foreground color and ignores "fg". This is the
+	 * default.
+	 */
+	bool default_fg() const { return flag(AttrDefaultFg); }
+	void default_fg(bool v) { flag(AttrDefaultFg, v); }
+
+	/**
+	 * If true, uses the default background color and ignores "bg". This is the
+	 * default.
+	 */
+	bool default_bg() const { return flag(AttrDefaultBg); }
+	void default_bg(bool v) { flag(AttrDefaultBg, v); }
 
 	/**
 	 * True if the foreground is not rendered.
 	 */
-	bool concealed : 1;
+	bool concealed() const { return flag(AttrConcealed); }
+	void concealed(bool v) { flag(AttrConcealed, v); }
 
 	/**
 	 * If true, the glyph is drawn with a bold font.
 	 */
-	bool bold : 1;
+	bool bold() const { return flag(AttrBold); }
+	void bold(bool v) { flag(AttrBold, v); }
 
 	/**
 	 * If true, the glyph is drawn with an italic font.
 	 */
-	bool italic : 1;
+	bool italic() const { return flag(AttrItalic); }
+	void italic(bool v) { flag(AttrItalic, v); }
 
 	/**
 	 * If true, the glyph is rendered striked through.
 	 */
-	bool strikethrough : 1;
+	bool strikethrough() const { return flag(AttrStrikethrough); }
+	void strikethrough(bool v) { flag(AttrStrikethrough, v); }
 
 	/**
 	 * If true, background and foreground color are inverted.
 	 */
-	bool inverse : 1;
+	bool inverse() const { return flag(AttrInverse); }
+	void inverse(bool v) { flag(AttrInverse, v); }
 
 	/**
 	 * If zero, the glyph is not underlined, if one the glyph is singly
 	 * underlined, if two the glyph is doubly underlined.
 	 */
-	unsigned int underline : 2;
+	unsigned int underline() const {
+		return (attrs & AttrUnderlineMask) >> AttrUnderlineShift;
+	}
+	void underline(unsigned int v) {
+		attrs = (attrs & ~uint32_t(AttrUnderlineMask)) |
+		        ((v << AttrUnderlineShift) & AttrUnderlineMask);
+	}
 
 	/**
-	 * Default constructor, resets all member variables to their default value.
+	 * Returns true if the effective foreground colour of this style is equal
+	 * to the effective foreground colour of the given style.
 	 */
-	Style()
-	    : fg(0xF7F7F7),
-	      bg(0x000000),
-	      concealed(false),
-	      bold(false),
-	      italic(false),
-	      strikethrough(false),
-	      inverse(false),
-	      underline(0) {}
+	bool same_fg(const Style &o) const {
+		return default_fg() ? o.default_fg() : (!o.default_fg() && fg == o.fg);
+	}
+
+	/**
+	 * Returns true if the effective background colour of this style is equal
+	 * to the effective background colour of the given style.
+	 */
+	bool same_bg(const Style &o) const {
+		return default_bg() ? o.default_bg() : (!o.default_bg() && bg == o.bg);
+	}
 
 	/**
 	 * Compares this Style instance to the given other Style instance.
 	 */
 	bool operator==(const Style &o) const {
-		return (fg == o.fg) && (bg == o.bg) && (concealed == o.concealed) &&
-		       (bold == o.bold) && (italic == o.italic) &&
-		       (strikethrough == o.strikethrough) && (inverse == o.inverse) &&
-		       (underline == o.underline);
+		return (attrs == o.attrs) && (fg == o.fg) && (bg == o.bg);
 	}
 
 	bool operator!=(const Style &o) const { return !((*this) == o); }
@@ -127,26 +180,32 @@ public:
 	struct Cell {
 		/**
 		 * Current Unicode glyph that is being displayed in this cell or zero if
-		 * the cell is empty.
+		 * the cell is empty. Unicode code points fit into 21 bits.
 		 */
-		uint32_t glyph;
+		uint32_t glyph : 21;
 
 		/**
-		 * Current cell style.
+		 * If true, this cell corresponds to the current cursor location.
 		 */
-		Style style;
+		bool cursor : 1;
 
 		/**
-		 * If true, this cell corresponds to the current cursor location.
+		 * If true, the cell has been touched.
 		 */
-		bool cursor;
+		bool dirty : 1;
 
 		/**
-		 * If true, the cell has been touched.
+		 * If true, this is the last cell of a row whose text was soft-wrapped,
+		 * i.e. the row forms a logical line together with the next row.
+		 */
+		bool wrapped : 1;
+
+		/**
+		 * Current cell style.
 		 */
-		bool dirty;
+		Style style;
 
-		Cell() : glyph(0), cursor(false), dirty(true) {}
+		Cell() : glyph(0), cursor(false), dirty(true), wrapped(false) {}
 
 		/**
 		 * Returns true if the cell changed in any significant way compared to
@@ -161,9 +220,24 @@ public:
 	};
 
 	/**
-	 * Data structure holding the content of all cells in the matrix.
+	 * Data structure holding the content of all cells in the matrix. Cells
+	 * are stored in a single contiguous buffer; scrolling rotates the row
+	 * index table instead of copying cells.
 	 */
-	using CellArray = std::vector<std::vector<Cell>>;
+	using CellArray = Grid<Cell>;
+
+	/**
+	 * Describes a move operation on a rectangular region of cells as
+	 * performed by move() and scroll(). Within the region r (one-based,
+	 * inclusive), the cell at (x, y) received the content of the cell at
+	 * (x + rightward, y + downward). Cells whose source lies outside of r keep
+	 * their content.
+	 */
+	struct Scroll {
+		Rect r;
+		int downward;
+		int rightward;
+	};
 
 private:
 	/**
@@ -214,13 +288,61 @@ private:
 	bool m_alternative_buffer_active;
 
 	/**
-	 * Bounding rectangle describing the area of updated cells.
+	 * Span of updated cells in each row. Only these cells are scanned in
+	 * commit().
+	 */
+	DirtyRows m_dirty;
+
+	/**
+	 * Move operations since the last commit. These have already been applied
+	 * to m_cells_old, i.e. the old cell contents describe the screen content
+	 * after the consumer of commit() performed the same operations.
+	 */
+	std::vector<Scroll> m_scrolls;
+
+	/**
+	 * Store receiving the rows scrolled off the top of the screen, or nullptr
+	 * if scrollback is disabled.
+	 */
+	Scrollback *m_scrollback;
+
+	/**
+	 * Number of rows the view is scrolled back into the scrollback store.
+	 * While non-zero, commit() reports the content of the view instead of the
+	 * current cells.
+	 */
+	int m_view_offset;
+
+	/**
+	 * True if the last call to commit() reported the content of the view.
+	 */
+	bool m_view_active;
+
+	/**
+	 * Cell array holding the content of the view while m_view_active is set.
+	 */
+	CellArray m_cells_view;
+
+	/**
+	 * Memory allocated for the cell arrays.
 	 */
-	Rect m_update_bounds;
+	memory::Account m_account;
 
 	bool valid(const Point &p) const;
 
-	void extend_update_bounds(const Point &p);
+	/**
+	 * Adds the cell at the given (one-based) location to the dirty span of
+	 * its row, such that commit() scans it for updates.
+	 */
+	void mark_dirty(const Point &p);
+
+	void mark_all_dirty();
+
+	void account();
+
+	void reflow(CellArray &cells, const Point &size, bool track_cursor);
+
+	void commit_view(std::vector<Point> &updates);
 
 public:
 	/**
@@ -231,9 +353,32 @@ public:
 	/**
 	 * Returns a reference at the internal CellArray instance holding the
 	 * current state of the matrix. Note that some updates only become visible
-	 * visible in the CellArray after commit() has been called.
+	 * visible in the CellArray after commit() has been called. While the view
+	 * is scrolled back, this is the content of the view as of the last
+	 * commit().
+	 */
+	CellArray &cells() { return m_view_active ? m_cells_view : m_cells; }
+
+	/**
+	 * Attaches the store receiving the rows that scroll off the top of the
+	 * screen. The store is not owned by the matrix; pass nullptr to disable
+	 * scrollback.
+	 */
+	void scrollback(Scrollback *scrollback);
+
+	/**
+	 * Returns the number of rows the view is scrolled back into the
+	 * scrollback store. Zero if the view shows the current screen content.
+	 */
+	int view_offset() const { return m_view_offset; }
+
+	/**
+	 * Scrolls the view back by the given number of rows. The offset is
+	 * clipped to the number of rows in the scrollback store; the alternative
+	 * buffer cannot be scrolled back. The view stays in place while new rows
+	 * are added to the scrollback store.
 	 */
-	CellArray &cells() { return m_cells; }
+	void view_offset(int offset);
 
 	/**
 	 * Resets the matrix, does not change the size.
@@ -247,7 +392,9 @@ public:
 
 	/**
 	 * Resizes the matrix to the given side. This may be called outside of a
-	 * batch update.
+	 * batch update. The content of the primary screen is re-wrapped to the
+	 * new width; rows that no longer fit are moved to the scrollback store.
+	 * Moves the cursor along with the content.
 	 */
 	void resize(int rows, int cols);
 
@@ -289,6 +436,22 @@ public:
 	 */
 	void set(uint32_t glyph, const Style &style, Point pos);
 
+	/**
+	 * Sets the n cells starting at the given position to the given glyphs,
+	 * all with the same style. The cells must be in the same row; glyphs
+	 * beyond the end of the row are ignored. Equivalent to calling set() for
+	 * each glyph, but only checks the bounds and updates the dirty span once.
+	 */
+	void set_run(const uint32_t *glyphs, size_t n, const Style &style,
+	             Point pos);
+
+	/**
+	 * Marks the given row (one-based) as soft-wrapped, i.e. the text in the
+	 * row continues in the next row. Filling the last cell of the row resets
+	 * the flag.
+	 */
+	void set_wrapped(int row, bool wrapped);
+
 	/**
 	 * Fills the screen with the given glyph and style from the given cursor
 	 * location to the given cursor location.
@@ -297,8 +460,16 @@ public:
 	          const Point &to);
 
 	/**
-	 * Scrolls the entire view one line up or down. Inserts a blank row with the
-	 * given style.
+	 * Moves the content of the given region such that the cell at (x, y)
+	 * receives the content of the cell at (x + rightward, y + downward). Cells
+	 * whose source lies outside of the region keep their content. The
+	 * operation is reported as a Scroll in the next call to commit().
+	 */
+	void move(const Rect &r, int downward, int rightward);
+
+	/**
+	 * Scrolls the given region of the view, see move(). Fills the cells that
+	 * were scrolled in with the given glyph and style.
 	 */
 	void scroll(uint32_t glyph, const Style &style, const Rect &r, int downward,
 	            int rightward);
@@ -311,8 +482,21 @@ public:
 	 * "compressed" update, i.e. if the same cell is set twice, only the last
 	 * update will be present in the "updates" vector. Updates are likely not
 	 * in the sequence in which the above functions were called.
+	 *
+	 * The move operations performed since the last commit are written to the
+	 * "scrolls" vector in the order in which they occurred. The consumer must
+	 * apply these to the displayed content before applying the updates, the
+	 * update locations refer to the state after all move operations.
+	 */
+	void commit(std::vector<Point> &updates, std::vector<Scroll> &scrolls);
+
+	/**
+	 * Discards the move operations recorded since the last commit. Only
+	 * valid if the consumer redraws the entire matrix after the next commit,
+	 * e.g. because the matrix is currently not displayed. Prevents the list
+	 * of move operations from growing while nobody commits the matrix.
 	 */
-	void commit(std::vector<Point> &updates);
+	void discard_scrolls() { m_scrolls.clear(); }
 };
 
 }  // namespace inktty
@@ -156,9 +156,15 @@ static int spawn_child_in_pty(int pty_master, int pty_slave, unsigned int rows,
 
 const char *PTY::DEFAULT_TERM = "xterm-256color";
 
+constexpr size_t PTY::READ_BUF_SIZE;
+
 PTY::PTY(unsigned int rows, unsigned int cols,
          const std::vector<std::string> &args, const char *term)
-    : m_master_fd(-1), m_slave_fd(-1), m_child_pid(-1) {
+    : m_master_fd(-1),
+      m_slave_fd(-1),
+      m_child_pid(-1),
+      m_write_pos(0),
+      m_read_buf(READ_BUF_SIZE) {
 	// We need at least the program name as an argument
 	if (args.size() == 0) {
 		throw std::runtime_error("Invalid number of arguments.");
@@ -185,10 +191,47 @@ PTY::~PTY() {
 	}
 }
 
-void PTY::write(uint8_t *buf, size_t buf_len) {
+void PTY::write(const uint8_t *buf, size_t buf_len) {
 	m_write_buf.insert(m_write_buf.end(), buf, buf + buf_len);
 }
 
+int PTY::write_pending() {
+	while (m_write_pos < m_write_buf.size()) {
+		const ssize_t n_write =
+		    ::write(m_master_fd, m_write_buf.data() + m_write_pos,
+		            m_write_buf.size() - m_write_pos);
+		if (n_write > 0) {
+			m_write_pos += n_write;
+		} else if (n_write < 0 && errno == EINTR) {
+			continue;
+		} else if (n_write < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;  // The child does not accept more data right now
+		} else {
+			return (n_write < 0) ? errno : EIO;
+		}
+	}
+
+	// Discard the written data. Only move the remaining bytes once they are
+	// outnumbered by the written ones, such that large backlogs are not
+	// copied over and over again.
+	if (m_write_pos == m_write_buf.size()) {
+		m_write_buf.clear();
+		m_write_pos = 0;
+	} else if (m_write_pos > m_write_buf.size() / 2) {
+		m_write_buf.erase(m_write_buf.begin(),
+		                  m_write_buf.begin() + m_write_pos);
+		m_write_pos = 0;
+	}
+	return 0;
+}
+
+void PTY::flush() {
+	// Errors are reported by event_get() once the fd is polled
+	if (m_master_fd >= 0) {
+		write_pending();
+	}
+}
+
 /******************************************************************************
  * Interface PTY::EventSource                                                 *
  ******************************************************************************/
@@ -198,27 +241,45 @@ int PTY::event_fd() const { return m_master_fd; }
 EventSource::PollMode PTY::event_fd_poll_mode() const {
 	return EventSource::PollMode(
 	    EventSource::PollIn |
-	    (m_write_buf.empty() ? EventSource::PollNone : EventSource::PollOut));
+	    (backlog() ? EventSource::PollOut : EventSource::PollNone));
 }
 
 bool PTY::event_get(EventSource::PollMode mode, Event &event) {
+	// The QUIT event has already been reported when the fd was closed
+	if (m_master_fd < 0) {
+		return false;
+	}
+
 	if (mode == EventSource::PollIn) {
-		// Mark the event as a "child output" data event
-		event.type = Event::Type::CHILD_OUTPUT;
-
-		// Write the event-type specific data
-		Event::Child &data = event.data.child;
-		ssize_t n_read = read(m_master_fd, &data.buf, Event::BUF_SIZE);
-		if (n_read >= 0) {
-			data.buf_len = n_read;
+		// Drain everything the child has written so far, up to the size of
+		// the read buffer. The master fd is non-blocking.
+		size_t n = 0;
+		int err = 0;
+		while (n < m_read_buf.size()) {
+			const ssize_t n_read =
+			    read(m_master_fd, &m_read_buf[n], m_read_buf.size() - n);
+			if (n_read > 0) {
+				n += n_read;
+			} else if (n_read < 0 && errno == EINTR) {
+				continue;
+			} else {
+				err = (n_read < 0) ? errno : EIO;
+				break;
+			}
+		}
+
+		// Hand out the received data, reading errors are reported once the
+		// buffer has been processed
+		if (n > 0) {
+			event.type = Event::Type::CHILD_OUTPUT;
+			event.data.child.buf = m_read_buf.data();
+			event.data.child.buf_len = n;
 			return true;
+		} else if (err == EAGAIN || err == EWOULDBLOCK) {
+			return false;  // Spurious wakeup
 		}
 	} else if (mode == EventSource::PollOut) {
-		ssize_t n_write =
-		    ::write(m_master_fd, m_write_buf.data(), m_write_buf.size());
-		if (n_write >= 0) {
-			m_write_buf.erase(m_write_buf.begin(),
-			                  m_write_buf.begin() + n_write);
+		if (write_pending() == 0) {
 			return false;  // We handled this event
 		}
 	}
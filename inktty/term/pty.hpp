@@ -58,11 +58,30 @@ private:
 
 	/**
 	 * Write buffer containing the data that was not yet transmitted to the
-	 * client.
+	 * client. The bytes before m_write_pos have already been written.
 	 */
 	std::vector<uint8_t> m_write_buf;
+	size_t m_write_pos;
+
+	/**
+	 * Buffer receiving the output of the child process. CHILD_OUTPUT events
+	 * point directly into this buffer.
+	 */
+	std::vector<uint8_t> m_read_buf;
+
+	/**
+	 * Writes queued data until the child stops accepting it. Returns zero on
+	 * success or the error code of a failed write.
+	 */
+	int write_pending();
 
 public:
+	/**
+	 * Maximum number of bytes read from the child process per event. Reading
+	 * stops earlier once no more data is available.
+	 */
+	static constexpr size_t READ_BUF_SIZE = 64 * 1024;
+
 	/**
 	 * Default value for the TERM environment variable. Should be
 	 * "xterm-256color".
@@ -111,9 +130,23 @@ public:
 	int child_pid() const { return m_child_pid; }
 
 	/**
-	 * Sends data to the client via STDIN.
+	 * Queues data that should be sent to the client via STDIN. The data is
+	 * written once flush() is called or the file descriptor becomes writable.
+	 * Never blocks and never drops data.
+	 */
+	void write(const uint8_t *buf, size_t buf_len);
+
+	/**
+	 * Writes as much of the queued data as the child currently accepts
+	 * without blocking.
+	 */
+	void flush();
+
+	/**
+	 * Returns the number of queued bytes that have not been written yet.
+	 * Callers should stop producing new data while this is large.
 	 */
-	void write(uint8_t *buf, size_t buf_len);
+	size_t backlog() const { return m_write_buf.size() - m_write_pos; }
 
 	/* Interface EventSource */
 
@@ -0,0 +1,254 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <inktty/term/recording.hpp>
+
+namespace inktty {
+
+/******************************************************************************
+ * Static helpers                                                             *
+ ******************************************************************************/
+
+/**
+ * Size of the record header: type, time and payload length.
+ */
+static constexpr size_t HEADER_SIZE = 1 + 8 + 4;
+
+/**
+ * Size of a single encoded key.
+ */
+static constexpr size_t KEY_SIZE = 6;
+
+static void put_le(uint8_t *tar, uint64_t v, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		tar[i] = uint8_t(v >> (8 * i));
+	}
+}
+
+static uint64_t get_le(const uint8_t *src, size_t n) {
+	uint64_t res = 0;
+	for (size_t i = 0; i < n; i++) {
+		res |= uint64_t(src[i]) << (8 * i);
+	}
+	return res;
+}
+
+/******************************************************************************
+ * Class Recorder                                                             *
+ ******************************************************************************/
+
+Recorder::Recorder(const char *filename)
+    : m_file(fopen(filename, "wb")), m_t0(-1) {
+	if (!m_file) {
+		throw std::system_error(errno, std::system_category(), filename);
+	}
+	fwrite(RecordingReader::MAGIC, 1, 8, m_file);
+}
+
+Recorder::~Recorder() { fclose(m_file); }
+
+void Recorder::write(RecordType type, int64_t t, const uint8_t *buf,
+                     size_t len) {
+	if (m_t0 < 0) {
+		m_t0 = t;
+	}
+	uint8_t hdr[HEADER_SIZE];
+	hdr[0] = uint8_t(type);
+	put_le(hdr + 1, uint64_t(t - m_t0), 8);
+	put_le(hdr + 9, len, 4);
+	fwrite(hdr, 1, HEADER_SIZE, m_file);
+	fwrite(buf, 1, len, m_file);
+}
+
+void Recorder::record(int64_t t, const Event &event) {
+	switch (event.type) {
+		case Event::Type::CHILD_OUTPUT:
+			write(RecordType::Output, t, event.data.child.buf,
+			      event.data.child.buf_len);
+			break;
+		case Event::Type::TEXT_INPUT:
+			write(RecordType::Text, t, event.data.text.buf,
+			      event.data.text.buf_len);
+			break;
+		case Event::Type::KEY_INPUT:
+		case Event::Type::KEY_BATCH: {
+			const bool batch = event.type == Event::Type::KEY_BATCH;
+			const Event::Keyboard *keys =
+			    batch ? event.data.keys.keys : &event.data.keybd;
+			const size_t n_keys = batch ? event.data.keys.n_keys : 1;
+			m_buf.resize(n_keys * KEY_SIZE);
+			for (size_t i = 0; i < n_keys; i++) {
+				const Event::Keyboard &k = keys[i];
+				uint8_t *tar = &m_buf[i * KEY_SIZE];
+				put_le(tar, k.unichar, 4);
+				tar[4] = uint8_t(k.key);
+				tar[5] = (k.shift ? 1 : 0) | (k.ctrl ? 2 : 0) | (k.alt ? 4 : 0);
+			}
+			write(RecordType::Keys, t, m_buf.data(), m_buf.size());
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+/******************************************************************************
+ * Class RecordingReader                                                      *
+ ******************************************************************************/
+
+constexpr char RecordingReader::MAGIC[9];
+
+RecordingReader::RecordingReader(std::istream &is) : m_is(is) {
+	char magic[8];
+	if (!m_is.read(magic, 8) || memcmp(magic, MAGIC, 8) != 0) {
+		throw std::runtime_error("Not an inktty session log");
+	}
+}
+
+bool RecordingReader::is_recording(const std::string &data) {
+	return data.compare(0, 8, MAGIC) == 0;
+}
+
+bool RecordingReader::next(Record &record) {
+	uint8_t hdr[HEADER_SIZE];
+	if (!m_is.read((char *)hdr, HEADER_SIZE)) {
+		return false;
+	}
+	record.type = RecordType(hdr[0]);
+	record.time = int64_t(get_le(hdr + 1, 8));
+	record.data.resize(get_le(hdr + 9, 4));
+	return bool(m_is.read((char *)record.data.data(), record.data.size()));
+}
+
+/******************************************************************************
+ * Class Replay                                                               *
+ ******************************************************************************/
+
+static std::istream &open(std::ifstream &is, const char *filename) {
+	is.open(filename, std::ios::binary);
+	if (!is) {
+		throw std::system_error(errno, std::system_category(), filename);
+	}
+	return is;
+}
+
+static int64_t monotonic_time() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return int64_t(ts.tv_sec) * 1000 * 1000 + int64_t(ts.tv_nsec) / 1000;
+}
+
+Replay::Replay(const char *filename, bool realtime)
+    : m_reader(open(m_is, filename)),
+      m_realtime(realtime),
+      m_done(false),
+      m_timer_fd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)),
+      m_t_start(monotonic_time()) {
+	if (m_timer_fd < 0) {
+		throw std::system_error(errno, std::system_category());
+	}
+	advance();
+}
+
+Replay::~Replay() { close(m_timer_fd); }
+
+void Replay::advance() {
+	if (!m_reader.next(m_record)) {
+		m_done = true;
+		return;
+	}
+
+	// Fire immediately unless the record is to be replayed at its time
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	int flags = 0;
+	if (m_realtime) {
+		const int64_t t = m_t_start + m_record.time;
+		its.it_value.tv_sec = t / (1000 * 1000);
+		its.it_value.tv_nsec = (t % (1000 * 1000)) * 1000 + 1;
+		flags = TFD_TIMER_ABSTIME;
+	} else {
+		its.it_value.tv_nsec = 1;
+	}
+	timerfd_settime(m_timer_fd, flags, &its, nullptr);
+}
+
+int Replay::event_fd() const { return m_timer_fd; }
+
+EventSource::PollMode Replay::event_fd_poll_mode() const {
+	return m_done ? PollNone : PollIn;
+}
+
+bool Replay::event_get(EventSource::PollMode, Event &event) {
+	uint64_t expirations;
+	if (m_done || read(m_timer_fd, &expirations, sizeof(expirations)) < 0) {
+		return false;
+	}
+
+	// Keep the payload alive while reading ahead to the next record
+	m_data.swap(m_record.data);
+	const std::vector<uint8_t> &data = m_data;
+	switch (m_record.type) {
+		case RecordType::Output:
+			event.type = Event::Type::CHILD_OUTPUT;
+			event.data.child.buf = data.data();
+			event.data.child.buf_len = data.size();
+			break;
+		case RecordType::Text:
+			event.type = Event::Type::TEXT_INPUT;
+			event.data.text.buf_len = std::min(data.size(), Event::BUF_SIZE);
+			memcpy(event.data.text.buf, data.data(), event.data.text.buf_len);
+			event.data.text.shift = false;
+			event.data.text.ctrl = false;
+			event.data.text.alt = false;
+			break;
+		case RecordType::Keys:
+			event.type = Event::Type::KEY_BATCH;
+			m_keys.resize(data.size() / KEY_SIZE);
+			for (size_t i = 0; i < m_keys.size(); i++) {
+				const uint8_t *src = &data[i * KEY_SIZE];
+				Event::Keyboard &k = m_keys[i];
+				k.unichar = uint32_t(get_le(src, 4));
+				k.key = Event::Key(src[4]);
+				k.shift = src[5] & 1;
+				k.ctrl = src[5] & 2;
+				k.alt = src[5] & 4;
+			}
+			event.data.keys.keys = m_keys.data();
+			event.data.keys.n_keys = m_keys.size();
+			break;
+		default:
+			event.type = Event::Type::NONE;
+			break;
+	}
+
+	advance();
+	return event.type != Event::Type::NONE;
+}
+
+}  // namespace inktty
@@ -0,0 +1,201 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file recording.hpp
+ *
+ * Records the output of the child process and the user input of a session to
+ * a compact binary log and replays such logs.
+ *
+ * The log starts with the eight byte magic "INKTTYR1", followed by a sequence
+ * of records. Each record consists of a one byte record type, the time in
+ * microseconds since the first record (64 bit), the payload length (32 bit)
+ * and the payload. All integers are little endian. Output records contain the
+ * bytes read from the PTY, text records the UTF-8 encoded text input, and key
+ * records a sequence of keys encoded as six bytes each: the codepoint
+ * (32 bit), the key code and the modifier bits (shift = 1, ctrl = 2,
+ * alt = 4).
+ *
+ * @author Andreas Stöckel
+ */
+
+#ifndef INKTTY_TERM_RECORDING_HPP
+#define INKTTY_TERM_RECORDING_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include <inktty/term/events.hpp>
+
+namespace inktty {
+
+/**
+ * Record types in a session log.
+ */
+enum class RecordType : uint8_t { Output = 1, Keys = 2, Text = 3 };
+
+/**
+ * The Recorder class writes the events of a session to a log file.
+ */
+class Recorder {
+private:
+	FILE *m_file;
+
+	/**
+	 * Time of the first record, or a negative value if nothing has been
+	 * recorded yet.
+	 */
+	int64_t m_t0;
+
+	/**
+	 * Scratch buffer used to encode keys.
+	 */
+	std::vector<uint8_t> m_buf;
+
+	void write(RecordType type, int64_t t, const uint8_t *buf, size_t len);
+
+public:
+	/**
+	 * Creates the given log file. Throws a std::system_error if the file
+	 * cannot be created.
+	 */
+	explicit Recorder(const char *filename);
+
+	/**
+	 * Flushes and closes the log file.
+	 */
+	~Recorder();
+
+	/**
+	 * Appends the given event to the log. Only child output and keyboard
+	 * input are recorded, all other events are ignored.
+	 *
+	 * @param t is the time at which the event was handled in microseconds.
+	 */
+	void record(int64_t t, const Event &event);
+};
+
+/**
+ * The RecordingReader class reads the records of a session log.
+ */
+class RecordingReader {
+public:
+	struct Record {
+		RecordType type;
+
+		/**
+		 * Time in microseconds since the first record.
+		 */
+		int64_t time;
+
+		std::vector<uint8_t> data;
+	};
+
+private:
+	std::istream &m_is;
+
+public:
+	/**
+	 * Magic at the beginning of each session log.
+	 */
+	static constexpr char MAGIC[9] = "INKTTYR1";
+
+	/**
+	 * Reads the magic from the given stream. Throws a std::runtime_error if
+	 * the stream does not contain a session log.
+	 */
+	explicit RecordingReader(std::istream &is);
+
+	/**
+	 * Returns true if the given data starts with the magic of a session log.
+	 */
+	static bool is_recording(const std::string &data);
+
+	/**
+	 * Reads the next record. Returns false at the end of the log; truncated
+	 * records at the end are ignored.
+	 */
+	bool next(Record &record);
+};
+
+/**
+ * The Replay class is an event source that emits the events stored in a
+ * session log, either at the recorded times or as fast as the consumer
+ * handles them.
+ */
+class Replay : public EventSource {
+private:
+	std::ifstream m_is;
+	RecordingReader m_reader;
+	RecordingReader::Record m_record;
+
+	/**
+	 * Payload and keys of the last emitted event. The event points into
+	 * these buffers until the next call to event_get().
+	 */
+	std::vector<uint8_t> m_data;
+	std::vector<Event::Keyboard> m_keys;
+	bool m_realtime;
+	bool m_done;
+
+	/**
+	 * Timer signalling that the next record is due.
+	 */
+	int m_timer_fd;
+
+	/**
+	 * Monotonic time in microseconds at which the replay started.
+	 */
+	int64_t m_t_start;
+
+	/**
+	 * Reads the next record and arms the timer for it.
+	 */
+	void advance();
+
+public:
+	/**
+	 * Opens the given session log. Throws a std::system_error if the file
+	 * cannot be opened and a std::runtime_error if it is not a session log.
+	 *
+	 * @param realtime if true, the events are emitted at the recorded times,
+	 * otherwise as fast as possible.
+	 */
+	Replay(const char *filename, bool realtime = true);
+
+	~Replay() override;
+
+	/**
+	 * Returns true once all records have been emitted.
+	 */
+	bool done() const { return m_done; }
+
+	/* Interface EventSource */
+
+	int event_fd() const override;
+	EventSource::PollMode event_fd_poll_mode() const override;
+	bool event_get(EventSource::PollMode mode, Event &event) override;
+};
+
+}  // namespace inktty
+
+#endif /* INKTTY_TERM_RECORDING_HPP */
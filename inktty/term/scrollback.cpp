@@ -0,0 +1,271 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include <inktty/term/scrollback.hpp>
+#include <inktty/utils/utf8.hpp>
+
+namespace inktty {
+
+/******************************************************************************
+ * Static helpers                                                             *
+ ******************************************************************************/
+
+/*
+ * Each row is serialised as the number of stored cells (shifted left by one,
+ * the lowest bit is the "wrapped" flag) followed by the style runs. Each run
+ * consists of its length, the style, and the UTF-8 encoded glyphs of the cells
+ * in the run. Lengths are stored as variable-length integers with seven bits
+ * per byte.
+ */
+
+static void write_varint(std::vector<uint8_t> &buf, size_t v) {
+	while (v >= 0x80) {
+		buf.push_back(uint8_t(v) | 0x80);
+		v >>= 7;
+	}
+	buf.push_back(uint8_t(v));
+}
+
+static size_t read_varint(const uint8_t *&p) {
+	size_t res = 0;
+	for (unsigned int shift = 0;; shift += 7) {
+		const uint8_t b = *(p++);
+		res |= size_t(b & 0x7F) << shift;
+		if (!(b & 0x80)) {
+			return res;
+		}
+	}
+}
+
+static void write_glyph(std::vector<uint8_t> &buf, uint32_t glyph) {
+	if (glyph < 0x80) {
+		buf.push_back(glyph);
+	} else {
+		char s[4];
+		const int len = UTF8Encoder::unicode_to_utf8(glyph, s);
+		buf.insert(buf.end(), s, s + len);
+	}
+}
+
+static uint32_t read_glyph(const uint8_t *&p) {
+	const uint8_t b = *(p++);
+	if (b < 0x80) {
+		return b;
+	}
+	const int n = (b >= 0xF0) ? 3 : ((b >= 0xE0) ? 2 : 1);
+	uint32_t res = b & (0x3F >> n);
+	for (int i = 0; i < n; i++) {
+		res = (res << 6) | (*(p++) & 0x3F);
+	}
+	return res;
+}
+
+static bool is_empty(const Matrix::Cell &c) {
+	return c.glyph == 0 && c.style == Style{};
+}
+
+/******************************************************************************
+ * Class Scrollback                                                           *
+ ******************************************************************************/
+
+constexpr size_t Scrollback::CHUNK_SIZE;
+
+Scrollback::Scrollback(size_t max_bytes)
+    : m_max_bytes(max_bytes),
+      m_bytes(0),
+      m_account(memory::Pool::Scrollback),
+      m_first(0),
+      m_size(0),
+      m_wrap_width(0),
+      m_wrap_consumed(0) {}
+
+size_t Scrollback::chunk_bytes(const Chunk &chunk) {
+	return chunk.data.capacity() + chunk.rows.capacity() * sizeof(uint32_t);
+}
+
+void Scrollback::push(const Matrix::Cell *cells, size_t n) {
+	if (m_max_bytes == 0) {
+		return;
+	}
+
+	// Drop trailing empty cells, unless the row continues in the next row
+	const bool wrapped = n > 0 && cells[n - 1].wrapped;
+	while (!wrapped && n > 0 && is_empty(cells[n - 1])) {
+		n--;
+	}
+
+	// Serialise the row
+	m_buf.clear();
+	write_varint(m_buf, (n << 1) | (wrapped ? 1 : 0));
+	for (size_t i = 0; i < n;) {
+		size_t j = i + 1;
+		while (j < n && cells[j].style == cells[i].style) {
+			j++;
+		}
+		write_varint(m_buf, j - i);
+		const uint8_t *style = (const uint8_t *)&cells[i].style;
+		m_buf.insert(m_buf.end(), style, style + sizeof(Style));
+		for (; i < j; i++) {
+			write_glyph(m_buf, cells[i].glyph);
+		}
+	}
+
+	// Start a new chunk if the row does not fit into the current chunk
+	if (m_chunks.empty() ||
+	    m_chunks.back().data.size() + m_buf.size() > CHUNK_SIZE) {
+		m_chunks.emplace_back();
+		m_chunks.back().first = m_first + m_size;
+		m_chunks.back().data.reserve(std::max(CHUNK_SIZE, m_buf.size()));
+		m_bytes += chunk_bytes(m_chunks.back());
+
+		// Discard the oldest chunks if the memory limit is exceeded
+		while (m_bytes > m_max_bytes && m_chunks.size() > 1) {
+			const size_t n_rows = m_chunks.front().rows.size();
+			m_bytes -= chunk_bytes(m_chunks.front());
+			m_first += n_rows;
+			m_size -= n_rows;
+			m_chunks.pop_front();
+		}
+	}
+
+	// Append the row to the current chunk
+	Chunk &chunk = m_chunks.back();
+	m_bytes -= chunk_bytes(chunk);
+	chunk.rows.push_back(chunk.data.size());
+	chunk.data.insert(chunk.data.end(), m_buf.begin(), m_buf.end());
+	m_bytes += chunk_bytes(chunk);
+	m_account.set(m_bytes);
+	m_size++;
+
+	// The re-wrapped rows are counted from the most recent row and must be
+	// recomputed
+	m_wrapped.clear();
+	m_wrap_consumed = 0;
+}
+
+const uint8_t *Scrollback::row_data(size_t row) const {
+	// Find the chunk containing the row
+	auto it = std::upper_bound(
+	    m_chunks.begin(), m_chunks.end(), row,
+	    [](size_t row, const Chunk &chunk) { return row < chunk.first; });
+	const Chunk &chunk = *(--it);
+	return chunk.data.data() + chunk.rows[row - chunk.first];
+}
+
+void Scrollback::wrap(size_t width, size_t n) {
+	if (width != m_wrap_width) {
+		m_wrapped.clear();
+		m_wrap_width = width;
+		m_wrap_consumed = 0;
+	}
+	if (width == 0) {
+		return;
+	}
+
+	while (m_wrapped.size() < n && m_wrap_consumed < m_size) {
+		// The most recent row not consumed yet is the end of a logical line;
+		// collect the rows wrapping into it and sum up their length
+		const size_t last = m_first + m_size - 1 - m_wrap_consumed;
+		size_t first = last;
+		const uint8_t *p = row_data(last);
+		size_t len = read_varint(p) >> 1;
+		while (first > m_first) {
+			p = row_data(first - 1);
+			const size_t header = read_varint(p);
+			if (!(header & 1)) {
+				break;
+			}
+			len += header >> 1;
+			first--;
+		}
+		m_wrap_consumed += last - first + 1;
+
+		// Append the rows of the logical line, most recent row first
+		const size_t n_rows = std::max<size_t>(1, (len + width - 1) / width);
+		for (size_t i = n_rows; i-- > 0;) {
+			m_wrapped.emplace_back(WrappedRow{first, i * width});
+		}
+	}
+}
+
+size_t Scrollback::rows(size_t width, size_t max_rows) {
+	wrap(width, max_rows);
+	return std::min(max_rows, m_wrapped.size());
+}
+
+void Scrollback::get(size_t idx, Matrix::Cell *cells, size_t n) {
+	wrap(n, idx + 1);
+	if (idx >= m_wrapped.size()) {
+		return;
+	}
+
+	// Copy n cells of the logical line, starting at the offset of the
+	// re-wrapped row
+	const WrappedRow &w = m_wrapped[idx];
+	size_t skip = w.offset, i = 0;
+	for (size_t row = w.row; i < n && row < m_first + m_size; row++) {
+		const uint8_t *p = row_data(row);
+		const size_t header = read_varint(p);
+		const size_t n_stored = header >> 1;
+		if (skip >= n_stored) {
+			skip -= n_stored;
+		} else {
+			// Deserialise the runs
+			for (size_t j = 0; j < n_stored;) {
+				const size_t len = read_varint(p);
+				Style style;
+				memcpy(&style, p, sizeof(Style));
+				p += sizeof(Style);
+				for (size_t k = 0; k < len; k++, j++) {
+					const uint32_t glyph = read_glyph(p);
+					if (skip > 0) {
+						skip--;
+					} else if (i < n) {
+						cells[i] = Matrix::Cell();
+						cells[i].glyph = glyph;
+						cells[i].style = style;
+						i++;
+					}
+				}
+			}
+		}
+		if (!(header & 1)) {
+			break;
+		}
+	}
+
+	// Reset the remaining cells
+	for (; i < n; i++) {
+		cells[i] = Matrix::Cell();
+	}
+}
+
+void Scrollback::clear() {
+	m_chunks.clear();
+	m_bytes = 0;
+	m_account.set(0);
+	m_first += m_size;
+	m_size = 0;
+	m_wrapped.clear();
+	m_wrap_consumed = 0;
+}
+
+}  // namespace inktty
@@ -0,0 +1,195 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file scrollback.hpp
+ *
+ * Contains the Scrollback class, which stores the rows that scrolled off the
+ * top of the terminal matrix.
+ *
+ * @author Andreas Stöckel
+ */
+
+#ifndef INKTTY_TERM_SCROLLBACK_HPP
+#define INKTTY_TERM_SCROLLBACK_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include <inktty/term/matrix.hpp>
+#include <inktty/utils/memory.hpp>
+
+namespace inktty {
+/**
+ * The Scrollback class is a memory-bounded, append-only store for rows that
+ * scrolled off the screen. Rows are serialised into a compact representation:
+ * glyphs are stored as UTF-8, styles as runs of cells sharing the same style,
+ * and trailing empty cells are dropped. Serialised rows are appended to
+ * fixed-size chunks; once the memory limit is exceeded, the oldest chunk is
+ * discarded as a whole.
+ *
+ * Rows that were soft-wrapped (i.e. the last cell has the "wrapped" flag set)
+ * form a logical line together with the following rows. Rows are retrieved
+ * re-wrapped to the width requested by the caller. Re-wrapping is lazy: the
+ * mapping between the requested rows and the stored rows is only computed
+ * for the most recent rows that are actually accessed.
+ */
+class Scrollback {
+public:
+	/**
+	 * Size of a single storage chunk in bytes.
+	 */
+	static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+private:
+	struct Chunk {
+		/**
+		 * Index of the first row in this chunk.
+		 */
+		size_t first;
+
+		/**
+		 * Serialised rows.
+		 */
+		std::vector<uint8_t> data;
+
+		/**
+		 * Offset of each row in the data buffer.
+		 */
+		std::vector<uint32_t> rows;
+	};
+
+	/**
+	 * Chunks holding the rows, the oldest chunk is at the front.
+	 */
+	std::deque<Chunk> m_chunks;
+
+	/**
+	 * Maximum number of bytes allocated for all chunks.
+	 */
+	size_t m_max_bytes;
+
+	/**
+	 * Number of bytes currently allocated for all chunks.
+	 */
+	size_t m_bytes;
+	memory::Account m_account;
+
+	/**
+	 * Index of the oldest row that is still stored. Rows are indexed in the
+	 * order in which they were pushed.
+	 */
+	size_t m_first;
+
+	/**
+	 * Number of rows currently stored in all chunks.
+	 */
+	size_t m_size;
+
+	/**
+	 * Start of a row re-wrapped to m_wrap_width, given as the index of the
+	 * first stored row of the logical line and a cell offset into the line.
+	 */
+	struct WrappedRow {
+		size_t row;
+		size_t offset;
+	};
+
+	/**
+	 * Re-wrapped rows in reverse order, i.e. the most recent row first. Only
+	 * covers the logical lines formed by the m_wrap_consumed most recent
+	 * stored rows.
+	 */
+	std::vector<WrappedRow> m_wrapped;
+	size_t m_wrap_width;
+	size_t m_wrap_consumed;
+
+	/**
+	 * Serialisation buffer, kept to avoid reallocation.
+	 */
+	std::vector<uint8_t> m_buf;
+
+	static size_t chunk_bytes(const Chunk &chunk);
+
+	/**
+	 * Returns a pointer at the serialised row with the given index.
+	 */
+	const uint8_t *row_data(size_t row) const;
+
+	/**
+	 * Re-wraps the logical lines until at least n rows of the given width
+	 * are available or all stored rows have been consumed.
+	 */
+	void wrap(size_t width, size_t n);
+
+public:
+	/**
+	 * Creates a new, empty Scrollback instance.
+	 *
+	 * @param max_bytes is the upper bound for the memory used to store rows.
+	 * At least one chunk is always retained, i.e. the most recent rows are
+	 * stored even if max_bytes is smaller than CHUNK_SIZE. If zero, no rows
+	 * are stored at all.
+	 */
+	Scrollback(size_t max_bytes = 4 * 1024 * 1024);
+
+	/**
+	 * Returns the number of rows that are currently stored, independent of
+	 * the width they are retrieved with.
+	 */
+	size_t size() const { return m_size; }
+
+	bool empty() const { return m_size == 0; }
+
+	/**
+	 * Returns the number of bytes currently allocated for storing the rows.
+	 */
+	size_t bytes() const { return m_bytes; }
+
+	/**
+	 * Appends a row consisting of n cells. The row is soft-wrapped if the
+	 * "wrapped" flag of the last cell is set. Discards the oldest rows if the
+	 * memory limit is exceeded.
+	 */
+	void push(const Matrix::Cell *cells, size_t n);
+
+	/**
+	 * Returns the number of rows when re-wrapping the stored rows to the
+	 * given width, but at most max_rows. Only re-wraps as many logical lines
+	 * as necessary to reach max_rows.
+	 */
+	size_t rows(size_t width, size_t max_rows);
+
+	/**
+	 * Restores the row with the given index into the cell array "cells",
+	 * re-wrapping the stored rows to a width of n cells. An index of zero
+	 * refers to the most recent row. Cells not covered by the stored content
+	 * are reset to empty cells. Does nothing if the index is out of range.
+	 */
+	void get(size_t idx, Matrix::Cell *cells, size_t n);
+
+	/**
+	 * Discards all stored rows.
+	 */
+	void clear();
+};
+}  // namespace inktty
+
+#endif /* INKTTY_TERM_SCROLLBACK_HPP */
@@ -19,9 +19,17 @@
 #include <utf8proc/utf8proc.h>
 #include <vterm.h>
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <vector>
 
 #include <inktty/term/vterm.hpp>
+#include <inktty/utils/memory.hpp>
+#include <inktty/utils/profile.hpp>
+#include <inktty/utils/utf8.hpp>
 
 namespace inktty {
 /******************************************************************************
@@ -35,28 +43,138 @@ private:
 	::VTerm *m_vt;
 	::VTermState *m_vt_state;
 
+	/**
+	 * Output for the PTY that bypassed libvterm, e.g. text passed to
+	 * send_text(). Preceded by all output libvterm produced before the text
+	 * was added, such that the order of the output is preserved.
+	 */
+	std::vector<uint8_t> m_output;
+	size_t m_output_pos = 0;
+
+	/**
+	 * Moves the output currently buffered by libvterm to m_output.
+	 */
+	void drain_vterm_output() {
+		char buf[256];
+		size_t n;
+		while ((n = vterm_output_read(m_vt, buf, sizeof(buf)))) {
+			m_output.insert(m_output.end(), buf, buf + n);
+		}
+	}
+
+	/**
+	 * Glyphs written by libvterm that have not been passed to the matrix yet.
+	 * Consecutive glyphs in the same row with the same style are collected
+	 * and written using Matrix::set_run().
+	 */
+	std::vector<uint32_t> m_run;
+	Style m_run_style;
+	Point m_run_pos;
+
+	/**
+	 * Set if the last glyph was written to the last column of the row with
+	 * the given (zero-based) index. If the next glyph is written to the first
+	 * column of the next row, the text was soft-wrapped.
+	 */
+	bool m_wrap_pending;
+	int m_wrap_row;
+
+	/**
+	 * Memory allocated by libvterm.
+	 */
+	memory::Account m_account;
+
+	/**
+	 * Allocator passed to libvterm, such that the memory of the terminal state
+	 * is accounted for. Each allocation is preceded by a header holding its
+	 * size. Like the default allocator of libvterm, the memory is zeroed.
+	 */
+	union AllocHeader {
+		size_t size;
+		std::max_align_t align;
+	};
+
+	static void *vterm_alloc(size_t size, void *allocdata) {
+		AllocHeader *h =
+		    static_cast<AllocHeader *>(calloc(1, sizeof(AllocHeader) + size));
+		if (!h) {
+			return nullptr;
+		}
+		h->size = sizeof(AllocHeader) + size;
+		static_cast<memory::Account *>(allocdata)->add(h->size);
+		return h + 1;
+	}
+
+	static void vterm_dealloc(void *ptr, void *allocdata) {
+		if (!ptr) {
+			return;
+		}
+		AllocHeader *h = static_cast<AllocHeader *>(ptr) - 1;
+		static_cast<memory::Account *>(allocdata)->sub(h->size);
+		free(h);
+	}
+
+	static VTermAllocatorFunctions allocator;
+
+	/**
+	 * Writes the collected glyphs to the matrix. Must be called before any
+	 * other operation on the matrix.
+	 */
+	void flush_run() {
+		if (!m_run.empty()) {
+			m_matrix.set_run(m_run.data(), m_run.size(), m_run_style,
+			                 m_run_pos);
+			m_run.clear();
+		}
+	}
+
 	/**
 	 * Writes a single glyph to the character matrix.
 	 */
 	static int vterm_putglyph(VTermGlyphInfo *info, VTermPos pos, void *user) {
 		Impl &self = *static_cast<Impl *>(user);
 
-		// Count the number of characters in the buffer
-		ssize_t len;
-		for (len = 0; info->chars[len]; len++)
-			;
-
-		// Try to combine multiple glyphs into a single one
-		uint32_t glyph = 0;
-		if (utf8proc_normalize_utf32(
-		        (utf8proc_int32_t *)info->chars, len,
-		        static_cast<utf8proc_option_t>(UTF8PROC_STRIPCC |
-		                                       UTF8PROC_COMPOSE)) > 0) {
-			glyph = info->chars[0];
+		// Single printable ASCII or Latin-1 characters are neither control
+		// characters nor do they compose with anything; skip normalisation
+		uint32_t glyph = info->chars[0];
+		const bool simple = (glyph >= 0x20 && glyph < 0x7F) ||
+		                    (glyph >= 0xA0 && glyph < 0x100);
+		if (!simple || info->chars[1]) {
+			// Count the number of characters in the buffer
+			ssize_t len;
+			for (len = 0; info->chars[len]; len++)
+				;
+
+			// Try to combine multiple glyphs into a single one
+			glyph = 0;
+			if (utf8proc_normalize_utf32(
+			        (utf8proc_int32_t *)info->chars, len,
+			        static_cast<utf8proc_option_t>(UTF8PROC_STRIPCC |
+			                                       UTF8PROC_COMPOSE)) > 0) {
+				glyph = info->chars[0];
+			}
 		}
 
-		// Set the glyph in the matrix
-		self.m_matrix.set(glyph, self.m_style, Point{pos.col + 1, pos.row + 1});
+		// Detect soft-wrapped rows
+		if (self.m_wrap_pending && pos.col == 0 &&
+		    pos.row == self.m_wrap_row + 1) {
+			self.m_matrix.set_wrapped(pos.row, true);
+		}
+		self.m_wrap_pending =
+		    (pos.col + std::max(1, info->width) >= self.m_matrix.size().x);
+		self.m_wrap_row = pos.row;
+
+		// Append the glyph to the current run if it directly follows the
+		// last glyph, otherwise start a new run
+		const Point p{pos.col + 1, pos.row + 1};
+		if (self.m_run.empty() || p.y != self.m_run_pos.y ||
+		    p.x != self.m_run_pos.x + int(self.m_run.size()) ||
+		    self.m_style != self.m_run_style) {
+			self.flush_run();
+			self.m_run_pos = p;
+			self.m_run_style = self.m_style;
+		}
+		self.m_run.push_back(glyph);
 		return 1;
 	}
 
@@ -66,6 +184,13 @@ private:
 	static int vterm_movecursor(VTermPos pos, VTermPos oldpos, int visible,
 	                            void *user) {
 		Impl &self = *static_cast<Impl *>(user);
+
+		// Moving the cursor anywhere but to the position after the last glyph
+		// written to a row prevents soft-wrapping
+		if (pos.row != self.m_wrap_row ||
+		    pos.col < self.m_matrix.size().x - 1) {
+			self.m_wrap_pending = false;
+		}
 		self.m_matrix.move_abs(pos.row + 1, pos.col + 1);
 		self.m_matrix.cursor_visible(visible);
 		return 1;
@@ -77,6 +202,11 @@ private:
 	static int vterm_scrollrect(VTermRect rect, int downward, int rightward,
 	                            void *user) {
 		Impl &self = *static_cast<Impl *>(user);
+		self.flush_run();
+		const int row = self.m_wrap_row;
+		if (rect.start_row <= row && rect.end_row > row) {
+			self.m_wrap_row -= downward;
+		}
 		self.m_matrix.scroll(0, self.m_style,
 		                     {rect.start_col + 1, rect.start_row + 1,
 		                      rect.end_col, rect.end_row},
@@ -86,13 +216,21 @@ private:
 
 	static int vterm_moverect(VTermRect dest, VTermRect src, void *user) {
 		Impl &self = *static_cast<Impl *>(user);
-		(void)self;  // TODO
-		             //		std::cout << "vterm_moverect" << std::endl;
+		self.flush_run();
+		self.m_wrap_pending = false;
+		self.m_matrix.move({std::min(src.start_col, dest.start_col) + 1,
+		                    std::min(src.start_row, dest.start_row) + 1,
+		                    std::max(src.end_col, dest.end_col),
+		                    std::max(src.end_row, dest.end_row)},
+		                   src.start_row - dest.start_row,
+		                   src.start_col - dest.start_col);
 		return 1;
 	}
 
 	static int vterm_erase(VTermRect rect, int selective, void *user) {
 		Impl &self = *static_cast<Impl *>(user);
+		self.flush_run();
+		self.m_wrap_pending = false;
 		self.m_matrix.fill(0, self.m_style,
 		                   {rect.start_col + 1, rect.start_row + 1},
 		                   {rect.end_col, rect.end_row});
@@ -118,35 +256,35 @@ private:
 		Impl &self = *static_cast<Impl *>(user);
 		switch (attr) {
 			case VTERM_ATTR_BOLD:
-				self.m_style.bold = val->boolean;
+				self.m_style.bold(val->boolean);
 				break;
 			case VTERM_ATTR_UNDERLINE:
-				self.m_style.underline = val->number;
+				self.m_style.underline(val->number);
 				break;
 			case VTERM_ATTR_ITALIC:
-				self.m_style.italic = val->boolean;
+				self.m_style.italic(val->boolean);
 				break;
 			case VTERM_ATTR_BLINK:
 				/* Not supported. */
 				break;
 			case VTERM_ATTR_REVERSE:
-				self.m_style.inverse = val->boolean;
+				self.m_style.inverse(val->boolean);
 				break;
 			case VTERM_ATTR_STRIKE:
-				self.m_style.strikethrough = val->boolean;
+				self.m_style.strikethrough(val->boolean);
 				break;
 			case VTERM_ATTR_FONT:
 				/* Not supported. */
 				break;
 			case VTERM_ATTR_FOREGROUND:
 				self.m_style.fg = vterm_convert_color(val->color);
-				self.m_style.default_fg =
-				    VTERM_COLOR_IS_DEFAULT_FG(&val->color);
+				self.m_style.default_fg(
+				    VTERM_COLOR_IS_DEFAULT_FG(&val->color));
 				break;
 			case VTERM_ATTR_BACKGROUND:
 				self.m_style.bg = vterm_convert_color(val->color);
-				self.m_style.default_bg =
-				    VTERM_COLOR_IS_DEFAULT_BG(&val->color);
+				self.m_style.default_bg(
+				    VTERM_COLOR_IS_DEFAULT_BG(&val->color));
 				break;
 			default:
 				break; /* Ignore everything else */
@@ -163,6 +301,7 @@ private:
 				/* Not supported */
 				break;
 			case VTERM_PROP_ALTSCREEN:
+				self.flush_run();
 				self.m_matrix.set_alternative_buffer_active(val->boolean);
 				break;
 			case VTERM_PROP_TITLE:
@@ -194,9 +333,13 @@ private:
 	}
 
 	static int vterm_resize(int rows, int cols, VTermPos *delta, void *user) {
+		// The matrix has already been resized and moved the cursor along with
+		// the re-wrapped content; tell libvterm about the new location
 		Impl &self = *static_cast<Impl *>(user);
-		(void)self;  // TODO
-		             //		std::cout << "vterm_resize" << std::endl;
+		VTermPos pos;
+		vterm_state_get_cursorpos(self.m_vt_state, &pos);
+		delta->row = self.m_matrix.row() - 1 - pos.row;
+		delta->col = self.m_matrix.col() - 1 - pos.col;
 		return 1;
 	}
 
@@ -351,8 +494,13 @@ private:
 	static const VTermParserCallbacks unrecognised_fallbacks;
 
 public:
-	Impl(Matrix &matrix) : m_matrix(matrix) {
-		m_vt = vterm_new(matrix.size().y, matrix.size().x);
+	Impl(Matrix &matrix)
+	    : m_matrix(matrix),
+	      m_wrap_pending(false),
+	      m_wrap_row(-1),
+	      m_account(memory::Pool::VTerm) {
+		m_vt = vterm_new_with_allocator(matrix.size().y, matrix.size().x,
+		                                &allocator, &m_account);
 		vterm_set_utf8(m_vt, true);
 
 		m_vt_state = vterm_obtain_state(m_vt);
@@ -375,6 +523,8 @@ public:
 		                               &vt_default_bg);
 
 		vterm_state_reset(m_vt_state, 1);
+		m_run.clear();
+		m_wrap_pending = false;
 		m_matrix.reset();
 		m_style = Style{};
 	}
@@ -388,15 +538,45 @@ public:
 		vterm_keyboard_unichar(m_vt, unichar, vterm_keymod(shift, ctrl, alt));
 	}
 
+	void send_text(const uint32_t *text, size_t text_len) {
+		/* Without modifiers libvterm sends characters as plain UTF-8; encode
+		   the entire run at once instead of passing each character to
+		   vterm_keyboard_unichar() */
+		drain_vterm_output();
+		UTF8Encoder::encode(text, text_len, m_output);
+	}
+
+	void resize(int rows, int cols) {
+		flush_run();
+		m_wrap_pending = false;
+		m_matrix.resize(rows, cols);
+		vterm_set_size(m_vt, rows, cols);
+	}
+
 	void receive_from_pty(const uint8_t *buf, size_t buf_len) {
+		INKTTY_PROFILE_SCOPE(VTermReceive);
 		vterm_input_write(m_vt, (const char *)buf, buf_len);
+		flush_run();
 	}
 
 	size_t send_to_pty(uint8_t *buf, size_t buf_len) {
+		if (m_output_pos < m_output.size()) {
+			const size_t n = std::min(buf_len, m_output.size() - m_output_pos);
+			memcpy(buf, m_output.data() + m_output_pos, n);
+			m_output_pos += n;
+			if (m_output_pos == m_output.size()) {
+				m_output.clear();
+				m_output_pos = 0;
+			}
+			return n;
+		}
 		return vterm_output_read(m_vt, (char *)buf, buf_len);
 	}
 };
 
+VTermAllocatorFunctions VTerm::Impl::allocator{VTerm::Impl::vterm_alloc,
+                                                VTerm::Impl::vterm_dealloc};
+
 const VTermStateCallbacks VTerm::Impl::callbacks{
     VTerm::Impl::vterm_putglyph,   VTerm::Impl::vterm_movecursor,
     VTerm::Impl::vterm_scrollrect, VTerm::Impl::vterm_moverect,
@@ -432,6 +612,12 @@ void VTerm::send_char(uint32_t unichar, bool shift, bool ctrl, bool alt) {
 	m_impl->send_char(unichar, shift, ctrl, alt);
 }
 
+void VTerm::send_text(const uint32_t *text, size_t text_len) {
+	m_impl->send_text(text, text_len);
+}
+
+void VTerm::resize(int rows, int cols) { m_impl->resize(rows, cols); }
+
 void VTerm::receive_from_pty(const uint8_t *buf, size_t buf_len) {
 	m_impl->receive_from_pty(buf, buf_len);
 }
@@ -59,6 +59,19 @@ public:
 
 	void send_char(uint32_t unichar, bool shift, bool ctrl, bool alt);
 
+	/**
+	 * Sends a run of characters without modifiers, e.g. pasted text. This is
+	 * equivalent to calling send_char() for each character, but encodes the
+	 * entire run at once.
+	 */
+	void send_text(const uint32_t *text, size_t text_len);
+
+	/**
+	 * Resizes the matrix and the terminal state to the given size. The matrix
+	 * re-wraps its content, the cursor moves along with the content.
+	 */
+	void resize(int rows, int cols);
+
 	void receive_from_pty(const uint8_t *buf, size_t buf_len);
 
 	size_t send_to_pty(uint8_t *buf, size_t buf_len);
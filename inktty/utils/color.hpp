@@ -81,6 +81,31 @@ struct RGBA {
 		return RGBA(uint16_t(r) * a / 255, uint16_t(g) * a / 255,
 		            uint16_t(b) * a / 255, a);
 	}
+
+	/**
+	 * Returns the 8-bit luminance of the colour using the ITU-R BT.601
+	 * weights. The alpha channel is ignored.
+	 */
+	uint8_t luma() const {
+		return (uint16_t(r) * 77U + uint16_t(g) * 151U + uint16_t(b) * 28U) >> 8U;
+	}
+};
+
+/**
+ * Greyscale pixel with alpha channel. Used by displays operating in greyscale
+ * mode to store layers that require transparency. Like the RGBA layers, the
+ * value is premultiplied with the alpha channel.
+ */
+struct GreyA {
+	uint8_t v, a;
+
+	constexpr GreyA() : v(0U), a(0U) {}
+
+	constexpr GreyA(uint8_t v, uint8_t a = 0xFFU) : v(v), a(a) {}
+
+	bool operator==(const GreyA &o) const { return (v == o.v) && (a == o.a); }
+
+	bool operator!=(const GreyA &o) const { return !((*this) == o); }
 };
 
 /**
@@ -143,35 +168,37 @@ public:
 };
 
 /**
- * The color class represents either an indexed colour or an RGBA colour.
+ * The color class represents either an indexed colour or an RGB colour. The
+ * colour is packed into a single 32-bit integer, where the lower 24 bits hold
+ * either the palette index or the RGB value; bit 24 is set for indexed
+ * colours. RGB colours are always fully opaque.
  */
 class Color {
 private:
-	/**
-	 * Enum describing the two possible colour modes: indexed colours or RGBA
-	 * colours.
-	 */
-	enum class Mode { Indexed, RGB };
+	static constexpr uint32_t FLAG_INDEXED = 0x01000000U;
 
 	/**
-	 * Mode of this colour descriptor, either Indexed or RGBA.
+	 * Packed colour value.
 	 */
-	Mode m_mode;
-
-	int m_idx;
-
-	RGBA m_rgb;
+	uint32_t m_value;
 
 public:
-	Color(int idx) : m_mode(Mode::Indexed), m_idx(idx) {}
+	Color(int idx) : m_value(FLAG_INDEXED | (uint32_t(idx) & 0xFFU)) {}
 
-	Color(const RGBA &rgba) : m_mode(Mode::RGB), m_rgb(rgba) {}
+	Color(const RGBA &rgba)
+	    : m_value((uint32_t(rgba.r) << 16U) | (uint32_t(rgba.g) << 8U) |
+	              uint32_t(rgba.b)) {}
 
-	int idx() const { return is_indexed() ? m_idx : -1; }
+	int idx() const { return is_indexed() ? int(m_value & 0xFFU) : -1; }
 
-	bool is_indexed() const { return m_mode == Mode::Indexed; }
+	bool is_indexed() const { return m_value & FLAG_INDEXED; }
 
-	bool is_rgb() const { return m_mode == Mode::RGB; }
+	bool is_rgb() const { return !is_indexed(); }
+
+	/**
+	 * Returns the packed representation of this colour.
+	 */
+	uint32_t value() const { return m_value; }
 
 	/**
 	 * Returns the RGBA colour represented by this Colour instance. If the
@@ -181,23 +208,16 @@ public:
 	 * @param p is the palette from which the colour should be looked up if in
 	 * indexed mode.
 	 */
-	const RGBA &rgb(const Palette &p) const {
-		switch (m_mode) {
-			case Mode::Indexed:
-				return p[m_idx];
-			case Mode::RGB:
-				return m_rgb;
+	RGBA rgb(const Palette &p) const {
+		if (is_indexed()) {
+			return p[m_value & 0xFFU];
 		}
-		__builtin_unreachable();
+		return RGBA(m_value);
 	}
 
-	bool operator==(const Color &o) const {
-		return (m_mode == o.m_mode) &&
-		       (((m_mode == Mode::Indexed) && (m_idx == o.m_idx)) ||
-		        ((m_mode == Mode::RGB) && (m_rgb == o.m_rgb)));
-	}
+	bool operator==(const Color &o) const { return m_value == o.m_value; }
 
-	bool operator!=(const Color &o) const { return !((*this) == o); }
+	bool operator!=(const Color &o) const { return m_value != o.m_value; }
 };
 
 /**
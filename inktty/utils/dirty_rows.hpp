@@ -0,0 +1,148 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file dirty_rows.hpp
+ *
+ * Contains the DirtyRows class, which tracks the changed cells of a grid as a
+ * column span per row.
+ *
+ * @author Andreas Stöckel
+ */
+
+#ifndef INKTTY_UTILS_DIRTY_ROWS_HPP
+#define INKTTY_UTILS_DIRTY_ROWS_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+namespace inktty {
+/**
+ * The DirtyRows class stores a span of changed columns for each row of a grid.
+ * In contrast to a single bounding rectangle, changes in distant parts of the
+ * grid (such as a status line and the cursor) do not cause the entire area
+ * between them to be scanned. Rows are indexed starting at zero, columns are
+ * stored as passed by the caller. All spans are inclusive.
+ */
+class DirtyRows {
+public:
+	struct Span {
+		int x0, x1;
+
+		/**
+		 * Creates a new, invalid span.
+		 */
+		Span()
+		    : x0(std::numeric_limits<int>::max()),
+		      x1(std::numeric_limits<int>::min()) {}
+
+		bool valid() const { return x0 <= x1; }
+	};
+
+private:
+	/**
+	 * Column span for each row.
+	 */
+	std::vector<Span> m_spans;
+
+	/**
+	 * First and last row with a valid span.
+	 */
+	int m_y0, m_y1;
+
+public:
+	DirtyRows(size_t rows = 0) : m_y0(0), m_y1(-1) { resize(rows); }
+
+	/**
+	 * Resizes the row table. Spans of rows that are cut off are discarded.
+	 */
+	void resize(size_t rows) {
+		m_spans.resize(rows);
+		m_y1 = std::min(m_y1, int(rows) - 1);
+		if (empty()) {
+			m_y0 = 0, m_y1 = -1;
+		}
+	}
+
+	size_t rows() const { return m_spans.size(); }
+
+	/**
+	 * Returns true if no row is marked as dirty.
+	 */
+	bool empty() const { return m_y0 > m_y1; }
+
+	/**
+	 * First and last row that may have a valid span. Iterating over this
+	 * range is sufficient to visit all dirty rows.
+	 */
+	int y0() const { return m_y0; }
+	int y1() const { return m_y1; }
+
+	const Span &operator[](size_t y) const { return m_spans[y]; }
+
+	/**
+	 * Marks the columns [x0, x1] in row y as dirty. Rows outside of the table
+	 * are ignored.
+	 */
+	void grow(int y, int x0, int x1) {
+		if (y < 0 || y >= int(m_spans.size()) || x0 > x1) {
+			return;
+		}
+		Span &s = m_spans[y];
+		s.x0 = std::min(s.x0, x0);
+		s.x1 = std::max(s.x1, x1);
+		if (empty()) {
+			m_y0 = m_y1 = y;
+		} else {
+			m_y0 = std::min(m_y0, y);
+			m_y1 = std::max(m_y1, y);
+		}
+	}
+
+	/**
+	 * Marks the cell in column x and row y as dirty.
+	 */
+	void grow(int y, int x) { grow(y, x, x); }
+
+	/**
+	 * Replaces the span of row y. Used when moving spans along with the rows
+	 * they refer to.
+	 */
+	void set(int y, const Span &s) {
+		if (y < 0 || y >= int(m_spans.size())) {
+			return;
+		}
+		m_spans[y] = Span();
+		grow(y, s.x0, s.x1);
+	}
+
+	/**
+	 * Resets all spans. Only visits the rows between y0() and y1().
+	 */
+	void clear() {
+		for (int y = m_y0; y <= m_y1; y++) {
+			m_spans[y] = Span();
+		}
+		m_y0 = 0, m_y1 = -1;
+	}
+};
+}  // namespace inktty
+
+#endif /* INKTTY_UTILS_DIRTY_ROWS_HPP */
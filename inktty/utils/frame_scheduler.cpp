@@ -0,0 +1,136 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include <inktty/utils/frame_scheduler.hpp>
+
+namespace inktty {
+
+/**
+ * Length of the window in which the output rate is measured in microseconds.
+ */
+static constexpr int64_t RATE_WINDOW = 100 * 1000;
+
+/******************************************************************************
+ * Class FrameScheduler                                                       *
+ ******************************************************************************/
+
+FrameScheduler::FrameScheduler(const config::Scheduler &config)
+    : m_config(config),
+      m_pending(false),
+      m_echo(false),
+      m_t_first_output(0),
+      m_t_last_output(0),
+      m_t_input(-1),
+      m_t_last_draw(0),
+      m_t_wakeup(-1),
+      m_t_window(0),
+      m_window_bytes(0),
+      m_jump(false),
+      m_skipped(0) {}
+
+int64_t FrameScheduler::interval() const {
+	return int64_t(m_jump ? m_config.jump_interval : m_config.frame_interval) *
+	       1000;
+}
+
+void FrameScheduler::input(int64_t t) { m_t_input = t; }
+
+void FrameScheduler::output(int64_t t, size_t bytes) {
+	// Stop jump scrolling once the output paused for a jump interval
+	if (t - m_t_last_output > int64_t(m_config.jump_interval) * 1000) {
+		m_jump = false;
+		m_t_window = t;
+		m_window_bytes = 0;
+	}
+
+	// Measure the output rate; start jump scrolling if it is too high
+	m_window_bytes += bytes;
+	if (t - m_t_window >= RATE_WINDOW) {
+		const uint64_t rate = m_window_bytes * 1000 * 1000 / (t - m_t_window);
+		m_jump = (m_config.jump_rate > 0) &&
+		         (rate > uint64_t(m_config.jump_rate));
+		m_t_window = t;
+		m_window_bytes = 0;
+	}
+
+	if (!m_pending) {
+		m_pending = true;
+		m_t_first_output = t;
+	}
+	m_t_last_output = t;
+
+	// Output shortly after a key press is most likely the echo of that key
+	if (m_t_input >= 0 && t - m_t_input <= m_config.echo_window * 1000) {
+		m_echo = true;
+	}
+}
+
+void FrameScheduler::drawn(int64_t t, int next) {
+	// The echo of the last key press has been drawn, batch any further
+	// output normally
+	if (m_echo) {
+		m_t_input = -1;
+	}
+	// Count the frames that would have been drawn at the regular interval
+	if (m_jump && m_pending) {
+		const int64_t dt = t - std::max(m_t_last_draw, m_t_first_output);
+		const int64_t frame_interval = int64_t(m_config.frame_interval) * 1000;
+		if (frame_interval > 0 && dt > frame_interval) {
+			m_skipped += dt / frame_interval - 1;
+		}
+	}
+	m_pending = false;
+	m_echo = false;
+	m_t_last_draw = t;
+	wakeup(t, next);
+}
+
+void FrameScheduler::wakeup(int64_t t, int next) {
+	m_t_wakeup = (next >= 0) ? (t + int64_t(next) * 1000) : -1;
+}
+
+int64_t FrameScheduler::deadline() const {
+	int64_t res = -1;
+	if (m_echo) {
+		res = m_t_last_output;
+	} else if (m_pending) {
+		// Draw once the burst of output is over, but do not defer drawing
+		// longer than the latency bound
+		const int64_t t_burst_end =
+		    m_t_last_output + m_config.burst_gap * 1000;
+		const int64_t t_latency = m_t_first_output + m_config.max_latency * 1000;
+		res = std::max(std::min(t_burst_end, t_latency),
+		               m_t_last_draw + interval());
+	}
+	if (m_t_wakeup >= 0 && (res < 0 || m_t_wakeup < res)) {
+		res = m_t_wakeup;
+	}
+	return res;
+}
+
+int FrameScheduler::timeout(int64_t t) const {
+	const int64_t d = deadline();
+	if (d < 0) {
+		return -1;
+	}
+	return int(std::max<int64_t>(0, (d - t + 999) / 1000));
+}
+
+}  // namespace inktty
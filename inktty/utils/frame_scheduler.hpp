@@ -0,0 +1,167 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file frame_scheduler.hpp
+ *
+ * Contains the FrameScheduler class, which decides when the main loop should
+ * draw a new frame.
+ *
+ * @author Andreas Stöckel
+ */
+
+#ifndef INKTTY_UTILS_FRAME_SCHEDULER_HPP
+#define INKTTY_UTILS_FRAME_SCHEDULER_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include <inktty/config/configuration.hpp>
+
+namespace inktty {
+/**
+ * The FrameScheduler class batches the output of the child process into
+ * frames. While output keeps arriving, drawing is deferred until either the
+ * burst of output ends or the configured latency bound is reached. Output
+ * echoing a key press is drawn immediately. If nothing needs to be drawn, the
+ * main loop may sleep until the next event arrives.
+ *
+ * If the child writes faster than the configured jump rate, the scheduler
+ * switches to jump scrolling: frames are drawn at most once per jump
+ * interval and the intermediate screen states are skipped. Jump scrolling
+ * ends once the output pauses for a jump interval.
+ *
+ * All timestamps are in microseconds and must be taken from the same
+ * monotonic clock.
+ */
+class FrameScheduler {
+private:
+	config::Scheduler m_config;
+
+	/**
+	 * True if output was received since the last frame.
+	 */
+	bool m_pending;
+
+	/**
+	 * True if the pending output is the echo of a key press.
+	 */
+	bool m_echo;
+
+	int64_t m_t_first_output;
+	int64_t m_t_last_output;
+	int64_t m_t_input;
+	int64_t m_t_last_draw;
+
+	/**
+	 * Time at which the renderer requested to be called again, or a negative
+	 * value if there is no such request.
+	 */
+	int64_t m_t_wakeup;
+
+	/**
+	 * Start of the current output rate measurement window and the number of
+	 * bytes received within the window.
+	 */
+	int64_t m_t_window;
+	uint64_t m_window_bytes;
+
+	/**
+	 * True while jump scrolling.
+	 */
+	bool m_jump;
+
+	/**
+	 * Number of frames skipped while jump scrolling.
+	 */
+	uint64_t m_skipped;
+
+	/**
+	 * Minimum time between two frames in microseconds.
+	 */
+	int64_t interval() const;
+
+public:
+	FrameScheduler(const config::Scheduler &config = config::Scheduler());
+
+	/**
+	 * Must be called whenever the user pressed a key or entered text.
+	 */
+	void input(int64_t t);
+
+	/**
+	 * Must be called whenever output from the child process was passed to the
+	 * terminal emulator.
+	 *
+	 * @param bytes is the number of bytes received, used to decide whether
+	 * to jump scroll.
+	 */
+	void output(int64_t t, size_t bytes = 0);
+
+	/**
+	 * Must be called after a frame has been drawn.
+	 *
+	 * @param next is the number of milliseconds after which the renderer
+	 * needs to draw again even if no new output arrives, or a negative value
+	 * if there is no such need.
+	 */
+	void drawn(int64_t t, int next = -1);
+
+	/**
+	 * Requests a frame after the given number of milliseconds even if no new
+	 * output arrives. Used if the result of a frame is only known after
+	 * drawn() was called, e.g. if frames are drawn on another thread.
+	 * Negative values cancel a previous request.
+	 */
+	void wakeup(int64_t t, int next);
+
+	/**
+	 * Returns the time at which the next frame should be drawn, or a negative
+	 * value if there is nothing to draw.
+	 */
+	int64_t deadline() const;
+
+	/**
+	 * Returns true if a frame should be drawn now.
+	 */
+	bool due(int64_t t) const {
+		const int64_t d = deadline();
+		return (d >= 0) && (t >= d);
+	}
+
+	/**
+	 * Returns the time in milliseconds the main loop may sleep while waiting
+	 * for events, or -1 if it may sleep indefinitely.
+	 */
+	int timeout(int64_t t) const;
+
+	/**
+	 * Returns true while jump scrolling.
+	 */
+	bool jump() const { return m_jump; }
+
+	/**
+	 * Returns the total number of frames that were not drawn because of jump
+	 * scrolling, i.e. the number of frames that could have been drawn at the
+	 * regular frame interval between two jump scroll frames.
+	 */
+	uint64_t skipped() const { return m_skipped; }
+};
+}  // namespace inktty
+
+#endif /* INKTTY_UTILS_FRAME_SCHEDULER_HPP */
@@ -17,6 +17,7 @@
  */
 
 #include <algorithm>
+#include <cstdint>
 #include <vector>
 
 #include <inktty/utils/geometry.hpp>
@@ -27,88 +28,229 @@ namespace inktty {
  * Class RectangleMerger::Impl                                                *
  ******************************************************************************/
 
-/**
- * The RectangleMerger class tries to merge multiple overlapping or close
- * rectangles into larger rectangles without increasing the total area covered
- * by the larger rectangles by too much.
- */
 class RectangleMerger::Impl {
 private:
+	Cost m_cost;
 	std::vector<Rect> m_rects;
 
-	int search_matching_rectangle(const Rect &r, int i0, int i1) const {
-		const int r_area = r.area();
-		for (int i = i1 - 1; i >= 0; i--) {
-			const Rect &s = m_rects[i];
-			const int s_area = s.area();
-
-			// Merge two rectangles if the percentage of the area covered by the
-			// two rectangles withing the larger rectangle is larger than 3 / 4.
-			const Rect rs = r.grow(s);
-			if (r_area + s_area >= (3 * rs.area()) / 4) {
-				return i;
+	/**
+	 * Number of rectangles following each rectangle in the sweep order that
+	 * are considered as merge candidates.
+	 */
+	static constexpr size_t WINDOW = 8;
+
+	/**
+	 * Pair of rectangles that may be merged. The version numbers are used to
+	 * discard candidates referring to rectangles that changed in the meantime.
+	 */
+	struct Candidate {
+		int64_t saving;
+		uint32_t i, j;
+		uint32_t version_i, version_j;
+
+		bool operator<(const Candidate &o) const { return saving < o.saving; }
+	};
+
+	/**
+	 * Scratch memory used by merge_pairs(), kept across calls to avoid
+	 * allocating memory for every merge.
+	 */
+	std::vector<uint32_t> m_next, m_prev, m_version;
+	std::vector<uint8_t> m_alive;
+	std::vector<Candidate> m_queue;
+
+	int64_t cost(const Rect &r) const {
+		return int64_t(r.width()) * int64_t(r.height()) + m_cost.update_cost;
+	}
+
+	/**
+	 * Returns the cost saved by replacing the two rectangles with their
+	 * bounding box. Negative if merging the rectangles increases the cost.
+	 */
+	int64_t saving(const Rect &a, const Rect &b) const {
+		return cost(a) + cost(b) - cost(a.grow(b));
+	}
+
+	/**
+	 * Sorts the rectangles and merges consecutive rectangles in the same band
+	 * if this does not increase the cost. Used to combine adjacent cells in a
+	 * row, and stacks of rows, before running the more general merge.
+	 */
+	template <typename Less, typename Same>
+	void merge_runs(Less less, Same same) {
+		std::sort(m_rects.begin(), m_rects.end(), less);
+		size_t n = 0;
+		for (size_t i = 0; i < m_rects.size(); i++) {
+			if (n > 0 && same(m_rects[n - 1], m_rects[i]) &&
+			    saving(m_rects[n - 1], m_rects[i]) >= 0) {
+				m_rects[n - 1] = m_rects[n - 1].grow(m_rects[i]);
+			} else {
+				m_rects[n++] = m_rects[i];
+			}
+		}
+		m_rects.resize(n);
+	}
+
+	/**
+	 * Greedily merges the pair of rectangles with the largest saving. Only
+	 * pairs within the given window in the order of the top edge are
+	 * considered. Returns false if the maximum number of rectangles could not
+	 * be reached with this window size.
+	 */
+	bool merge_pairs(size_t window) {
+		// Sort by the top edge. The bounding box of two rectangles is stored
+		// at the smaller index, which keeps the alive rectangles sorted.
+		std::sort(m_rects.begin(), m_rects.end(),
+		          [](const Rect &a, const Rect &b) {
+			          return (a.y0 < b.y0) || (a.y0 == b.y0 && a.x0 < b.x0);
+		          });
+
+		// Doubly linked list of the alive rectangles
+		const uint32_t n = m_rects.size();
+		std::vector<uint32_t> &next = m_next, &prev = m_prev,
+		                      &version = m_version;
+		std::vector<uint8_t> &alive = m_alive;
+		next.resize(n);
+		prev.resize(n);
+		version.assign(n, 0);
+		alive.assign(n, true);
+		for (uint32_t i = 0; i < n; i++) {
+			next[i] = i + 1;
+			prev[i] = i - 1;  // Wraps around for i = 0, marks the list head
+		}
+
+		// Priority queue of merge candidates, stored as a heap
+		std::vector<Candidate> &queue = m_queue;
+		queue.clear();
+		auto push = [&](uint32_t i, uint32_t j) {
+			if (j < i) {
+				std::swap(i, j);
+			}
+			queue.push_back(Candidate{saving(m_rects[i], m_rects[j]), i, j,
+			                          version[i], version[j]});
+			std::push_heap(queue.begin(), queue.end());
+		};
+		for (uint32_t i = 0; i < n; i++) {
+			uint32_t j = next[i];
+			for (size_t k = 0; k < window && j < n; k++, j = next[j]) {
+				push(i, j);
+			}
+		}
+
+		const size_t max_rects = m_cost.max_rects;
+		size_t n_alive = n;
+		while (!queue.empty()) {
+			std::pop_heap(queue.begin(), queue.end());
+			const Candidate c = queue.back();
+			queue.pop_back();
+			if (!alive[c.i] || !alive[c.j] || version[c.i] != c.version_i ||
+			    version[c.j] != c.version_j) {
+				continue;  // Outdated candidate
+			}
+			if (c.saving < 0 && (max_rects == 0 || n_alive <= max_rects)) {
+				break;  // All further merges increase the cost
+			}
+
+			// Replace the rectangle i with the bounding box, remove j
+			m_rects[c.i] = m_rects[c.i].grow(m_rects[c.j]);
+			version[c.i]++;
+			alive[c.j] = false;
+			if (prev[c.j] < n) {
+				next[prev[c.j]] = next[c.j];
+			}
+			if (next[c.j] < n) {
+				prev[next[c.j]] = prev[c.j];
+			}
+			n_alive--;
+
+			// Add the neighbours of the bounding box as new candidates
+			uint32_t j = next[c.i];
+			for (size_t k = 0; k < window && j < n; k++, j = next[j]) {
+				push(c.i, j);
+			}
+			j = prev[c.i];
+			for (size_t k = 0; k < window && j < n; k++, j = prev[j]) {
+				push(j, c.i);
+			}
+		}
+
+		// Remove the merged rectangles
+		size_t i_tar = 0;
+		for (size_t i = 0; i < n; i++) {
+			if (alive[i]) {
+				m_rects[i_tar++] = m_rects[i];
 			}
 		}
-		return -1;
+		m_rects.resize(i_tar);
+		return max_rects == 0 || m_rects.size() <= max_rects;
 	}
 
 public:
+	Impl(const Cost &cost) : m_cost(cost) {}
+
+	const Cost &cost() const { return m_cost; }
+
+	void set_cost(const Cost &cost) { m_cost = cost; }
+
 	void reset() { m_rects.clear(); }
 
 	void insert(const Rect &r) {
-		const int idx = search_matching_rectangle(r, 0, m_rects.size());
-		if (idx >= 0) {
-			m_rects[idx] = m_rects[idx].grow(r);
-		} else {
+		if (r.valid() && r.width() > 0 && r.height() > 0) {
 			m_rects.emplace_back(r);
 		}
 	}
 
 	void merge() {
-		// Repeat this process until no further merges can be found
-		bool found_merge;
-		do {
-			found_merge = false;
-			// Iterate backwards over the list of rectangles
-			for (int i = int(m_rects.size()) - 1; i >= 1; i--) {
-				// Try to find a rectangle up to the given index that matches
-				// the current rectangle
-				const int idx = search_matching_rectangle(m_rects[i], 0, i);
-
-				// If we found a match, update the corresponding rectangle and
-				// invalidate the currently selected rectangle
-				if (idx >= 0) {
-					m_rects[idx] = m_rects[idx].grow(m_rects[i]);
-					m_rects[i] = Rect();
-					found_merge = true;
-				}
-			}
+		// Combine cells in the same row, then identical runs in successive
+		// rows
+		merge_runs(
+		    [](const Rect &a, const Rect &b) {
+			    return (a.y0 < b.y0) || (a.y0 == b.y0 && a.y1 < b.y1) ||
+			           (a.y0 == b.y0 && a.y1 == b.y1 && a.x0 < b.x0);
+		    },
+		    [](const Rect &a, const Rect &b) {
+			    return a.y0 == b.y0 && a.y1 == b.y1;
+		    });
+		merge_runs(
+		    [](const Rect &a, const Rect &b) {
+			    return (a.x0 < b.x0) || (a.x0 == b.x0 && a.x1 < b.x1) ||
+			           (a.x0 == b.x0 && a.x1 == b.x1 && a.y0 < b.y0);
+		    },
+		    [](const Rect &a, const Rect &b) {
+			    return a.x0 == b.x0 && a.x1 == b.x1;
+		    });
 
-			// Remove invalid rectangles from the list
-			if (found_merge) {
-				m_rects.erase(
-				    std::remove_if(m_rects.begin(), m_rects.end(),
-				                   [](const Rect &r) { return !r.valid(); }),
-				    m_rects.end());
-			}
-		} while (found_merge);
+		// Merge the remaining rectangles pairwise. Widen the window if the
+		// rectangle limit has not been reached; a window spanning all
+		// rectangles always succeeds.
+		for (size_t window = WINDOW; !merge_pairs(window); window *= 4) {
+		}
 	}
 
-	const Rect *begin() const { return &(*m_rects.cbegin()); }
+	const Rect *begin() const { return m_rects.data(); }
 
-	const Rect *end() const { return &(*m_rects.cend()); }
+	const Rect *end() const { return m_rects.data() + m_rects.size(); }
 };
 
+constexpr size_t RectangleMerger::Impl::WINDOW;
+
 /******************************************************************************
  * Class RectangleMerger                                                      *
  ******************************************************************************/
 
-RectangleMerger::RectangleMerger() : m_impl(new RectangleMerger::Impl()) {}
+RectangleMerger::RectangleMerger(const Cost &cost)
+    : m_impl(new RectangleMerger::Impl(cost)) {}
 
 RectangleMerger::~RectangleMerger() {
 	// Do nothing here, make sure the m_impl destructor is called
 }
 
+const RectangleMerger::Cost &RectangleMerger::cost() const {
+	return m_impl->cost();
+}
+
+void RectangleMerger::set_cost(const Cost &cost) { m_impl->set_cost(cost); }
+
 void RectangleMerger::reset() { m_impl->reset(); }
 
 void RectangleMerger::insert(const Rect &r) { m_impl->insert(r); }
@@ -27,6 +27,7 @@
 #ifndef INKTTY_UTILS_GEOMETRY_HPP
 #define INKTTY_UTILS_GEOMETRY_HPP
 
+#include <cstddef>
 #include <memory>
 #include <algorithm>
 #include <limits>
@@ -137,6 +138,14 @@ struct Rect {
 		            clipy(r.y1, true)};
 	}
 
+	/**
+	 * Returns true if this rectangle and the given rectangle share at least
+	 * one pixel. The lower-right corner is treated as being exclusive.
+	 */
+	constexpr bool overlaps(const Rect &r) const {
+		return (x0 < r.x1) && (r.x0 < x1) && (y0 < r.y1) && (r.y0 < y1);
+	}
+
 	Rect grow(const Rect &r) const {
 		return Rect{std::min(x0, r.x0), std::min(y0, r.y0), std::max(x1, r.x1),
 		            std::max(y1, r.y1)};
@@ -169,32 +178,66 @@ struct Rect {
 
 /**
  * The RectangleMerger class tries to merge multiple overlapping or close
- * rectangles into larger rectangles without increasing the total area covered
- * by the larger rectangles by too much.
+ * rectangles into larger rectangles. Whether two rectangles are merged is
+ * decided by a cost model: sending a rectangle to the display costs its area
+ * in pixels plus a fixed per-update overhead. Two rectangles are merged if
+ * sending their bounding box is not more expensive than sending both of them.
  */
 class RectangleMerger {
+public:
+	/**
+	 * Parameters of the cost model.
+	 */
+	struct Cost {
+		/**
+		 * Fixed overhead of a single update in pixels. Larger values cause
+		 * rectangles that are further apart to be merged.
+		 */
+		int update_cost;
+
+		/**
+		 * Maximum number of rectangles after merge(). If there are more
+		 * rectangles, the ones that are cheapest to combine are merged even if
+		 * this increases the cost. Zero disables the limit.
+		 */
+		size_t max_rects;
+
+		Cost(int update_cost = 1024, size_t max_rects = 0)
+		    : update_cost(update_cost), max_rects(max_rects) {}
+	};
+
 private:
 	class Impl;
 	std::unique_ptr<Impl> m_impl;
 
 public:
-	RectangleMerger();
+	RectangleMerger(const Cost &cost = Cost());
 	~RectangleMerger();
 
+	/**
+	 * Returns the cost model used by the merger.
+	 */
+	const Cost &cost() const;
+
+	/**
+	 * Replaces the cost model used by the merger.
+	 */
+	void set_cost(const Cost &cost);
+
 	/**
 	 * Resets the rectangle merger to its initial state.
 	 */
 	void reset();
 
 	/**
-	 * Inserts a new rectangle into the rectangle merger and tries to combine
-	 * it with the available rectangles.
+	 * Inserts a new rectangle into the rectangle merger. The rectangles are
+	 * combined once merge() is called.
 	 */
 	void insert(const Rect &r);
 
 	/**
-	 * Tries to merge individual rectangles currently stored in the rectangle
-	 * merger.
+	 * Merges the rectangles currently stored in the rectangle merger. Runs in
+	 * O(n log n) for n rectangles.
 	 */
 	void merge();
 
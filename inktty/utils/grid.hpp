@@ -0,0 +1,219 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file grid.hpp
+ *
+ * Contains the Grid class, a two-dimensional array stored in a single
+ * contiguous buffer.
+ *
+ * @author Andreas Stöckel
+ */
+
+#ifndef INKTTY_UTILS_GRID_HPP
+#define INKTTY_UTILS_GRID_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <vector>
+
+namespace inktty {
+/**
+ * The Grid class stores a two-dimensional array of elements in a single
+ * row-major buffer. Rows are accessed through a row index table, which allows
+ * to move entire rows (e.g. when scrolling) by rotating the index table instead
+ * of copying the row content. Indexing follows the usual grid[row][col]
+ * notation; all indices are zero-based.
+ */
+template <typename T>
+class Grid {
+private:
+	/**
+	 * Storage for all elements. The order of the rows in this buffer is
+	 * arbitrary, the row index table determines which row is stored where.
+	 */
+	std::vector<T> m_data;
+
+	/**
+	 * Offset of the first element of each row in m_data.
+	 */
+	std::vector<size_t> m_rows;
+
+	/**
+	 * Number of columns.
+	 */
+	size_t m_cols;
+
+public:
+	/**
+	 * Creates a new grid with the given number of rows and columns. All
+	 * elements are default-initialised.
+	 */
+	Grid(size_t rows = 0, size_t cols = 0) : m_cols(0) { resize(rows, cols); }
+
+	/**
+	 * Returns the number of rows in the grid.
+	 */
+	size_t rows() const { return m_rows.size(); }
+
+	/**
+	 * Returns the number of columns in the grid.
+	 */
+	size_t cols() const { return m_cols; }
+
+	/**
+	 * Returns the number of bytes allocated for the grid.
+	 */
+	size_t bytes() const {
+		return m_data.capacity() * sizeof(T) +
+		       m_rows.capacity() * sizeof(size_t);
+	}
+
+	/**
+	 * Returns a pointer at the first element in the given row.
+	 */
+	T *operator[](size_t row) { return &m_data[m_rows[row]]; }
+
+	const T *operator[](size_t row) const { return &m_data[m_rows[row]]; }
+
+	/**
+	 * Iterators over all elements of the grid in storage order. This order
+	 * does not correspond to the row order and should only be used for
+	 * operations applied to every element.
+	 */
+	T *begin() { return m_data.data(); }
+	T *end() { return m_data.data() + m_data.size(); }
+	const T *begin() const { return m_data.data(); }
+	const T *end() const { return m_data.data() + m_data.size(); }
+
+	/**
+	 * Resizes the grid, preserving the content in the area covered by both the
+	 * old and the new size. New elements are default-initialised.
+	 */
+	void resize(size_t rows, size_t cols) {
+		if (rows == this->rows() && cols == m_cols) {
+			return;
+		}
+
+		std::vector<T> data(rows * cols);
+		const size_t r1 = std::min(rows, this->rows());
+		const size_t c1 = std::min(cols, m_cols);
+		for (size_t r = 0; r < r1; r++) {
+			const T *src = (*this)[r];
+			std::copy(src, src + c1, &data[r * cols]);
+		}
+
+		m_data.swap(data);
+		m_rows.resize(rows);
+		for (size_t r = 0; r < rows; r++) {
+			m_rows[r] = r * cols;
+		}
+		m_cols = cols;
+	}
+
+	/**
+	 * Sets all elements in the grid to the given value.
+	 */
+	void fill(const T &value) { std::fill(m_data.begin(), m_data.end(), value); }
+
+	/**
+	 * Rotates the rows in the range [row0, row1) by the given number of rows.
+	 * If n is positive, row row0 + n becomes row row0, i.e. the content moves
+	 * upwards; if n is negative the content moves downwards. The rows wrapping
+	 * around the end of the range keep their previous content. Only the row
+	 * index table is modified, no elements are copied.
+	 */
+	void rotate(size_t row0, size_t row1, int n) {
+		if (row1 <= row0) {
+			return;
+		}
+		const int len = int(row1 - row0);
+		n = ((n % len) + len) % len;
+		std::rotate(m_rows.begin() + row0, m_rows.begin() + row0 + n,
+		            m_rows.begin() + row1);
+	}
+
+	/**
+	 * Moves the content of the rectangular region spanned by the rows
+	 * [row0, row1) and columns [col0, col1). After the operation, the element
+	 * at (row, col) holds the previous content of (row + down, col + right).
+	 * Elements whose source lies outside of the region keep their previous
+	 * content, similar to memmove(). Moves spanning entire rows are mostly
+	 * implemented by rotating the row index table.
+	 */
+	void move(size_t row0, size_t row1, size_t col0, size_t col1, int down,
+	          int right) {
+		if (row1 <= row0 || col1 <= col0 || (down == 0 && right == 0)) {
+			return;
+		}
+		const int h = int(row1 - row0), w = int(col1 - col0);
+		if (std::abs(down) >= h || std::abs(right) >= w) {
+			return; /* Nothing to move */
+		}
+
+		/* If entire rows are moved and the moved rows cover at least the
+		   scrolled-in rows, rotate the row table and duplicate the scrolled-in
+		   rows from their new location. */
+		const int n = std::abs(down);
+		if (right == 0 && col0 == 0 && col1 == m_cols && 2 * n <= h) {
+			rotate(row0, row1, down);
+			if (down > 0) {
+				for (size_t r = row1 - n; r < row1; r++) {
+					std::copy((*this)[r - n], (*this)[r - n] + m_cols,
+					          (*this)[r]);
+				}
+			} else {
+				for (size_t r = row0; r < row0 + n; r++) {
+					std::copy((*this)[r + n], (*this)[r + n] + m_cols,
+					          (*this)[r]);
+				}
+			}
+			return;
+		}
+
+		/* Otherwise copy the individual elements, choosing the iteration
+		   direction such that no source element is overwritten before it is
+		   read */
+		const int dy = (down >= 0) ? 1 : -1, dx = (right >= 0) ? 1 : -1;
+		const int y0 = (down >= 0) ? int(row0) : int(row1) - 1;
+		const int x0 = (right >= 0) ? int(col0) : int(col1) - 1;
+		for (int i = 0; i < h - n; i++) {
+			const int y = y0 + dy * i;
+			T *tar = (*this)[y];
+			const T *src = (*this)[y + down];
+			for (int j = 0; j < w - std::abs(right); j++) {
+				const int x = x0 + dx * j;
+				tar[x] = src[x + right];
+			}
+		}
+	}
+
+	/**
+	 * Exchanges the content of two grids.
+	 */
+	void swap(Grid &o) {
+		m_data.swap(o.m_data);
+		m_rows.swap(o.m_rows);
+		std::swap(m_cols, o.m_cols);
+	}
+};
+
+}  // namespace inktty
+
+#endif /* INKTTY_UTILS_GRID_HPP */
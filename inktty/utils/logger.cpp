@@ -22,10 +22,18 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
 #include <map>
+#include <streambuf>
+#include <thread>
 
 #include <inktty/utils/ansi_terminal_writer.hpp>
 #include <inktty/utils/logger.hpp>
+#include <inktty/utils/memory.hpp>
+#include <inktty/utils/spsc_queue.hpp>
 
 namespace inktty {
 /******************************************************************************
@@ -104,6 +112,240 @@ LogStreamBackend::~LogStreamBackend()
 	// Do nothing here, just required for the unique_ptr destructor
 }
 
+/******************************************************************************
+ * Class LogAsyncBackend::Impl                                                *
+ ******************************************************************************/
+
+/**
+ * The Impl class is the stream buffer the messages are written to. The
+ * message text is written directly into a record, which is pushed onto the
+ * ring buffer when the Logger::StreamProxy flushes the stream at the end of
+ * the message. The Logger serialises all calls to log(), so there is only
+ * ever one producer.
+ */
+class LogAsyncBackend::Impl : public std::streambuf {
+private:
+	/**
+	 * Interval in which the background thread polls the ring buffer in case
+	 * a wakeup was missed.
+	 */
+	static constexpr int POLL_INTERVAL_MS = 50;
+
+	static constexpr size_t MAX_MODULE = 31;
+
+	struct Record {
+		LogSeverity lvl;
+		std::time_t time;
+		bool has_module;
+		char module[MAX_MODULE + 1];
+		size_t len;
+		char text[MAX_MESSAGE + 1];
+	};
+
+	std::shared_ptr<LogBackend> m_backend;
+
+	/**
+	 * Record the current message is written to, and whether a message is
+	 * currently being written.
+	 */
+	Record m_record;
+	bool m_open;
+	std::ostream m_os;
+
+	SPSCQueue<Record> m_queue;
+	memory::Account m_account;
+
+	/**
+	 * Number of messages dropped since the last report and in total.
+	 */
+	std::atomic<size_t> m_dropped;
+	std::atomic<size_t> m_dropped_total;
+
+	/**
+	 * Number of messages pushed onto the ring buffer and number of messages
+	 * passed to the wrapped backend. The latter is protected by m_mtx.
+	 */
+	std::atomic<size_t> m_pushed;
+	size_t m_written;
+
+	std::mutex m_mtx;
+	std::condition_variable m_cond;
+	std::condition_variable m_cond_written;
+	bool m_wake;
+	bool m_done;
+
+	/**
+	 * Background thread, declared last such that it is started after all
+	 * other members have been initialised.
+	 */
+	std::thread m_thread;
+
+	void write(const Record &r)
+	{
+		std::ostream *os =
+		    m_backend->log(r.lvl, r.time, r.has_module ? r.module : nullptr);
+		if (os) {
+			os->write(r.text, r.len);
+			(*os) << std::endl;
+		}
+	}
+
+	void run()
+	{
+		Record r;
+		std::unique_lock<std::mutex> lock(m_mtx);
+		while (true) {
+			// Drain the ring buffer without holding the lock
+			lock.unlock();
+			size_t n = 0;
+			while (m_queue.pop(r)) {
+				write(r);
+				n++;
+			}
+			const size_t dropped = m_dropped.exchange(0);
+			if (dropped > 0) {
+				std::ostream *os = m_backend->log(LogSeverity::WARNING,
+				                                  std::time(nullptr), "logger");
+				if (os) {
+					(*os) << "Dropped " << dropped << " log message(s)"
+					      << std::endl;
+				}
+			}
+			lock.lock();
+
+			// Notify threads waiting in flush()
+			m_written += n;
+			m_cond_written.notify_all();
+
+			if (m_done && m_queue.empty()) {
+				break;
+			}
+			m_cond.wait_for(lock, std::chrono::milliseconds(POLL_INTERVAL_MS),
+			                [this] { return m_wake || m_done; });
+			m_wake = false;
+		}
+	}
+
+protected:
+	int_type overflow(int_type c) override
+	{
+		// The record is full, silently truncate the message
+		return traits_type::not_eof(c);
+	}
+
+	int sync() override
+	{
+		if (!m_open) {
+			return 0;
+		}
+		m_open = false;
+
+		// Strip the line break added by the StreamProxy
+		m_record.len = pptr() - pbase();
+		while (m_record.len > 0 && m_record.text[m_record.len - 1] == '\n') {
+			m_record.len--;
+		}
+		if (m_queue.push(m_record)) {
+			m_pushed++;
+			m_cond.notify_one();
+		} else {
+			m_dropped++;
+			m_dropped_total++;
+		}
+		return 0;
+	}
+
+public:
+	Impl(std::shared_ptr<LogBackend> backend, size_t capacity)
+	    : m_backend(std::move(backend)),
+	      m_open(false),
+	      m_os(this),
+	      m_queue(capacity),
+	      m_account(memory::Pool::Log),
+	      m_dropped(0),
+	      m_dropped_total(0),
+	      m_pushed(0),
+	      m_written(0),
+	      m_wake(false),
+	      m_done(false),
+	      m_thread([this] { run(); })
+	{
+		m_account.set(m_queue.capacity() * sizeof(Record));
+	}
+
+	~Impl()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mtx);
+			m_done = true;
+		}
+		m_cond.notify_one();
+		m_thread.join();
+	}
+
+	std::ostream *log(LogSeverity lvl, std::time_t time, const char *module)
+	{
+		// Finish a previous message that was never flushed
+		sync();
+
+		m_record.lvl = lvl;
+		m_record.time = time;
+		m_record.has_module = module != nullptr;
+		if (module) {
+			strncpy(m_record.module, module, MAX_MODULE);
+			m_record.module[MAX_MODULE] = '\0';
+		}
+		setp(m_record.text, m_record.text + MAX_MESSAGE);
+		m_open = true;
+		m_os.clear();
+		return &m_os;
+	}
+
+	void flush()
+	{
+		const size_t pushed = m_pushed;
+		std::unique_lock<std::mutex> lock(m_mtx);
+		m_wake = true;
+		m_cond.notify_one();
+		m_cond_written.wait(lock, [this, pushed] {
+			return m_written >= pushed;
+		});
+	}
+
+	size_t dropped() const { return m_dropped_total; }
+};
+
+constexpr int LogAsyncBackend::Impl::POLL_INTERVAL_MS;
+constexpr size_t LogAsyncBackend::Impl::MAX_MODULE;
+
+/******************************************************************************
+ * Class LogAsyncBackend                                                      *
+ ******************************************************************************/
+
+constexpr size_t LogAsyncBackend::DEFAULT_CAPACITY;
+constexpr size_t LogAsyncBackend::MAX_MESSAGE;
+
+LogAsyncBackend::LogAsyncBackend(std::shared_ptr<LogBackend> backend,
+                                 size_t capacity)
+    : m_impl(new Impl(std::move(backend), capacity))
+{
+}
+
+std::ostream *LogAsyncBackend::log(LogSeverity lvl, std::time_t time,
+                                   const char *module)
+{
+	return m_impl->log(lvl, time, module);
+}
+
+void LogAsyncBackend::flush() { m_impl->flush(); }
+
+size_t LogAsyncBackend::dropped() const { return m_impl->dropped(); }
+
+LogAsyncBackend::~LogAsyncBackend()
+{
+	// Do nothing here, just required for the unique_ptr destructor
+}
+
 /******************************************************************************
  * Class Logger::Impl                                                         *
  ******************************************************************************/
@@ -133,6 +375,18 @@ public:
 		return m_backends.size() - 1;
 	}
 
+	std::shared_ptr<LogBackend> backend(int idx)
+	{
+		std::lock_guard<std::mutex> lock(m_logger_mtx);
+		return std::get<0>(m_backends[backend_idx(idx)]);
+	}
+
+	void backend(std::shared_ptr<LogBackend> backend, int idx)
+	{
+		std::lock_guard<std::mutex> lock(m_logger_mtx);
+		std::get<0>(m_backends[backend_idx(idx)]) = std::move(backend);
+	}
+
 	void min_level(LogSeverity lvl, int idx)
 	{
 		std::get<1>(m_backends[backend_idx(idx)]) = lvl;
@@ -205,6 +459,11 @@ Logger::Logger(std::shared_ptr<LogBackend> backend, LogSeverity lvl) : Logger()
 	add_backend(std::move(backend), lvl);
 }
 
+Logger::~Logger()
+{
+	// Do nothing here, just required for the unique_ptr destructor
+}
+
 size_t Logger::backend_count() const { return m_impl->backend_count(); }
 
 size_t Logger::count(LogSeverity lvl) const { return m_impl->count(lvl); }
@@ -214,6 +473,16 @@ int Logger::add_backend(std::shared_ptr<LogBackend> backend, LogSeverity lvl)
 	return m_impl->add_backend(backend, lvl);
 }
 
+std::shared_ptr<LogBackend> Logger::backend(int idx)
+{
+	return m_impl->backend(idx);
+}
+
+void Logger::backend(std::shared_ptr<LogBackend> backend, int idx)
+{
+	m_impl->backend(std::move(backend), idx);
+}
+
 void Logger::min_level(LogSeverity lvl, int idx)
 {
 	return m_impl->min_level(lvl, idx);
@@ -84,6 +84,46 @@ public:
 	~LogStreamBackend() override;
 };
 
+/**
+ * Implementation of the LogBackend class which copies each message into a
+ * preallocated ring buffer and passes it to the wrapped backend on a
+ * background thread. Logging thus never waits for the wrapped backend, e.g. a
+ * slow serial console. Messages are dropped if the ring buffer is full; the
+ * number of dropped messages is reported through the wrapped backend once
+ * there is room again. Messages longer than MAX_MESSAGE bytes are truncated.
+ */
+class LogAsyncBackend : public LogBackend {
+private:
+	class Impl;
+	std::unique_ptr<Impl> m_impl;
+
+public:
+	static constexpr size_t DEFAULT_CAPACITY = 256;
+	static constexpr size_t MAX_MESSAGE = 255;
+
+	LogAsyncBackend(std::shared_ptr<LogBackend> backend,
+	                size_t capacity = DEFAULT_CAPACITY);
+
+	std::ostream* log(LogSeverity lvl, std::time_t time, const char *module) override;
+
+	/**
+	 * Blocks until all messages logged so far have been passed to the wrapped
+	 * backend.
+	 */
+	void flush();
+
+	/**
+	 * Returns the total number of messages dropped because the ring buffer
+	 * was full.
+	 */
+	size_t dropped() const;
+
+	/**
+	 * Writes all pending messages and stops the background thread.
+	 */
+	~LogAsyncBackend() override;
+};
+
 /**
  * The Logger class is the frontend class that should be used to log messages.
  * A global instance which logs to std::cerr can be accessed using the
@@ -159,6 +199,8 @@ public:
 	Logger(std::shared_ptr<LogBackend> backend,
 	       LogSeverity lvl = LogSeverity::INFO);
 
+	~Logger();
+
 	/**
 	 * Returns the number of attached backends.
 	 */
@@ -171,6 +213,18 @@ public:
 	int add_backend(std::shared_ptr<LogBackend> backend,
 	                LogSeverity lvl = LogSeverity::INFO);
 
+	/**
+	 * Returns the backend with the given index. Negative indices allow to
+	 * access the backend list in reverse order.
+	 */
+	std::shared_ptr<LogBackend> backend(int idx = -1);
+
+	/**
+	 * Replaces the backend with the given index, keeping its log level. May be
+	 * used to wrap an existing backend, e.g. in a LogAsyncBackend.
+	 */
+	void backend(std::shared_ptr<LogBackend> backend, int idx = -1);
+
 	/**
 	 * Sets the minimum level for the backend with the given index. Negative
 	 * indices allow to access the backend list in reverse order. Per default
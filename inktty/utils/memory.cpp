@@ -0,0 +1,198 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <inktty/utils/logger.hpp>
+#include <inktty/utils/memory.hpp>
+
+namespace inktty {
+namespace memory {
+
+namespace {
+std::atomic<size_t> pools[size_t(Pool::COUNT)];
+std::atomic<size_t> total_bytes(0);
+std::atomic<size_t> peak_bytes(0);
+std::atomic<size_t> budget_bytes(0);
+
+/**
+ * Total after the last reclaim. Another reclaim is only triggered by the
+ * budget once the total grew by an eighth of the budget beyond this level,
+ * such that the caches are not flushed over and over again if the remaining
+ * memory exceeds the budget.
+ */
+std::atomic<size_t> reclaim_level(0);
+std::atomic<bool> reclaim_requested(false);
+
+size_t kib(size_t bytes) { return (bytes + 1023) / 1024; }
+}  // namespace
+
+const char *name(Pool pool) {
+	switch (pool) {
+		case Pool::Display:
+			return "display";
+		case Pool::Cells:
+			return "cells";
+		case Pool::Scrollback:
+			return "scrollback";
+		case Pool::Glyphs:
+			return "glyphs";
+		case Pool::Tiles:
+			return "tiles";
+		case Pool::VTerm:
+			return "vterm";
+		case Pool::Log:
+			return "log";
+		case Pool::COUNT:
+			break;
+	}
+	return "unknown";
+}
+
+/******************************************************************************
+ * Class Account                                                              *
+ ******************************************************************************/
+
+Account &Account::operator=(const Account &o) {
+	if (this != &o) {
+		set(0);
+		m_pool = o.m_pool;
+		set(o.m_bytes);
+	}
+	return *this;
+}
+
+void Account::set(size_t bytes) {
+	if (bytes > m_bytes) {
+		const size_t delta = bytes - m_bytes;
+		pools[size_t(m_pool)] += delta;
+		const size_t t = (total_bytes += delta);
+		size_t p = peak_bytes;
+		while (t > p && !peak_bytes.compare_exchange_weak(p, t)) {
+		}
+	} else if (bytes < m_bytes) {
+		const size_t delta = m_bytes - bytes;
+		pools[size_t(m_pool)] -= delta;
+		total_bytes -= delta;
+	}
+	m_bytes = bytes;
+}
+
+/******************************************************************************
+ * Functions                                                                  *
+ ******************************************************************************/
+
+size_t usage(Pool pool) { return pools[size_t(pool)]; }
+
+size_t total() { return total_bytes; }
+
+size_t peak() { return peak_bytes; }
+
+void set_budget(size_t bytes) {
+	budget_bytes = bytes;
+	reclaim_level = 0;
+}
+
+size_t budget() { return budget_bytes; }
+
+void request_reclaim() { reclaim_requested = true; }
+
+bool under_pressure() {
+	if (reclaim_requested) {
+		return true;
+	}
+	const size_t b = budget_bytes, level = reclaim_level;
+	const size_t t = total_bytes;
+	return (b > 0) && (t > b) && (level == 0 || t > level + b / 8);
+}
+
+void reclaimed(Logger &logger, size_t total_before) {
+	reclaim_requested = false;
+	const size_t t = total_bytes, b = budget_bytes;
+	reclaim_level = t;
+	logger.info("memory") << "Released "
+	                      << kib(total_before > t ? total_before - t : 0)
+	                      << " KiB, using " << kib(t) << " KiB";
+	if (b > 0 && t > b) {
+		logger.warn("memory") << "Memory usage exceeds the budget of "
+		                      << kib(b) << " KiB: " << summary();
+	}
+}
+
+std::string summary() {
+	std::string res;
+	char buf[64];
+	for (size_t i = 0; i < size_t(Pool::COUNT); i++) {
+		const size_t bytes = pools[i];
+		if (bytes > 0) {
+			snprintf(buf, sizeof(buf), "%s%s %zu KiB", res.empty() ? "" : ", ",
+			         name(Pool(i)), kib(bytes));
+			res += buf;
+		}
+	}
+	snprintf(buf, sizeof(buf), "%s(total %zu KiB, peak %zu KiB",
+	         res.empty() ? "" : " ", kib(total_bytes), kib(peak_bytes));
+	res += buf;
+	if (budget_bytes > 0) {
+		snprintf(buf, sizeof(buf), ", budget %zu KiB", kib(budget_bytes));
+		res += buf;
+	}
+	return res + ")";
+}
+
+void report(Logger &logger) { logger.info("memory") << summary(); }
+
+/******************************************************************************
+ * Class PressureMonitor                                                      *
+ ******************************************************************************/
+
+PressureMonitor::PressureMonitor(int stall_us, int window_us) : m_fd(-1) {
+	m_fd = open("/proc/pressure/memory", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (m_fd < 0) {
+		return;
+	}
+
+	// The trigger is registered by writing it including the terminating zero
+	char trigger[64];
+	snprintf(trigger, sizeof(trigger), "some %d %d", stall_us, window_us);
+	if (write(m_fd, trigger, strlen(trigger) + 1) < 0) {
+		close(m_fd);
+		m_fd = -1;
+	}
+}
+
+PressureMonitor::~PressureMonitor() {
+	if (m_fd >= 0) {
+		close(m_fd);
+	}
+}
+
+bool PressureMonitor::event_get(PollMode mode, Event &) {
+	if (mode & PollPri) {
+		request_reclaim();
+	}
+	return false;
+}
+
+}  // namespace memory
+}  // namespace inktty
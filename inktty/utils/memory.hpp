@@ -0,0 +1,213 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file memory.hpp
+ *
+ * Accounts for the memory allocated by the larger subsystems, such as the
+ * display layers, the cell arrays and the glyph caches. Whenever the total
+ * exceeds the configured budget, or the kernel reports memory pressure, the
+ * owner of the caches is asked to release memory that can be recomputed.
+ *
+ * @author Andreas Stöckel
+ */
+
+#ifndef INKTTY_UTILS_MEMORY_HPP
+#define INKTTY_UTILS_MEMORY_HPP
+
+#include <cstddef>
+#include <string>
+
+#include <inktty/term/events.hpp>
+
+namespace inktty {
+
+class Logger;
+
+namespace memory {
+/**
+ * Subsystems memory is accounted to.
+ */
+enum class Pool {
+	/**
+	 * Pixel buffers of the display, e.g. the layers of the MemoryDisplay.
+	 */
+	Display,
+
+	/**
+	 * Cell arrays of the terminal matrices.
+	 */
+	Cells,
+
+	/**
+	 * Rows stored in the scrollback history.
+	 */
+	Scrollback,
+
+	/**
+	 * Rendered glyph bitmaps.
+	 */
+	Glyphs,
+
+	/**
+	 * Composed cell images of the renderer.
+	 */
+	Tiles,
+
+	/**
+	 * Terminal state allocated by libvterm.
+	 */
+	VTerm,
+
+	/**
+	 * Buffered log messages.
+	 */
+	Log,
+
+	COUNT
+};
+
+/**
+ * Returns the name of the given pool used in the output.
+ */
+const char *name(Pool pool);
+
+/**
+ * The Account class holds the number of bytes a single object allocated in a
+ * pool. The bytes are added to the pool usage while the account exists. A
+ * copy of an account accounts for the same number of bytes again.
+ */
+class Account {
+private:
+	Pool m_pool;
+	size_t m_bytes;
+
+public:
+	explicit Account(Pool pool) : m_pool(pool), m_bytes(0) {}
+
+	Account(const Account &o) : m_pool(o.m_pool), m_bytes(0) {
+		set(o.m_bytes);
+	}
+
+	Account &operator=(const Account &o);
+
+	~Account() { set(0); }
+
+	/**
+	 * Sets the number of bytes allocated by the owner of the account. May be
+	 * called from any thread.
+	 */
+	void set(size_t bytes);
+
+	void add(size_t bytes) { set(m_bytes + bytes); }
+
+	void sub(size_t bytes) { set(m_bytes - bytes); }
+
+	size_t bytes() const { return m_bytes; }
+};
+
+/**
+ * Returns the number of bytes currently accounted to the given pool.
+ */
+size_t usage(Pool pool);
+
+/**
+ * Returns the number of bytes accounted to all pools and the maximum of this
+ * number since the program was started.
+ */
+size_t total();
+size_t peak();
+
+/**
+ * Sets the budget for the total memory usage in bytes. Zero disables the
+ * budget.
+ */
+void set_budget(size_t bytes);
+size_t budget();
+
+/**
+ * Asks for memory to be released at the next opportunity, e.g. because the
+ * system is low on memory. Async-signal-safe.
+ */
+void request_reclaim();
+
+/**
+ * Returns true if memory should be released, i.e. if a reclaim was requested
+ * or if the total exceeds the budget and grew since the last reclaim.
+ */
+bool under_pressure();
+
+/**
+ * Must be called after memory was released in response to under_pressure().
+ * Clears the pending request and logs the number of bytes released since
+ * the given total.
+ */
+void reclaimed(Logger &logger, size_t total_before);
+
+/**
+ * Returns the usage of all non-empty pools in a human readable form, e.g.
+ * "display 3072 KiB, glyphs 256 KiB (total 3328 KiB, peak 3400 KiB)".
+ */
+std::string summary();
+
+/**
+ * Writes the summary to the given logger.
+ */
+void report(Logger &logger);
+
+/**
+ * The PressureMonitor class is an event source that calls request_reclaim()
+ * whenever the kernel reports memory pressure. It uses the pressure stall
+ * information (PSI) trigger interface of Linux 5.2 and later. If the kernel
+ * does not support PSI, the monitor has no file descriptor and never fires.
+ */
+class PressureMonitor : public EventSource {
+private:
+	int m_fd;
+
+public:
+	/**
+	 * Registers a trigger that fires once some tasks stalled on memory for
+	 * more than stall_us microseconds within a window of window_us
+	 * microseconds.
+	 */
+	PressureMonitor(int stall_us = 150 * 1000, int window_us = 1000 * 1000);
+
+	~PressureMonitor() override;
+
+	PressureMonitor(const PressureMonitor &) = delete;
+	PressureMonitor &operator=(const PressureMonitor &) = delete;
+
+	/**
+	 * Returns true if the trigger was registered successfully.
+	 */
+	bool active() const { return m_fd >= 0; }
+
+	int event_fd() const override { return m_fd; }
+
+	PollMode event_fd_poll_mode() const override {
+		return (m_fd >= 0) ? PollPri : PollNone;
+	}
+
+	bool event_get(PollMode mode, Event &event) override;
+};
+
+}  // namespace memory
+}  // namespace inktty
+
+#endif /* INKTTY_UTILS_MEMORY_HPP */
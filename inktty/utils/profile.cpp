@@ -0,0 +1,225 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <sstream>
+
+#include <time.h>
+
+#include <inktty/utils/logger.hpp>
+#include <inktty/utils/profile.hpp>
+
+namespace inktty {
+
+/******************************************************************************
+ * Class Histogram                                                            *
+ ******************************************************************************/
+
+constexpr size_t Histogram::BUCKETS;
+
+size_t Histogram::bucket(int64_t value) {
+	size_t res = 0;
+	while (value > 0 && res + 1 < BUCKETS) {
+		value >>= 1;
+		res++;
+	}
+	return res;
+}
+
+void Histogram::add(int64_t value) {
+	m_buckets[bucket(value)]++;
+	m_min = m_count ? std::min(m_min, value) : value;
+	m_max = m_count ? std::max(m_max, value) : value;
+	m_sum += value;
+	m_count++;
+}
+
+void Histogram::reset() {
+	for (size_t i = 0; i < BUCKETS; i++) {
+		m_buckets[i] = 0;
+	}
+	m_count = 0;
+	m_sum = m_min = m_max = 0;
+}
+
+int64_t Histogram::percentile(double p) const {
+	if (m_count == 0) {
+		return 0;
+	}
+	const double n = p * double(m_count);
+	uint64_t acc = 0;
+	for (size_t i = 0; i < BUCKETS; i++) {
+		acc += m_buckets[i];
+		if (double(acc) >= n && acc > 0) {
+			return std::min(upper_bound(i), m_max);
+		}
+	}
+	return m_max;
+}
+
+std::string Histogram::to_string() const {
+	std::stringstream ss;
+	ss << "n=" << m_count << " mean=" << int64_t(mean()) << "us p50<="
+	   << percentile(0.5) << "us p90<=" << percentile(0.9) << "us p99<="
+	   << percentile(0.99) << "us max=" << max() << "us [";
+	bool first = true;
+	for (size_t i = 0; i < BUCKETS; i++) {
+		if (m_buckets[i]) {
+			ss << (first ? "" : " ") << "<" << upper_bound(i) << ":"
+			   << m_buckets[i];
+			first = false;
+		}
+	}
+	ss << "]";
+	return ss.str();
+}
+
+/******************************************************************************
+ * Namespace profile                                                          *
+ ******************************************************************************/
+
+namespace profile {
+
+namespace {
+/**
+ * Statistics shared by all threads.
+ */
+struct State {
+	std::mutex mtx;
+	Histogram histograms[size_t(Probe::COUNT)];
+	uint64_t counters[size_t(Counter::COUNT)] = {};
+	int64_t t_last_dump = -1;
+};
+
+State &state() {
+	static State state;
+	return state;
+}
+
+std::atomic<int64_t> t_key_pressed(-1);
+std::atomic<bool> dump_requested(false);
+}  // namespace
+
+const char *name(Probe probe) {
+	switch (probe) {
+		case Probe::EventWait:
+			return "event_wait";
+		case Probe::VTermReceive:
+			return "vterm_receive";
+		case Probe::MatrixCommit:
+			return "matrix_commit";
+		case Probe::RendererLowQuality:
+			return "renderer_low_quality";
+		case Probe::RendererHighQuality:
+			return "renderer_high_quality";
+		case Probe::DisplayCompose:
+			return "display_compose";
+		case Probe::DisplayUnlock:
+			return "display_unlock";
+		case Probe::KeyToSubmit:
+			return "key_to_submit";
+		case Probe::COUNT:
+			break;
+	}
+	return "unknown";
+}
+
+const char *name(Counter counter) {
+	switch (counter) {
+		case Counter::GlyphHit:
+			return "glyph_hit";
+		case Counter::GlyphMiss:
+			return "glyph_miss";
+		case Counter::FramesSkipped:
+			return "frames_skipped";
+		case Counter::COUNT:
+			break;
+	}
+	return "unknown";
+}
+
+int64_t now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return int64_t(ts.tv_sec) * 1000 * 1000 + int64_t(ts.tv_nsec) / 1000;
+}
+
+void record(Probe probe, int64_t dt) {
+	State &s = state();
+	std::lock_guard<std::mutex> lock(s.mtx);
+	s.histograms[size_t(probe)].add(dt);
+}
+
+void count(Counter counter, uint64_t n) {
+	State &s = state();
+	std::lock_guard<std::mutex> lock(s.mtx);
+	s.counters[size_t(counter)] += n;
+}
+
+void key_pressed(int64_t t) {
+	int64_t none = -1;
+	t_key_pressed.compare_exchange_strong(none, t);
+}
+
+void submitted(int64_t t) {
+	const int64_t t0 = t_key_pressed.exchange(-1);
+	if (t0 >= 0) {
+		record(Probe::KeyToSubmit, t - t0);
+	}
+}
+
+void dump(Logger &logger) {
+	State &s = state();
+	std::lock_guard<std::mutex> lock(s.mtx);
+	for (size_t i = 0; i < size_t(Probe::COUNT); i++) {
+		Histogram &h = s.histograms[i];
+		if (h.count()) {
+			logger.info("profile", std::string(name(Probe(i))) + ": " +
+			                           h.to_string());
+			h.reset();
+		}
+	}
+	for (size_t i = 0; i < size_t(Counter::COUNT); i++) {
+		if (s.counters[i]) {
+			logger.info("profile", std::string(name(Counter(i))) + ": " +
+			                           std::to_string(s.counters[i]));
+			s.counters[i] = 0;
+		}
+	}
+}
+
+void request_dump() { dump_requested = true; }
+
+bool poll(Logger &logger, int64_t t, int64_t interval) {
+	int64_t &t_last_dump = state().t_last_dump;
+	if (t_last_dump < 0) {
+		t_last_dump = t;
+	}
+	if (dump_requested.exchange(false) ||
+	    (interval > 0 && t - t_last_dump >= interval)) {
+		dump(logger);
+		t_last_dump = t;
+		return true;
+	}
+	return false;
+}
+
+}  // namespace profile
+}  // namespace inktty
@@ -0,0 +1,260 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file profile.hpp
+ *
+ * Lightweight instrumentation of the hot paths. Scoped timers and counters
+ * are placed using the INKTTY_PROFILE_* macros, which compile to nothing
+ * unless inktty is configured with "-Dprofile=true".
+ *
+ * @author Andreas Stöckel
+ */
+
+#ifndef INKTTY_UTILS_PROFILE_HPP
+#define INKTTY_UTILS_PROFILE_HPP
+
+#include <config.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace inktty {
+class Logger;
+
+/**
+ * The Histogram class collects durations in microseconds in buckets with
+ * exponentially growing bounds. Bucket zero holds all values smaller than
+ * one microsecond, bucket i > 0 holds values in [2^(i - 1), 2^i).
+ */
+class Histogram {
+public:
+	static constexpr size_t BUCKETS = 32;
+
+private:
+	uint64_t m_buckets[BUCKETS];
+	uint64_t m_count;
+	int64_t m_sum, m_min, m_max;
+
+public:
+	Histogram() { reset(); }
+
+	/**
+	 * Returns the index of the bucket the given value is sorted into.
+	 */
+	static size_t bucket(int64_t value);
+
+	/**
+	 * Returns the exclusive upper bound of the given bucket.
+	 */
+	static int64_t upper_bound(size_t bucket) {
+		return int64_t(1) << bucket;
+	}
+
+	void add(int64_t value);
+
+	void reset();
+
+	uint64_t count() const { return m_count; }
+	uint64_t count(size_t bucket) const { return m_buckets[bucket]; }
+	int64_t sum() const { return m_sum; }
+	int64_t min() const { return m_count ? m_min : 0; }
+	int64_t max() const { return m_count ? m_max : 0; }
+	double mean() const { return m_count ? double(m_sum) / m_count : 0.0; }
+
+	/**
+	 * Returns an upper bound for the given percentile p in [0, 1], i.e. the
+	 * upper bound of the bucket the percentile falls into, but at most the
+	 * largest recorded value.
+	 */
+	int64_t percentile(double p) const;
+
+	/**
+	 * Returns a single line summary including all non-empty buckets.
+	 */
+	std::string to_string() const;
+};
+
+namespace profile {
+/**
+ * Instrumented code regions.
+ */
+enum class Probe {
+	/**
+	 * Time spent in EventLoop::wait(), i.e. waiting for input.
+	 */
+	EventWait,
+
+	/**
+	 * Parsing the output of the child process in VTerm::receive_from_pty().
+	 */
+	VTermReceive,
+
+	/**
+	 * Collecting the updated cells in Matrix::commit().
+	 */
+	MatrixCommit,
+
+	/**
+	 * The low and high quality passes in MatrixRenderer::draw().
+	 */
+	RendererLowQuality,
+	RendererHighQuality,
+
+	/**
+	 * Composing the layers in MemoryDisplay::unlock().
+	 */
+	DisplayCompose,
+
+	/**
+	 * Handing the composed image to the display backend (e.g. converting it
+	 * and submitting the EPDC updates).
+	 */
+	DisplayUnlock,
+
+	/**
+	 * Latency between a key press and the next submission to the display
+	 * backend.
+	 */
+	KeyToSubmit,
+
+	COUNT
+};
+
+/**
+ * Event counters.
+ */
+enum class Counter { GlyphHit, GlyphMiss, FramesSkipped, COUNT };
+
+/**
+ * Returns the name of the given probe or counter used in the output.
+ */
+const char *name(Probe probe);
+const char *name(Counter counter);
+
+/**
+ * Returns the current time of the monotonic clock in microseconds.
+ */
+int64_t now();
+
+/**
+ * Adds a duration in microseconds to the histogram of the given probe. May be
+ * called from any thread.
+ */
+void record(Probe probe, int64_t dt);
+
+/**
+ * Increments the given counter. May be called from any thread.
+ */
+void count(Counter counter, uint64_t n = 1);
+
+/**
+ * Marks the time of a key press. Only the first key press since the last
+ * display submission is taken into account.
+ */
+void key_pressed(int64_t t);
+
+/**
+ * Marks the submission of an update to the display backend and records the
+ * latency since the pending key press, if any.
+ */
+void submitted(int64_t t);
+
+/**
+ * Writes all non-empty histograms and counters to the given logger and resets
+ * them.
+ */
+void dump(Logger &logger);
+
+/**
+ * Requests a dump at the next call to poll(). Async-signal-safe.
+ */
+void request_dump();
+
+/**
+ * Dumps the statistics to the given logger if a dump has been requested or
+ * if more than "interval" microseconds passed since the last dump. Returns
+ * true if a dump was written.
+ */
+bool poll(Logger &logger, int64_t t, int64_t interval);
+
+/**
+ * Records the time between its construction and destruction, or the first
+ * call to stop().
+ */
+class ScopedTimer {
+private:
+	Probe m_probe;
+	int64_t m_t0;
+
+public:
+	explicit ScopedTimer(Probe probe) : m_probe(probe), m_t0(now()) {}
+	~ScopedTimer() { stop(); }
+
+	void stop() {
+		if (m_t0 >= 0) {
+			record(m_probe, now() - m_t0);
+			m_t0 = -1;
+		}
+	}
+
+	ScopedTimer(const ScopedTimer &) = delete;
+	ScopedTimer &operator=(const ScopedTimer &) = delete;
+};
+}  // namespace profile
+}  // namespace inktty
+
+#define INKTTY_PROFILE_CONCAT_(a, b) a##b
+#define INKTTY_PROFILE_CONCAT(a, b) INKTTY_PROFILE_CONCAT_(a, b)
+
+#ifdef HAS_PROFILE
+#define INKTTY_PROFILE_SCOPE(probe)                                  \
+	::inktty::profile::ScopedTimer INKTTY_PROFILE_CONCAT(            \
+	    inktty_profile_scope_, __LINE__)(::inktty::profile::Probe::probe)
+#define INKTTY_PROFILE_TIMER(var, probe) \
+	::inktty::profile::ScopedTimer var(::inktty::profile::Probe::probe)
+#define INKTTY_PROFILE_STOP(var) var.stop()
+#define INKTTY_PROFILE_COUNT(counter) \
+	::inktty::profile::count(::inktty::profile::Counter::counter)
+#define INKTTY_PROFILE_KEY_PRESSED() \
+	::inktty::profile::key_pressed(::inktty::profile::now())
+#define INKTTY_PROFILE_SUBMITTED() \
+	::inktty::profile::submitted(::inktty::profile::now())
+#else
+#define INKTTY_PROFILE_SCOPE(probe) \
+	do {                            \
+	} while (false)
+#define INKTTY_PROFILE_TIMER(var, probe) \
+	do {                                 \
+	} while (false)
+#define INKTTY_PROFILE_STOP(var) \
+	do {                         \
+	} while (false)
+#define INKTTY_PROFILE_COUNT(counter) \
+	do {                              \
+	} while (false)
+#define INKTTY_PROFILE_KEY_PRESSED() \
+	do {                             \
+	} while (false)
+#define INKTTY_PROFILE_SUBMITTED() \
+	do {                           \
+	} while (false)
+#endif
+
+#endif /* INKTTY_UTILS_PROFILE_HPP */
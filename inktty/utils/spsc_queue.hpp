@@ -0,0 +1,144 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file spsc_queue.hpp
+ *
+ * Contains the SPSCQueue class, a bounded lock-free queue for exactly one
+ * producer and one consumer thread.
+ *
+ * @author Andreas Stöckel
+ */
+
+#ifndef INKTTY_UTILS_SPSC_QUEUE_HPP
+#define INKTTY_UTILS_SPSC_QUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace inktty {
+/**
+ * The SPSCQueue class is a bounded ring buffer that can be used to pass
+ * elements from one producer thread to one consumer thread without locking.
+ * Neither push() nor pop() ever blocks; they fail if the queue is full or
+ * empty, respectively. Only the producer may call push(), only the consumer
+ * may call pop().
+ */
+template <typename T>
+class SPSCQueue {
+private:
+	/**
+	 * Size of a cache line. The head and tail indices are placed on separate
+	 * cache lines to prevent the threads from invalidating each other's
+	 * caches.
+	 */
+	static constexpr size_t CACHE_LINE = 64;
+
+	std::vector<T> m_buf;
+	size_t m_mask;
+
+	char m_pad0[CACHE_LINE];
+
+	/**
+	 * Index of the next element to read. Only written by the consumer.
+	 */
+	std::atomic<size_t> m_head;
+
+	char m_pad1[CACHE_LINE - sizeof(std::atomic<size_t>)];
+
+	/**
+	 * Index of the next element to write. Only written by the producer.
+	 */
+	std::atomic<size_t> m_tail;
+
+	char m_pad2[CACHE_LINE - sizeof(std::atomic<size_t>)];
+
+	static size_t round_capacity(size_t capacity) {
+		size_t res = 1;
+		while (res < capacity) {
+			res <<= 1;
+		}
+		return res;
+	}
+
+public:
+	/**
+	 * Creates a queue that holds at least the given number of elements. The
+	 * capacity is rounded up to the next power of two.
+	 */
+	explicit SPSCQueue(size_t capacity)
+	    : m_buf(round_capacity(capacity)),
+	      m_mask(m_buf.size() - 1),
+	      m_head(0),
+	      m_tail(0) {}
+
+	SPSCQueue(const SPSCQueue &) = delete;
+	SPSCQueue &operator=(const SPSCQueue &) = delete;
+
+	/**
+	 * Returns the maximum number of elements in the queue.
+	 */
+	size_t capacity() const { return m_buf.size(); }
+
+	/**
+	 * Appends an element to the queue. Returns false if the queue is full, in
+	 * which case the element is not moved from.
+	 */
+	bool push(T &&value) {
+		const size_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail - m_head.load(std::memory_order_acquire) > m_mask) {
+			return false;
+		}
+		m_buf[tail & m_mask] = std::move(value);
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool push(const T &value) {
+		T tmp(value);
+		return push(std::move(tmp));
+	}
+
+	/**
+	 * Removes the oldest element from the queue and moves it to "value".
+	 * Returns false if the queue is empty.
+	 */
+	bool pop(T &value) {
+		const size_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_tail.load(std::memory_order_acquire)) {
+			return false;
+		}
+		value = std::move(m_buf[head & m_mask]);
+		m_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * Returns true if the queue is empty. The result is only reliable when
+	 * called by the consumer.
+	 */
+	bool empty() const {
+		return m_head.load(std::memory_order_acquire) ==
+		       m_tail.load(std::memory_order_acquire);
+	}
+};
+}  // namespace inktty
+
+#endif /* INKTTY_UTILS_SPSC_QUEUE_HPP */
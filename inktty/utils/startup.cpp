@@ -0,0 +1,108 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+#include <inktty/utils/logger.hpp>
+#include <inktty/utils/profile.hpp>
+#include <inktty/utils/startup.hpp>
+#include <inktty/utils/trace.hpp>
+
+namespace inktty {
+namespace startup {
+
+namespace {
+struct Phase {
+	const char *name;
+	int64_t t0, t1;
+};
+
+struct State {
+	std::mutex mtx;
+	int64_t t0 = -1;
+	int64_t t_last = -1;
+	bool done = false;
+	std::vector<Phase> phases;
+};
+
+State &state() {
+	static State s;
+	return s;
+}
+}  // namespace
+
+void begin() {
+	State &s = state();
+	std::lock_guard<std::mutex> lock(s.mtx);
+	s.t0 = s.t_last = profile::now();
+}
+
+void phase(const char *name) {
+	const int64_t t = profile::now();
+	State &s = state();
+	std::lock_guard<std::mutex> lock(s.mtx);
+	if (s.done) {
+		return;
+	}
+	if (s.t0 < 0) {
+		s.t0 = s.t_last = t;
+	}
+	s.phases.push_back(Phase{name, s.t_last, t});
+	trace::span(name, s.t_last, t);
+	s.t_last = t;
+}
+
+std::string summary() {
+	State &s = state();
+	std::lock_guard<std::mutex> lock(s.mtx);
+	std::string res;
+	char buf[64];
+	for (const Phase &p : s.phases) {
+		snprintf(buf, sizeof(buf), "%s%s %.1f ms", res.empty() ? "" : ", ",
+		         p.name, (p.t1 - p.t0) * 1e-3);
+		res += buf;
+	}
+	snprintf(buf, sizeof(buf), "%s(total %.1f ms)", res.empty() ? "" : " ",
+	         (s.t0 < 0) ? 0.0 : (s.t_last - s.t0) * 1e-3);
+	return res + buf;
+}
+
+void report(Logger &logger) {
+	{
+		State &s = state();
+		std::lock_guard<std::mutex> lock(s.mtx);
+		if (s.done) {
+			return;
+		}
+		s.done = true;
+	}
+	logger.info("startup") << summary();
+}
+
+void reset() {
+	State &s = state();
+	std::lock_guard<std::mutex> lock(s.mtx);
+	s.t0 = s.t_last = -1;
+	s.done = false;
+	s.phases.clear();
+}
+
+}  // namespace startup
+}  // namespace inktty
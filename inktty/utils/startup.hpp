@@ -0,0 +1,73 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file startup.hpp
+ *
+ * Measures the duration of the phases between the start of the program and
+ * the first prompt on the screen, such as loading the configuration, opening
+ * the display, spawning the shell and loading the font. The phases are logged
+ * once startup has finished and recorded as spans in the trace file.
+ *
+ * @author Andreas Stöckel
+ */
+
+#ifndef INKTTY_UTILS_STARTUP_HPP
+#define INKTTY_UTILS_STARTUP_HPP
+
+#include <string>
+
+namespace inktty {
+
+class Logger;
+
+namespace startup {
+/**
+ * Marks the beginning of the first phase. Should be called as early as
+ * possible in main().
+ */
+void begin();
+
+/**
+ * Marks the end of the phase with the given name, which started with the
+ * previous call to phase() or begin(). The name must be a string literal.
+ * Ignored once report() has been called.
+ */
+void phase(const char *name);
+
+/**
+ * Returns the phases recorded so far and their durations in a human readable
+ * form, e.g. "config 0.3 ms, font 12.5 ms (total 12.8 ms)".
+ */
+std::string summary();
+
+/**
+ * Writes the summary to the given logger. Only the first call has an effect,
+ * startup is considered finished afterwards.
+ */
+void report(Logger &logger);
+
+/**
+ * Discards all recorded phases and starts over. Used by the unit tests.
+ */
+void reset();
+
+}  // namespace startup
+}  // namespace inktty
+
+#endif /* INKTTY_UTILS_STARTUP_HPP */
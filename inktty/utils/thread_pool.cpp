@@ -0,0 +1,145 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <inktty/utils/thread_pool.hpp>
+
+namespace inktty {
+
+/******************************************************************************
+ * Class ThreadPool::Impl                                                     *
+ ******************************************************************************/
+
+class ThreadPool::Impl {
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_cond_task;
+	std::condition_variable m_cond_idle;
+
+	/**
+	 * Ring buffer holding the queued tasks. The buffer only grows, such that
+	 * submitting tasks does not allocate memory once it is large enough.
+	 */
+	std::vector<Task> m_tasks;
+	size_t m_head;
+	size_t m_count;
+
+	/**
+	 * Number of tasks currently being executed.
+	 */
+	size_t m_active;
+
+	/**
+	 * Set to true to stop the workers once the queue is empty.
+	 */
+	bool m_done;
+
+	std::vector<std::thread> m_threads;
+
+	void run(size_t worker) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true) {
+			m_cond_task.wait(lock, [this] { return m_done || m_count > 0; });
+			if (m_count == 0) {
+				return;  // m_done is set
+			}
+
+			// Fetch the next task and execute it without holding the lock
+			Task task = std::move(m_tasks[m_head]);
+			m_tasks[m_head] = nullptr;
+			m_head = (m_head + 1) % m_tasks.size();
+			m_count--;
+			m_active++;
+			lock.unlock();
+			task(worker);
+			lock.lock();
+			m_active--;
+
+			if (m_count == 0 && m_active == 0) {
+				m_cond_idle.notify_all();
+			}
+		}
+	}
+
+public:
+	Impl(size_t n_threads)
+	    : m_tasks(16), m_head(0), m_count(0), m_active(0), m_done(false) {
+		for (size_t i = 0; i < n_threads; i++) {
+			m_threads.emplace_back([this, i] { run(i); });
+		}
+	}
+
+	~Impl() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_done = true;
+		}
+		m_cond_task.notify_all();
+		for (std::thread &thread : m_threads) {
+			thread.join();
+		}
+	}
+
+	size_t size() const { return m_threads.size(); }
+
+	void submit(Task task) {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_count == m_tasks.size()) {
+				// Unroll the ring buffer into a larger one
+				std::vector<Task> tasks(2 * m_tasks.size());
+				for (size_t i = 0; i < m_count; i++) {
+					tasks[i] = std::move(m_tasks[(m_head + i) % m_tasks.size()]);
+				}
+				m_tasks.swap(tasks);
+				m_head = 0;
+			}
+			m_tasks[(m_head + m_count) % m_tasks.size()] = std::move(task);
+			m_count++;
+		}
+		m_cond_task.notify_one();
+	}
+
+	void wait() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cond_idle.wait(lock,
+		                 [this] { return m_count == 0 && m_active == 0; });
+	}
+};
+
+/******************************************************************************
+ * Class ThreadPool                                                           *
+ ******************************************************************************/
+
+ThreadPool::ThreadPool(size_t n_threads) : m_impl(new Impl(n_threads)) {}
+
+ThreadPool::~ThreadPool() {
+	// Implicitly destroy m_impl
+}
+
+size_t ThreadPool::size() const { return m_impl->size(); }
+
+void ThreadPool::submit(Task task) { m_impl->submit(std::move(task)); }
+
+void ThreadPool::wait() { m_impl->wait(); }
+
+}  // namespace inktty
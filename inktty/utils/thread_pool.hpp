@@ -0,0 +1,82 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file thread_pool.hpp
+ *
+ * Contains the ThreadPool class, a set of persistent worker threads executing
+ * tasks from a shared queue.
+ *
+ * @author Andreas Stöckel
+ */
+
+#ifndef INKTTY_UTILS_THREAD_POOL_HPP
+#define INKTTY_UTILS_THREAD_POOL_HPP
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+namespace inktty {
+/**
+ * The ThreadPool class starts a fixed number of worker threads when it is
+ * constructed and keeps them alive until it is destroyed. Tasks are executed
+ * in the order they were submitted. Each task receives the index of the
+ * worker thread it runs on, which allows tasks to use per-worker resources.
+ */
+class ThreadPool {
+public:
+	/**
+	 * Function executed by a worker. The argument is the index of the worker
+	 * in [0, size()).
+	 */
+	using Task = std::function<void(size_t worker)>;
+
+private:
+	class Impl;
+	std::unique_ptr<Impl> m_impl;
+
+public:
+	/**
+	 * Starts the given number of worker threads.
+	 */
+	explicit ThreadPool(size_t n_threads);
+
+	/**
+	 * Waits for all submitted tasks to complete and stops the workers.
+	 */
+	~ThreadPool();
+
+	/**
+	 * Returns the number of worker threads.
+	 */
+	size_t size() const;
+
+	/**
+	 * Adds a task to the queue.
+	 */
+	void submit(Task task);
+
+	/**
+	 * Blocks until all submitted tasks have been executed.
+	 */
+	void wait();
+};
+}  // namespace inktty
+
+#endif /* INKTTY_UTILS_THREAD_POOL_HPP */
@@ -0,0 +1,271 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <system_error>
+
+#include <inktty/utils/profile.hpp>
+#include <inktty/utils/trace.hpp>
+
+namespace inktty {
+namespace trace {
+
+namespace detail {
+std::atomic<bool> enabled(false);
+}  // namespace detail
+
+namespace {
+/**
+ * Key presses that did not reach the display after this many microseconds
+ * (e.g. because the child process did not echo them) are discarded.
+ */
+constexpr int64_t MAX_KEYSTROKE_AGE = 10 * 1000 * 1000;
+
+/**
+ * A key press on its way to the display.
+ */
+struct Keystroke {
+	uint64_t id;
+	int64_t t_input;
+	int64_t t_forwarded;
+	bool echoed;
+	uint32_t marker;
+};
+
+struct State {
+	std::mutex mtx;
+	FILE *file = nullptr;
+	bool first = true;
+	uint64_t next_id = 1;
+
+	/**
+	 * Key presses whose echo has not been submitted to the display yet.
+	 */
+	std::deque<Keystroke> pending;
+
+	/**
+	 * Key presses whose echo is part of an asynchronous display update that
+	 * has not been completed yet, ordered by marker.
+	 */
+	std::deque<Keystroke> in_flight;
+};
+
+State &state() {
+	static State state;
+	return state;
+}
+
+/**
+ * Returns a small, unique number identifying the calling thread.
+ */
+unsigned int thread_id() {
+	static std::atomic<unsigned int> next(1);
+	static thread_local unsigned int id = next++;
+	return id;
+}
+
+/**
+ * Appends a single event to the trace file. The state mutex must be held.
+ */
+void write(State &s, const char *fmt, ...) {
+	if (!s.file) {
+		return;
+	}
+	fputs(s.first ? "\n" : ",\n", s.file);
+	s.first = false;
+
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(s.file, fmt, args);
+	va_end(args);
+}
+
+void write_step(State &s, const Keystroke &k, const char *name, int64_t t) {
+	write(s,
+	      "{\"name\":\"keystroke\",\"cat\":\"latency\",\"ph\":\"n\","
+	      "\"id\":%llu,\"pid\":1,\"tid\":%u,\"ts\":%lld,"
+	      "\"args\":{\"step\":\"%s\"}}",
+	      (unsigned long long)k.id, thread_id(), (long long)t, name);
+}
+
+void write_end(State &s, const Keystroke &k, int64_t t, bool dropped) {
+	write(s,
+	      "{\"name\":\"keystroke\",\"cat\":\"latency\",\"ph\":\"e\","
+	      "\"id\":%llu,\"pid\":1,\"tid\":%u,\"ts\":%lld,"
+	      "\"args\":{\"latency_us\":%lld,\"marker\":%u,\"dropped\":%s}}",
+	      (unsigned long long)k.id, thread_id(), (long long)t,
+	      (long long)(t - k.t_input), k.marker, dropped ? "true" : "false");
+
+	// Keep the trace usable if inktty does not exit cleanly
+	if (s.file) {
+		fflush(s.file);
+	}
+}
+}  // namespace
+
+void start(const char *filename) {
+	State &s = state();
+	std::lock_guard<std::mutex> lock(s.mtx);
+	if (s.file) {
+		return;
+	}
+	s.file = fopen(filename, "w");
+	if (!s.file) {
+		throw std::system_error(errno, std::generic_category(),
+		                        std::string("Cannot open trace file ") +
+		                            filename);
+	}
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", s.file);
+	s.first = true;
+	detail::enabled = true;
+}
+
+void stop() {
+	State &s = state();
+	std::lock_guard<std::mutex> lock(s.mtx);
+	if (!s.file) {
+		return;
+	}
+	detail::enabled = false;
+	fputs("\n]}\n", s.file);
+	fclose(s.file);
+	s.file = nullptr;
+	s.pending.clear();
+	s.in_flight.clear();
+}
+
+int64_t now() { return profile::now(); }
+
+void span(const char *name, int64_t t0, int64_t t1, uint32_t marker) {
+	if (!enabled()) {
+		return;
+	}
+	State &s = state();
+	std::lock_guard<std::mutex> lock(s.mtx);
+	write(s,
+	      "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%lld,"
+	      "\"dur\":%lld,\"args\":{\"marker\":%u}}",
+	      name, thread_id(), (long long)t0, (long long)(t1 - t0), marker);
+}
+
+void instant(const char *name, int64_t t, uint32_t marker) {
+	if (!enabled()) {
+		return;
+	}
+	State &s = state();
+	std::lock_guard<std::mutex> lock(s.mtx);
+	write(s,
+	      "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%u,"
+	      "\"ts\":%lld,\"args\":{\"marker\":%u}}",
+	      name, thread_id(), (long long)t, marker);
+}
+
+void input(int64_t t) {
+	if (!enabled()) {
+		return;
+	}
+	State &s = state();
+	std::lock_guard<std::mutex> lock(s.mtx);
+
+	// Discard key presses that never made it to the display
+	while (!s.pending.empty() &&
+	       t - s.pending.front().t_input > MAX_KEYSTROKE_AGE) {
+		write_end(s, s.pending.front(), t, true);
+		s.pending.pop_front();
+	}
+
+	const Keystroke k{s.next_id++, t, -1, false, 0};
+	write(s,
+	      "{\"name\":\"keystroke\",\"cat\":\"latency\",\"ph\":\"b\","
+	      "\"id\":%llu,\"pid\":1,\"tid\":%u,\"ts\":%lld}",
+	      (unsigned long long)k.id, thread_id(), (long long)t);
+	s.pending.push_back(k);
+}
+
+void forwarded(int64_t t) {
+	if (!enabled()) {
+		return;
+	}
+	State &s = state();
+	std::lock_guard<std::mutex> lock(s.mtx);
+	for (Keystroke &k : s.pending) {
+		if (k.t_forwarded < 0) {
+			k.t_forwarded = t;
+			write_step(s, k, "pty_write", t);
+		}
+	}
+}
+
+void output(int64_t t) {
+	if (!enabled()) {
+		return;
+	}
+	State &s = state();
+	std::lock_guard<std::mutex> lock(s.mtx);
+	for (Keystroke &k : s.pending) {
+		if (k.t_forwarded >= 0 && !k.echoed) {
+			k.echoed = true;
+			write_step(s, k, "echo", t);
+		}
+	}
+}
+
+void submitted(int64_t t, uint32_t marker) {
+	if (!enabled()) {
+		return;
+	}
+	State &s = state();
+	std::lock_guard<std::mutex> lock(s.mtx);
+	std::deque<Keystroke> pending;
+	for (Keystroke &k : s.pending) {
+		if (!k.echoed) {
+			pending.push_back(k);
+			continue;
+		}
+		k.marker = marker;
+		write_step(s, k, "submitted", t);
+		if (marker == 0) {
+			write_end(s, k, t, false);
+		} else {
+			s.in_flight.push_back(k);
+		}
+	}
+	s.pending.swap(pending);
+}
+
+void completed(int64_t t, uint32_t marker) {
+	if (!enabled()) {
+		return;
+	}
+	State &s = state();
+	std::lock_guard<std::mutex> lock(s.mtx);
+	// Markers are increasing, but may wrap around
+	while (!s.in_flight.empty() &&
+	       int32_t(s.in_flight.front().marker - marker) <= 0) {
+		write_end(s, s.in_flight.front(), t, false);
+		s.in_flight.pop_front();
+	}
+}
+
+}  // namespace trace
+}  // namespace inktty
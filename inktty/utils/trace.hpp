@@ -0,0 +1,135 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file trace.hpp
+ *
+ * Records a timeline of the processing stages and of the latency between key
+ * presses and the corresponding display updates as a Chrome trace file, which
+ * can be inspected with chrome://tracing or Perfetto.
+ *
+ * @author Andreas Stöckel
+ */
+
+#ifndef INKTTY_UTILS_TRACE_HPP
+#define INKTTY_UTILS_TRACE_HPP
+
+#include <atomic>
+#include <cstdint>
+
+namespace inktty {
+namespace trace {
+namespace detail {
+extern std::atomic<bool> enabled;
+}  // namespace detail
+
+/**
+ * Returns true if a trace is being recorded. All other functions in this
+ * namespace return immediately if this is not the case.
+ */
+inline bool enabled() {
+	return detail::enabled.load(std::memory_order_relaxed);
+}
+
+/**
+ * Starts writing a trace to the given file. Throws a std::system_error if the
+ * file cannot be opened.
+ */
+void start(const char *filename);
+
+/**
+ * Finishes the trace file. Keystrokes that did not reach the display yet are
+ * discarded.
+ */
+void stop();
+
+/**
+ * Returns the current time of the monotonic clock in microseconds. All
+ * timestamps passed to the functions below must be taken from this clock.
+ */
+int64_t now();
+
+/**
+ * Adds a processing stage running from t0 to t1 on the calling thread to
+ * the trace. The name must be a string literal.
+ */
+void span(const char *name, int64_t t0, int64_t t1, uint32_t marker = 0);
+
+/**
+ * Adds an instantaneous event on the calling thread to the trace.
+ */
+void instant(const char *name, int64_t t, uint32_t marker = 0);
+
+/**
+ * Marks a key press that was read at time t. Each key press is traced until
+ * the display update showing its echo is complete.
+ */
+void input(int64_t t);
+
+/**
+ * Marks the time at which the input was written to the PTY.
+ */
+void forwarded(int64_t t);
+
+/**
+ * Marks the arrival of output of the child process, which is assumed to
+ * contain the echo of all forwarded key presses.
+ */
+void output(int64_t t);
+
+/**
+ * Marks the submission of a display update containing the echo of all
+ * pending key presses. Displays with an asynchronous update pipeline pass
+ * the marker of the last submitted update and call completed() once it is
+ * done; a zero marker denotes a synchronous update that is complete when
+ * this function is called.
+ */
+void submitted(int64_t t, uint32_t marker = 0);
+
+/**
+ * Marks the completion of the update with the given marker and all updates
+ * submitted before it. Records the end-to-end latency of the corresponding
+ * key presses.
+ */
+void completed(int64_t t, uint32_t marker);
+
+/**
+ * Adds a span covering the lifetime of the Span object to the trace.
+ */
+class Span {
+private:
+	const char *m_name;
+	int64_t m_t0;
+
+public:
+	explicit Span(const char *name)
+	    : m_name(name), m_t0(enabled() ? now() : -1) {}
+
+	~Span() {
+		if (m_t0 >= 0) {
+			span(m_name, m_t0, now());
+		}
+	}
+
+	Span(const Span &) = delete;
+	Span &operator=(const Span &) = delete;
+};
+}  // namespace trace
+}  // namespace inktty
+
+#endif /* INKTTY_UTILS_TRACE_HPP */
@@ -16,12 +16,38 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <cstring>
+
 #include <utf8proc/utf8proc.h>
 #include <inktty/utils/utf8.hpp>
 
 namespace inktty {
 /******************************************************************************
- * Class UTF8Encoder                                                          *
+ * Static helpers                                                             *
+ ******************************************************************************/
+
+/**
+ * Returns the length of the run of ASCII characters at the beginning of the
+ * given buffer. Tests eight bytes at a time.
+ */
+static size_t ascii_run(const uint8_t *src, size_t n) {
+	static constexpr uint64_t HIGH_BITS = 0x8080808080808080ULL;
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		uint64_t w;
+		memcpy(&w, src + i, sizeof(w));
+		if (w & HIGH_BITS) {
+			break;
+		}
+	}
+	while (i < n && !(src[i] & 0x80)) {
+		i++;
+	}
+	return i;
+}
+
+/******************************************************************************
+ * Class UTF8Decoder                                                          *
  ******************************************************************************/
 
 UTF8Decoder::UTF8Decoder() { reset(); }
@@ -93,6 +119,40 @@ error:
 	return Status::Error();
 }
 
+size_t UTF8Decoder::decode(const uint8_t *src, size_t n,
+                           std::vector<uint32_t> &tar) {
+	size_t n_errors = 0;
+	size_t i = 0;
+	while (i < n) {
+		// ASCII characters are starters and never compose with the previous
+		// codepoint; copy them without normalisation. Only the last one is
+		// relevant for normalising the following codepoints.
+		if (m_n_continuation_bytes == 0) {
+			const size_t run = ascii_run(src + i, n - i);
+			if (run > 0) {
+				tar.insert(tar.end(), src + i, src + i + run);
+				i += run;
+				m_cp = m_cp_buf[0] = src[i - 1];
+				m_cp_buf_cur = 1;
+				continue;
+			}
+		}
+
+		// Decode all other characters one byte at a time
+		const Status res = feed(src[i++]);
+		if (res.error) {
+			n_errors++;
+		} else if (res.valid) {
+			if (res.replaces_last && !tar.empty()) {
+				tar.back() = res.codepoint;
+			} else {
+				tar.push_back(res.codepoint);
+			}
+		}
+	}
+	return n_errors;
+}
+
 void UTF8Decoder::reset() {
 	m_cp = 0;
 	m_cp_buf_cur = 0;
@@ -125,4 +185,18 @@ int UTF8Encoder::unicode_to_utf8(uint32_t glyph, char *s) {
 	}
 	return 0;
 }
+
+void UTF8Encoder::encode(const uint32_t *src, size_t n,
+                         std::vector<uint8_t> &tar) {
+	tar.reserve(tar.size() + n);
+	for (size_t i = 0; i < n; i++) {
+		if (src[i] < 0x80) {
+			tar.push_back(src[i]);
+		} else {
+			char s[4];
+			const int len = unicode_to_utf8(src[i], s);
+			tar.insert(tar.end(), s, s + len);
+		}
+	}
+}
 }  // namespace inktty
@@ -19,7 +19,9 @@
 #ifndef INKTTY_UTILS_UTF8
 #define INKTTY_UTILS_UTF8
 
+#include <cstddef>
 #include <cstdint>
+#include <vector>
 
 namespace inktty {
 
@@ -57,12 +59,30 @@ public:
 	UTF8Decoder();
 
 	Status feed(uint8_t c);
+
+	/**
+	 * Decodes the given buffer and appends the resulting codepoints to "tar".
+	 * Codepoints that replace the previous one due to normalisation overwrite
+	 * the last element of "tar"; invalid sequences are skipped. The decoder
+	 * state carries over to the next call, i.e. codepoints may be split
+	 * across buffers. Runs of ASCII characters are processed a machine word
+	 * at a time.
+	 *
+	 * @return the number of invalid sequences.
+	 */
+	size_t decode(const uint8_t *src, size_t n, std::vector<uint32_t> &tar);
+
 	void reset();
 };
 
 class UTF8Encoder {
 public:
 	static int unicode_to_utf8(uint32_t glyph, char *s);
+
+	/**
+	 * Appends the UTF-8 encoding of the given codepoints to "tar".
+	 */
+	static void encode(const uint32_t *src, size_t n, std::vector<uint8_t> &tar);
 };
 }
 
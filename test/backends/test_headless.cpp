@@ -0,0 +1,106 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <unistd.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <foxen/unittest.h>
+#include <inktty/backends/headless.hpp>
+
+using namespace inktty;
+
+static void fill_and_commit(Display &display, const Rect &r, const RGBA &c,
+                            UpdateMode mode = UpdateMode()) {
+	display.lock();
+	display.fill(Display::Layer::Background, c, r);
+	display.commit(r, mode);
+	display.unlock();
+}
+
+void test_headless_statistics() {
+	HeadlessDisplay display(64, 48);
+	fill_and_commit(display, Rect(0, 0, 64, 48), RGBA::White);
+	fill_and_commit(display, Rect(8, 8, 24, 16), RGBA(255, 0, 0));
+
+	/* Partially committing unchanged content does not cause an update */
+	fill_and_commit(display, Rect(8, 8, 24, 16), RGBA(255, 0, 0),
+	                UpdateMode(UpdateMode::Identity, UpdateMode::Partial));
+
+	const HeadlessDisplay::Statistics s = display.statistics();
+	EXPECT_EQ(2U, s.frames);
+	EXPECT_EQ(2U, s.updates);
+	EXPECT_EQ(64U * 48U + 16U * 8U, s.pixels);
+	EXPECT_TRUE(RGBA(255, 0, 0) == display.pixel(10, 10));
+	EXPECT_TRUE(RGBA::White == display.pixel(30, 30));
+}
+
+void test_headless_double_buffered() {
+	HeadlessDisplay display(64, 48);
+	display.set_double_buffered(true);
+	fill_and_commit(display, Rect(0, 0, 64, 48), RGBA(0, 0, 255));
+	display.flush();
+	EXPECT_EQ(1U, display.statistics().frames);
+	EXPECT_TRUE(RGBA(0, 0, 255) == display.pixel(63, 47));
+}
+
+void test_headless_epaper_emulation() {
+	HeadlessDisplay display(64, 48, true);
+	fill_and_commit(display, Rect(0, 0, 64, 48), RGBA(255, 0, 0));
+
+	/* The emulated panel only shows grey values */
+	const RGBA c = display.pixel(5, 5);
+	EXPECT_EQ(c.r, c.g);
+	EXPECT_EQ(c.g, c.b);
+}
+
+void test_headless_write_png() {
+	HeadlessDisplay display(64, 48);
+	fill_and_commit(display, Rect(0, 0, 64, 48), RGBA::White);
+	fill_and_commit(display, Rect(0, 0, 32, 48), RGBA(0, 128, 0));
+
+	char filename[] = "/tmp/inktty_test_headless_XXXXXX";
+	const int fd = mkstemp(filename);
+	ASSERT_TRUE(fd >= 0);
+	close(fd);
+	ASSERT_TRUE(display.write_png(filename));
+
+	int w = 0, h = 0, n = 0;
+	uint8_t *img = stbi_load(filename, &w, &h, &n, 4);
+	remove(filename);
+	ASSERT_TRUE(img != nullptr);
+	EXPECT_EQ(64, w);
+	EXPECT_EQ(48, h);
+	EXPECT_EQ(0, img[0]);
+	EXPECT_EQ(128, img[1]);
+	EXPECT_EQ(255, img[(10 * 64 + 40) * 4]);
+	stbi_image_free(img);
+}
+
+int main() {
+	RUN(test_headless_statistics);
+	RUN(test_headless_double_buffered);
+	RUN(test_headless_epaper_emulation);
+	RUN(test_headless_write_png);
+	DONE;
+}
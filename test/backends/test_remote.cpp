@@ -0,0 +1,165 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <foxen/unittest.h>
+#include <inktty/backends/headless.hpp>
+#include <inktty/backends/remote.hpp>
+#include <inktty/backends/remote_protocol.hpp>
+
+using namespace inktty;
+
+static void fill_and_commit(Display &display, const Rect &r, const RGBA &c) {
+	display.lock();
+	display.fill(Display::Layer::Background, c, r);
+	display.commit(r);
+	display.unlock();
+}
+
+static int connect_to(int port) {
+	const int fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	struct timeval tv = {5, 0};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	return fd;
+}
+
+static std::vector<uint8_t> read_exact(int fd, size_t n) {
+	std::vector<uint8_t> res(n);
+	size_t pos = 0;
+	while (pos < n) {
+		const ssize_t m = recv(fd, res.data() + pos, n - pos, 0);
+		if (m <= 0) {
+			res.resize(pos);
+			break;
+		}
+		pos += m;
+	}
+	return res;
+}
+
+/**
+ * Reads a MSG_RECT message and returns the decoded pixels.
+ */
+static std::vector<uint8_t> read_rect(int fd, Rect &r) {
+	std::vector<uint8_t> hdr = read_exact(fd, 13);
+	if (hdr.size() != 13 || hdr[0] != remote::MSG_RECT) {
+		return std::vector<uint8_t>();
+	}
+	r = Rect::sized(remote::get_u16(&hdr[1]), remote::get_u16(&hdr[3]),
+	                remote::get_u16(&hdr[5]), remote::get_u16(&hdr[7]));
+	const std::vector<uint8_t> data = read_exact(fd, remote::get_u32(&hdr[9]));
+	std::vector<uint8_t> res(r.area());
+	if (!remote::decode_rle4(data.data(), data.size(), res.data(),
+	                         res.size())) {
+		res.clear();
+	}
+	return res;
+}
+
+void test_remote_rle4() {
+	std::vector<uint8_t> src(40, 0xFF);
+	std::fill(src.begin() + 20, src.end(), 0x12);
+	std::fill(src.begin() + 35, src.end(), 0x80);
+
+	std::vector<uint8_t> enc;
+	remote::encode_rle4(src.data(), src.size(), enc);
+	ASSERT_EQ(4U, enc.size());
+	EXPECT_EQ(0xFF, enc[0]);  // 16 x 0xF
+	EXPECT_EQ(0x3F, enc[1]);  // 4 x 0xF
+	EXPECT_EQ(0xE1, enc[2]);  // 15 x 0x1
+	EXPECT_EQ(0x48, enc[3]);  // 5 x 0x8
+
+	std::vector<uint8_t> dec(src.size());
+	EXPECT_EQ(4U, remote::decode_rle4(enc.data(), enc.size(), dec.data(),
+	                                  dec.size()));
+	EXPECT_EQ(0xFF, dec[0]);
+	EXPECT_EQ(0x11, dec[20]);
+	EXPECT_EQ(0x88, dec[39]);
+
+	/* Truncated input is rejected */
+	EXPECT_EQ(0U, remote::decode_rle4(enc.data(), 3, dec.data(), dec.size()));
+}
+
+void test_remote_stream() {
+	HeadlessDisplay display(64, 48);
+	fill_and_commit(display, Rect(0, 0, 64, 48), RGBA::White);
+
+	RemoteFramebuffer remote(display, "127.0.0.1", 0);
+	EXPECT_FALSE(remote.connected());
+	const int fd = connect_to(remote.port());
+	ASSERT_TRUE(fd >= 0);
+
+	/* Accepting the viewer requests a redraw, the next unlock sends the
+	   entire display */
+	Event event;
+	EXPECT_TRUE(remote.event_get(EventSource::PollIn, event));
+	EXPECT_TRUE(event.type == Event::Type::REPAINT);
+	EXPECT_TRUE(remote.connected());
+	display.lock();
+	display.unlock();
+	const std::vector<uint8_t> hdr = read_exact(fd, 8 + 5);
+	ASSERT_EQ(13U, hdr.size());
+	EXPECT_EQ(0, memcmp(hdr.data(), remote::MAGIC, 8));
+	EXPECT_EQ(remote::MSG_SIZE, hdr[8]);
+	EXPECT_EQ(64U, remote::get_u16(&hdr[9]));
+	EXPECT_EQ(48U, remote::get_u16(&hdr[11]));
+
+	Rect r;
+	std::vector<uint8_t> px = read_rect(fd, r);
+	EXPECT_TRUE(r == Rect(0, 0, 64, 48));
+	ASSERT_EQ(64U * 48U, px.size());
+	EXPECT_EQ(0xFF, px[0]);
+	EXPECT_EQ(0xFF, px[64 * 48 - 1]);
+	EXPECT_EQ(remote::MSG_FRAME, read_exact(fd, 1)[0]);
+
+	/* Subsequent updates only contain the committed regions */
+	fill_and_commit(display, Rect(8, 8, 24, 16), RGBA::Black);
+	px = read_rect(fd, r);
+	EXPECT_TRUE(r == Rect(8, 8, 24, 16));
+	ASSERT_EQ(16U * 8U, px.size());
+	EXPECT_EQ(0x00, px[0]);
+	EXPECT_EQ(remote::MSG_FRAME, read_exact(fd, 1)[0]);
+
+	/* Closing the connection is detected */
+	close(fd);
+	remote.event_get(EventSource::PollIn, event);
+	EXPECT_FALSE(remote.connected());
+}
+
+int main() {
+	RUN(test_remote_rle4);
+	RUN(test_remote_stream);
+	DONE;
+}
@@ -0,0 +1,125 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+
+#include <foxen/unittest.h>
+#include <inktty/gfx/compose.hpp>
+
+using namespace inktty;
+
+void test_compose_over_exact() {
+	// Compare against the exact, rounded result for all background and alpha
+	// values with transparent black as foreground
+	std::vector<RGBA> bg, mg, tar(256);
+	for (int a = 0; a < 256; a++) {
+		bg.clear();
+		mg.clear();
+		for (int x = 0; x < 256; x++) {
+			bg.emplace_back(x, x, x);
+			mg.emplace_back(0, 0, 0, a);
+		}
+		compose::over(tar.data(), bg.data(), mg.data(), 256);
+		for (int x = 0; x < 256; x++) {
+			const int expected = (x * (255 - a) + 127) / 255;
+			EXPECT_EQ(expected, int(tar[x].r));
+			EXPECT_EQ(255, int(tar[x].a));
+		}
+	}
+}
+
+void test_compose_over_matches_scalar() {
+	// Use an odd number of pixels and an unaligned start to exercise the tail
+	// handling of the vectorised kernels
+	const size_t n = 37;
+	std::vector<RGBA> bg(n + 1), mg(n + 1), tar0(n + 1), tar1(n + 1);
+	uint32_t seed = 1;
+	for (size_t i = 0; i <= n; i++) {
+		seed = seed * 1103515245U + 12345U;
+		bg[i] = RGBA(seed >> 8, seed >> 16, seed >> 24);
+		seed = seed * 1103515245U + 12345U;
+		mg[i] = RGBA(seed >> 8, seed >> 16, seed >> 24, seed).premultiply_alpha();
+	}
+	compose::over(&tar0[1], &bg[1], &mg[1], n);
+	compose::over_scalar(&tar1[1], &bg[1], &mg[1], n);
+	for (size_t i = 1; i <= n; i++) {
+		EXPECT_TRUE(tar0[i] == tar1[i]);
+	}
+}
+
+void test_compose_mask() {
+	const size_t n = 23;
+	std::vector<uint8_t> mask(n);
+	std::vector<RGBA> tar0(n, RGBA(1, 2, 3, 4)), tar1(tar0);
+	for (size_t i = 0; i < n; i++) {
+		mask[i] = (i % 3 == 0) ? 0 : uint8_t(i * 11);
+	}
+	const RGBA c(0x80, 0xFF, 0x11);
+
+	// Generic masks must match the scalar implementation
+	compose::mask(tar0.data(), mask.data(), c, n);
+	compose::mask_scalar(tar1.data(), mask.data(), c, n);
+	for (size_t i = 0; i < n; i++) {
+		EXPECT_TRUE(tar0[i] == tar1[i]);
+	}
+
+	// Binary masks are a select between the colour and the old content
+	for (size_t i = 0; i < n; i++) {
+		mask[i] = (i % 3 == 0) ? 0 : 255;
+	}
+	compose::mask(tar0.data(), mask.data(), c, n, true);
+	compose::mask_scalar(tar1.data(), mask.data(), c, n);
+	for (size_t i = 0; i < n; i++) {
+		EXPECT_TRUE(tar0[i] == tar1[i]);
+	}
+
+	// Erasing resets the masked pixels to transparent black
+	compose::mask_erase(tar0.data(), mask.data(), n);
+	for (size_t i = 0; i < n; i++) {
+		EXPECT_TRUE(tar0[i] == ((i % 3 == 0) ? tar1[i] : RGBA(0, 0, 0, 0)));
+	}
+}
+
+void test_compose_greyscale() {
+	// For grey values, the greyscale kernels must match the RGBA kernels
+	const size_t n = 37;
+	std::vector<uint8_t> mask(n), bg(n), tar0(n);
+	std::vector<GreyA> mg(n);
+	std::vector<RGBA> bg_rgba(n), mg_rgba(n), tar1(n);
+	for (size_t i = 0; i < n; i++) {
+		mask[i] = (i * 41) & 0xFF;
+		bg[i] = (i * 97) & 0xFF;
+		bg_rgba[i] = RGBA(bg[i], bg[i], bg[i]);
+	}
+	compose::mask(mg.data(), mask.data(), 0xC0, n);
+	compose::mask(mg_rgba.data(), mask.data(), RGBA(0xC0, 0xC0, 0xC0), n);
+	compose::over(tar0.data(), bg.data(), mg.data(), n);
+	compose::over(tar1.data(), bg_rgba.data(), mg_rgba.data(), n);
+	for (size_t i = 0; i < n; i++) {
+		EXPECT_EQ(mg[i].a, mg_rgba[i].a);
+		EXPECT_EQ(tar0[i], tar1[i].r);
+	}
+}
+
+int main() {
+	RUN(test_compose_over_exact);
+	RUN(test_compose_over_matches_scalar);
+	RUN(test_compose_mask);
+	RUN(test_compose_greyscale);
+	DONE;
+}
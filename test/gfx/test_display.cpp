@@ -0,0 +1,347 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <foxen/unittest.h>
+#include <inktty/gfx/display.hpp>
+#include <inktty/gfx/panel_shadow.hpp>
+
+using namespace inktty;
+
+/**
+ * Display backend copying the committed regions of the composite image into
+ * a plain RGBA buffer.
+ */
+class TestDisplay : public MemoryDisplay {
+private:
+	int m_width, m_height;
+
+protected:
+	Rect do_lock() override { return Rect(0, 0, m_width, m_height); }
+
+	void do_unlock(const CommitRequest *begin, const CommitRequest *end,
+	               const RGBA *buf, size_t stride) override {
+		while (hold) {
+			std::this_thread::yield();
+		}
+		presented++;
+		committed.clear();
+		for (const CommitRequest *req = begin; req < end; req++) {
+			committed.push_back(req->r);
+		}
+		for_each_band(begin, end, [this, buf, stride](const Rect &r) {
+			for (int y = r.y0; y < r.y1; y++) {
+				const RGBA *src = buf + y * stride / sizeof(RGBA);
+				for (int x = r.x0; x < r.x1; x++) {
+					pixels[y * m_width + x] = src[x];
+					touched[y * m_width + x]++;
+				}
+			}
+		});
+	}
+
+public:
+	std::vector<RGBA> pixels;
+	std::vector<int> touched;
+	std::vector<Rect> committed;
+	std::atomic<bool> hold;
+	std::atomic<int> presented;
+
+	TestDisplay(int width, int height, unsigned int threads,
+	            bool double_buffered = false)
+	    : m_width(width),
+	      m_height(height),
+	      pixels(width * height, RGBA::Black),
+	      touched(width * height, 0),
+	      hold(false),
+	      presented(0) {
+		set_threads(threads);
+		set_double_buffered(double_buffered);
+	}
+
+	~TestDisplay() { flush(); }
+
+	void enable_panel_shadow() { set_panel_shadow(true); }
+
+	const PanelShadow &shadow() const { return *panel_shadow(); }
+};
+
+static void draw(TestDisplay &display) {
+	display.lock();
+	display.fill(Display::Layer::Background, RGBA::White);
+	display.fill(Display::Layer::Background, RGBA(255, 0, 0),
+	             Rect(10, 10, 300, 200));
+	display.fill(Display::Layer::Presentation, RGBA(0, 0, 255, 128),
+	             Rect(100, 50, 400, 280));
+	display.fill_dither(Display::Layer::Background, 128, Rect(0, 250, 50, 300));
+
+	// Overlapping commit requests, large enough to be processed in parallel
+	display.commit(Rect(0, 0, 400, 200));
+	display.commit(Rect(50, 100, 350, 300));
+	display.unlock();
+}
+
+void test_display_threads_match_serial() {
+	TestDisplay serial(400, 300, 0), parallel(400, 300, 4);
+	draw(serial);
+	draw(parallel);
+	for (size_t i = 0; i < serial.pixels.size(); i++) {
+		EXPECT_TRUE(serial.pixels[i] == parallel.pixels[i]);
+	}
+}
+
+void test_display_threads_cover_each_row_once() {
+	TestDisplay serial(400, 300, 0), parallel(400, 300, 3);
+	draw(serial);
+	draw(parallel);
+	for (size_t i = 0; i < serial.touched.size(); i++) {
+		EXPECT_EQ(serial.touched[i], parallel.touched[i]);
+	}
+}
+
+static void draw_cursor(TestDisplay &display) {
+	display.lock();
+	display.fill(Display::Layer::Presentation, RGBA::Black,
+	             Rect(200, 150, 210, 170));
+	display.commit(Rect(200, 150, 210, 170));
+	display.unlock();
+}
+
+void test_display_double_buffered() {
+	TestDisplay serial(400, 300, 0), buffered(400, 300, 2, true);
+	draw(serial);
+	draw_cursor(serial);
+
+	// The first lock() fetches the display size synchronously
+	buffered.lock();
+	buffered.unlock();
+	buffered.flush();
+	EXPECT_EQ(2, int(buffered.presented));
+
+	// Unlocking must not wait for the backend to present the frame
+	buffered.hold = true;
+	draw(buffered);
+	EXPECT_EQ(2, int(buffered.presented));
+	buffered.hold = false;
+
+	draw_cursor(buffered);
+	buffered.flush();
+	EXPECT_EQ(4, int(buffered.presented));
+	for (size_t i = 0; i < serial.pixels.size(); i++) {
+		EXPECT_TRUE(serial.pixels[i] == buffered.pixels[i]);
+	}
+}
+
+static void fill_and_commit(TestDisplay &display, const Rect &r,
+                            const RGBA &c, const Rect &rc, UpdateMode mode) {
+	display.lock();
+	display.fill(Display::Layer::Background, c, r);
+	display.commit(rc, mode);
+	display.unlock();
+}
+
+void test_display_skip_unchanged() {
+	TestDisplay display(400, 300, 0);
+	const UpdateMode partial(UpdateMode::Identity, UpdateMode::Partial);
+	const UpdateMode mono(UpdateMode::Identity, UpdateMode::SourceMono);
+
+	/* Nothing is known about the display content initially */
+	fill_and_commit(display, Rect(0, 0, 400, 300), RGBA::White, Rect(),
+	                partial);
+	EXPECT_EQ(1U, display.committed.size());
+	EXPECT_TRUE(Rect(0, 0, 400, 300) == display.committed[0]);
+
+	/* Unchanged content is not committed again... */
+	fill_and_commit(display, Rect(10, 10, 50, 50), RGBA::White,
+	                Rect(0, 0, 100, 100), partial);
+	EXPECT_EQ(0U, display.committed.size());
+
+	/* ...unless all pixels should be updated */
+	fill_and_commit(display, Rect(10, 10, 50, 50), RGBA::White,
+	                Rect(0, 0, 100, 100), UpdateMode());
+	EXPECT_EQ(1U, display.committed.size());
+	EXPECT_TRUE(Rect(0, 0, 100, 100) == display.committed[0]);
+
+	/* Commit requests shrink to the changed pixels */
+	fill_and_commit(display, Rect(20, 20, 30, 25), RGBA::Black,
+	                Rect(0, 0, 100, 100), partial);
+	EXPECT_EQ(1U, display.committed.size());
+	EXPECT_TRUE(Rect(20, 20, 30, 25) == display.committed[0]);
+
+	/* Monochrome updates may not show the composite image as it is, a
+	   following update of the same content must be committed */
+	fill_and_commit(display, Rect(60, 60, 70, 70), RGBA(255, 0, 0),
+	                Rect(60, 60, 70, 70), mono);
+	EXPECT_EQ(1U, display.committed.size());
+	fill_and_commit(display, Rect(60, 60, 70, 70), RGBA(255, 0, 0),
+	                Rect(50, 50, 70, 70), partial);
+	EXPECT_EQ(1U, display.committed.size());
+	EXPECT_TRUE(Rect(60, 60, 70, 70) == display.committed[0]);
+	fill_and_commit(display, Rect(60, 60, 70, 70), RGBA(255, 0, 0),
+	                Rect(50, 50, 70, 70), partial);
+	EXPECT_EQ(0U, display.committed.size());
+
+	/* The displayed content matches the content drawn */
+	EXPECT_TRUE(RGBA(0, 0, 0) == display.pixels[22 * 400 + 22]);
+	EXPECT_TRUE(RGBA(255, 0, 0) == display.pixels[65 * 400 + 65]);
+	EXPECT_TRUE(RGBA::White == display.pixels[5 * 400 + 5]);
+}
+
+void test_display_panel_shadow() {
+	TestDisplay display(400, 300, 0);
+	display.enable_panel_shadow();
+	const UpdateMode partial(UpdateMode::Identity, UpdateMode::Partial);
+	const UpdateMode source_mono(UpdateMode::Identity, UpdateMode::SourceMono);
+	const UpdateMode target_mono(UpdateMode::Identity, UpdateMode::TargetMono);
+
+	/* Nothing is known about the panel content initially */
+	fill_and_commit(display, Rect(0, 0, 400, 300), RGBA::White, Rect(),
+	                partial);
+	EXPECT_EQ(1U, display.committed.size());
+	EXPECT_TRUE(display.shadow().known(399, 299));
+	EXPECT_EQ(15U, display.shadow().get(399, 299));
+
+	/* Grey pixels are not updated by monochrome updates... */
+	const RGBA grey(128, 128, 128);
+	fill_and_commit(display, Rect(10, 10, 20, 20), grey, Rect(0, 0, 50, 50),
+	                source_mono);
+	EXPECT_EQ(0U, display.committed.size());
+	EXPECT_EQ(15U, display.shadow().get(15, 15));
+
+	/* ...but by high quality updates */
+	fill_and_commit(display, Rect(10, 10, 20, 20), grey, Rect(0, 0, 50, 50),
+	                partial);
+	EXPECT_EQ(1U, display.committed.size());
+	EXPECT_TRUE(Rect(10, 10, 20, 20) == display.committed[0]);
+	EXPECT_EQ(8U, display.shadow().get(15, 15));
+
+	/* Target mono updates skip pixels currently shown in grey */
+	fill_and_commit(display, Rect(10, 10, 30, 20), RGBA::Black,
+	                Rect(0, 0, 50, 50), target_mono);
+	EXPECT_EQ(1U, display.committed.size());
+	EXPECT_TRUE(Rect(20, 10, 30, 20) == display.committed[0]);
+	EXPECT_EQ(8U, display.shadow().get(15, 15));
+	EXPECT_EQ(0U, display.shadow().get(25, 15));
+}
+
+/**
+ * Returns a colour uniquely identifying the given pixel location.
+ */
+static RGBA pixel_id(int x, int y) {
+	return RGBA(x & 0xFF, y & 0xFF, (x >> 8) | ((y >> 8) << 4));
+}
+
+void test_display_rotation() {
+	const int W = 100, H = 60;
+	for (unsigned int rotation = 0; rotation < 4; rotation++) {
+		for (bool double_buffered : {false, true}) {
+			TestDisplay display(W, H, 2, double_buffered);
+			display.set_rotation(rotation);
+
+			/* The surface is rotated, swapping width and height */
+			const Rect surf = display.lock();
+			const int w = surf.width(), h = surf.height();
+			EXPECT_EQ((rotation & 1) ? H : W, w);
+			EXPECT_EQ((rotation & 1) ? W : H, h);
+
+			/* Draw an image identifying each pixel, commit part of it */
+			std::vector<RGBA> img;
+			for (int y = 0; y < h; y++) {
+				for (int x = 0; x < w; x++) {
+					img.push_back(pixel_id(x, y));
+				}
+			}
+			display.blit_tile(img.data(), w * sizeof(RGBA), surf);
+			display.commit(Rect(5, 10, 25, 40));
+			display.unlock();
+			display.flush();
+
+			/* Each committed pixel must end up in the rotated location */
+			ASSERT_EQ(1U, display.committed.size());
+			int n = 0;
+			for (int y = 10; y < 40; y++) {
+				for (int x = 5; x < 25; x++) {
+					int tx = x, ty = y;
+					switch (rotation) {
+						case 1:
+							tx = y, ty = w - 1 - x;
+							break;
+						case 2:
+							tx = w - 1 - x, ty = h - 1 - y;
+							break;
+						case 3:
+							tx = h - 1 - y, ty = x;
+							break;
+					}
+					const Rect &c = display.committed[0];
+					EXPECT_TRUE(tx >= c.x0 && tx < c.x1 && ty >= c.y0 &&
+					            ty < c.y1);
+					EXPECT_TRUE(pixel_id(x, y) == display.pixels[ty * W + tx]);
+					n += display.touched[ty * W + tx];
+				}
+			}
+			EXPECT_EQ(20 * 30, display.committed[0].area());
+			EXPECT_EQ(20 * 30, n);
+		}
+	}
+}
+
+void test_display_nested_lock() {
+	TestDisplay display(40, 30, 0);
+
+	// Nested locks only present the frame once the outermost lock is released
+	display.lock();
+	display.lock();
+	display.fill(Display::Layer::Background, RGBA::White);
+	display.commit();
+	display.unlock();
+	EXPECT_EQ(0, display.presented);
+	display.unlock();
+	EXPECT_EQ(1, display.presented);
+
+	// Afterwards the display can be locked by another thread
+	std::atomic<bool> done(false);
+	std::thread thread([&display, &done] {
+		display.lock();
+		display.unlock();
+		done = true;
+	});
+	for (int i = 0; i < 1000 && !done; i++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	if (!done) {
+		thread.detach();  // Blocked forever, the mutex is never released
+	}
+	ASSERT_TRUE(done);
+	thread.join();
+}
+
+int main() {
+	RUN(test_display_threads_match_serial);
+	RUN(test_display_threads_cover_each_row_once);
+	RUN(test_display_double_buffered);
+	RUN(test_display_skip_unchanged);
+	RUN(test_display_panel_shadow);
+	RUN(test_display_rotation);
+	RUN(test_display_nested_lock);
+	DONE;
+}
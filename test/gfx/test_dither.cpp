@@ -0,0 +1,122 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+
+#include <foxen/unittest.h>
+#include <inktty/gfx/dither.hpp>
+
+using namespace inktty;
+
+static const dither::Pattern PATTERNS[] = {dither::Pattern::Ordered4x4,
+                                           dither::Pattern::Bayer8x8,
+                                           dither::Pattern::BlueNoise16x16};
+
+static const int W = 53, H = 37;
+
+static std::vector<uint8_t> fill(uint8_t g, dither::Pattern pattern) {
+	std::vector<uint8_t> buf(W * H, 0x55);
+	dither::ordered_binary_4bit_greyscale(g, buf.data(), W, 0, 0, W, H,
+	                                      pattern);
+	return buf;
+}
+
+void test_dither_periodic() {
+	for (dither::Pattern pattern : PATTERNS) {
+		const int p = dither::period(pattern);
+		for (uint8_t g = 0; g < 16; g++) {
+			const std::vector<uint8_t> buf = fill(g, pattern);
+			for (int y = 0; y < H; y++) {
+				for (int x = 0; x < W; x++) {
+					const uint8_t v = buf[y * W + x];
+					EXPECT_TRUE(v == 0x00 || v == 0xFF);
+					EXPECT_EQ(buf[(y % p) * W + (x % p)], v);
+				}
+			}
+		}
+	}
+}
+
+void test_dither_levels() {
+	for (dither::Pattern pattern : PATTERNS) {
+		const int p = dither::period(pattern);
+		int last = -1;
+		for (uint8_t g = 0; g < 16; g++) {
+			const std::vector<uint8_t> buf = fill(g, pattern);
+			int white = 0;
+			for (int y = 0; y < p; y++) {
+				for (int x = 0; x < p; x++) {
+					white += buf[y * W + x] ? 1 : 0;
+				}
+			}
+			EXPECT_TRUE(white > last);
+			last = white;
+			if (g == 0) {
+				EXPECT_EQ(0, white);
+			} else if (g == 15) {
+				EXPECT_EQ(p * p, white);
+			}
+		}
+	}
+
+	// The 4x4 pattern with a single white pixel
+	const std::vector<uint8_t> buf = fill(1, dither::Pattern::Ordered4x4);
+	EXPECT_EQ(0xFF, buf[0]);
+	EXPECT_EQ(0xFF, buf[4 * W + 4]);
+	EXPECT_EQ(0x00, buf[1]);
+	EXPECT_EQ(0x00, buf[W]);
+}
+
+void test_dither_sub_rect() {
+	for (dither::Pattern pattern : PATTERNS) {
+		const std::vector<uint8_t> full = fill(6, pattern);
+		std::vector<uint8_t> grey(W * H, 0x55);
+		std::vector<RGBA> rgba(W * H, RGBA(1, 2, 3, 4));
+		std::vector<GreyA> grey_a(W * H, GreyA(5, 6));
+		const int x0 = 3, y0 = 5, x1 = 50, y1 = 20;
+		dither::ordered_binary_4bit_greyscale(6, grey.data(), W, x0, y0, x1,
+		                                      y1, pattern);
+		dither::ordered_binary_4bit_greyscale(6, rgba.data(), W * sizeof(RGBA),
+		                                      x0, y0, x1, y1, pattern);
+		dither::ordered_binary_4bit_greyscale(
+		    6, grey_a.data(), W * sizeof(GreyA), x0, y0, x1, y1, pattern);
+		for (int y = 0; y < H; y++) {
+			for (int x = 0; x < W; x++) {
+				const size_t i = y * W + x;
+				if (x >= x0 && x < x1 && y >= y0 && y < y1) {
+					const uint8_t v = full[i];
+					EXPECT_EQ(v, grey[i]);
+					EXPECT_TRUE(rgba[i] == RGBA(v, v, v, 0xFF));
+					EXPECT_EQ(v, grey_a[i].v);
+					EXPECT_EQ(0xFF, grey_a[i].a);
+				} else {
+					EXPECT_EQ(0x55, grey[i]);
+					EXPECT_TRUE(rgba[i] == RGBA(1, 2, 3, 4));
+					EXPECT_EQ(5, grey_a[i].v);
+				}
+			}
+		}
+	}
+}
+
+int main() {
+	RUN(test_dither_periodic);
+	RUN(test_dither_levels);
+	RUN(test_dither_sub_rect);
+	DONE;
+}
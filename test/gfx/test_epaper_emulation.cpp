@@ -0,0 +1,129 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+
+#include <foxen/unittest.h>
+#include <inktty/gfx/epaper_emulation.hpp>
+
+using namespace inktty;
+
+/**
+ * Straight-forward per-pixel implementation of an e-paper update.
+ */
+static uint8_t reference(uint8_t g_src, uint8_t g_tar, UpdateMode mode) {
+	if (mode.output_op & UpdateMode::Invert) {
+		g_src = 15U - g_src;
+	}
+	if (mode.output_op & UpdateMode::ForceMono) {
+		g_src = (g_src > 7U) ? 15U : 0U;
+	}
+	bool masked = false;
+	if ((mode.mask_op & UpdateMode::SourceMono) && g_src != 0U &&
+	    g_src != 15U) {
+		masked = true;
+	}
+	if ((mode.mask_op & UpdateMode::TargetMono) && g_tar != 0U &&
+	    g_tar != 15U) {
+		masked = true;
+	}
+	if ((mode.mask_op & UpdateMode::Partial) && g_tar == g_src) {
+		masked = true;
+	}
+	if (mode.output_op & UpdateMode::White) {
+		g_src = 15U;
+	}
+	return masked ? g_tar : g_src;
+}
+
+static const UpdateMode::OutputOp OUTPUT_OPS[] = {
+    UpdateMode::Identity, UpdateMode::ForceMono, UpdateMode::Invert,
+    UpdateMode::InvertAndForceMono, UpdateMode::White};
+
+static const UpdateMode::MaskOp MASK_OPS[] = {
+    UpdateMode::Full, UpdateMode::SourceMono, UpdateMode::TargetMono,
+    UpdateMode::SourceAndTargetMono, UpdateMode::Partial};
+
+void test_epaper_emulation_lut() {
+	for (UpdateMode::OutputOp o : OUTPUT_OPS) {
+		for (UpdateMode::MaskOp m : MASK_OPS) {
+			const UpdateMode mode(o, m);
+			const uint8_t *l = epaper_emulation::lut(mode);
+			for (unsigned int s = 0; s < 16; s++) {
+				for (unsigned int t = 0; t < 16; t++) {
+					EXPECT_EQ(reference(s, t, mode),
+					          l[(s << 4) | t] & 0x0FU);
+				}
+			}
+		}
+	}
+}
+
+static void check_update(uint8_t bpp, PixelFormat::Type type) {
+	// Every combination of source and target grey level in a 16x16 block,
+	// offset such that the update does not start at the first column
+	const int w = 20, h = 16, x0 = 3, y0 = 0, x1 = 19, y1 = 16;
+	ColorLayout layout;
+	layout.bpp = bpp;
+	layout.rr = layout.gr = layout.br = layout.ar = 0;
+	layout.rl = 16, layout.gl = 8, layout.bl = 0, layout.al = 24;
+	const PixelFormat format(layout, type);
+	std::vector<RGBA> src(w * h);
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			src[y * w + x] = epaper_emulation::greyscale_to_rgba(x - x0);
+		}
+	}
+	for (UpdateMode::OutputOp o : OUTPUT_OPS) {
+		for (UpdateMode::MaskOp m : MASK_OPS) {
+			const UpdateMode mode(o, m);
+			const size_t stride = w * layout.bypp();
+			std::vector<uint8_t> tar(stride * h);
+			std::vector<RGBA> row(w);
+			for (int y = 0; y < h; y++) {
+				for (int x = 0; x < w; x++) {
+					row[x] = epaper_emulation::greyscale_to_rgba(y);
+				}
+				format.from_rgba(&tar[y * stride], row.data(), 0, w);
+			}
+			epaper_emulation::update(tar.data(), stride, format, src.data(),
+			                         w * sizeof(RGBA), x0, y0, x1, y1, mode);
+			for (int y = 0; y < h; y++) {
+				format.to_rgba(row.data(), &tar[y * stride], 0, w);
+				for (int x = 0; x < w; x++) {
+					const uint8_t expected =
+					    (x < x0 || x >= x1) ? y : reference(x - x0, y, mode);
+					EXPECT_EQ(expected,
+					          epaper_emulation::rgba_to_greyscale(row[x]));
+				}
+			}
+		}
+	}
+}
+
+void test_epaper_emulation_update() {
+	check_update(32, PixelFormat::Type::Generic);
+	check_update(32, PixelFormat::Type::XRGB8888);
+	check_update(8, PixelFormat::Type::Y8);
+}
+
+int main() {
+	RUN(test_epaper_emulation_lut);
+	RUN(test_epaper_emulation_update);
+	DONE;
+}
@@ -0,0 +1,79 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <foxen/unittest.h>
+#include <inktty/gfx/font_cache.hpp>
+
+using namespace inktty;
+
+static GlyphMetadata glyph(uint32_t g) {
+	return GlyphMetadata{g, 12 * 64, false, 0, 0};
+}
+
+void test_font_cache_get_put() {
+	FontCache cache(FontCache::PAGE_SIZE);
+	EXPECT_EQ(nullptr, cache.get(glyph('A')));
+
+	GlyphBitmap *a = cache.put(1, 2, 8, 16, 16, glyph('A'));
+	a->buf()[0] = 42;
+	GlyphBitmap *b = cache.put(1, 2, 8, 16, 16, glyph('B'));
+	EXPECT_EQ(a, cache.get(glyph('A')));
+	EXPECT_EQ(b, cache.get(glyph('B')));
+	EXPECT_EQ(42, int(cache.get(glyph('A'))->buf()[0]));
+	EXPECT_EQ(0, int(b->buf()[0]));
+	EXPECT_EQ(2U, cache.size());
+
+	/* Glyphs that differ in their style are distinct */
+	GlyphMetadata m = glyph('A');
+	m.orientation = 1;
+	EXPECT_EQ(nullptr, cache.get(m));
+}
+
+void test_font_cache_eviction() {
+	/* A single page of 256 byte slots */
+	FontCache cache(FontCache::PAGE_SIZE);
+	const size_t n = FontCache::PAGE_SIZE / 256;
+	for (size_t i = 0; i < n; i++) {
+		cache.put(0, 0, 16, 16, 16, glyph(i));
+	}
+	EXPECT_EQ(n, cache.size());
+	EXPECT_EQ(FontCache::PAGE_SIZE, cache.bytes());
+
+	/* The glyph that was accessed survives the clock sweep */
+	cache.get(glyph(0));
+	cache.put(0, 0, 16, 16, 16, glyph(n));
+	EXPECT_EQ(n, cache.size());
+	EXPECT_EQ(FontCache::PAGE_SIZE, cache.bytes());
+	EXPECT_TRUE(cache.get(glyph(0)) != nullptr);
+	EXPECT_EQ(nullptr, cache.get(glyph(1)));
+	EXPECT_TRUE(cache.get(glyph(n)) != nullptr);
+	for (size_t i = 2; i < n; i++) {
+		EXPECT_TRUE(cache.get(glyph(i)) != nullptr);
+	}
+
+	cache.clear();
+	EXPECT_EQ(0U, cache.size());
+	EXPECT_EQ(0U, cache.bytes());
+	EXPECT_EQ(nullptr, cache.get(glyph(0)));
+}
+
+int main() {
+	RUN(test_font_cache_get_put);
+	RUN(test_font_cache_eviction);
+	DONE;
+}
@@ -0,0 +1,120 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <set>
+
+#include <foxen/unittest.h>
+#include <inktty/gfx/font.hpp>
+
+using namespace inktty;
+
+/**
+ * Font containing a fixed set of glyphs. Counts the calls to render().
+ */
+class TestFont : public Font {
+private:
+	std::set<uint32_t> m_glyphs;
+	GlyphBitmap m_bmp;
+	uint8_t m_buf[16];
+
+public:
+	int calls;
+
+	TestFont(std::set<uint32_t> glyphs, uint8_t id)
+	    : m_glyphs(glyphs),
+	      m_bmp(0, 0, 4, 4, 4, GlyphMetadata{0, 0, false, 0, id}, m_buf),
+	      calls(0) {}
+
+	const GlyphBitmap *render(uint32_t glyph, unsigned int, bool,
+	                          unsigned int) override {
+		calls++;
+		if (!m_glyphs.count(glyph)) {
+			return nullptr;
+		}
+		m_bmp.metadata.glyph = glyph;
+		return &m_bmp;
+	}
+
+	MonospaceFontMetrics metrics(int size) const override {
+		return MonospaceFontMetrics{size, 2 * size, size};
+	}
+};
+
+struct TestFamily {
+	FontFamily family;
+	TestFont *regular, *fallback, *bold, *italic;
+
+	TestFamily() {
+		regular = new TestFont({'a', 'b', 'c'}, 0);
+		fallback = new TestFont({'a', 'x'}, 1);
+		bold = new TestFont({'a'}, 2);
+		italic = new TestFont({'b'}, 3);
+		family.add(std::unique_ptr<Font>(regular));
+		family.add(std::unique_ptr<Font>(fallback));
+		family.add(std::unique_ptr<Font>(bold), FontFamily::Weight::Bold);
+		family.add(std::unique_ptr<Font>(italic), FontFamily::Weight::Regular,
+		           FontFamily::Style::Italic);
+	}
+
+	int face(uint32_t glyph, bool bold, bool italic) {
+		const GlyphBitmap *g = family.render_styled(glyph, 12, bold, italic);
+		return g ? g->metadata.face : -1;
+	}
+};
+
+void test_font_family_variants() {
+	TestFamily f;
+	EXPECT_EQ(4U, f.family.size());
+	EXPECT_EQ(12, f.family.metrics(12).cell_width);
+
+	EXPECT_EQ(0, f.face('a', false, false));
+	EXPECT_EQ(2, f.face('a', true, false));
+	EXPECT_EQ(0, f.face('a', false, true));
+	EXPECT_EQ(2, f.face('a', true, true));
+	EXPECT_EQ(3, f.face('b', false, true));
+	EXPECT_EQ(3, f.face('b', true, true));
+	EXPECT_EQ(0, f.face('b', true, false));
+}
+
+void test_font_family_fallback() {
+	TestFamily f;
+	EXPECT_EQ(1, f.face('x', false, false));
+	EXPECT_EQ(1, f.face('x', true, true));
+	EXPECT_EQ(-1, f.face('y', false, false));
+	EXPECT_EQ(-1, f.face('y', true, false));
+}
+
+void test_font_family_remembers_faces() {
+	TestFamily f;
+	for (int i = 0; i < 10; i++) {
+		EXPECT_EQ(1, f.face('x', false, false));
+		EXPECT_EQ(-1, f.face('y', false, false));
+	}
+
+	/* The fallback glyph is rendered directly from the fallback face after
+	   the first lookup, missing glyphs are not rendered at all */
+	EXPECT_EQ(2, f.regular->calls);
+	EXPECT_EQ(11, f.fallback->calls);
+}
+
+int main() {
+	RUN(test_font_family_variants);
+	RUN(test_font_family_fallback);
+	RUN(test_font_family_remembers_faces);
+	DONE;
+}
@@ -0,0 +1,96 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <string>
+
+#include <unistd.h>
+
+#include <foxen/unittest.h>
+#include <inktty/gfx/glyph_cache_file.hpp>
+
+using namespace inktty;
+
+static std::string tmp_filename() {
+	char name[] = "/tmp/inktty_glyph_cache_XXXXXX";
+	const int fd = mkstemp(name);
+	if (fd >= 0) {
+		close(fd);
+	}
+	return name;
+}
+
+void test_glyph_cache_file_round_trip() {
+	const std::string filename = tmp_filename();
+	const GlyphCacheFile::Key key{1234, 96, 1};
+	const GlyphMetadata ma{'A', 12 * 64, false, 0, 0};
+	const GlyphMetadata mb{'B', 12 * 64, true, 1, 0};
+
+	uint8_t buf[32];
+	for (size_t i = 0; i < sizeof(buf); i++) {
+		buf[i] = i;
+	}
+
+	/* Write a missing glyph, a bitmap and the metrics */
+	{
+		GlyphCacheFile file(filename.c_str(), key);
+		MonospaceFontMetrics m;
+		EXPECT_FALSE(file.metrics(m));
+		EXPECT_EQ(nullptr, file.find(ma));
+
+		const GlyphBitmap bmp(1, -2, 3, 2, 16, mb, buf);
+		file.add(ma, nullptr);
+		file.add(mb, &bmp);
+		file.set_metrics(MonospaceFontMetrics{8, 16, 12});
+	}
+
+	/* Read the file back */
+	{
+		GlyphCacheFile file(filename.c_str(), key);
+		MonospaceFontMetrics m;
+		EXPECT_TRUE(file.metrics(m));
+		EXPECT_EQ(16, m.cell_height);
+
+		const GlyphCacheFile::Record *ra = file.find(ma);
+		EXPECT_TRUE(ra != nullptr);
+		EXPECT_TRUE(ra->flags & GlyphCacheFile::FLAG_MISSING);
+
+		const GlyphCacheFile::Record *rb = file.find(mb);
+		EXPECT_TRUE(rb != nullptr);
+		EXPECT_EQ(-2, rb->y);
+		EXPECT_EQ(16U, rb->stride);
+		const uint8_t *data = file.data(*rb);
+		for (size_t i = 0; i < sizeof(buf); i++) {
+			EXPECT_EQ(int(buf[i]), int(data[i]));
+		}
+	}
+
+	/* Files created with a different key are ignored */
+	{
+		const GlyphCacheFile::Key other{4321, 96, 1};
+		GlyphCacheFile file(filename.c_str(), other);
+		EXPECT_EQ(nullptr, file.find(mb));
+	}
+
+	std::remove(filename.c_str());
+}
+
+int main() {
+	RUN(test_glyph_cache_file_round_trip);
+	DONE;
+}
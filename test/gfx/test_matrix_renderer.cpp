@@ -0,0 +1,209 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <foxen/unittest.h>
+#include <inktty/backends/headless.hpp>
+#include <inktty/gfx/font_bitmap.hpp>
+#include <inktty/gfx/matrix_renderer.hpp>
+
+using namespace inktty;
+
+/**
+ * Returns the brightness of the centre of the given (one-based) cell.
+ */
+static int brightness(const HeadlessDisplay &display, int row, int col) {
+	const RGBA c = display.pixel((col - 1) * 8 + 4, (row - 1) * 16 + 8);
+	return (int(c.r) + int(c.g) + int(c.b)) / 3;
+}
+
+void test_matrix_renderer_cursor_fast_path() {
+	Configuration config;
+	HeadlessDisplay display(320, 160);
+	Matrix matrix;
+	MatrixRenderer renderer(config, FontBitmap::Font8x16, display, matrix);
+	matrix.cursor_visible(true);
+	renderer.draw(false, 0);
+	ASSERT_EQ(40, matrix.size().x);
+	ASSERT_EQ(10, matrix.size().y);
+
+	// Writing text is not a cursor-only frame
+	const uint64_t cursor_frames = renderer.statistics().cursor_frames;
+	const uint32_t text[] = {'a', 'b', 'c'};
+	matrix.set_run(text, 3, Style(), Point(1, 1));
+	matrix.move_abs(2, 1);
+	renderer.draw(false, 10);
+	EXPECT_EQ(cursor_frames, renderer.statistics().cursor_frames);
+	EXPECT_TRUE(brightness(display, 2, 1) > 128);
+
+	// Moving the cursor only redraws the two affected cells. No time passes,
+	// such that no region is due for a high quality refresh.
+	const uint64_t high_quality = renderer.statistics().cells_high_quality;
+	for (int i = 2; i <= 5; i++) {
+		const uint64_t low_quality = renderer.statistics().cells_low_quality;
+		matrix.move_abs(2, i);
+		renderer.draw(false, 0);
+		EXPECT_EQ(cursor_frames + i - 1, renderer.statistics().cursor_frames);
+		EXPECT_EQ(low_quality + 2, renderer.statistics().cells_low_quality);
+		EXPECT_TRUE(brightness(display, 2, i - 1) < 128);
+		EXPECT_TRUE(brightness(display, 2, i) > 128);
+	}
+	EXPECT_EQ(high_quality, renderer.statistics().cells_high_quality);
+
+	// Moving onto a cell with text keeps the glyph
+	matrix.move_abs(1, 2);
+	renderer.draw(false, 0);
+	EXPECT_EQ(cursor_frames + 5, renderer.statistics().cursor_frames);
+	EXPECT_TRUE(brightness(display, 2, 5) < 128);
+	EXPECT_TRUE(brightness(display, 1, 2) > 64);
+}
+
+void test_matrix_renderer_set_matrix() {
+	Configuration config;
+	HeadlessDisplay display(320, 160);
+	Matrix a, b(5, 20);
+	MatrixRenderer renderer(config, FontBitmap::Font8x16, display, a);
+	a.cursor_visible(true);
+	b.cursor_visible(true);
+	b.move_abs(5, 7);
+	renderer.draw(false, 0);
+	EXPECT_TRUE(brightness(display, 1, 1) > 128);
+
+	// Switching adapts the new matrix to the screen and redraws everything
+	renderer.set_matrix(b);
+	renderer.draw(false, 0);
+	EXPECT_EQ(40, b.size().x);
+	EXPECT_EQ(10, b.size().y);
+	EXPECT_TRUE(brightness(display, 1, 1) < 128);
+	EXPECT_TRUE(brightness(display, 5, 7) > 128);
+
+	// Changes to the matrix that is not drawn do not reach the screen
+	a.move_abs(3, 3);
+	renderer.draw(false, 0);
+	EXPECT_TRUE(brightness(display, 3, 3) < 128);
+
+	// Switching back shows the current state of the first matrix
+	renderer.set_matrix(a);
+	renderer.draw(false, 0);
+	EXPECT_TRUE(brightness(display, 5, 7) < 128);
+	EXPECT_TRUE(brightness(display, 3, 3) > 128);
+}
+
+void test_matrix_renderer_decorations() {
+	Configuration config;
+	HeadlessDisplay display(320, 160);
+	Matrix matrix;
+	MatrixRenderer renderer(config, FontBitmap::Font8x16, display, matrix);
+	renderer.draw(false, 0);
+
+	// Underline ten blank cells in the third row. The underline is drawn
+	// with a single fill spanning all cells.
+	const uint32_t text[10] = {' ', ' ', ' ', ' ', ' ',
+	                           ' ', ' ', ' ', ' ', ' '};
+	Style style;
+	style.underline(1);
+	uint64_t fills = renderer.statistics().decoration_fills;
+	matrix.set_run(text, 10, style, Point(1, 3));
+	renderer.draw(false, 0);
+	EXPECT_EQ(fills + 1, renderer.statistics().decoration_fills);
+	for (int x = 0; x < 80; x++) {
+		EXPECT_TRUE(display.pixel(x, 32 + 14).r > 128);
+		EXPECT_TRUE(display.pixel(x, 32 + 8).r < 128);
+	}
+	EXPECT_TRUE(display.pixel(80, 32 + 14).r < 128);
+
+	// A double underline consists of two lines
+	style.underline(2);
+	fills = renderer.statistics().decoration_fills;
+	matrix.set_run(text, 10, style, Point(1, 3));
+	renderer.draw(false, 0);
+	EXPECT_EQ(fills + 2, renderer.statistics().decoration_fills);
+	EXPECT_TRUE(display.pixel(40, 32 + 13).r > 128);
+	EXPECT_TRUE(display.pixel(40, 32 + 14).r < 128);
+	EXPECT_TRUE(display.pixel(40, 32 + 15).r > 128);
+
+	// Decorated cells are not drawn as tiles, such that the glyphs stay on
+	// top of the lines
+	const uint32_t glyphs[10] = {'g', 'g', 'g', 'g', 'g',
+	                             'g', 'g', 'g', 'g', 'g'};
+	style.underline(1);
+	fills = renderer.statistics().decoration_fills;
+	const uint64_t tiled = renderer.statistics().cells_tiled;
+	matrix.set_run(glyphs, 10, style, Point(1, 3));
+	renderer.draw(false, 0);
+	EXPECT_EQ(fills + 1, renderer.statistics().decoration_fills);
+	EXPECT_EQ(tiled, renderer.statistics().cells_tiled);
+	EXPECT_TRUE(display.pixel(40, 32 + 14).r > 128);
+
+	// Redrawing the cells without decoration removes the lines
+	fills = renderer.statistics().decoration_fills;
+	matrix.set_run(text, 10, Style(), Point(1, 3));
+	renderer.draw(false, 0);
+	EXPECT_EQ(fills, renderer.statistics().decoration_fills);
+	for (int x = 0; x < 80; x++) {
+		EXPECT_TRUE(display.pixel(x, 32 + 13).r < 128);
+		EXPECT_TRUE(display.pixel(x, 32 + 15).r < 128);
+	}
+}
+
+/**
+ * Display tap counting the number of times the display content is passed to
+ * the backend.
+ */
+class CountingTap : public MemoryDisplay::Tap {
+public:
+	int n;
+
+	CountingTap() : n(0) {}
+
+	void tap(const MemoryDisplay::CommitRequest *,
+	         const MemoryDisplay::CommitRequest *, const uint8_t *, size_t,
+	         const Rect &, MemoryDisplay::Format) override {
+		n++;
+	}
+};
+
+void test_matrix_renderer_repaint() {
+	Configuration config;
+	HeadlessDisplay display(320, 160);
+	Matrix matrix;
+	MatrixRenderer renderer(config, FontBitmap::Font8x16, display, matrix);
+	CountingTap tap;
+	display.set_tap(&tap);
+	renderer.draw(false, 0);
+
+	// Nothing is passed to the backend if nothing changed
+	const int n = tap.n;
+	renderer.draw(false, 0);
+	EXPECT_EQ(n, tap.n);
+
+	// A repaint passes the unchanged content once
+	renderer.repaint();
+	renderer.draw(false, 0);
+	EXPECT_EQ(n + 1, tap.n);
+	renderer.draw(false, 0);
+	EXPECT_EQ(n + 1, tap.n);
+	display.set_tap(nullptr);
+}
+
+int main() {
+	RUN(test_matrix_renderer_cursor_fast_path);
+	RUN(test_matrix_renderer_set_matrix);
+	RUN(test_matrix_renderer_decorations);
+	RUN(test_matrix_renderer_repaint);
+	DONE;
+}
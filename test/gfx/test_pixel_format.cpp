@@ -0,0 +1,100 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+
+#include <foxen/unittest.h>
+#include <inktty/gfx/pixel_format.hpp>
+
+using namespace inktty;
+
+static ColorLayout layout(uint8_t bpp, uint8_t rl, uint8_t rlen, uint8_t gl,
+                          uint8_t glen, uint8_t bl, uint8_t blen, uint8_t al,
+                          uint8_t alen) {
+	ColorLayout res;
+	res.bpp = bpp;
+	res.rl = rl, res.rr = 8 - rlen;
+	res.gl = gl, res.gr = 8 - glen;
+	res.bl = bl, res.br = 8 - blen;
+	res.al = al, res.ar = 8 - alen;
+	return res;
+}
+
+static void check_matches_generic(const ColorLayout &l, PixelFormat::Type type) {
+	// Fill a row with a set of test colours. Convert an odd subrange to
+	// exercise the unaligned head and tail of the vectorised converters.
+	const int n = 37, x0 = 3, x1 = 34;
+	std::vector<RGBA> src(n), back0(n), back1(n);
+	for (int x = 0; x < n; x++) {
+		src[x] = RGBA(x * 7, 255 - x * 5, x * 13, 255);
+	}
+
+	const PixelFormat f0(l, PixelFormat::Type::Generic), f1(l);
+	EXPECT_TRUE(f1.type() == type);
+
+	const size_t bypp = l.bypp();
+	std::vector<uint8_t> tar0(n * bypp, 0xAB), tar1(n * bypp, 0xAB);
+	f0.from_rgba(tar0.data(), src.data(), x0, x1);
+	f1.from_rgba(tar1.data(), src.data(), x0, x1);
+	for (size_t i = 0; i < tar0.size(); i++) {
+		EXPECT_EQ(int(tar0[i]), int(tar1[i]));
+	}
+
+	f0.to_rgba(back0.data(), tar0.data(), x0, x1);
+	f1.to_rgba(back1.data(), tar1.data(), x0, x1);
+	for (int x = x0; x < x1; x++) {
+		EXPECT_TRUE(back0[x] == back1[x]);
+	}
+}
+
+void test_pixel_format_rgb565() {
+	check_matches_generic(layout(16, 11, 5, 5, 6, 0, 5, 0, 0),
+	                      PixelFormat::Type::RGB565);
+}
+
+void test_pixel_format_xrgb8888() {
+	check_matches_generic(layout(32, 16, 8, 8, 8, 0, 8, 24, 8),
+	                      PixelFormat::Type::XRGB8888);
+}
+
+void test_pixel_format_y4() {
+	// Write a greyscale ramp to a packed 4-bit row and read it back
+	const int n = 16;
+	const PixelFormat f(layout(4, 0, 4, 0, 4, 0, 4, 0, 0), true);
+	EXPECT_TRUE(f.type() == PixelFormat::Type::Y4);
+	std::vector<uint8_t> src(n), tar(n / 2, 0);
+	for (int x = 0; x < n; x++) {
+		src[x] = x * 17;
+	}
+	f.from_grey(tar.data(), src.data(), 1, n);
+	EXPECT_EQ(0x10, int(tar[0]));
+	EXPECT_EQ(0xF0 | 0x0E, int(tar[n / 2 - 1]));
+
+	std::vector<RGBA> back(n);
+	f.to_rgba(back.data(), tar.data(), 0, n);
+	for (int x = 1; x < n; x++) {
+		EXPECT_EQ(x * 17, int(back[x].r));
+	}
+}
+
+int main() {
+	RUN(test_pixel_format_rgb565);
+	RUN(test_pixel_format_xrgb8888);
+	RUN(test_pixel_format_y4);
+	DONE;
+}
@@ -0,0 +1,137 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+
+#include <foxen/unittest.h>
+#include <inktty/gfx/refresh_scheduler.hpp>
+
+using namespace inktty;
+
+static config::Refresh test_config() {
+	config::Refresh res;
+	res.region_rows = 4;
+	res.region_cols = 10;
+	res.redraw_timeout = 3000;
+	res.ghosting_budget = 5;
+	res.budget_timeout = 500;
+	res.stale_frames = 0;
+	res.max_concurrent = 2;
+	res.refresh_duration = 400;
+	return res;
+}
+
+void test_refresh_scheduler_timeout() {
+	RefreshScheduler s(test_config());
+	s.reset(10, 25);
+	std::vector<Rect> blocks;
+
+	// Nothing is due without monochrome updates
+	s.due(0, blocks);
+	EXPECT_EQ(0U, blocks.size());
+	EXPECT_EQ(-1, s.next_wakeup(0));
+
+	// The region is refreshed once it was idle for the redraw timeout
+	s.frame(1000);
+	s.drawn_low_quality(9, 24);
+	EXPECT_EQ(3000, s.next_wakeup(1000));
+	s.due(3999, blocks);
+	EXPECT_EQ(0U, blocks.size());
+	s.due(4000, blocks);
+	ASSERT_EQ(1U, blocks.size());
+	EXPECT_TRUE(Rect(20, 8, 25, 10) == blocks[0]);
+	EXPECT_EQ(-1, s.next_wakeup(4000));
+}
+
+void test_refresh_scheduler_budget() {
+	RefreshScheduler s(test_config());
+	s.reset(10, 25);
+	std::vector<Rect> blocks;
+
+	// Multiple updates within a single frame count once
+	s.frame(0);
+	s.drawn_low_quality(0, 0);
+	s.drawn_low_quality(1, 1);
+	for (int i = 1; i < 4; i++) {
+		s.frame(i * 100);
+		s.drawn_low_quality(0, 0);
+	}
+	EXPECT_EQ(3000, s.next_wakeup(300));
+
+	// Exceeding the budget shortens the timeout
+	s.frame(400);
+	s.drawn_low_quality(0, 0);
+	EXPECT_EQ(500, s.next_wakeup(400));
+	s.due(900, blocks);
+	ASSERT_EQ(1U, blocks.size());
+	EXPECT_TRUE(Rect(0, 0, 10, 4) == blocks[0]);
+}
+
+void test_refresh_scheduler_concurrency() {
+	RefreshScheduler s(test_config());
+	s.reset(10, 25);
+	std::vector<Rect> blocks;
+
+	// Touch four regions, the one with the most updates is refreshed first
+	s.frame(0);
+	s.drawn_low_quality(0, 0);
+	s.drawn_low_quality(0, 10);
+	s.drawn_low_quality(4, 0);
+	s.drawn_low_quality(4, 10);
+	s.frame(10);
+	s.drawn_low_quality(4, 10);
+	s.due(3010, blocks);
+	ASSERT_EQ(2U, blocks.size());
+	EXPECT_TRUE(Rect(10, 4, 20, 8) == blocks[0]);
+
+	// The remaining regions wait until the refreshes are done
+	blocks.clear();
+	s.due(3100, blocks);
+	EXPECT_EQ(0U, blocks.size());
+	EXPECT_EQ(310, s.next_wakeup(3100));
+	s.due(3410, blocks);
+	EXPECT_EQ(2U, blocks.size());
+}
+
+void test_refresh_scheduler_stale() {
+	config::Refresh cfg = test_config();
+	cfg.stale_frames = 3;
+	RefreshScheduler s(cfg);
+	s.reset(4, 10);
+	std::vector<Rect> blocks;
+
+	// Regions are refreshed after a number of frames, but not while they are
+	// being written to
+	for (int i = 0; i < 3; i++) {
+		s.frame(i);
+		s.drawn_low_quality(0, 0);
+	}
+	s.due(3, blocks);
+	EXPECT_EQ(0U, blocks.size());
+	s.frame(4);
+	s.due(4, blocks);
+	EXPECT_EQ(1U, blocks.size());
+}
+
+int main() {
+	RUN(test_refresh_scheduler_timeout);
+	RUN(test_refresh_scheduler_budget);
+	RUN(test_refresh_scheduler_concurrency);
+	RUN(test_refresh_scheduler_stale);
+	DONE;
+}
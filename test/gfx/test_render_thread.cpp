@@ -0,0 +1,131 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <mutex>
+
+#include <poll.h>
+
+#include <foxen/unittest.h>
+#include <inktty/backends/headless.hpp>
+#include <inktty/gfx/font_bitmap.hpp>
+#include <inktty/gfx/matrix_renderer.hpp>
+#include <inktty/gfx/render_thread.hpp>
+
+using namespace inktty;
+
+static constexpr unsigned int W = 320, H = 160;
+
+/**
+ * Writes the given text to the given row of the matrix.
+ */
+static void write(Matrix &matrix, int row, const char *text) {
+	uint32_t glyphs[80];
+	size_t n = 0;
+	for (; text[n] && n < 80; n++) {
+		glyphs[n] = uint32_t(text[n]);
+	}
+	matrix.set_run(glyphs, n, Style(), Point(1, row));
+}
+
+/**
+ * Applies the same sequence of updates to a matrix; "step" selects the update.
+ */
+static void update(Matrix &matrix, int step) {
+	Style style;
+	switch (step % 4) {
+		case 0:
+			write(matrix, 1 + step % matrix.size().y, "Hello World");
+			break;
+		case 1:
+			matrix.scroll(0, style,
+			              Rect(1, 1, matrix.size().x, matrix.size().y), 1, 0);
+			break;
+		case 2:
+			write(matrix, matrix.size().y, "The quick brown fox");
+			matrix.move_abs(3, 5);
+			break;
+		case 3:
+			matrix.scroll(0, style, Rect(3, 2, 10, 6), -1, 2);
+			write(matrix, 2, "jumps over the lazy dog");
+			break;
+	}
+}
+
+static bool wait_finished(RenderThread &thread, int &next) {
+	for (int i = 0; i < 100; i++) {
+		struct pollfd pfd = {thread.event_fd(), POLLIN, 0};
+		poll(&pfd, 1, 100);
+		Event event;
+		thread.event_get(EventSource::PollIn, event);
+		if (thread.finished(next)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool same_content(const HeadlessDisplay &a, const HeadlessDisplay &b) {
+	for (unsigned int y = 0; y < H; y++) {
+		for (unsigned int x = 0; x < W; x++) {
+			if (!(a.pixel(x, y) == b.pixel(x, y))) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void test_render_thread_matches_draw() {
+	Configuration config;
+	HeadlessDisplay display_ref(W, H), display(W, H);
+	Matrix matrix_ref, matrix;
+	MatrixRenderer renderer_ref(config, FontBitmap::Font8x16, display_ref,
+	                            matrix_ref);
+	MatrixRenderer renderer(config, FontBitmap::Font8x16, display, matrix);
+	std::mutex mutex;
+	RenderThread thread(renderer, mutex);
+
+	// Frames drawn on the render thread match frames drawn by draw()
+	int next_ref = renderer_ref.draw(false, 0), next = -1;
+	EXPECT_TRUE(thread.request(0));
+	EXPECT_TRUE(thread.busy());
+	EXPECT_FALSE(thread.request(0));
+	ASSERT_TRUE(wait_finished(thread, next));
+	EXPECT_FALSE(thread.busy());
+	EXPECT_EQ(next_ref, next);
+	EXPECT_EQ(matrix_ref.size().x, matrix.size().x);
+	EXPECT_EQ(matrix_ref.size().y, matrix.size().y);
+
+	for (int step = 0; step < 16; step++) {
+		update(matrix_ref, step);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			update(matrix, step);
+		}
+		next_ref = renderer_ref.draw(false, 100);
+		EXPECT_TRUE(thread.request(100));
+		ASSERT_TRUE(wait_finished(thread, next));
+		EXPECT_EQ(next_ref, next);
+		EXPECT_TRUE(same_content(display_ref, display));
+	}
+}
+
+int main() {
+	RUN(test_render_thread_matches_draw);
+	DONE;
+}
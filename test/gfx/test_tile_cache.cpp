@@ -0,0 +1,93 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <foxen/unittest.h>
+#include <inktty/gfx/tile_cache.hpp>
+
+using namespace inktty;
+
+static TileCache::Key key(uint32_t glyph, uint32_t mode = 0) {
+	return TileCache::Key{glyph, RGBA::Black, RGBA::White, mode};
+}
+
+void test_tile_cache_get_put() {
+	TileCache cache;
+	cache.reset(8, 16);
+	EXPECT_EQ(32U, cache.stride());
+	EXPECT_EQ(nullptr, cache.get(key('A')));
+
+	RGBA *a = cache.put(key('A'));
+	a[0] = RGBA(1, 2, 3);
+	a[8 * 16 - 1] = RGBA(4, 5, 6);
+	cache.put(key('B'))[0] = RGBA(7, 8, 9);
+	EXPECT_EQ(2U, cache.size());
+	EXPECT_TRUE(RGBA(1, 2, 3) == cache.get(key('A'))[0]);
+	EXPECT_TRUE(RGBA(4, 5, 6) == cache.get(key('A'))[8 * 16 - 1]);
+	EXPECT_TRUE(RGBA(7, 8, 9) == cache.get(key('B'))[0]);
+
+	/* Tiles that differ in their colours or mode are distinct */
+	EXPECT_EQ(nullptr, cache.get(key('A', 1)));
+	TileCache::Key k = key('A');
+	k.fg = RGBA::White;
+	EXPECT_EQ(nullptr, cache.get(k));
+
+	/* Changing the tile size discards all tiles */
+	cache.reset(16, 32);
+	EXPECT_EQ(0U, cache.size());
+	EXPECT_EQ(nullptr, cache.get(key('A')));
+}
+
+void test_tile_cache_eviction() {
+	const size_t n = 4;
+	TileCache cache(n * 8 * 16 * sizeof(RGBA));
+	cache.reset(8, 16);
+	for (size_t i = 0; i < n; i++) {
+		cache.put(key(i));
+	}
+	EXPECT_EQ(n, cache.size());
+	EXPECT_EQ(n * 8 * 16 * sizeof(RGBA), cache.bytes());
+
+	/* The tile that was accessed survives the clock sweep */
+	cache.get(key(0));
+	cache.put(key(n));
+	EXPECT_EQ(n, cache.size());
+	EXPECT_EQ(n * 8 * 16 * sizeof(RGBA), cache.bytes());
+	EXPECT_TRUE(cache.get(key(0)) != nullptr);
+	EXPECT_EQ(nullptr, cache.get(key(1)));
+	for (size_t i = 2; i <= n; i++) {
+		EXPECT_TRUE(cache.get(key(i)) != nullptr);
+	}
+
+	/* A single tile is stored regardless of the memory limit */
+	TileCache tiny(0);
+	tiny.reset(8, 16);
+	tiny.put(key(0));
+	tiny.put(key(1));
+	EXPECT_EQ(1U, tiny.size());
+	EXPECT_TRUE(tiny.get(key(1)) != nullptr);
+
+	cache.clear();
+	EXPECT_EQ(0U, cache.size());
+	EXPECT_EQ(0U, cache.bytes());
+}
+
+int main() {
+	RUN(test_tile_cache_get_put);
+	RUN(test_tile_cache_eviction);
+	DONE;
+}
@@ -0,0 +1,148 @@
+/*
+ *  libfoxenbitstream -- Tiny, inflexible bitstream reader
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <unistd.h>
+
+#include <foxen/unittest.h>
+#include <inktty/term/events.hpp>
+
+using namespace inktty;
+
+/**
+ * Event source reading single bytes from a pipe.
+ */
+class PipeSource : public EventSource {
+private:
+	int m_fds[2];
+
+public:
+	PollMode mode;
+	int n_get;
+
+	PipeSource() : mode(PollIn), n_get(0) { pipe(m_fds); }
+
+	~PipeSource() {
+		close(m_fds[0]);
+		hang_up();
+	}
+
+	void send(uint8_t c) { write(m_fds[1], &c, 1); }
+
+	void hang_up() {
+		if (m_fds[1] >= 0) {
+			close(m_fds[1]);
+			m_fds[1] = -1;
+		}
+	}
+
+	int event_fd() const override { return m_fds[0]; }
+
+	PollMode event_fd_poll_mode() const override { return mode; }
+
+	bool event_get(PollMode mode, Event &event) override {
+		n_get++;
+		uint8_t c;
+		if (mode != PollIn || read(m_fds[0], &c, 1) != 1) {
+			return false;
+		}
+		event.type = Event::Type::TEXT_INPUT;
+		event.data.text.buf[0] = c;
+		event.data.text.buf_len = 1;
+		return true;
+	}
+};
+
+static void check_event_loop(bool use_epoll) {
+	PipeSource a, b, c;
+	EventLoop loop(use_epoll);
+	loop.add(&a);
+	loop.add(&b);
+	loop.add(&c);
+
+	/* Nothing ready, the timeout expires */
+	std::vector<Event> events;
+	EXPECT_EQ(0U, loop.wait(events, 0));
+
+	/* All ready sources are dispatched in one wakeup, one event each */
+	c.send('c');
+	a.send('a');
+	a.send('x');
+	EXPECT_EQ(2U, loop.wait(events, 100));
+	ASSERT_EQ(2U, events.size());
+	EXPECT_EQ('a', events[0].data.text.buf[0]);
+	EXPECT_EQ('c', events[1].data.text.buf[0]);
+	EXPECT_TRUE(events[0].source == &a);
+	EXPECT_TRUE(events[1].source == &c);
+	EXPECT_EQ(0, b.n_get);
+	EXPECT_EQ(1U, loop.wait(events, 100));
+	EXPECT_EQ('x', events[0].data.text.buf[0]);
+
+	/* Changes to the poll mode are picked up */
+	b.mode = EventSource::PollNone;
+	b.send('b');
+	EXPECT_EQ(0U, loop.wait(events, 0));
+	b.mode = EventSource::PollIn;
+	EXPECT_EQ(1U, loop.wait(events, 100));
+	EXPECT_EQ('b', events[0].data.text.buf[0]);
+
+	/* Disabled sources are not dispatched until they are enabled again */
+	loop.set_enabled(&c, false);
+	c.send('c');
+	EXPECT_EQ(0U, loop.wait(events, 0));
+	loop.set_enabled(&c, true);
+	EXPECT_EQ(1U, loop.wait(events, 100));
+	EXPECT_EQ('c', events[0].data.text.buf[0]);
+
+	/* Hang-ups of disabled sources do not wake up the loop */
+	loop.set_enabled(&b, false);
+	b.hang_up();
+	const int n_get = b.n_get;
+	EXPECT_EQ(0U, loop.wait(events, 0));
+	EXPECT_EQ(n_get, b.n_get);
+	loop.set_enabled(&b, true);
+	EXPECT_EQ(0U, loop.wait(events, 100));
+	EXPECT_EQ(n_get + 1, b.n_get);
+	loop.set_enabled(&b, false);
+
+	/* Removed sources are no longer dispatched */
+	loop.remove(&a);
+	a.send('a');
+	EXPECT_EQ(0U, loop.wait(events, 0));
+}
+
+void test_event_loop_epoll() {
+	EventLoop loop;
+#ifdef HAS_EPOLL
+	EXPECT_TRUE(loop.uses_epoll());
+#endif
+	check_event_loop(true);
+}
+
+void test_event_loop_poll() {
+	EventLoop loop(false);
+	EXPECT_FALSE(loop.uses_epoll());
+	check_event_loop(false);
+}
+
+int main() {
+	RUN(test_event_loop_epoll);
+	RUN(test_event_loop_poll);
+	DONE;
+}
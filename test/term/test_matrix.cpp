@@ -30,7 +30,117 @@ void test_matrix_simple() {
 	EXPECT_EQ(2U, updates.size());*/
 }
 
+static void write_rows(Matrix &matrix) {
+	for (int y = 1; y <= matrix.size().y; y++) {
+		for (int x = 1; x <= matrix.size().x; x++) {
+			matrix.set('A' + y - 1, Style{}, Point{x, y});
+		}
+	}
+}
+
+void test_matrix_scroll_rows() {
+	{
+		Matrix matrix(4, 3);
+		write_rows(matrix);
+		matrix.scroll(0, Style{}, Rect{1, 1, 3, 4}, 1, 0);
+		const Matrix::CellArray &cells = matrix.cells();
+		EXPECT_EQ('B', int(cells[0][0].glyph));
+		EXPECT_EQ('C', int(cells[1][2].glyph));
+		EXPECT_EQ('D', int(cells[2][1].glyph));
+		EXPECT_EQ(0U, cells[3][0].glyph);
+		EXPECT_TRUE(cells[0][0].dirty);
+	}
+
+	{
+		Matrix matrix(4, 3);
+		write_rows(matrix);
+		matrix.scroll(0, Style{}, Rect{1, 2, 3, 4}, -2, 0);
+		const Matrix::CellArray &cells = matrix.cells();
+		EXPECT_EQ('A', int(cells[0][0].glyph));
+		EXPECT_EQ(0U, cells[1][0].glyph);
+		EXPECT_EQ(0U, cells[2][2].glyph);
+		EXPECT_EQ('B', int(cells[3][1].glyph));
+	}
+
+	{
+		Matrix matrix(4, 3);
+		write_rows(matrix);
+		matrix.scroll(0, Style{}, Rect{1, 1, 3, 4}, 5, 0);
+		const Matrix::CellArray &cells = matrix.cells();
+		for (int y = 0; y < 4; y++) {
+			EXPECT_EQ(0U, cells[y][0].glyph);
+		}
+	}
+}
+
+void test_matrix_scroll_commit() {
+	Matrix matrix(4, 3);
+	matrix.cursor_visible(false);
+	write_rows(matrix);
+
+	std::vector<Point> updates;
+	std::vector<Matrix::Scroll> scrolls;
+	matrix.commit(updates, scrolls);
+	EXPECT_EQ(12U, updates.size());
+	EXPECT_EQ(0U, scrolls.size());
+
+	/* Only the row that was scrolled in needs to be redrawn */
+	updates.clear();
+	matrix.scroll(0, Style{}, Rect{1, 1, 3, 4}, 1, 0);
+	matrix.commit(updates, scrolls);
+	EXPECT_EQ(1U, scrolls.size());
+	EXPECT_EQ(1, scrolls[0].downward);
+	EXPECT_EQ(3U, updates.size());
+	for (const Point &p : updates) {
+		EXPECT_EQ(4, p.y);
+	}
+
+	/* Partial-width moves keep the cells outside of the moved area */
+	updates.clear();
+	scrolls.clear();
+	matrix.move(Rect{2, 1, 3, 3}, 0, 1);
+	matrix.commit(updates, scrolls);
+	EXPECT_EQ(1U, scrolls.size());
+	const Matrix::CellArray &cells = matrix.cells();
+	EXPECT_EQ('B', int(cells[0][0].glyph));
+	EXPECT_EQ('B', int(cells[0][1].glyph));
+	EXPECT_EQ('B', int(cells[0][2].glyph));
+	EXPECT_EQ(0U, updates.size());
+}
+
+void test_matrix_dirty_spans() {
+	Matrix matrix(4, 3);
+	matrix.cursor_visible(false);
+	write_rows(matrix);
+
+	std::vector<Point> updates;
+	std::vector<Matrix::Scroll> scrolls;
+	matrix.commit(updates, scrolls);
+
+	/* Updates in opposite corners */
+	updates.clear();
+	matrix.set('Y', Style{}, Point{1, 1});
+	matrix.set('Z', Style{}, Point{3, 4});
+	matrix.commit(updates, scrolls);
+	EXPECT_EQ(2U, updates.size());
+
+	/* Dirty cells move along with the scrolled rows */
+	updates.clear();
+	matrix.set('X', Style{}, Point{2, 4});
+	matrix.scroll(0, Style{}, Rect{1, 1, 3, 4}, 1, 0);
+	matrix.commit(updates, scrolls);
+	EXPECT_EQ(4U, updates.size());
+	bool found = false;
+	for (const Point &p : updates) {
+		found = found || (p.x == 2 && p.y == 3);
+	}
+	EXPECT_TRUE(found);
+}
+
 int main() {
 	RUN(test_matrix_simple);
+	RUN(test_matrix_scroll_rows);
+	RUN(test_matrix_scroll_commit);
+	RUN(test_matrix_dirty_spans);
 	DONE;
 }
@@ -0,0 +1,58 @@
+/*
+ *  libfoxenbitstream -- Tiny, inflexible bitstream reader
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+
+#include <foxen/unittest.h>
+#include <inktty/term/pty.hpp>
+
+using namespace inktty;
+
+void test_pty_write_backlog() {
+	PTY pty(24, 80, {"/bin/cat"});
+	EventLoop loop;
+	loop.add(&pty);
+
+	/* Queue far more data than the PTY buffers can hold; nothing blocks */
+	std::vector<uint8_t> line(64, 'x');
+	line.back() = '\n';
+	for (int i = 0; i < 4096; i++) {
+		pty.write(line.data(), line.size());
+	}
+	pty.flush();
+	EXPECT_TRUE(pty.backlog() > 0);
+
+	/* The backlog is written whenever the child accepts more data; the
+	   echoed output has to be read for the child to make progress */
+	size_t n_read = 0;
+	std::vector<Event> events;
+	for (int i = 0; i < 10000 && pty.backlog() > 0; i++) {
+		loop.wait(events, 1000);
+		for (const Event &event : events) {
+			ASSERT_TRUE(event.type == Event::Type::CHILD_OUTPUT);
+			n_read += event.data.child.buf_len;
+		}
+	}
+	EXPECT_EQ(0U, pty.backlog());
+	EXPECT_TRUE(n_read > 0);
+}
+
+int main() {
+	RUN(test_pty_write_backlog);
+	DONE;
+}
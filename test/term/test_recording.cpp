@@ -0,0 +1,195 @@
+/*
+ *  libfoxenbitstream -- Tiny, inflexible bitstream reader
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <foxen/unittest.h>
+#include <inktty/term/recording.hpp>
+
+using namespace inktty;
+
+static std::string tmp_filename() {
+	char name[] = "/tmp/inktty_test_recording_XXXXXX";
+	const int fd = mkstemp(name);
+	if (fd >= 0) {
+		close(fd);
+	}
+	return name;
+}
+
+static Event output_event(const char *str) {
+	Event event;
+	event.type = Event::Type::CHILD_OUTPUT;
+	event.data.child.buf = (const uint8_t *)str;
+	event.data.child.buf_len = strlen(str);
+	return event;
+}
+
+static Event key_event(Event::Key key, uint32_t unichar, bool ctrl) {
+	Event event;
+	event.type = Event::Type::KEY_INPUT;
+	event.data.keybd.key = key;
+	event.data.keybd.unichar = unichar;
+	event.data.keybd.shift = false;
+	event.data.keybd.ctrl = ctrl;
+	event.data.keybd.alt = false;
+	return event;
+}
+
+/**
+ * Records a short session: output at 0 ms, a key at 20 ms, output at 40 ms
+ * and a mouse event that is not recorded.
+ */
+static void write_session(const std::string &filename) {
+	Recorder recorder(filename.c_str());
+	recorder.record(1000000, output_event("hello"));
+	recorder.record(1020000, key_event(Event::Key::NONE, 'c', true));
+	Event mouse;
+	mouse.type = Event::Type::MOUSE_MOVE;
+	recorder.record(1030000, mouse);
+	recorder.record(1040000, output_event("\033[2Jworld"));
+}
+
+static bool wait_readable(int fd, int timeout) {
+	struct pollfd pfd = {fd, POLLIN, 0};
+	return poll(&pfd, 1, timeout) == 1;
+}
+
+void test_recording_round_trip() {
+	const std::string filename = tmp_filename();
+	write_session(filename);
+
+	std::ifstream is(filename, std::ios::binary);
+	RecordingReader reader(is);
+	RecordingReader::Record record;
+
+	ASSERT_TRUE(reader.next(record));
+	EXPECT_EQ(int(RecordType::Output), int(record.type));
+	EXPECT_EQ(0, record.time);
+	EXPECT_EQ("hello", std::string(record.data.begin(), record.data.end()));
+
+	ASSERT_TRUE(reader.next(record));
+	EXPECT_EQ(int(RecordType::Keys), int(record.type));
+	EXPECT_EQ(20000, record.time);
+	ASSERT_EQ(6U, record.data.size());
+	EXPECT_EQ('c', record.data[0]);
+	EXPECT_EQ(2, record.data[5]);
+
+	ASSERT_TRUE(reader.next(record));
+	EXPECT_EQ(int(RecordType::Output), int(record.type));
+	EXPECT_EQ(40000, record.time);
+
+	EXPECT_FALSE(reader.next(record));
+	unlink(filename.c_str());
+}
+
+void test_recording_invalid() {
+	std::istringstream is("not a session log");
+	bool thrown = false;
+	try {
+		RecordingReader reader(is);
+	} catch (const std::runtime_error &) {
+		thrown = true;
+	}
+	EXPECT_TRUE(thrown);
+	EXPECT_TRUE(RecordingReader::is_recording("INKTTYR1..."));
+	EXPECT_FALSE(RecordingReader::is_recording("INKTTY"));
+}
+
+void test_recording_truncated() {
+	const std::string filename = tmp_filename();
+	write_session(filename);
+	truncate(filename.c_str(), 8 + 13 + 5 + 13 + 3);
+
+	std::ifstream is(filename, std::ios::binary);
+	RecordingReader reader(is);
+	RecordingReader::Record record;
+	EXPECT_TRUE(reader.next(record));
+	EXPECT_FALSE(reader.next(record));
+	unlink(filename.c_str());
+}
+
+void test_replay_fast() {
+	const std::string filename = tmp_filename();
+	write_session(filename);
+
+	Replay replay(filename.c_str(), false);
+	Event event;
+
+	ASSERT_TRUE(wait_readable(replay.event_fd(), 1000));
+	ASSERT_TRUE(replay.event_get(EventSource::PollIn, event));
+	ASSERT_TRUE(event.type == Event::Type::CHILD_OUTPUT);
+	EXPECT_EQ("hello", std::string((const char *)event.data.child.buf,
+	                               event.data.child.buf_len));
+
+	ASSERT_TRUE(wait_readable(replay.event_fd(), 1000));
+	ASSERT_TRUE(replay.event_get(EventSource::PollIn, event));
+	ASSERT_TRUE(event.type == Event::Type::KEY_BATCH);
+	ASSERT_EQ(1U, event.data.keys.n_keys);
+	EXPECT_EQ('c', event.data.keys.keys[0].unichar);
+	EXPECT_TRUE(event.data.keys.keys[0].key == Event::Key::NONE);
+	EXPECT_TRUE(event.data.keys.keys[0].ctrl);
+	EXPECT_FALSE(event.data.keys.keys[0].shift);
+	EXPECT_FALSE(replay.done());
+
+	ASSERT_TRUE(wait_readable(replay.event_fd(), 1000));
+	ASSERT_TRUE(replay.event_get(EventSource::PollIn, event));
+	ASSERT_TRUE(event.type == Event::Type::CHILD_OUTPUT);
+	EXPECT_EQ("\033[2Jworld", std::string((const char *)event.data.child.buf,
+	                                      event.data.child.buf_len));
+	EXPECT_TRUE(replay.done());
+	EXPECT_EQ(int(EventSource::PollNone), int(replay.event_fd_poll_mode()));
+	unlink(filename.c_str());
+}
+
+void test_replay_realtime() {
+	using namespace std::chrono;
+	const std::string filename = tmp_filename();
+	write_session(filename);
+
+	const steady_clock::time_point t0 = steady_clock::now();
+	Replay replay(filename.c_str(), true);
+	Event event;
+	for (int i = 0; i < 3; i++) {
+		ASSERT_TRUE(wait_readable(replay.event_fd(), 1000));
+		ASSERT_TRUE(replay.event_get(EventSource::PollIn, event));
+	}
+	const int64_t dt =
+	    duration_cast<milliseconds>(steady_clock::now() - t0).count();
+	EXPECT_TRUE(dt >= 40);
+	EXPECT_TRUE(replay.done());
+	unlink(filename.c_str());
+}
+
+int main() {
+	RUN(test_recording_round_trip);
+	RUN(test_recording_invalid);
+	RUN(test_recording_truncated);
+	RUN(test_replay_fast);
+	RUN(test_replay_realtime);
+	DONE;
+}
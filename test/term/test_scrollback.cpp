@@ -0,0 +1,250 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <foxen/unittest.h>
+#include <inktty/term/matrix.hpp>
+#include <inktty/term/scrollback.hpp>
+
+using namespace inktty;
+
+static void make_row(Matrix::Cell *cells, size_t n, uint32_t glyph) {
+	for (size_t i = 0; i < n; i++) {
+		cells[i] = Matrix::Cell();
+		cells[i].glyph = glyph + i;
+	}
+}
+
+void test_scrollback_push_get() {
+	Scrollback sb;
+	EXPECT_TRUE(sb.empty());
+
+	Matrix::Cell row[8];
+	make_row(row, 8, 'a');
+	row[2].style.bold(true);
+	row[3].style.bold(true);
+	row[5].glyph = 0x1F92A;
+	row[6].glyph = 0xFC;
+	row[7] = Matrix::Cell();
+	sb.push(row, 8);
+	make_row(row, 4, 'A');
+	sb.push(row, 4);
+	EXPECT_EQ(2U, sb.size());
+
+	/* Index zero is the most recent row; cells not stored are reset */
+	Matrix::Cell res[8];
+	sb.get(0, res, 8);
+	EXPECT_EQ('A', int(res[0].glyph));
+	EXPECT_EQ('D', int(res[3].glyph));
+	EXPECT_EQ(0, int(res[4].glyph));
+	EXPECT_TRUE(res[4].style == Style{});
+
+	sb.get(1, res, 8);
+	EXPECT_EQ('a', int(res[0].glyph));
+	EXPECT_FALSE(res[1].style.bold());
+	EXPECT_TRUE(res[2].style.bold());
+	EXPECT_TRUE(res[3].style.bold());
+	EXPECT_FALSE(res[4].style.bold());
+	EXPECT_EQ(0x1F92A, int(res[5].glyph));
+	EXPECT_EQ(0xFC, int(res[6].glyph));
+	EXPECT_EQ(0, int(res[7].glyph));
+
+	/* Rows are re-wrapped to the given number of cells */
+	Matrix::Cell res_short[3];
+	EXPECT_EQ(5U, sb.rows(3, 100));
+	EXPECT_EQ(2U, sb.rows(3, 2));
+	sb.get(0, res_short, 3);
+	EXPECT_EQ('D', int(res_short[0].glyph));
+	EXPECT_EQ(0, int(res_short[1].glyph));
+	sb.get(1, res_short, 3);
+	EXPECT_EQ('A', int(res_short[0].glyph));
+	EXPECT_EQ('C', int(res_short[2].glyph));
+	sb.get(2, res_short, 3);
+	EXPECT_EQ(0xFC, int(res_short[0].glyph));
+	sb.get(3, res_short, 3);
+	EXPECT_EQ(0x1F92A, int(res_short[2].glyph));
+	sb.get(4, res_short, 3);
+	EXPECT_EQ('a', int(res_short[0].glyph));
+	EXPECT_TRUE(res_short[2].style.bold());
+}
+
+void test_scrollback_rewrap() {
+	Scrollback sb;
+
+	/* A logical line of ten cells soft-wrapped at a width of four */
+	Matrix::Cell row[4];
+	make_row(row, 4, 'a');
+	row[3].wrapped = true;
+	sb.push(row, 4);
+	make_row(row, 4, 'e');
+	row[3].wrapped = true;
+	sb.push(row, 4);
+	make_row(row, 2, 'i');
+	sb.push(row, 2);
+	make_row(row, 3, 'X');
+	sb.push(row, 3);
+	EXPECT_EQ(4U, sb.size());
+
+	/* Re-wrap to a width of five */
+	Matrix::Cell res[5];
+	EXPECT_EQ(3U, sb.rows(5, 100));
+	sb.get(0, res, 5);
+	EXPECT_EQ('X', int(res[0].glyph));
+	sb.get(1, res, 5);
+	EXPECT_EQ('f', int(res[0].glyph));
+	EXPECT_EQ('j', int(res[4].glyph));
+	sb.get(2, res, 5);
+	EXPECT_EQ('a', int(res[0].glyph));
+	EXPECT_EQ('e', int(res[4].glyph));
+
+	/* Re-wrap to a width of ten */
+	Matrix::Cell res_wide[10];
+	EXPECT_EQ(2U, sb.rows(10, 100));
+	sb.get(1, res_wide, 10);
+	EXPECT_EQ('a', int(res_wide[0].glyph));
+	EXPECT_EQ('j', int(res_wide[9].glyph));
+}
+
+void test_scrollback_memory_limit() {
+	Scrollback sb(2 * Scrollback::CHUNK_SIZE);
+	Matrix::Cell row[80];
+	for (uint32_t i = 0; i < 10000; i++) {
+		make_row(row, 80, 'a' + (i % 26));
+		sb.push(row, 80);
+		EXPECT_TRUE(sb.bytes() <= 2 * Scrollback::CHUNK_SIZE + 4096 * 4);
+	}
+	EXPECT_TRUE(sb.size() > 0U);
+	EXPECT_TRUE(sb.size() < 10000U);
+
+	/* The most recent rows are retained */
+	Matrix::Cell res[80];
+	sb.get(0, res, 80);
+	EXPECT_EQ(int('a' + (9999 % 26)), int(res[0].glyph));
+	sb.get(sb.size() - 1, res, 80);
+	EXPECT_EQ(int('a' + ((10000 - sb.size()) % 26)), int(res[0].glyph));
+
+	sb.clear();
+	EXPECT_TRUE(sb.empty());
+	EXPECT_EQ(0U, sb.bytes());
+}
+
+void test_scrollback_disabled() {
+	Scrollback sb(0);
+	Matrix::Cell row[4];
+	make_row(row, 4, 'a');
+	sb.push(row, 4);
+	EXPECT_TRUE(sb.empty());
+}
+
+void test_scrollback_matrix_view() {
+	Scrollback sb;
+	Matrix matrix(3, 4);
+	matrix.scrollback(&sb);
+	matrix.cursor_visible(false);
+
+	std::vector<Point> updates;
+	std::vector<Matrix::Scroll> scrolls;
+	for (int y = 1; y <= 3; y++) {
+		for (int x = 1; x <= 4; x++) {
+			matrix.set('A' + y - 1, Style{}, Point{x, y});
+		}
+	}
+	matrix.commit(updates, scrolls);
+
+	/* Rows scrolled off the top are stored, other scrolls are not */
+	matrix.scroll(0, Style{}, Rect{1, 1, 4, 3}, 1, 0);
+	matrix.scroll(0, Style{}, Rect{1, 2, 4, 3}, 1, 0);
+	EXPECT_EQ(1U, sb.size());
+	updates.clear();
+	scrolls.clear();
+	matrix.commit(updates, scrolls);
+
+	/* Scroll the view back */
+	matrix.view_offset(5);
+	EXPECT_EQ(1, matrix.view_offset());
+	updates.clear();
+	scrolls.clear();
+	matrix.commit(updates, scrolls);
+	EXPECT_EQ(0U, scrolls.size());
+	EXPECT_EQ(8U, updates.size());
+	EXPECT_EQ('A', int(matrix.cells()[0][0].glyph));
+	EXPECT_EQ('B', int(matrix.cells()[1][0].glyph));
+	EXPECT_EQ(0, int(matrix.cells()[2][0].glyph));
+
+	/* The view stays in place while new rows scroll off the screen */
+	matrix.scroll(0, Style{}, Rect{1, 1, 4, 3}, 1, 0);
+	EXPECT_EQ(2, matrix.view_offset());
+	updates.clear();
+	scrolls.clear();
+	matrix.commit(updates, scrolls);
+	EXPECT_EQ(0U, scrolls.size());
+	EXPECT_EQ(0U, updates.size());
+	EXPECT_EQ('A', int(matrix.cells()[0][0].glyph));
+
+	/* Return to the current screen content */
+	matrix.view_offset(0);
+	updates.clear();
+	matrix.commit(updates, scrolls);
+	EXPECT_EQ(8U, updates.size());
+	EXPECT_EQ(0, int(matrix.cells()[0][0].glyph));
+	EXPECT_EQ(0, int(matrix.cells()[1][0].glyph));
+}
+
+void test_scrollback_matrix_reflow() {
+	Scrollback sb;
+	Matrix matrix(3, 4);
+	matrix.scrollback(&sb);
+
+	/* Write "abcdef" soft-wrapped into the first two rows */
+	const uint32_t text[] = {'a', 'b', 'c', 'd', 'e', 'f'};
+	matrix.set_run(text, 4, Style{}, Point{1, 1});
+	matrix.set_wrapped(1, true);
+	matrix.set_run(text + 4, 2, Style{}, Point{1, 2});
+	matrix.move_abs(2, 3);
+
+	/* Widening joins the two rows */
+	matrix.resize(3, 8);
+	const Matrix::CellArray &cells = matrix.cells();
+	EXPECT_EQ('a', int(cells[0][0].glyph));
+	EXPECT_EQ('f', int(cells[0][5].glyph));
+	EXPECT_EQ(0, int(cells[1][0].glyph));
+	EXPECT_EQ(1, matrix.row());
+	EXPECT_EQ(7, matrix.col());
+
+	/* Narrowing wraps the line again; rows that do not fit are moved to the
+	   scrollback store */
+	matrix.resize(1, 3);
+	EXPECT_EQ(2U, sb.size());
+	EXPECT_EQ(0, int(cells[0][0].glyph));
+	EXPECT_EQ(1, matrix.row());
+	EXPECT_EQ(1, matrix.col());
+	Matrix::Cell res[6];
+	EXPECT_EQ(1U, sb.rows(6, 100));
+	sb.get(0, res, 6);
+	EXPECT_EQ('a', int(res[0].glyph));
+	EXPECT_EQ('f', int(res[5].glyph));
+}
+
+int main() {
+	RUN(test_scrollback_push_get);
+	RUN(test_scrollback_rewrap);
+	RUN(test_scrollback_memory_limit);
+	RUN(test_scrollback_disabled);
+	RUN(test_scrollback_matrix_view);
+	RUN(test_scrollback_matrix_reflow);
+	DONE;
+}
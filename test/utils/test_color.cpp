@@ -63,7 +63,26 @@ void test_color_layout() {
 	}
 }
 
+void test_color_packed() {
+	const Color c1(5), c2(RGBA{0x12, 0x34, 0x56});
+	EXPECT_TRUE(c1.is_indexed());
+	EXPECT_EQ(5, c1.idx());
+	EXPECT_TRUE(c2.is_rgb());
+	EXPECT_EQ(-1, c2.idx());
+	EXPECT_TRUE(c1 != c2);
+	EXPECT_TRUE(Color(5) == c1);
+
+	const RGBA rgb = c2.rgb(Palette::Default16Colours);
+	EXPECT_EQ(0x12, rgb.r);
+	EXPECT_EQ(0x34, rgb.g);
+	EXPECT_EQ(0x56, rgb.b);
+	EXPECT_EQ(0xFF, rgb.a);
+	EXPECT_TRUE(c1.rgb(Palette::Default16Colours) ==
+	            Palette::Default16Colours[5]);
+}
+
 int main() {
 	RUN(test_color_layout);
+	RUN(test_color_packed);
 	DONE;
 }
@@ -0,0 +1,151 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <foxen/unittest.h>
+#include <inktty/utils/frame_scheduler.hpp>
+
+using namespace inktty;
+
+static constexpr int64_t MS = 1000;
+
+static config::Scheduler test_config() {
+	config::Scheduler res;
+	res.frame_interval = 30;
+	res.max_latency = 200;
+	res.burst_gap = 10;
+	res.echo_window = 100;
+	res.jump_rate = 10000;
+	res.jump_interval = 500;
+	return res;
+}
+
+void test_frame_scheduler_idle() {
+	// Without any output there is nothing to draw
+	FrameScheduler s(test_config());
+	EXPECT_EQ(-1, s.timeout(0));
+	EXPECT_FALSE(s.due(1000 * MS));
+
+	// Requested wakeups are honoured, even without output
+	s.drawn(1000 * MS, 500);
+	EXPECT_EQ(500, s.timeout(1000 * MS));
+	EXPECT_TRUE(s.due(1500 * MS));
+}
+
+void test_frame_scheduler_burst() {
+	FrameScheduler s(test_config());
+	s.drawn(0);
+
+	// Drawing is deferred while output keeps arriving
+	int64_t t = 1000 * MS;
+	for (int i = 0; i < 10; i++, t += 5 * MS) {
+		s.output(t);
+		EXPECT_FALSE(s.due(t));
+	}
+
+	// ...and happens once the burst is over
+	EXPECT_TRUE(s.due(t - 5 * MS + 10 * MS));
+	s.drawn(t + 10 * MS);
+	EXPECT_EQ(-1, s.timeout(t + 10 * MS));
+
+	// Continuous output is drawn once the latency bound is reached
+	t = 2000 * MS;
+	for (int i = 0; i < 100; i++, t += 5 * MS) {
+		s.output(t);
+		if (s.due(t)) {
+			break;
+		}
+	}
+	EXPECT_EQ(2200 * MS, t);
+}
+
+void test_frame_scheduler_echo() {
+	FrameScheduler s(test_config());
+	s.drawn(0);
+
+	// The echo of a key press is drawn immediately
+	s.input(1000 * MS);
+	s.output(1002 * MS);
+	EXPECT_TRUE(s.due(1002 * MS));
+	s.drawn(1002 * MS);
+
+	// Output following the echo is batched
+	s.output(1010 * MS);
+	EXPECT_FALSE(s.due(1010 * MS));
+}
+
+void test_frame_scheduler_wakeup() {
+	FrameScheduler s(test_config());
+	s.drawn(0);
+
+	// Output arriving while a frame is drawn asynchronously is kept when the
+	// renderer reports its wakeup request
+	s.drawn(1000 * MS);
+	s.output(1005 * MS);
+	s.wakeup(1050 * MS, 500);
+	EXPECT_TRUE(s.due(1050 * MS));
+	s.drawn(1050 * MS);
+
+	// The wakeup request is honoured without output
+	s.wakeup(1060 * MS, 100);
+	EXPECT_FALSE(s.due(1100 * MS));
+	EXPECT_TRUE(s.due(1160 * MS));
+}
+
+void test_frame_scheduler_jump() {
+	FrameScheduler s(test_config());
+	s.drawn(0);
+
+	// A flood of output is drawn at the jump interval instead of the latency
+	// bound
+	int64_t t = 1000 * MS;
+	int frames = 0;
+	for (int i = 0; i < 400; i++, t += 5 * MS) {
+		s.output(t, 1000);
+		if (s.due(t)) {
+			s.drawn(t);
+			frames++;
+		}
+	}
+	EXPECT_TRUE(s.jump());
+	EXPECT_EQ(4, frames);
+	EXPECT_TRUE(s.skipped() > 40);
+
+	// Key presses are still echoed immediately
+	s.input(t);
+	s.output(t + 1 * MS, 10);
+	EXPECT_TRUE(s.due(t + 1 * MS));
+	s.drawn(t + 1 * MS);
+
+	// Jump scrolling stops once the output pauses
+	t += 1000 * MS;
+	s.output(t, 10);
+	EXPECT_FALSE(s.jump());
+	const uint64_t skipped = s.skipped();
+	EXPECT_TRUE(s.due(t + 30 * MS));
+	s.drawn(t + 30 * MS);
+	EXPECT_EQ(skipped, s.skipped());
+}
+
+int main() {
+	RUN(test_frame_scheduler_idle);
+	RUN(test_frame_scheduler_burst);
+	RUN(test_frame_scheduler_echo);
+	RUN(test_frame_scheduler_wakeup);
+	RUN(test_frame_scheduler_jump);
+	DONE;
+}
@@ -0,0 +1,123 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+
+#include <foxen/unittest.h>
+#include <inktty/utils/geometry.hpp>
+
+using namespace inktty;
+
+static std::vector<Rect> rects(const RectangleMerger &merger) {
+	return std::vector<Rect>(merger.begin(), merger.end());
+}
+
+static bool covered(const Rect &r, const std::vector<Rect> &res) {
+	for (const Rect &s : res) {
+		if (s.x0 <= r.x0 && s.y0 <= r.y0 && s.x1 >= r.x1 && s.y1 >= r.y1) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void test_rectangle_merger_row() {
+	RectangleMerger merger;
+	for (int x = 0; x < 10; x++) {
+		merger.insert(Rect::sized(x * 8, 16, 8, 16));
+	}
+	merger.merge();
+	const std::vector<Rect> res = rects(merger);
+	ASSERT_EQ(1U, res.size());
+	EXPECT_TRUE(res[0] == Rect(0, 16, 80, 32));
+}
+
+void test_rectangle_merger_full_screen() {
+	RectangleMerger merger;
+	for (int y = 0; y < 60; y++) {
+		for (int x = 0; x < 200; x++) {
+			merger.insert(Rect::sized(x * 8, y * 16, 8, 16));
+		}
+	}
+	merger.merge();
+	const std::vector<Rect> res = rects(merger);
+	ASSERT_EQ(1U, res.size());
+	EXPECT_TRUE(res[0] == Rect(0, 0, 1600, 960));
+}
+
+void test_rectangle_merger_distant() {
+	// Merging two small rectangles far apart would send far more pixels than
+	// the overhead of a second update
+	RectangleMerger merger(RectangleMerger::Cost(1024));
+	merger.insert(Rect::sized(0, 0, 8, 16));
+	merger.insert(Rect::sized(800, 600, 8, 16));
+	merger.insert(Rect::sized(810, 600, 8, 16));
+	merger.merge();
+	const std::vector<Rect> res = rects(merger);
+	ASSERT_EQ(2U, res.size());
+	EXPECT_TRUE(covered(Rect::sized(0, 0, 8, 16), res));
+	EXPECT_TRUE(covered(Rect(800, 600, 818, 616), res));
+}
+
+void test_rectangle_merger_overlapping() {
+	RectangleMerger merger(RectangleMerger::Cost(0));
+	merger.insert(Rect(0, 0, 100, 100));
+	merger.insert(Rect(10, 10, 90, 90));
+	merger.merge();
+	const std::vector<Rect> res = rects(merger);
+	ASSERT_EQ(1U, res.size());
+	EXPECT_TRUE(res[0] == Rect(0, 0, 100, 100));
+}
+
+void test_rectangle_merger_max_rects() {
+	// Scatter small rectangles across the screen, none of which would be
+	// merged without the limit
+	std::vector<Rect> input;
+	for (int i = 0; i < 100; i++) {
+		input.push_back(Rect::sized((i * 37) % 97 * 10, (i * 53) % 89 * 10, 4,
+		                            4));
+	}
+	RectangleMerger merger(RectangleMerger::Cost(1, 5));
+	for (const Rect &r : input) {
+		merger.insert(r);
+	}
+	merger.merge();
+	const std::vector<Rect> res = rects(merger);
+	EXPECT_TRUE(res.size() <= 5U);
+	for (const Rect &r : input) {
+		EXPECT_TRUE(covered(r, res));
+	}
+}
+
+void test_rectangle_merger_reset() {
+	RectangleMerger merger;
+	merger.insert(Rect(0, 0, 8, 8));
+	merger.reset();
+	merger.merge();
+	EXPECT_TRUE(merger.begin() == merger.end());
+}
+
+int main() {
+	RUN(test_rectangle_merger_row);
+	RUN(test_rectangle_merger_full_screen);
+	RUN(test_rectangle_merger_distant);
+	RUN(test_rectangle_merger_overlapping);
+	RUN(test_rectangle_merger_max_rects);
+	RUN(test_rectangle_merger_reset);
+	DONE;
+}
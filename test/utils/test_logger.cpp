@@ -0,0 +1,116 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <mutex>
+#include <sstream>
+
+#include <foxen/unittest.h>
+#include <inktty/utils/logger.hpp>
+
+using namespace inktty;
+
+/**
+ * Backend recording all messages into a string stream. Logging blocks while
+ * the "gate" mutex is held.
+ */
+class TestBackend : public LogBackend {
+public:
+	std::ostringstream os;
+	std::mutex gate;
+	int messages = 0;
+
+	std::ostream *log(LogSeverity lvl, std::time_t,
+	                  const char *module) override {
+		std::lock_guard<std::mutex> lock(gate);
+		messages++;
+		os << int(lvl) << " " << (module ? module : "-") << ": ";
+		return &os;
+	}
+};
+
+void test_logger_async_order() {
+	auto backend = std::make_shared<TestBackend>();
+	auto async = std::make_shared<LogAsyncBackend>(backend);
+	Logger logger(async, LogSeverity::DEBUG);
+
+	logger.info("foo") << "Hello " << 42;
+	logger.warn() << "World";
+	logger.debug("bar", "Test");
+	async->flush();
+
+	EXPECT_EQ(3, backend->messages);
+	EXPECT_EQ("20 foo: Hello 42\n30 -: World\n10 bar: Test\n",
+	          backend->os.str());
+	EXPECT_EQ(0U, async->dropped());
+}
+
+void test_logger_async_truncate() {
+	auto backend = std::make_shared<TestBackend>();
+	auto async = std::make_shared<LogAsyncBackend>(backend);
+	Logger logger(async);
+
+	logger.info() << std::string(1000, 'x');
+	logger.info() << "y";
+	async->flush();
+
+	EXPECT_EQ("20 -: " + std::string(LogAsyncBackend::MAX_MESSAGE, 'x') +
+	              "\n20 -: y\n",
+	          backend->os.str());
+}
+
+void test_logger_async_drop() {
+	auto backend = std::make_shared<TestBackend>();
+	auto async = std::make_shared<LogAsyncBackend>(backend, 4);
+	Logger logger(async);
+
+	/* Block the background thread; logging must not block */
+	backend->gate.lock();
+	for (int i = 0; i < 20; i++) {
+		logger.info() << i;
+	}
+	EXPECT_TRUE(async->dropped() >= 15U);
+	backend->gate.unlock();
+	async->flush();
+
+	/* The number of dropped messages is reported */
+	EXPECT_TRUE(backend->os.str().find("30 logger: Dropped") !=
+	            std::string::npos);
+	EXPECT_EQ(20U, backend->messages + async->dropped() - 1U);
+}
+
+void test_logger_replace_backend() {
+	auto backend = std::make_shared<TestBackend>();
+	Logger logger(backend, LogSeverity::WARNING);
+	auto async = std::make_shared<LogAsyncBackend>(logger.backend());
+	logger.backend(async);
+	EXPECT_TRUE(logger.backend() == async);
+	EXPECT_EQ(LogSeverity::WARNING, logger.min_level());
+
+	logger.info() << "Ignored";
+	logger.error() << "Error";
+	async->flush();
+	EXPECT_EQ("40 -: Error\n", backend->os.str());
+}
+
+int main() {
+	RUN(test_logger_async_order);
+	RUN(test_logger_async_truncate);
+	RUN(test_logger_async_drop);
+	RUN(test_logger_replace_backend);
+	DONE;
+}
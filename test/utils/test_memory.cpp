@@ -0,0 +1,161 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <sstream>
+#include <string>
+
+#include <foxen/unittest.h>
+#include <inktty/gfx/font_cache.hpp>
+#include <inktty/gfx/tile_cache.hpp>
+#include <inktty/term/matrix.hpp>
+#include <inktty/utils/logger.hpp>
+#include <inktty/utils/memory.hpp>
+
+using namespace inktty;
+using memory::Pool;
+
+/**
+ * Backend recording all messages into a string stream.
+ */
+class TestBackend : public LogBackend {
+public:
+	std::ostringstream os;
+	int messages = 0;
+
+	std::ostream *log(LogSeverity, std::time_t, const char *module) override {
+		messages++;
+		os << (module ? module : "-") << ": ";
+		return &os;
+	}
+};
+
+void test_memory_account() {
+	const size_t tiles = memory::usage(Pool::Tiles);
+	const size_t total = memory::total();
+	{
+		memory::Account a(Pool::Tiles);
+		a.set(1000);
+		EXPECT_EQ(tiles + 1000, memory::usage(Pool::Tiles));
+		EXPECT_EQ(total + 1000, memory::total());
+		EXPECT_TRUE(memory::peak() >= total + 1000);
+
+		memory::Account b(a);
+		EXPECT_EQ(tiles + 2000, memory::usage(Pool::Tiles));
+
+		memory::Account c(Pool::Cells);
+		b = c;
+		EXPECT_EQ(tiles + 1000, memory::usage(Pool::Tiles));
+
+		a.sub(400);
+		EXPECT_EQ(tiles + 600, memory::usage(Pool::Tiles));
+	}
+	EXPECT_EQ(tiles, memory::usage(Pool::Tiles));
+	EXPECT_EQ(total, memory::total());
+}
+
+void test_memory_subsystems() {
+	const size_t glyphs = memory::usage(Pool::Glyphs);
+	{
+		FontCache cache(1024 * 1024);
+		cache.put(0, 0, 8, 16, 8, GlyphMetadata{'a', 12 * 64, false, 0, 0});
+		EXPECT_EQ(glyphs + cache.bytes(), memory::usage(Pool::Glyphs));
+		EXPECT_TRUE(cache.bytes() > 0);
+		cache.clear();
+		EXPECT_EQ(glyphs, memory::usage(Pool::Glyphs));
+	}
+
+	const size_t tiles = memory::usage(Pool::Tiles);
+	{
+		TileCache cache;
+		cache.reset(8, 16);
+		cache.put(TileCache::Key{'a', RGBA(), RGBA(), 0});
+		EXPECT_TRUE(memory::usage(Pool::Tiles) >= tiles + cache.bytes());
+	}
+	EXPECT_EQ(tiles, memory::usage(Pool::Tiles));
+
+	const size_t cells = memory::usage(Pool::Cells);
+	{
+		Matrix matrix(10, 20);
+		EXPECT_TRUE(memory::usage(Pool::Cells) >=
+		            cells + 4 * 10 * 20 * sizeof(Matrix::Cell));
+		const size_t small = memory::usage(Pool::Cells);
+		matrix.resize(20, 40);
+		EXPECT_TRUE(memory::usage(Pool::Cells) > small);
+	}
+	EXPECT_EQ(cells, memory::usage(Pool::Cells));
+}
+
+void test_memory_budget() {
+	auto backend = std::make_shared<TestBackend>();
+	Logger logger(backend);
+
+	memory::set_budget(0);
+	EXPECT_FALSE(memory::under_pressure());
+
+	// Exceeding the budget triggers a single reclaim
+	memory::Account a(Pool::Tiles);
+	memory::set_budget(memory::total() + 8192);
+	EXPECT_FALSE(memory::under_pressure());
+	a.set(16384);
+	EXPECT_TRUE(memory::under_pressure());
+	memory::reclaimed(logger, memory::total());
+	EXPECT_FALSE(memory::under_pressure());
+
+	// The budget is still exceeded, but the next reclaim only happens once
+	// the usage grew by an eighth of the budget
+	a.add(memory::budget() / 16);
+	EXPECT_FALSE(memory::under_pressure());
+	a.add(memory::budget() / 8);
+	EXPECT_TRUE(memory::under_pressure());
+	const size_t before = memory::total();
+	a.set(0);
+	memory::reclaimed(logger, before);
+	EXPECT_FALSE(memory::under_pressure());
+	EXPECT_TRUE(backend->os.str().find("memory: Released ") !=
+	            std::string::npos);
+
+	// Explicit requests trigger a reclaim regardless of the budget
+	memory::set_budget(0);
+	memory::request_reclaim();
+	EXPECT_TRUE(memory::under_pressure());
+	memory::reclaimed(logger, memory::total());
+	EXPECT_FALSE(memory::under_pressure());
+}
+
+void test_memory_summary() {
+	memory::Account a(Pool::Scrollback);
+	a.set(2048);
+	const std::string s = memory::summary();
+	EXPECT_TRUE(s.find("scrollback 2 KiB") != std::string::npos);
+	EXPECT_TRUE(s.find("(total ") != std::string::npos);
+	EXPECT_EQ(std::string::npos, s.find("budget"));
+
+	auto backend = std::make_shared<TestBackend>();
+	Logger logger(backend);
+	memory::report(logger);
+	EXPECT_EQ(1, backend->messages);
+	EXPECT_EQ(0U, backend->os.str().find("memory: "));
+}
+
+int main() {
+	RUN(test_memory_account);
+	RUN(test_memory_subsystems);
+	RUN(test_memory_budget);
+	RUN(test_memory_summary);
+	DONE;
+}
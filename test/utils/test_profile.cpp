@@ -0,0 +1,105 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <sstream>
+
+#include <foxen/unittest.h>
+#include <inktty/utils/logger.hpp>
+#include <inktty/utils/profile.hpp>
+
+using namespace inktty;
+
+void test_histogram_bucket() {
+	EXPECT_EQ(0U, Histogram::bucket(0));
+	EXPECT_EQ(1U, Histogram::bucket(1));
+	EXPECT_EQ(2U, Histogram::bucket(2));
+	EXPECT_EQ(2U, Histogram::bucket(3));
+	EXPECT_EQ(3U, Histogram::bucket(4));
+	EXPECT_EQ(11U, Histogram::bucket(1024));
+	EXPECT_EQ(Histogram::BUCKETS - 1, Histogram::bucket(INT64_MAX));
+	for (int64_t v = 1; v < 100000; v = v * 3 + 1) {
+		EXPECT_TRUE(v < Histogram::upper_bound(Histogram::bucket(v)));
+		EXPECT_TRUE(v >= Histogram::upper_bound(Histogram::bucket(v)) / 2);
+	}
+}
+
+void test_histogram_statistics() {
+	Histogram h;
+	EXPECT_EQ(0U, h.count());
+	EXPECT_EQ(0, h.percentile(0.5));
+
+	// 90 fast and 10 slow samples
+	for (int i = 0; i < 90; i++) {
+		h.add(10);
+	}
+	for (int i = 0; i < 10; i++) {
+		h.add(1000);
+	}
+	EXPECT_EQ(100U, h.count());
+	EXPECT_EQ(10, h.min());
+	EXPECT_EQ(1000, h.max());
+	EXPECT_EQ(109.0, h.mean());
+	EXPECT_EQ(90U, h.count(Histogram::bucket(10)));
+	EXPECT_EQ(16, h.percentile(0.5));
+	EXPECT_EQ(16, h.percentile(0.9));
+	EXPECT_EQ(1000, h.percentile(0.99));
+
+	h.reset();
+	EXPECT_EQ(0U, h.count());
+	EXPECT_EQ(0, h.max());
+}
+
+void test_profile_dump() {
+	static std::stringstream ss;
+	Logger &logger = global_logger();
+	logger.add_backend(std::make_shared<LogStreamBackend>(ss));
+	profile::record(profile::Probe::MatrixCommit, 5);
+	profile::count(profile::Counter::GlyphMiss, 3);
+
+	// Only the first key press since the last submission counts
+	profile::key_pressed(100);
+	profile::key_pressed(200);
+	profile::submitted(350);
+	profile::submitted(400);
+
+	// Dumps happen on request and after the given interval
+	EXPECT_FALSE(profile::poll(logger, 0, 1000));
+	profile::request_dump();
+	EXPECT_TRUE(profile::poll(logger, 10, 1000));
+	const std::string log = ss.str();
+	EXPECT_TRUE(log.find("matrix_commit: n=1 ") != std::string::npos);
+	EXPECT_TRUE(log.find("key_to_submit: n=1 mean=250us") != std::string::npos);
+	EXPECT_TRUE(log.find("glyph_miss: 3") != std::string::npos);
+	EXPECT_TRUE(log.find("glyph_hit") == std::string::npos);
+
+	// Statistics are reset after each dump
+	ss.str("");
+	profile::request_dump();
+	EXPECT_TRUE(profile::poll(logger, 20, 1000));
+	EXPECT_TRUE(ss.str().empty());
+	EXPECT_FALSE(profile::poll(logger, 500, 1000));
+	EXPECT_TRUE(profile::poll(logger, 1020, 1000));
+	EXPECT_FALSE(profile::poll(logger, 1500, 0));
+}
+
+int main() {
+	RUN(test_histogram_bucket);
+	RUN(test_histogram_statistics);
+	RUN(test_profile_dump);
+	DONE;
+}
@@ -0,0 +1,82 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <thread>
+
+#include <foxen/unittest.h>
+#include <inktty/utils/spsc_queue.hpp>
+
+using namespace inktty;
+
+void test_spsc_queue_bounded() {
+	SPSCQueue<int> queue(3);
+	EXPECT_EQ(4U, queue.capacity());
+	EXPECT_TRUE(queue.empty());
+
+	int x = -1;
+	EXPECT_FALSE(queue.pop(x));
+	for (int i = 0; i < 4; i++) {
+		EXPECT_TRUE(queue.push(i));
+	}
+	EXPECT_FALSE(queue.push(4));
+
+	/* Elements are returned in order, the ring buffer wraps around */
+	for (int round = 0; round < 3; round++) {
+		EXPECT_TRUE(queue.pop(x));
+		EXPECT_EQ(round, x);
+		EXPECT_TRUE(queue.push(4 + round));
+	}
+	for (int i = 3; i < 7; i++) {
+		EXPECT_TRUE(queue.pop(x));
+		EXPECT_EQ(i, x);
+	}
+	EXPECT_TRUE(queue.empty());
+}
+
+void test_spsc_queue_threads() {
+	static constexpr int N = 100000;
+	SPSCQueue<int> queue(16);
+	std::thread producer([&queue] {
+		for (int i = 0; i < N; i++) {
+			while (!queue.push(i)) {
+				std::this_thread::yield();
+			}
+		}
+	});
+
+	int expected = 0;
+	bool ok = true;
+	while (expected < N) {
+		int x;
+		if (queue.pop(x)) {
+			ok = ok && (x == expected);
+			expected++;
+		} else {
+			std::this_thread::yield();
+		}
+	}
+	producer.join();
+	EXPECT_TRUE(ok);
+	EXPECT_TRUE(queue.empty());
+}
+
+int main() {
+	RUN(test_spsc_queue_bounded);
+	RUN(test_spsc_queue_threads);
+	DONE;
+}
@@ -0,0 +1,82 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+#include <unistd.h>
+
+#include <foxen/unittest.h>
+#include <inktty/utils/logger.hpp>
+#include <inktty/utils/startup.hpp>
+
+using namespace inktty;
+
+/**
+ * Backend recording all messages into a string stream.
+ */
+class TestBackend : public LogBackend {
+public:
+	std::ostringstream os;
+	int messages = 0;
+
+	std::ostream *log(LogSeverity, std::time_t, const char *module) override {
+		messages++;
+		os << (module ? module : "-") << ": ";
+		return &os;
+	}
+};
+
+void test_startup_summary() {
+	startup::reset();
+	EXPECT_EQ("(total 0.0 ms)", startup::summary());
+
+	startup::begin();
+	usleep(2000);
+	startup::phase("config");
+	startup::phase("font");
+	const std::string s = startup::summary();
+	EXPECT_EQ(0U, s.find("config "));
+	EXPECT_TRUE(s.find(" ms, font ") != std::string::npos);
+	EXPECT_TRUE(s.find(" ms (total ") != std::string::npos);
+
+	// The config phase includes the sleep
+	EXPECT_TRUE(atof(s.c_str() + 7) >= 2.0);
+}
+
+void test_startup_report_once() {
+	startup::reset();
+	startup::begin();
+	startup::phase("display");
+
+	auto backend = std::make_shared<TestBackend>();
+	Logger logger(backend);
+	startup::report(logger);
+	startup::phase("ignored");
+	startup::report(logger);
+	EXPECT_EQ(1, backend->messages);
+	EXPECT_EQ(0U, backend->os.str().find("startup: display "));
+	EXPECT_EQ(std::string::npos, startup::summary().find("ignored"));
+}
+
+int main() {
+	RUN(test_startup_summary);
+	RUN(test_startup_report_once);
+	DONE;
+}
@@ -0,0 +1,54 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <vector>
+
+#include <foxen/unittest.h>
+#include <inktty/utils/thread_pool.hpp>
+
+using namespace inktty;
+
+void test_thread_pool_wait() {
+	ThreadPool pool(3);
+	EXPECT_EQ(3U, pool.size());
+
+	std::atomic<int> sum(0);
+	std::vector<int> workers(100, -1);
+	for (int i = 0; i < 100; i++) {
+		pool.submit([&sum, &workers, i](size_t worker) {
+			sum += i;
+			workers[i] = worker;
+		});
+	}
+	pool.wait();
+	EXPECT_EQ(4950, int(sum));
+	for (int w : workers) {
+		EXPECT_TRUE(w >= 0 && w < 3);
+	}
+
+	/* The pool can be reused after waiting */
+	pool.submit([&sum](size_t) { sum = 0; });
+	pool.wait();
+	EXPECT_EQ(0, int(sum));
+}
+
+int main() {
+	RUN(test_thread_pool_wait);
+	DONE;
+}
@@ -0,0 +1,119 @@
+/*
+ *  inktty -- Terminal emulator optimized for epaper displays
+ *  Copyright (C) 2018  Andreas Stöckel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <unistd.h>
+
+#include <foxen/unittest.h>
+#include <inktty/utils/trace.hpp>
+
+using namespace inktty;
+
+static std::string temp_file() {
+	char name[] = "/tmp/inktty_test_trace_XXXXXX";
+	const int fd = mkstemp(name);
+	close(fd);
+	return name;
+}
+
+static std::string read_file(const std::string &name) {
+	std::ifstream is(name);
+	std::stringstream ss;
+	ss << is.rdbuf();
+	return ss.str();
+}
+
+static bool contains(const std::string &s, const char *sub) {
+	return s.find(sub) != std::string::npos;
+}
+
+void test_trace_disabled() {
+	// Nothing happens if no trace is being recorded
+	EXPECT_FALSE(trace::enabled());
+	trace::input(0);
+	trace::submitted(10);
+	trace::Span span("unused");
+}
+
+void test_trace_keystroke_synchronous() {
+	const std::string name = temp_file();
+	trace::start(name.c_str());
+	EXPECT_TRUE(trace::enabled());
+
+	trace::input(1000);
+	trace::submitted(1100);  // Nothing echoed yet, not the keystroke's frame
+	trace::forwarded(1200);
+	trace::output(1500);
+	trace::span("draw", 1600, 1700);
+	trace::submitted(2000);
+	trace::stop();
+	EXPECT_FALSE(trace::enabled());
+
+	const std::string s = read_file(name);
+	unlink(name.c_str());
+	EXPECT_EQ(0U, s.find("{\"displayTimeUnit\":\"ms\",\"traceEvents\":["));
+	EXPECT_TRUE(contains(s, "\"ph\":\"b\",\"id\":1,"));
+	EXPECT_TRUE(contains(s, "\"step\":\"pty_write\""));
+	EXPECT_TRUE(contains(s, "\"step\":\"echo\""));
+	EXPECT_TRUE(contains(s, "\"name\":\"draw\",\"ph\":\"X\""));
+	EXPECT_TRUE(contains(s, "\"dur\":100,"));
+	EXPECT_TRUE(contains(s, "\"latency_us\":1000,\"marker\":0,"));
+	EXPECT_EQ(s.size() - 4, s.rfind("\n]}\n"));
+}
+
+void test_trace_keystroke_asynchronous() {
+	const std::string name = temp_file();
+	trace::start(name.c_str());
+
+	// Two key presses echoed in the same update
+	trace::input(1000);
+	trace::input(1050);
+	trace::forwarded(1100);
+	trace::output(1200);
+	trace::submitted(1300, 7);
+
+	// A third key press echoed in a later update
+	trace::input(1400);
+	trace::forwarded(1410);
+	trace::output(1420);
+	trace::submitted(1430, 8);
+
+	// Completing an earlier update does not end the later key press
+	trace::completed(5000, 7);
+	std::string s = read_file(name);
+	trace::completed(6000, 8);
+	trace::stop();
+
+	EXPECT_TRUE(contains(s, "\"latency_us\":4000,\"marker\":7,"));
+	EXPECT_TRUE(contains(s, "\"latency_us\":3950,\"marker\":7,"));
+	EXPECT_FALSE(contains(s, "\"marker\":8,"));
+
+	s = read_file(name);
+	unlink(name.c_str());
+	EXPECT_TRUE(contains(s, "\"latency_us\":4600,\"marker\":8,"));
+}
+
+int main() {
+	RUN(test_trace_disabled);
+	RUN(test_trace_keystroke_synchronous);
+	RUN(test_trace_keystroke_asynchronous);
+	DONE;
+}
@@ -16,6 +16,10 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
 #include <foxen/unittest.h>
 #include <inktty/utils/utf8.hpp>
 
@@ -102,10 +106,85 @@ void test_utf8_decoder_normalisation() {
 	step(dec, &s, 0xFC, true, true, false);
 }
 
+static std::vector<uint32_t> decode_feed(const char *s) {
+	UTF8Decoder dec;
+	std::vector<uint32_t> res;
+	for (; *s; s++) {
+		UTF8Decoder::Status status = dec.feed(*s);
+		if (status.valid) {
+			if (status.replaces_last) {
+				res.back() = status.codepoint;
+			} else {
+				res.push_back(status.codepoint);
+			}
+		}
+	}
+	return res;
+}
+
+static std::vector<uint32_t> decode_bulk(const char *s, size_t n_split = 0) {
+	UTF8Decoder dec;
+	std::vector<uint32_t> res;
+	const uint8_t *src = (const uint8_t *)s;
+	const size_t n = strlen(s);
+	n_split = std::min(n_split, n);
+	EXPECT_EQ(0U, dec.decode(src, n_split, res));
+	EXPECT_EQ(0U, dec.decode(src + n_split, n - n_split, res));
+	return res;
+}
+
+void test_utf8_decoder_bulk() {
+	const char *inputs[] = {ASCII_INPUT, LATIN1_INPUT, EMOJI_INPUT,
+	                        DENORM_INPUT, "Ein langer Satz ohne Umlaute.",
+	                        "Gr\xc3\xbc\xc3\x9f Gott u\xcc\x88" "ber"};
+	for (const char *s : inputs) {
+		const std::vector<uint32_t> expected = decode_feed(s);
+		for (size_t n_split = 0; n_split <= strlen(s); n_split++) {
+			const std::vector<uint32_t> res = decode_bulk(s, n_split);
+			EXPECT_EQ(expected.size(), res.size());
+			for (size_t i = 0; i < std::min(expected.size(), res.size()); i++) {
+				EXPECT_EQ(expected[i], res[i]);
+			}
+		}
+	}
+
+	const std::vector<uint32_t> denorm = decode_bulk(DENORM_INPUT);
+	EXPECT_EQ(1U, denorm.size());
+	EXPECT_EQ(0xFCU, denorm[0]);
+}
+
+void test_utf8_decoder_bulk_errors() {
+	UTF8Decoder dec;
+	std::vector<uint32_t> res;
+	const uint8_t src[] = {'a', 0x80, 'b', 0xC3, 'c'};
+	EXPECT_EQ(2U, dec.decode(src, sizeof(src), res));
+	EXPECT_EQ(2U, res.size());
+	EXPECT_EQ(uint32_t('a'), res[0]);
+	EXPECT_EQ(uint32_t('b'), res[1]);
+}
+
+void test_utf8_encoder_bulk() {
+	const uint32_t src[] = {'H', 'i', 0xFC, 0x20AC, 0x1F92A, '!'};
+	std::vector<uint8_t> res;
+	UTF8Encoder::encode(src, 6, res);
+	EXPECT_EQ(12U, res.size());
+
+	UTF8Decoder dec;
+	std::vector<uint32_t> cps;
+	EXPECT_EQ(0U, dec.decode(res.data(), res.size(), cps));
+	EXPECT_EQ(6U, cps.size());
+	for (size_t i = 0; i < std::min<size_t>(6, cps.size()); i++) {
+		EXPECT_EQ(src[i], cps[i]);
+	}
+}
+
 int main() {
 	RUN(test_utf8_decoder_ascii);
 	RUN(test_utf8_decoder_latin1);
 	RUN(test_utf8_decoder_emoji);
 	RUN(test_utf8_decoder_normalisation);
+	RUN(test_utf8_decoder_bulk);
+	RUN(test_utf8_decoder_bulk_errors);
+	RUN(test_utf8_encoder_bulk);
 	DONE;
 }
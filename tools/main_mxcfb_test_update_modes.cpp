@@ -18,11 +18,16 @@
 
 #include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <stdexcept>
+#include <string>
 #include <system_error>
 #include <thread>
 #include <vector>
@@ -44,7 +49,12 @@
 using namespace inktty;
 
 /* This is a small program used to test the various update modes of the MXCFB
- * framebuffer driver for eink displays. */
+ * framebuffer driver for eink displays. Without arguments, a test sheet is
+ * shown for each combination of waveform, update mode and flags. When called
+ * with "--calibrate [FILE]", the latency of the individual waveforms and update
+ * modes is measured for different rectangle sizes instead, and the resulting
+ * cost model is written to FILE (default "mxcfb_calibration.toml") as a
+ * snippet for the inktty configuration file. */
 
 // Framebuffer device to use
 static const char *fbdev = "/dev/fb0";
@@ -118,33 +128,87 @@ static void draw_text(const std::string &str, int tar_x, int tar_y,
 	}
 }
 
-static bool mxc_update(int fb_fd, int x, int y, int w, int h, int waveform_mode,
-                       int update_mode, int flags) {
-	static constexpr uint32_t MARKER = 0x4a58f17c;
+/**
+ * Returns a marker that has not been used for any other update, such that
+ * waiting for an update is not satisfied by the completion of another one.
+ */
+static uint32_t next_marker() {
+	static uint32_t marker = 0x4a58f17c;
+	return ++marker;
+}
 
+static bool mxc_send(int fb_fd, int x, int y, int w, int h, int waveform_mode,
+                     int update_mode, int flags, uint32_t marker) {
 	struct mxcfb_update_data data;
 	memset(&data, 0, sizeof(data));
 	data.update_region.top = y;
 	data.update_region.left = x;
 	data.update_region.width = w;
 	data.update_region.height = h;
-	data.update_marker = MARKER;
+	data.update_marker = marker;
 	data.temp = TEMP_USE_AMBIENT;
 
 	data.waveform_mode = waveform_mode;
 	data.update_mode = update_mode;
 	data.flags = flags;
 
-	return (ioctl(fb_fd, MXCFB_SEND_UPDATE, &data) >= 0) &&
-	       (ioctl(fb_fd, MXCFB_WAIT_FOR_UPDATE_COMPLETE, &MARKER) >= 0);
+	return ioctl(fb_fd, MXCFB_SEND_UPDATE, &data) >= 0;
+}
+
+static bool mxc_wait(int fb_fd, uint32_t marker) {
+	return ioctl(fb_fd, MXCFB_WAIT_FOR_UPDATE_COMPLETE, &marker) >= 0;
+}
+
+static bool mxc_update(int fb_fd, int x, int y, int w, int h, int waveform_mode,
+                       int update_mode, int flags) {
+	const uint32_t marker = next_marker();
+	return mxc_send(fb_fd, x, y, w, h, waveform_mode, update_mode, flags,
+	                marker) &&
+	       mxc_wait(fb_fd, marker);
 }
 
-int main() {
+/**
+ * Memory mapped framebuffer device.
+ */
+struct Framebuffer {
+	int fd;
+	int w, h;
+	ColorLayout layout;
+	uint8_t *buf;
+	size_t buf_size, stride, buf_offs;
+
+	Framebuffer();
+	~Framebuffer();
+
+	/**
+	 * Returns a pointer at the first visible pixel.
+	 */
+	uint8_t *pixels() const { return buf + buf_offs; }
+
+	/**
+	 * Fills the given rectangle with a single colour.
+	 */
+	void fill(int x, int y, int rw, int rh, RGBA c) {
+		const int bypp = layout.bypp();
+		const uint32_t cc = layout.conv_from_rgba(c);
+		for (int ty = y; ty < std::min(h, y + rh); ty++) {
+			uint8_t *ptar = pixels() + ty * stride + x * bypp;
+			for (int tx = x; tx < std::min(w, x + rw); tx++) {
+				for (int k = 0; k < bypp; k++) {
+					*(ptar++) = (cc >> (8 * k)) & 0xFF;
+				}
+			}
+		}
+	}
+};
+
+Framebuffer::Framebuffer() {
 	/* Try to open the framebuffer device */
 	int fb_fd = open(fbdev, O_RDWR);
 	if (fb_fd < 0) {
 		throw std::system_error(errno, std::system_category());
 	}
+	fd = fb_fd;
 
 	/* Make sure the frame buffer is closed when the program exits (e.g. because
 	   it forks). */
@@ -161,11 +225,10 @@ int main() {
 	}
 
 	/* Read the screen size */
-	const int w = vinfo.xres;
-	const int h = vinfo.yres;
+	w = vinfo.xres;
+	h = vinfo.yres;
 
 	/* Read the color layout */
-	ColorLayout layout;
 	layout.bpp = vinfo.bits_per_pixel;
 	layout.rr = 8U - vinfo.red.length;
 	layout.gr = 8U - vinfo.green.length;
@@ -190,15 +253,31 @@ int main() {
 	DBG_PRINT(vinfo.transp.offset);
 
 	/* Memory map the frame buffer device to memory */
-	const size_t buf_size = finfo.line_length * vinfo.yres_virtual;
-	uint8_t *buf = (uint8_t *)mmap(NULL, buf_size, PROT_READ | PROT_WRITE,
-	                               MAP_SHARED, fb_fd, 0);
-	if (!buf) {
+	buf_size = finfo.line_length * vinfo.yres_virtual;
+	buf = (uint8_t *)mmap(NULL, buf_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	                      fb_fd, 0);
+	if (buf == MAP_FAILED) {
 		throw std::system_error(errno, std::system_category());
 	}
-	const size_t stride = finfo.line_length;
-	const size_t buf_offs =
-	    vinfo.xoffset * layout.bypp() + vinfo.yoffset * stride;
+	stride = finfo.line_length;
+	buf_offs = vinfo.xoffset * layout.bypp() + vinfo.yoffset * stride;
+}
+
+Framebuffer::~Framebuffer() {
+	munmap(buf, buf_size);
+	close(fd);
+}
+
+/******************************************************************************
+ * Test sheet                                                                 *
+ ******************************************************************************/
+
+static void test_sheet(Framebuffer &fb) {
+	const int fb_fd = fb.fd, w = fb.w, h = fb.h;
+	const ColorLayout &layout = fb.layout;
+	uint8_t *buf = fb.buf;
+	const size_t buf_size = fb.buf_size, stride = fb.stride,
+	             buf_offs = fb.buf_offs;
 
 	/* Try to load the test images */
 	Image img_test_calib("data/mxcfb_camera_calibration.png");
@@ -262,6 +341,186 @@ int main() {
 			}
 		}
 	}
+}
 
-	munmap(buf, buf_size);
+/******************************************************************************
+ * Calibration                                                                *
+ ******************************************************************************/
+
+/**
+ * Waveforms measured by the calibration, named as in the configuration file.
+ */
+static const struct {
+	int mode;
+	const char *name;
+} CALIBRATION_WAVEFORMS[] = {
+    {WAVEFORM_MODE_DU, "du"},
+    {WAVEFORM_MODE_GC16, "gc16"},
+    {WAVEFORM_MODE_GC16_FAST, "gc16_fast"},
+    {WAVEFORM_MODE_A2, "a2"},
+    {WAVEFORM_MODE_GL16, "gl16"},
+    {WAVEFORM_MODE_GL16_FAST, "gl16_fast"},
+};
+
+/**
+ * Number of updates per waveform, update mode and rectangle size. The median
+ * latency is used.
+ */
+static constexpr int CALIBRATION_REPEAT = 3;
+
+/**
+ * Latency model of a single waveform and update mode: an update of n pixels
+ * takes fixed + per_pixel * n milliseconds.
+ */
+struct LatencyModel {
+	double fixed;
+	double per_pixel;
+
+	double operator()(double n) const { return fixed + per_pixel * n; }
+
+	/**
+	 * Returns the fixed overhead in pixels, i.e. the number of pixels that
+	 * could be sent in the time of the fixed overhead. This is the unit of
+	 * the update_cost of the rectangle merger.
+	 */
+	double overhead_pixels() const {
+		return (per_pixel > 0.0) ? (fixed / per_pixel) : 0.0;
+	}
+
+	/**
+	 * Least-squares fit of the model to the given (pixels, latency) pairs.
+	 */
+	static LatencyModel fit(const std::vector<std::pair<double, double>> &xy) {
+		const double n = xy.size();
+		double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+		for (const auto &p : xy) {
+			sx += p.first, sy += p.second;
+			sxx += p.first * p.first, sxy += p.first * p.second;
+		}
+		const double det = n * sxx - sx * sx;
+		if (n < 2 || std::abs(det) < 1e-9) {
+			return LatencyModel{n > 0 ? sy / n : 0.0, 0.0};
+		}
+		const double b = std::max(0.0, (n * sxy - sx * sy) / det);
+		return LatencyModel{std::max(0.0, (sy - b * sx) / n), b};
+	}
+};
+
+/**
+ * Measures the time between sending an update of the given rectangle and its
+ * completion in milliseconds. The rectangle is inverted beforehand, such that
+ * all pixels change. Returns a negative value if the update failed.
+ */
+static double measure(Framebuffer &fb, int x, int y, int w, int h,
+                      int waveform_mode, int update_mode, bool black) {
+	using namespace std::chrono;
+	fb.fill(x, y, w, h, black ? RGBA{0, 0, 0, 255} : RGBA{255, 255, 255, 255});
+	const uint32_t marker = next_marker();
+	const steady_clock::time_point t0 = steady_clock::now();
+	if (!mxc_send(fb.fd, x, y, w, h, waveform_mode, update_mode, 0, marker) ||
+	    !mxc_wait(fb.fd, marker)) {
+		return -1.0;
+	}
+	return duration_cast<microseconds>(steady_clock::now() - t0).count() *
+	       1e-3;
+}
+
+static void calibrate(Framebuffer &fb, const char *filename) {
+	// Clear the screen
+	fb.fill(0, 0, fb.w, fb.h, RGBA{255, 255, 255, 255});
+	mxc_update(fb.fd, 0, 0, fb.w, fb.h, WAVEFORM_MODE_INIT, UPDATE_MODE_FULL,
+	           0);
+
+	// Square rectangles of increasing size in the centre of the screen and
+	// the entire screen
+	std::vector<std::pair<int, int>> sizes;
+	for (int s : {32, 128, 512}) {
+		if (s < fb.w && s < fb.h) {
+			sizes.emplace_back(s, s);
+		}
+	}
+	sizes.emplace_back(fb.w, fb.h);
+
+	std::ostringstream table;
+	LatencyModel model_a2{0.0, 0.0}, model_gc16{0.0, 0.0};
+	for (const auto &wf : CALIBRATION_WAVEFORMS) {
+		for (int update_mode : {UPDATE_MODE_PARTIAL, UPDATE_MODE_FULL}) {
+			const bool full = update_mode == UPDATE_MODE_FULL;
+			std::vector<std::pair<double, double>> samples;
+			bool black = true;
+			for (const auto &s : sizes) {
+				const int x = (fb.w - s.first) / 2, y = (fb.h - s.second) / 2;
+				std::vector<double> ts;
+				for (int i = 0; i < CALIBRATION_REPEAT; i++, black = !black) {
+					const double t = measure(fb, x, y, s.first, s.second,
+					                         wf.mode, update_mode, black);
+					if (t >= 0.0) {
+						ts.push_back(t);
+					}
+				}
+				if (ts.empty()) {
+					std::cerr << wf.name << (full ? " full" : " partial")
+					          << " failed" << std::endl;
+					continue;
+				}
+				std::sort(ts.begin(), ts.end());
+				const double median = ts[ts.size() / 2];
+				samples.emplace_back(double(s.first) * s.second, median);
+				std::cerr << wf.name << (full ? " full " : " partial ")
+				          << s.first << "x" << s.second << ": " << median
+				          << " ms" << std::endl;
+			}
+			if (samples.empty()) {
+				continue;
+			}
+
+			const LatencyModel m = LatencyModel::fit(samples);
+			char buf[128];
+			snprintf(buf, sizeof(buf), "# %-10s %-8s %10.1f %14.2f %14.0f\n",
+			         wf.name, full ? "full" : "partial", m.fixed,
+			         m.per_pixel * 1e6, m.overhead_pixels());
+			table << buf;
+			if (!full && wf.mode == WAVEFORM_MODE_A2) {
+				model_a2 = m;
+			} else if (!full && wf.mode == WAVEFORM_MODE_GC16) {
+				model_gc16 = m;
+			}
+		}
+	}
+
+	// Derive the configuration: monochrome updates use partial A2 updates,
+	// the high quality refresh of a region (by default 16 x 4 cells, assumed
+	// to be 16 x 32 pixels each) uses partial GC16 updates
+	std::ostringstream os;
+	os << "# E-paper cost model of a " << fb.w << "x" << fb.h
+	   << " panel, measured by \"mxcfb_test_update_modes --calibrate\".\n"
+	   << "# An update of n pixels takes \"fixed + n * per_mpixel / 1e6\" ms;"
+	   << " the\n# overhead is the fixed latency in pixels.\n#\n"
+	   << "# waveform   mode     fixed [ms] per_mpixel [ms]  overhead [px]\n"
+	   << table.str() << "\n";
+	if (model_a2.per_pixel > 0.0) {
+		os << "[epaper]\nupdate_cost = "
+		   << int(std::lround(model_a2.overhead_pixels())) << "\n\n";
+	}
+	if (model_gc16.fixed > 0.0) {
+		os << "[refresh]\nrefresh_duration = "
+		   << int(std::lround(model_gc16(16.0 * 16.0 * 4.0 * 32.0))) << "\n";
+	}
+
+	std::ofstream f(filename);
+	f << os.str();
+	if (!f) {
+		throw std::system_error(errno, std::system_category(), filename);
+	}
+	std::cout << os.str();
+}
+
+int main(int argc, const char *argv[]) {
+	Framebuffer fb;
+	if (argc > 1 && strcmp(argv[1], "--calibrate") == 0) {
+		calibrate(fb, (argc > 2) ? argv[2] : "mxcfb_calibration.toml");
+	} else {
+		test_sheet(fb);
+	}
+	return 0;
 }